@@ -6,6 +6,7 @@
 #include <vector>
 #include <unordered_map>
 #include <map>
+#include <algorithm>
 
 #include <boost/array.hpp>
 #include <boost/thread/locks.hpp>
@@ -20,6 +21,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/grid_threads.hpp"
 #include "caffe/util/rng.hpp"
 
 #include "gninasrc/lib/atom.h"
@@ -72,6 +74,9 @@ class MolGridDataLayer : public BaseDataLayer<Dtype> {
         {}, const qt& rotate = {}) = 0;
     virtual void setLigand(const vector<atom>& ligand, const vector<vec>& coords, 
         bool calcCenter=true) = 0;
+    virtual void addLigand(const vector<atom>& ligand, const vector<vec>& coords,
+        bool calcCenter=true) = 0;
+    virtual void addReceptorMask(const vector<unsigned>& removed) = 0;
     virtual void setCenter(const vec& center) = 0;
     virtual void setLabels(Dtype pose, Dtype affinity=0, Dtype rmsd=0) = 0;
     virtual void enableAtomGradients() = 0;
@@ -229,7 +234,8 @@ class BaseMolGridDataLayer : public MolGridDataLayer<Dtype> {
       binary(false), randrotate(false), ligpeturb(false), ignore_ligand(false),
       use_covalent_radius(false), dim(0), numgridpoints(0), numchannels(0),
       numReceptorTypes(0), numLigandTypes(0), gpu_alloc_size(0),
-      gpu_gridatoms(NULL), gpu_gridwhich(NULL), compute_atom_gradients(false) {}
+      gpu_gridatoms(NULL), gpu_gridwhich(NULL), compute_atom_gradients(false),
+      prefetch_current(NULL) {}
   virtual ~BaseMolGridDataLayer();
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -320,6 +326,8 @@ class BaseMolGridDataLayer : public MolGridDataLayer<Dtype> {
     mem_rec.atoms.clear();
     mem_rec.whichGrid.clear();
     mem_rec.gradient.clear();
+    mem_rec_index.clear();
+    mem_masks.clear();
 
     float3 c = make_float3(mem_lig.center[0], mem_lig.center[1], mem_lig.center[2]);
     float3 trans = make_float3(translate[0],translate[1],translate[2]);
@@ -354,10 +362,29 @@ class BaseMolGridDataLayer : public MolGridDataLayer<Dtype> {
         mem_rec.atoms.push_back(ainfo);
         mem_rec.whichGrid.push_back(rmap[t]);
         mem_rec.gradient.push_back(gradient);
+        mem_rec_index.push_back(i);
       }
     }
   }
 
+  //grid the in memory complex again in the next example of the batch, but
+  //without the removed receptor atoms (indices into the atoms given to
+  //setReceptor); the batch is resized to hold every mask added since
+  //setReceptor, after the unmasked complex
+  void addReceptorMask(const vector<unsigned>& removed)
+  {
+    mem_masks.push_back(vector<unsigned>());
+    vector<unsigned>& mask = mem_masks.back();
+    for(unsigned i = 0, n = removed.size(); i < n; i++) {
+      vector<unsigned>::const_iterator pos = std::lower_bound(mem_rec_index.begin(),
+          mem_rec_index.end(), removed[i]);
+      if(pos != mem_rec_index.end() && *pos == removed[i]) //otherwise not gridded
+        mask.push_back(pos - mem_rec_index.begin());
+    }
+    std::sort(mask.begin(), mask.end());
+    mask.erase(std::unique(mask.begin(), mask.end()), mask.end());
+  }
+
   //set center to use for memory ligand
   void setCenter(const vec& center) {
     mem_lig.center = center;
@@ -366,9 +393,26 @@ class BaseMolGridDataLayer : public MolGridDataLayer<Dtype> {
   //set in memory buffer
   void setLigand(const vector<atom>& ligand, const vector<vec>& coords, bool calcCenter=true)
   {
-    mem_lig.atoms.clear();
-    mem_lig.whichGrid.clear();
-    mem_lig.gradient.clear();
+    mem_ligs.clear();
+    setLigandInfo(mem_lig, ligand, coords, calcCenter);
+  }
+
+  //grid another ligand against the in memory receptor in the next example of
+  //the batch; the batch is resized to hold every ligand added since setLigand
+  //and without calcCenter the ligand is centered like the first one
+  void addLigand(const vector<atom>& ligand, const vector<vec>& coords, bool calcCenter=true)
+  {
+    mem_ligs.push_back(typename MolGridDataLayer<Dtype>::mol_info());
+    mem_ligs.back().center = mem_lig.center;
+    setLigandInfo(mem_ligs.back(), ligand, coords, calcCenter);
+  }
+
+  void setLigandInfo(typename MolGridDataLayer<Dtype>::mol_info& mol,
+      const vector<atom>& ligand, const vector<vec>& coords, bool calcCenter)
+  {
+    mol.atoms.clear();
+    mol.whichGrid.clear();
+    mol.gradient.clear();
 
     //ligand atoms, grid positions offset and coordinates are specified separately
     vec center(0,0,0);
@@ -389,9 +433,9 @@ class BaseMolGridDataLayer : public MolGridDataLayer<Dtype> {
           ainfo.w = fixedradius;
         float3 gradient(0,0,0);
 
-        mem_lig.atoms.push_back(ainfo);
-        mem_lig.whichGrid.push_back(lmap[t]+numReceptorTypes);
-        mem_lig.gradient.push_back(gradient);
+        mol.atoms.push_back(ainfo);
+        mol.whichGrid.push_back(lmap[t]+numReceptorTypes);
+        mol.gradient.push_back(gradient);
         center += coord;
         acnt++;
       }
@@ -402,8 +446,8 @@ class BaseMolGridDataLayer : public MolGridDataLayer<Dtype> {
     }
     center /= acnt; //not ligand.size() because of hydrogens
 
-    if(calcCenter || !isfinite(mem_lig.center[0])) {
-      mem_lig.center = center;
+    if(calcCenter || !isfinite(mol.center[0])) {
+      mol.center = center;
     }
   }
 
@@ -913,6 +957,7 @@ class BaseMolGridDataLayer : public MolGridDataLayer<Dtype> {
 
   //grid stuff
   GridMakerT gmaker;
+  shared_ptr<GridThreads> grid_threads; //shared by gmaker and its copies
   double resolution;
   double dimension;
   double radiusmultiple; //extra to consider past vdw radius
@@ -950,9 +995,33 @@ class BaseMolGridDataLayer : public MolGridDataLayer<Dtype> {
   typedef boost::unordered_map<string, typename MolGridDataLayer<Dtype>::mol_info> MolCache;
   static MolCache recmolcache; //the cache is shared GLOBALLY
   static MolCache ligmolcache; //the cache is shared GLOBALLY
+  static boost::mutex& molcache_mutex() { static boost::mutex m; return m; }
+  //OpenBabel is not thread safe, so prefetch threads read non-gninatypes
+  //files one at a time
+  static boost::mutex& openbabel_mutex() { static boost::mutex m; return m; }
+
+  //a batch built ahead of time by a prefetch thread, along with everything
+  //forward would otherwise have set while building it
+  struct molgrid_batch : public Batch<Dtype> {
+    vector<Dtype> labels;
+    vector<Dtype> affinities;
+    vector<Dtype> rmsds;
+    vector<Dtype> weights;
+    vector<output_transform> perturbations;
+    vector<typename MolGridDataLayer<Dtype>::mol_transform> transforms;
+  };
+  vector<shared_ptr<molgrid_batch> > prefetch;
+  BlockingQueue<Batch<Dtype>*> prefetch_free;
+  BlockingQueue<Batch<Dtype>*> prefetch_full;
+  molgrid_batch *prefetch_current; //owned by the net until the next forward
+  vector<shared_ptr<boost::thread> > prefetch_workers;
+  boost::mutex example_mutex; //prefetch threads share data and data2
 
   typename MolGridDataLayer<Dtype>::mol_info mem_rec; //molecular data set programmatically with setReceptor
   typename MolGridDataLayer<Dtype>::mol_info mem_lig; //molecular data set programmatically with setLigand
+  vector<typename MolGridDataLayer<Dtype>::mol_info> mem_ligs; //further examples set with addLigand
+  vector<unsigned> mem_rec_index; //index given to setReceptor of each atom of mem_rec
+  vector<vector<unsigned> > mem_masks; //atoms of mem_rec left out of further examples, set with addReceptorMask
 
   ////////////////////   PROTECTED METHODS   //////////////////////
   static void remove_missing_and_setup(vector<balanced_example_provider>& examples);
@@ -966,15 +1035,34 @@ class BaseMolGridDataLayer : public MolGridDataLayer<Dtype> {
   bool add_to_minfo(const string& file, const vector<int>& atommap, unsigned mapoffset, smt t, float x, float y, float z,  typename MolGridDataLayer<Dtype>::mol_info& minfo);
   void load_cache(const string& file, const vector<int>& atommap, unsigned atomoffset, MolCache& molcache);
   void set_mol_info(const string& file, const vector<int>& atommap, unsigned atomoffset, typename MolGridDataLayer<Dtype>::mol_info& minfo);
+  const typename MolGridDataLayer<Dtype>::mol_info& cached_mol_info(MolCache& molcache, const string& name,
+      const string& root_folder, const vector<int>& atommap, unsigned atomoffset);
+  //builder is the grid maker of a prefetch thread, NULL to use the layer's own
   void set_grid_ex(Dtype *grid, const example& ex, const string& root_folder,
                     typename MolGridDataLayer<Dtype>::mol_transform& transform, 
-                    int pose, output_transform& pertub, bool gpu);
+                    int pose, output_transform& pertub, bool gpu, GridMakerT *builder = NULL);
   virtual void set_grid_minfo(Dtype *grid, 
       const typename MolGridDataLayer<Dtype>::mol_info& recatoms, 
       const typename MolGridDataLayer<Dtype>::mol_info& ligatoms,
                     typename MolGridDataLayer<Dtype>::mol_transform& transform, 
                     output_transform& peturb, bool gpu);
+  void set_grid_minfo_with(GridMakerT& gmaker, Dtype *grid,
+      const typename MolGridDataLayer<Dtype>::mol_info& recatoms,
+      const typename MolGridDataLayer<Dtype>::mol_info& ligatoms,
+                    typename MolGridDataLayer<Dtype>::mol_transform& transform,
+                    output_transform& peturb, bool gpu);
+  void set_grid_masked(Dtype *grid, const Dtype *complex,
+      const vector<unsigned>& mask,
+      const typename MolGridDataLayer<Dtype>::mol_transform& complextransform,
+                    typename MolGridDataLayer<Dtype>::mol_transform& transform,
+                    output_transform& peturb, bool gpu);
+
+  void start_prefetch(unsigned nthreads, unsigned nbatches);
+  void stop_prefetch();
+  void prefetch_entry(shared_ptr<rng_t> rng);
+  void load_batch(molgrid_batch& batch, GridMakerT& builder);
   void setAtomGradientsGPU(GridMakerT& gmaker, Dtype *diff, unsigned batch_size);
+  void reshape_batch(unsigned batch_size, const vector<Blob<Dtype>*>& top);
 
   virtual void forward(const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top, bool gpu);
   virtual void backward(const vector<Blob<Dtype>*>& top, const vector<Blob<Dtype>*>& bottom, bool gpu);
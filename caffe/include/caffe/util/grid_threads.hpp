@@ -0,0 +1,52 @@
+#ifndef CAFFE_UTIL_GRID_THREADS_HPP_
+#define CAFFE_UTIL_GRID_THREADS_HPP_
+
+#include <boost/function.hpp>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace boost { class thread; }
+
+namespace caffe {
+
+/**
+ * Persistent threads that split a range of indices (e.g. the x planes of a
+ * grid) into contiguous blocks and process one block each.  Gridding runs
+ * once per example, which is too often to start new threads every time.
+ * Calls to Run from different threads are serialized.
+ */
+class GridThreads {
+ public:
+  typedef boost::function<void(unsigned, unsigned)> RangeFunction;
+
+  explicit GridThreads(unsigned nthreads);
+  ~GridThreads();
+
+  // number of blocks a range is split into, including the calling thread's
+  unsigned size() const { return nthreads_; }
+
+  // call f(begin, end) for each block of [0, n), the calling thread doing the
+  // first one; returns once all blocks are done and rethrows the first
+  // exception thrown by f
+  void Run(unsigned n, const RangeFunction& f);
+
+ protected:
+  /**
+   Move synchronization fields out instead of including boost/thread.hpp
+   to avoid boost/NVCC issues, as in BlockingQueue.
+   */
+  class sync;
+
+  void Entry(unsigned block);
+
+  unsigned nthreads_;
+  shared_ptr<sync> sync_;
+  std::vector<shared_ptr<boost::thread> > threads_;
+
+DISABLE_COPY_AND_ASSIGN(GridThreads);
+};
+
+}  // namespace caffe
+
+#endif
@@ -10,6 +10,7 @@
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/thread.hpp>
 
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
@@ -43,7 +44,7 @@ namespace caffe {
 
 template <typename Dtype, class GridMakerT>
 BaseMolGridDataLayer<Dtype, GridMakerT>::~BaseMolGridDataLayer<Dtype, GridMakerT>() {
-  //this->StopInternalThread();
+  stop_prefetch();
 
   if(gpu_gridatoms) {
     cudaFree(gpu_gridatoms);
@@ -580,6 +581,10 @@ void BaseMolGridDataLayer<Dtype, GridMakerT>::DataLayerSetUp(const vector<Blob<D
   CHECK_LE(fabs(remainder(dimension,resolution)), 0.001) << "Resolution does not evenly divide dimension.";
 
   gmaker.initialize(param);
+  if(param.grid_threads() > 1) {
+    grid_threads.reset(new GridThreads(param.grid_threads()));
+    gmaker.setCPUThreads(grid_threads.get());
+  }
 
   dim = round(dimension/resolution)+1; //number of grid points on a side
   numgridpoints = dim*dim*dim;
@@ -716,6 +721,12 @@ void BaseMolGridDataLayer<Dtype, GridMakerT>::DataLayerSetUp(const vector<Blob<D
     peturbshape[1] = output_transform::size(); //trans+orient
     top.back()->Reshape(peturbshape);
   }
+
+  //overlap reading and gridding with the net when training on the cpu;
+  //grouped and subcube layers keep per-example state and build inline
+  if(!inmem && param.prefetch_threads() > 0 && Caffe::mode() == Caffe::CPU &&
+      param.maxgroupsize() == 1 && param.maxchunksize() <= 1 && param.subgrid_dim() == 0)
+    start_prefetch(param.prefetch_threads(), std::max(param.prefetch_batches(), 1u));
 }
 
 //return quaternion representing one of 24 distinct axial rotations
@@ -934,6 +945,7 @@ void BaseMolGridDataLayer<Dtype, GridMakerT>::set_mol_info(const string& file, c
   {
     //read mol from file and set mol info (atom coords and grid positions)
     //types are mapped using atommap values plus offset
+    boost::lock_guard<boost::mutex> lock(openbabel_mutex());
     OpenBabel::OBConversion conv;
     OBMol mol;
     CHECK(conv.ReadFile(&mol, file)) << "Could not read " << file;
@@ -970,7 +982,7 @@ template <typename Dtype, class GridMakerT>
 void BaseMolGridDataLayer<Dtype, GridMakerT>::set_grid_ex(Dtype *data, 
     const BaseMolGridDataLayer<Dtype, GridMakerT>::example& ex,
     const string& root_folder, typename MolGridDataLayer<Dtype>::mol_transform& transform, 
-    int pose, output_transform& peturb, bool gpu)
+    int pose, output_transform& peturb, bool gpu, GridMakerT *builder)
 {
   //set grid values for example
   //cache atom info
@@ -990,29 +1002,23 @@ void BaseMolGridDataLayer<Dtype, GridMakerT>::set_grid_ex(Dtype *data,
 
   if(docache)
   {
-    if(recmolcache.count(ex.receptor) == 0)
-    {
-      set_mol_info(root_folder+ex.receptor, rmap, 0, recmolcache[ex.receptor]);
-    }
-    if(ligmolcache.count(ligand) == 0)
-    {
-      set_mol_info(root_folder+ligand, lmap, numReceptorTypes, ligmolcache[ligand]);
-    }
+    const typename MolGridDataLayer<Dtype>::mol_info& rec =
+        cached_mol_info(recmolcache, ex.receptor, root_folder, rmap, 0);
+    const typename MolGridDataLayer<Dtype>::mol_info& lig0 =
+        cached_mol_info(ligmolcache, ligand, root_folder, lmap, numReceptorTypes);
 
     if(doall) {
       //make sure every ligand is in the cache, then aggregate
-      typename MolGridDataLayer<Dtype>::mol_info lig(ligmolcache[ligand]);
+      typename MolGridDataLayer<Dtype>::mol_info lig(lig0);
       for(unsigned p = 1, np = ex.ligands.size(); p < np; p++) {
         ligand = ex.ligands[p];
-        if(ligmolcache.count(ligand) == 0)
-        {
-          set_mol_info(root_folder+ligand, lmap, numReceptorTypes, ligmolcache[ligand]);
-        }
-        lig.append(ligmolcache[ligand],numLigandTypes*p);
+        lig.append(cached_mol_info(ligmolcache, ligand, root_folder, lmap, numReceptorTypes),numLigandTypes*p);
       }
-      set_grid_minfo(data, recmolcache[ex.receptor], lig, transform, peturb, gpu);
+      if(builder) set_grid_minfo_with(*builder, data, rec, lig, transform, peturb, gpu);
+      else set_grid_minfo(data, rec, lig, transform, peturb, gpu);
     } else {
-        set_grid_minfo(data, recmolcache[ex.receptor], ligmolcache[ligand], transform, peturb, gpu);
+      if(builder) set_grid_minfo_with(*builder, data, rec, lig0, transform, peturb, gpu);
+      else set_grid_minfo(data, rec, lig0, transform, peturb, gpu);
     }
   }
   else
@@ -1028,8 +1034,28 @@ void BaseMolGridDataLayer<Dtype, GridMakerT>::set_grid_ex(Dtype *data,
           lig.append(tmplig);
         }
     }    
-    set_grid_minfo(data, rec, lig, transform, peturb, gpu);
+    if(builder) set_grid_minfo_with(*builder, data, rec, lig, transform, peturb, gpu);
+    else set_grid_minfo(data, rec, lig, transform, peturb, gpu);
+  }
+}
+
+//return the cached info for molecule name, reading it if this is the first use;
+//the reference stays valid since entries are never removed
+template <typename Dtype, class GridMakerT>
+const typename MolGridDataLayer<Dtype>::mol_info& BaseMolGridDataLayer<Dtype, GridMakerT>::cached_mol_info(
+    MolCache& molcache, const string& name, const string& root_folder,
+    const vector<int>& atommap, unsigned atomoffset)
+{
+  {
+    boost::lock_guard<boost::mutex> lock(molcache_mutex());
+    typename MolCache::iterator pos = molcache.find(name);
+    if(pos != molcache.end()) return pos->second;
   }
+  //read without the lock so prefetch threads don't wait on each other's files
+  typename MolGridDataLayer<Dtype>::mol_info minfo;
+  set_mol_info(root_folder+name, atommap, atomoffset, minfo);
+  boost::lock_guard<boost::mutex> lock(molcache_mutex());
+  return molcache.insert(std::make_pair(name, minfo)).first->second;
 }
 
 
@@ -1039,6 +1065,16 @@ void BaseMolGridDataLayer<Dtype, GridMakerT>::set_grid_minfo(Dtype *data,
     const typename MolGridDataLayer<Dtype>::mol_info& ligatoms, 
     typename MolGridDataLayer<Dtype>::mol_transform& transform,
     output_transform& peturb, bool gpu)
+{
+  set_grid_minfo_with(gmaker, data, recatoms, ligatoms, transform, peturb, gpu);
+}
+
+template <typename Dtype, class GridMakerT>
+void BaseMolGridDataLayer<Dtype, GridMakerT>::set_grid_minfo_with(GridMakerT& gmaker, Dtype *data,
+    const typename MolGridDataLayer<Dtype>::mol_info& recatoms,
+    const typename MolGridDataLayer<Dtype>::mol_info& ligatoms,
+    typename MolGridDataLayer<Dtype>::mol_transform& transform,
+    output_transform& peturb, bool gpu)
 {
   bool fixcenter = this->layer_param_.molgrid_data_param().fix_center_to_origin();
   //set grid values from mol info
@@ -1178,6 +1214,69 @@ void BaseMolGridDataLayer<Dtype, GridMakerT>::set_grid_minfo(Dtype *data,
   }
 }
 
+//grid the complex that was gridded into complex with transform complextransform
+//again without the receptor atoms in mask (indices into mem_rec)
+//gaussian densities are sums over atoms, so the grid is the complex minus
+//the grid of the masked atoms alone, using the same rotation and center;
+//binary occupancy and the transformations that move atoms one by one aren't
+//additive, so those grid the masked complex from scratch
+template <typename Dtype, class GridMakerT>
+void BaseMolGridDataLayer<Dtype, GridMakerT>::set_grid_masked(Dtype *data,
+    const Dtype *complex, const vector<unsigned>& mask,
+    const typename MolGridDataLayer<Dtype>::mol_transform& complextransform,
+    typename MolGridDataLayer<Dtype>::mol_transform& transform,
+    output_transform& peturb, bool gpu)
+{
+  typename MolGridDataLayer<Dtype>::mol_info kept, removed;
+  kept.center = mem_rec.center;
+  for(unsigned i = 0, m = 0, n = mem_rec.atoms.size(); i < n; i++) {
+    bool masked = m < mask.size() && mask[m] == i;
+    if(masked) m++;
+    typename MolGridDataLayer<Dtype>::mol_info& dest = masked ? removed : kept;
+    dest.atoms.push_back(mem_rec.atoms[i]);
+    dest.whichGrid.push_back(mem_rec.whichGrid[i]);
+    dest.gradient.push_back(mem_rec.gradient[i]);
+  }
+
+  bool fixcenter = this->layer_param_.molgrid_data_param().fix_center_to_origin();
+  if(binary || fixcenter || ligpeturb || jitter > 0) {
+    set_grid_minfo(data, kept, mem_lig, transform, peturb, gpu);
+    return;
+  }
+
+  //the complex stores receptor atoms first, then the ligand
+  transform = complextransform;
+  transform.mol = kept;
+  typename MolGridDataLayer<Dtype>::mol_info lig;
+  const typename MolGridDataLayer<Dtype>::mol_info& complexmol = complextransform.mol;
+  for(unsigned i = mem_rec.atoms.size(), n = complexmol.atoms.size(); i < n; i++) {
+    lig.atoms.push_back(complexmol.atoms[i]);
+    lig.whichGrid.push_back(complexmol.whichGrid[i]);
+    lig.gradient.push_back(complexmol.gradient[i]);
+  }
+  transform.mol.append(lig);
+  transform.mol.center = complexmol.center;
+  peturb = output_transform();
+
+  gmaker.setCenter(transform.center[0], transform.center[1], transform.center[2]);
+  if (gpu)
+  {
+    unsigned natoms = removed.atoms.size();
+    if(natoms > 0) {
+      allocateGPUMem(natoms);
+      CUDA_CHECK(cudaMemcpy(gpu_gridatoms, &removed.atoms[0], natoms*sizeof(float4), cudaMemcpyHostToDevice));
+      CUDA_CHECK(cudaMemcpy(gpu_gridwhich, &removed.whichGrid[0], natoms*sizeof(short), cudaMemcpyHostToDevice));
+    }
+    gmaker.template setAtomsGPU<Dtype>(natoms, gpu_gridatoms, gpu_gridwhich, transform.Q, numchannels, data);
+    caffe_gpu_axpby<Dtype>(example_size, Dtype(1), complex, Dtype(-1), data);
+  }
+  else
+  {
+    gmaker.setAtomsCPU(removed.atoms, removed.whichGrid, transform.Q.boost(), data, numchannels);
+    caffe_cpu_axpby<Dtype>(example_size, Dtype(1), complex, Dtype(-1), data);
+  }
+}
+
 template <typename Dtype>
 void GroupedMolGridDataLayer<Dtype>::set_grid_minfo(Dtype *data, 
     const typename MolGridDataLayer<Dtype>::mol_info& recatoms,
@@ -1477,6 +1576,45 @@ void BaseMolGridDataLayer<Dtype, GridMakerT>::forward(const vector<Blob<Dtype>*>
   int peturb_bins = this->layer_param_.molgrid_data_param().peturb_bins();
   double peturb_translate = this->layer_param_.molgrid_data_param().peturb_ligand_translate();
 
+  if(prefetch_workers.size() > 0 && (gpu || Caffe::mode() != Caffe::CPU)) {
+    //batches are only built ahead on the cpu; the mode can change after setup
+    LOG(INFO) << "Not in cpu mode, building molgrid batches inline";
+    //stop pointing the top blob at a prefetch batch before they are freed
+    Blob<Dtype> own(top_shape);
+    top[0]->ShareData(own);
+    stop_prefetch();
+  }
+
+  if(prefetch_workers.size() > 0)
+  {
+    //hand the previous batch back to the builders and use the next ready one
+    if(prefetch_current) prefetch_free.push(prefetch_current);
+    prefetch_current = static_cast<molgrid_batch*>(prefetch_full.pop("Waiting for molgrid data"));
+    top[0]->set_cpu_data(prefetch_current->data_.mutable_cpu_data());
+    labels.swap(prefetch_current->labels);
+    affinities.swap(prefetch_current->affinities);
+    rmsds.swap(prefetch_current->rmsds);
+    weights.swap(prefetch_current->weights);
+    perturbations.swap(prefetch_current->perturbations);
+    batch_transform.swap(prefetch_current->transforms);
+
+    copyToBlobs(top, hasaffinity, hasrmsd, hasweights, gpu);
+    if(peturb_bins > 0) {
+      for(unsigned i = 0, n = perturbations.size(); i < n; i++) {
+        perturbations[i].discretize(peturb_translate, peturb_bins);
+      }
+    }
+    return;
+  }
+
+  if(inmem && !subgrid_dim && maxgroupsize == 1) {
+    //one example per in memory ligand, back to the configured size otherwise
+    unsigned nexamples = mem_ligs.size() + mem_masks.size();
+    nexamples = nexamples ? nexamples+1 : this->layer_param_.molgrid_data_param().batch_size();
+    if(top_shape[0] != nexamples)
+      reshape_batch(nexamples, top);
+  }
+
   Dtype *top_data = NULL;
   if(gpu)
     top_data = top[0]->mutable_gpu_data();
@@ -1505,15 +1643,29 @@ void BaseMolGridDataLayer<Dtype, GridMakerT>::forward(const vector<Blob<Dtype>*>
     CHECK_EQ(maxgroupsize, 1) << "Groups not currently supported with structure in memory";
     if(mem_rec.atoms.size() == 0) LOG(WARNING) << "Receptor not set in MolGridDataLayer";
     CHECK_GT(mem_lig.atoms.size(),0) << "Ligand not set in MolGridDataLayer";
+    CHECK(mem_ligs.size() == 0 || !subgrid_dim) << "Multiple ligands in memory not supported with subgrids";
+    CHECK(mem_masks.size() == 0 || !subgrid_dim) << "Receptor masks not supported with subgrids";
+    CHECK(mem_masks.size() == 0 || mem_ligs.size() == 0) << "Receptor masks can't be combined with multiple ligands";
     //memory is now available
     set_grid_minfo(top_data, mem_rec, mem_lig, batch_transform[0], peturb, gpu); //TODO how do we know what batch position?
     perturbations.push_back(peturb);
+    for(unsigned i = 0, n = mem_ligs.size(); i < n; i++) {
+      set_grid_minfo(top_data+(i+1)*example_size, mem_rec, mem_ligs[i], batch_transform[i+1], peturb, gpu);
+      perturbations.push_back(peturb);
+    }
+    for(unsigned i = 0, n = mem_masks.size(); i < n; i++) {
+      set_grid_masked(top_data+(i+1)*example_size, top_data, mem_masks[i], batch_transform[0], batch_transform[i+1], peturb, gpu);
+      perturbations.push_back(peturb);
+    }
 
     if (num_rotations > 0) {
       current_rotation = (current_rotation+1)%num_rotations;
     }
 
     CHECK_GT(labels.size(),0) << "Did not set labels in memory based molgrid";
+    //every in memory example has the labels set with setLabels
+    while(labels.size() < mem_ligs.size()+mem_masks.size()+1)
+      updateLabels(labels[0], affinities[0], rmsds[0], weights[0]);
 
   }
   else
@@ -1588,6 +1740,145 @@ void BaseMolGridDataLayer<Dtype, GridMakerT>::forward(const vector<Blob<Dtype>*>
   }
 }
 
+//build the next batch on the cpu in a prefetch thread; this is the non-inmem
+//path of forward with batch-local labels and transforms and the thread's own
+//grid maker
+template <typename Dtype, class GridMakerT>
+void BaseMolGridDataLayer<Dtype, GridMakerT>::load_batch(molgrid_batch& batch, GridMakerT& builder)
+{
+  bool duplicate = this->layer_param_.molgrid_data_param().duplicate_poses();
+  unsigned batch_size = top_shape[0];
+  if(numposes > 1 && duplicate) batch_size /= numposes;
+
+  unsigned dataswitch = batch_size;
+  if (data2)
+    dataswitch = batch_size*data_ratio/(data_ratio+1);
+
+  batch.labels.clear();
+  batch.affinities.clear();
+  batch.rmsds.clear();
+  batch.weights.clear();
+  batch.perturbations.clear();
+  batch.transforms.resize(batch_size);
+
+  Dtype *top_data = batch.data_.mutable_cpu_data();
+  output_transform peturb;
+  for (unsigned batch_idx = 0; batch_idx < batch_size; ++batch_idx)
+  {
+    //draw and grid one example at a time like forward does so a single
+    //prefetch thread uses the random stream in the same order
+    example ex;
+    {
+      boost::lock_guard<boost::mutex> lock(example_mutex);
+      if (batch_idx < dataswitch) data->next(ex);
+      else data2->next(ex);
+    }
+    const string& root = batch_idx < dataswitch ? root_folder : root_folder2;
+    for(unsigned p = 0; p < numposes; p++) {
+      batch.labels.push_back(ex.label);
+      batch.affinities.push_back(ex.affinity);
+      batch.rmsds.push_back(ex.rmsd);
+      batch.weights.push_back(ex.affinity_weight);
+    }
+
+    if (ex.label == -1) {
+      memset(top_data+batch_idx*example_size, 0, example_size*sizeof(Dtype));
+    }
+    else if(!duplicate) {
+      set_grid_ex(top_data+batch_idx*example_size, ex, root, batch.transforms[batch_idx],
+          numposes > 1 ? -1 : 0, peturb, false, &builder);
+      batch.perturbations.push_back(peturb);
+    }
+    else {
+      for(unsigned p = 0; p < numposes; p++) {
+        int p_offset = batch_idx*(example_size*numposes)+example_size*p;
+        set_grid_ex(top_data+p_offset, ex, root, batch.transforms[batch_idx], p, peturb, false, &builder);
+        batch.perturbations.push_back(peturb);
+      }
+    }
+  }
+}
+
+template <typename Dtype, class GridMakerT>
+void BaseMolGridDataLayer<Dtype, GridMakerT>::prefetch_entry(shared_ptr<rng_t> rng)
+{
+  Caffe::set_mode(Caffe::CPU);
+  *caffe_rng() = *rng;
+  GridMakerT builder(gmaker); //setting the center modifies the grid maker
+
+  try {
+    while(true) {
+      molgrid_batch *batch = static_cast<molgrid_batch*>(prefetch_free.pop());
+      load_batch(*batch, builder);
+      prefetch_full.push(batch);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template <typename Dtype, class GridMakerT>
+void BaseMolGridDataLayer<Dtype, GridMakerT>::start_prefetch(unsigned nthreads, unsigned nbatches)
+{
+  for(unsigned i = 0; i < nbatches; i++) {
+    prefetch.push_back(shared_ptr<molgrid_batch>(new molgrid_batch()));
+    prefetch.back()->data_.Reshape(top_shape);
+    prefetch.back()->data_.mutable_cpu_data();
+    prefetch_free.push(prefetch.back().get());
+  }
+  for(unsigned i = 0; i < nthreads; i++) {
+    //the first thread continues the layer's random stream so that with one
+    //thread the batches match the ones built inline for the same seed
+    shared_ptr<rng_t> rng(i == 0 ? new rng_t(*caffe_rng()) : new rng_t(caffe_rng_rand()));
+    prefetch_workers.push_back(shared_ptr<boost::thread>(new boost::thread(
+        &BaseMolGridDataLayer<Dtype, GridMakerT>::prefetch_entry, this, rng)));
+  }
+  //move the layer's stream off the one the first thread continues, so that
+  //batches built inline after a fallback don't repeat its draws
+  caffe_rng()->seed(caffe_rng_rand());
+  LOG(INFO) << "Prefetching " << nbatches << " batches with " << nthreads << " threads";
+}
+
+template <typename Dtype, class GridMakerT>
+void BaseMolGridDataLayer<Dtype, GridMakerT>::stop_prefetch()
+{
+  for(unsigned i = 0, n = prefetch_workers.size(); i < n; i++) {
+    prefetch_workers[i]->interrupt();
+  }
+  for(unsigned i = 0, n = prefetch_workers.size(); i < n; i++) {
+    prefetch_workers[i]->join();
+  }
+  prefetch_workers.clear();
+
+  //drop batches built for the stopped threads so a restart starts afresh
+  Batch<Dtype> *batch;
+  while(prefetch_full.try_pop(&batch)) {}
+  while(prefetch_free.try_pop(&batch)) {}
+  prefetch_current = NULL;
+  prefetch.clear();
+}
+
+//change the number of examples (only for in memory molecules); the layers
+//after this one reshape themselves on the next forward
+template <typename Dtype, class GridMakerT>
+void BaseMolGridDataLayer<Dtype, GridMakerT>::reshape_batch(unsigned batch_size, const vector<Blob<Dtype>*>& top)
+{
+  vector<int> label_shape;
+  setLayerSpecificDims(batch_size, label_shape, top);
+  top[0]->Reshape(top_shape);
+  for(unsigned i = 1, n = top.size(); i < n; i++) {
+    if(ligpeturb && i == n-1) {
+      vector<int> peturbshape(2);
+      peturbshape[0] = batch_size;
+      peturbshape[1] = output_transform::size();
+      top[i]->Reshape(peturbshape);
+    }
+    else
+      top[i]->Reshape(label_shape);
+  }
+  batch_transform.resize(batch_size);
+}
+
 template <typename Dtype, class GridMakerT>
 void BaseMolGridDataLayer<Dtype, GridMakerT>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom)
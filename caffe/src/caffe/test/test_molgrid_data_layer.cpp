@@ -0,0 +1,117 @@
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/molgrid_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/format.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class MolGridDataLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  MolGridDataLayerTest()
+      : seed_(1701) {}
+
+  virtual void SetUp() {
+    // Write a handful of small receptor/ligand pairs in gninatypes format.
+    string dir;
+    MakeTempDir(&dir);
+    MakeTempFilename(&filename_);
+    std::ofstream outfile(filename_.c_str(), std::ofstream::out);
+    LOG(INFO) << "Using temporary file " << filename_;
+    const int types[] = {2, 3, 4, 6, 8, 10};
+    for (int i = 0; i < 8; ++i) {
+      string rec = dir + "/rec" + format_int(i) + ".gninatypes";
+      string lig = dir + "/lig" + format_int(i) + ".gninatypes";
+      write_atoms(rec, 12, types, i);
+      write_atoms(lig, 5, types, i + 100);
+      outfile << (i % 2) << " " << rec << " " << lig << std::endl;
+    }
+    outfile.close();
+  }
+
+  void write_atoms(const string& fname, int n, const int* types, int salt) {
+    struct {
+      float x, y, z;
+      int type;
+    } atom;
+    std::ofstream out(fname.c_str(), std::ofstream::binary);
+    for (int i = 0; i < n; ++i) {
+      atom.x = ((i * 7 + salt) % 11) * 0.4 - 2.0;
+      atom.y = ((i * 5 + salt) % 13) * 0.3 - 1.8;
+      atom.z = ((i * 3 + salt) % 7) * 0.5 - 1.5;
+      atom.type = types[(i + salt) % 6];
+      out.write(reinterpret_cast<char*>(&atom), sizeof(atom));
+    }
+  }
+
+  // Run a layer with the given number of prefetch threads from a fixed seed
+  // and record the data and labels of each batch.
+  void RunBatches(int prefetch_threads, int nbatches,
+      vector<vector<Dtype> >* data, vector<vector<Dtype> >* labels) {
+    LayerParameter param;
+    MolGridDataParameter* mgrid_param = param.mutable_molgrid_data_param();
+    mgrid_param->set_source(filename_);
+    mgrid_param->set_batch_size(3);
+    mgrid_param->set_dimension(6);
+    mgrid_param->set_resolution(0.5);
+    mgrid_param->set_shuffle(true);
+    mgrid_param->set_balanced(false);
+    mgrid_param->set_random_rotation(true);
+    mgrid_param->set_random_translate(2);
+    mgrid_param->set_prefetch_threads(prefetch_threads);
+
+    Blob<Dtype> top_data, top_label;
+    vector<Blob<Dtype>*> bottom_vec, top_vec;
+    top_vec.push_back(&top_data);
+    top_vec.push_back(&top_label);
+
+    Caffe::set_random_seed(seed_);
+    GenericMolGridDataLayer<Dtype> layer(param);
+    layer.SetUp(bottom_vec, top_vec);
+    for (int b = 0; b < nbatches; ++b) {
+      layer.Forward(bottom_vec, top_vec);
+      data->push_back(vector<Dtype>(top_data.cpu_data(),
+          top_data.cpu_data() + top_data.count()));
+      labels->push_back(vector<Dtype>(top_label.cpu_data(),
+          top_label.cpu_data() + top_label.count()));
+    }
+  }
+
+  int seed_;
+  string filename_;
+};
+
+TYPED_TEST_CASE(MolGridDataLayerTest, TestDtypes);
+
+TYPED_TEST(MolGridDataLayerTest, TestPrefetchMatchesInline) {
+  const int nbatches = 6;
+  vector<vector<TypeParam> > data, labels;
+  vector<vector<TypeParam> > pdata, plabels;
+  this->RunBatches(0, nbatches, &data, &labels);
+  this->RunBatches(1, nbatches, &pdata, &plabels);
+
+  ASSERT_EQ(nbatches, data.size());
+  ASSERT_EQ(nbatches, pdata.size());
+  for (int b = 0; b < nbatches; ++b) {
+    ASSERT_EQ(data[b].size(), pdata[b].size());
+    ASSERT_EQ(labels[b].size(), plabels[b].size());
+    for (int i = 0; i < labels[b].size(); ++i) {
+      EXPECT_EQ(labels[b][i], plabels[b][i]) << "batch " << b;
+    }
+    for (int i = 0; i < data[b].size(); ++i) {
+      EXPECT_EQ(data[b][i], pdata[b][i]) << "batch " << b << " index " << i;
+    }
+  }
+}
+
+}  // namespace caffe
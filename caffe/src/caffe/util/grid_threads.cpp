@@ -0,0 +1,111 @@
+#include <boost/thread.hpp>
+#include <exception>
+
+#include "caffe/util/grid_threads.hpp"
+
+namespace caffe {
+
+class GridThreads::sync {
+ public:
+  boost::mutex run_mutex_;  // held for the whole of a Run
+  boost::mutex mutex_;  // protects everything below
+  boost::condition_variable start_;
+  boost::condition_variable done_;
+  unsigned long generation_;  // incremented for every Run
+  unsigned n_;
+  const RangeFunction* f_;
+  unsigned remaining_;  // blocks of the current Run still being processed
+  std::exception_ptr error_;
+  bool stop_;
+
+  sync() : generation_(0), n_(0), f_(NULL), remaining_(0), stop_(false) {}
+};
+
+static void run_block(const GridThreads::RangeFunction& f, unsigned n,
+    unsigned block, unsigned nblocks, std::exception_ptr* error,
+    boost::mutex* mutex) {
+  unsigned begin = (unsigned long) n * block / nblocks;
+  unsigned end = (unsigned long) n * (block + 1) / nblocks;
+  if (begin == end) return;
+  try {
+    f(begin, end);
+  } catch (...) {
+    boost::mutex::scoped_lock lock(*mutex);
+    if (!*error) *error = std::current_exception();
+  }
+}
+
+GridThreads::GridThreads(unsigned nthreads)
+    : nthreads_(std::max(nthreads, 1U)), sync_(new sync()) {
+  for (unsigned i = 1; i < nthreads_; ++i) {
+    threads_.push_back(shared_ptr<boost::thread>(
+        new boost::thread(&GridThreads::Entry, this, i)));
+  }
+}
+
+GridThreads::~GridThreads() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    sync_->stop_ = true;
+  }
+  sync_->start_.notify_all();
+  for (unsigned i = 0; i < threads_.size(); ++i) {
+    threads_[i]->join();
+  }
+}
+
+void GridThreads::Run(unsigned n, const RangeFunction& f) {
+  if (nthreads_ == 1) {
+    f(0, n);
+    return;
+  }
+  boost::mutex::scoped_lock run_lock(sync_->run_mutex_);
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    sync_->n_ = n;
+    sync_->f_ = &f;
+    sync_->remaining_ = nthreads_ - 1;
+    sync_->generation_++;
+  }
+  sync_->start_.notify_all();
+
+  run_block(f, n, 0, nthreads_, &sync_->error_, &sync_->mutex_);
+
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (sync_->remaining_ > 0) {
+    sync_->done_.wait(lock);
+  }
+  sync_->f_ = NULL;
+  if (sync_->error_) {
+    std::exception_ptr e = sync_->error_;
+    sync_->error_ = std::exception_ptr();
+    std::rethrow_exception(e);
+  }
+}
+
+void GridThreads::Entry(unsigned block) {
+  unsigned long seen = 0;
+  while (true) {
+    unsigned n;
+    const RangeFunction* f;
+    {
+      boost::mutex::scoped_lock lock(sync_->mutex_);
+      while (!sync_->stop_ && sync_->generation_ == seen) {
+        sync_->start_.wait(lock);
+      }
+      if (sync_->stop_) return;
+      seen = sync_->generation_;
+      n = sync_->n_;
+      f = sync_->f_;
+    }
+
+    run_block(*f, n, block, nthreads_, &sync_->error_, &sync_->mutex_);
+
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    if (--sync_->remaining_ == 0) {
+      sync_->done_.notify_one();
+    }
+  }
+}
+
+}  // namespace caffe
@@ -10,6 +10,7 @@
 #include <fstream>
 #include "CommandLine2/CommandLine.h"
 #include "GninaConverter.h"
+#include "ligand_library.h"
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 
@@ -18,13 +19,49 @@ using namespace OpenBabel;
 
 cl::opt<string> infile("in", cl::desc("input file"), cl::Required,
     cl::Positional);
+cl::opt<unsigned> first("first",
+    cl::desc("first molecule to output from a .gninalib library"),
+    cl::init(0));
+cl::opt<unsigned> numout("count",
+    cl::desc("number of molecules to output from a .gninalib library"),
+    cl::init(UINT_MAX));
+
+static void write_parsed(parsing_struct& p, context& c, unsigned numtors) {
+  model m;
+
+  non_rigid_parsed nr;
+  pdbqt_initializer tmp;
+
+  postprocess_ligand(nr, p, c, numtors);
+  tmp.initialize_from_nrp(nr, c, true);
+  tmp.initialize(nr.mobility_matrix());
+  m.set_name(c.sdftext.name);
+
+  m.append(tmp.m);
+
+  stringstream str;
+  m.write_sdf(str);
+  cout << str.str() << "$$$$\n";
+}
 
 int main(int argc, char *argv[]) {
   cl::ParseCommandLineOptions(argc, argv);
 
+  if (ligand_library::is_library(path(infile))) {
+    //any molecule can be decoded directly
+    ligand_library lib((path(infile)));
+    for (sz i = first; i < lib.size() && i - first < numout; i++) {
+      unsigned numtors;
+      parsing_struct p;
+      context c;
+      lib.read(i, p, c, numtors);
+      write_parsed(p, c, numtors);
+    }
+    return 0;
+  }
+
   ifstream ifile(infile.c_str());
 
-  model initm;
   size_t position = 0;
   while (ifile) {
     unsigned sz;
@@ -55,20 +92,6 @@ int main(int argc, char *argv[]) {
     serialin >> p;
     serialin >> c;
 
-    model m = initm;
-
-    non_rigid_parsed nr;
-    pdbqt_initializer tmp;
-
-    postprocess_ligand(nr, p, c, numtors);
-    tmp.initialize_from_nrp(nr, c, true);
-    tmp.initialize(nr.mobility_matrix());
-    m.set_name(c.sdftext.name);
-
-    m.append(tmp.m);
-
-    stringstream str;
-    m.write_sdf(str);
-    cout << str.str() << "$$$$\n";
+    write_parsed(p, c, numtors);
   }
 }
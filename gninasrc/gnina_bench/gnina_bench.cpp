@@ -0,0 +1,374 @@
+/*
+ * gnina_bench.cpp
+ *
+ * Microbenchmarks of the docking hot paths. Every benchmark runs on the
+ * receptor and ligand checked in under gnina_bench/data with a fixed seed,
+ * so numbers from different builds are comparable. Results are written as
+ * JSON, one entry per benchmark, so that each hot path can be tracked on
+ * its own.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <boost/program_options.hpp>
+#include <boost/regex.hpp>
+#include <boost/timer/timer.hpp>
+#include <boost/multi_array.hpp>
+
+#include "common.h"
+#include "custom_terms.h"
+#include "weighted_terms.h"
+#include "precalculate.h"
+#include "cache.h"
+#include "non_cache.h"
+#include "szv_grid.h"
+#include "quasi_newton.h"
+#include "builtinscoring.h"
+#include "molgetter.h"
+#include "random.h"
+#include "gridmaker.h"
+#include "cnn_scorer.h"
+#include "atom_constants.h"
+#include "file.h"
+
+#ifndef GNINA_BENCH_DATA
+#define GNINA_BENCH_DATA "gnina_bench/data"
+#endif
+
+//reaches into the classes for the pieces that aren't public
+struct bench_access {
+    static const grid& type_grid(const cache& c, smt t) {
+      return c.grids[t];
+    }
+    static caffe::Net<float>& cnn_net(CNNScorer& c) {
+      return *c.net;
+    }
+    static fl intramolecular_deriv(model& m, const precalculate& p, fl v) {
+      fl e = 0;
+      VINA_FOR_IN(i, m.ligands)
+        e += m.eval_interacting_pairs_deriv(p, v, m.ligands[i].pairs,
+            m.coords, m.minus_forces);
+      return e;
+    }
+};
+
+struct bench_options {
+    std::string data;
+    std::string filter;
+    std::string json;
+    int seed;
+    unsigned samples;
+    double min_time; //seconds per sample
+    bool list;
+
+    bench_options()
+        : data(GNINA_BENCH_DATA), seed(1), samples(5), min_time(0.2),
+            list(false) {
+    }
+};
+
+//seconds per call of each sample
+struct bench_result {
+    std::string name;
+    unsigned iterations; //calls per sample
+    std::vector<double> seconds;
+
+    double min() const {
+      return *std::min_element(seconds.begin(), seconds.end());
+    }
+    double median() const {
+      std::vector<double> s(seconds);
+      std::sort(s.begin(), s.end());
+      sz n = s.size();
+      return n % 2 ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2;
+    }
+    double mean() const {
+      double sum = 0;
+      VINA_FOR_IN(i, seconds)
+        sum += seconds[i];
+      return sum / seconds.size();
+    }
+};
+
+static double time_calls(const std::function<void()>& body, unsigned n) {
+  boost::timer::cpu_timer t;
+  for (unsigned i = 0; i < n; i++)
+    body();
+  return t.elapsed().wall / 1e9;
+}
+
+//one untimed warm up call, then enough calls per sample to fill min_time
+static bench_result run_bench(const std::string& name,
+    const std::function<void()>& body, const bench_options& opts) {
+  bench_result r;
+  r.name = name;
+  body();
+  double once = time_calls(body, 1);
+  r.iterations = 1;
+  if (once < opts.min_time)
+    r.iterations = unsigned(opts.min_time / std::max(once, 1e-9)) + 1;
+  for (unsigned s = 0; s < opts.samples; s++)
+    r.seconds.push_back(time_calls(body, r.iterations) / r.iterations);
+  std::cerr << name << ": " << r.median() * 1e6 << " us (" << r.iterations
+      << " calls x " << opts.samples << ")\n";
+  return r;
+}
+
+static void write_json(std::ostream& out, const bench_options& opts,
+    const std::vector<bench_result>& results) {
+  out << std::setprecision(9);
+  out << "{\n  \"seed\": " << opts.seed << ",\n  \"benchmarks\": [";
+  VINA_FOR_IN(i, results) {
+    const bench_result& r = results[i];
+    out << (i ? ",\n" : "\n");
+    out << "    {\"name\": \"" << r.name << "\", \"iterations\": "
+        << r.iterations << ", \"samples\": " << r.seconds.size()
+        << ", \"min_seconds\": " << r.min() << ", \"median_seconds\": "
+        << r.median() << ", \"mean_seconds\": " << r.mean() << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+static bool parse_options(int argc, char *argv[], bench_options& o) {
+  using namespace boost::program_options;
+  options_description desc("gnina_bench options");
+  bool help = false;
+  desc.add_options()
+  ("data", value<std::string>(&o.data)->default_value(o.data),
+      "directory with receptor.pdbqt and ligand.pdbqt")
+  ("filter", value<std::string>(&o.filter),
+      "only run benchmarks whose name matches this regular expression")
+  ("json", value<std::string>(&o.json),
+      "write results to this file instead of stdout")
+  ("seed", value<int>(&o.seed)->default_value(o.seed),
+      "random seed for poses and sample points")
+  ("samples", value<unsigned>(&o.samples)->default_value(o.samples),
+      "timed samples per benchmark")
+  ("min_time", value<double>(&o.min_time)->default_value(o.min_time),
+      "minimum seconds per sample")
+  ("list", bool_switch(&o.list), "list the benchmarks and exit")
+  ("help", bool_switch(&help), "display usage summary");
+  variables_map vm;
+  try {
+    store(command_line_parser(argc, argv).options(desc).run(), vm);
+    notify(vm);
+  } catch (boost::program_options::error& e) {
+    std::cerr << "Command line parse error: " << e.what() << '\n'
+        << "\nCorrect usage:\n" << desc << '\n';
+    return false;
+  }
+  if (help) {
+    std::cout << desc << '\n';
+    return false;
+  }
+  if (o.samples == 0) o.samples = 1;
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  bench_options opts;
+  if (!parse_options(argc, argv, opts)) exit(0);
+
+  try {
+    tee log(true);
+    FlexInfo finfo(log);
+    MolGetter mols(opts.data + "/receptor.pdbqt", std::string(), finfo, true,
+        true, log);
+    mols.setInputFile(opts.data + "/ligand.pdbqt");
+    model m;
+    if (!mols.readMoleculeIntoModel(m))
+      throw usage_error("No ligand in " + opts.data + "/ligand.pdbqt");
+
+    //the default scoring function and approximation of gnina
+    custom_terms t;
+    VINA_CHECK(builtin_scoring_functions.set(t, "default"));
+    weighted_terms wt(&t, t.weights());
+    precalculate_linear prec(wt, 32);
+
+    //autobox around the ligand, as with --autobox_ligand
+    const fl granularity = 0.375, autobox_add = 4, slope = 10;
+    const vecv& coords = m.coordinates();
+    vec lo(max_fl, max_fl, max_fl), hi(-max_fl, -max_fl, -max_fl);
+    VINA_FOR(i, m.num_movable_atoms())
+      VINA_FOR(d, 3) {
+        lo[d] = std::min(lo[d], coords[i][d]);
+        hi[d] = std::max(hi[d], coords[i][d]);
+      }
+    grid_dims gd;
+    VINA_FOR(d, 3) {
+      fl span = hi[d] - lo[d] + 2 * autobox_add;
+      gd[d].n = sz(std::ceil(span / granularity));
+      fl real_span = granularity * gd[d].n;
+      gd[d].begin = (lo[d] + hi[d]) / 2 - real_span / 2;
+      gd[d].end = gd[d].begin + real_span;
+    }
+    vec corner1(gd[0].begin, gd[1].begin, gd[2].begin);
+    vec corner2(gd[0].end, gd[1].end, gd[2].end);
+    const vec authentic_v(1000, 1000, 1000);
+    grid user_grid;
+
+    std::vector<smt> types;
+    m.get_movable_atom_types(types);
+
+    cache c("scoring_function_version001", gd, slope);
+    c.populate(m, prec, types, user_grid, false);
+    szv_grid_cache gridcache(m, prec.cutoff_sqr());
+    non_cache nc(gridcache, gd, &prec, slope);
+
+    rng generator(static_cast<rng::result_type>(opts.seed));
+    conf_size s = m.get_size();
+    conf start = m.get_initial_conf(false);
+    start.randomize(corner1, corner2, generator);
+    change g(s, false);
+
+    //ligand atoms at random points of the box for grid::evaluate
+    std::vector<std::pair<const atom*, vec> > probes;
+    const atomv& ligatoms = m.get_movable_atoms();
+    VINA_FOR(i, 1000) {
+      const atom& a = ligatoms[i % ligatoms.size()];
+      if (!c.has_grid(a.get())) continue;
+      probes.push_back(
+          std::make_pair(&a,
+              vec(random_fl(corner1[0], corner2[0], generator),
+                  random_fl(corner1[1], corner2[1], generator),
+                  random_fl(corner1[2], corner2[2], generator))));
+    }
+
+    //receptor and ligand atoms as the cnn grids them
+    GridMaker gmaker(0.5, 23.5);
+    vec center((corner1[0] + corner2[0]) / 2, (corner1[1] + corner2[1]) / 2,
+        (corner1[2] + corner2[2]) / 2);
+    gmaker.setCenter(center[0], center[1], center[2]);
+    std::vector<float4> ainfo;
+    std::vector<short> gridindex;
+    const atomv& recatoms = m.get_fixed_atoms();
+    VINA_FOR_IN(i, recatoms) {
+      const atom& a = recatoms[i];
+      ainfo.push_back(make_float4(a.coords[0], a.coords[1], a.coords[2],
+          xs_radius(a.get())));
+      gridindex.push_back(a.get());
+    }
+    VINA_FOR_IN(i, ligatoms) {
+      ainfo.push_back(make_float4(coords[i][0], coords[i][1], coords[i][2],
+          xs_radius(ligatoms[i].get())));
+      gridindex.push_back(smina_atom_type::NumTypes + ligatoms[i].get());
+    }
+    const unsigned gdim = ::round(23.5 / 0.5) + 1;
+    boost::multi_array<float, 4> cnngrids(
+        boost::extents[2 * smina_atom_type::NumTypes][gdim][gdim][gdim]);
+
+    std::vector<std::pair<std::string, std::function<void()> > > benches;
+
+    benches.push_back(std::make_pair("cache_populate", [&]() {
+      cache fresh("scoring_function_version001", gd, slope);
+      fresh.populate(m, prec, types, user_grid, false);
+    }));
+
+    benches.push_back(std::make_pair("grid_evaluate", [&]() {
+      vec deriv;
+      VINA_FOR_IN(i, probes) {
+        const atom& a = *probes[i].first;
+        bench_access::type_grid(c, a.get()).evaluate(a, probes[i].second,
+            slope, a.charge, &deriv);
+      }
+    }));
+
+    benches.push_back(std::make_pair("non_cache_eval_deriv", [&]() {
+      m.set(start);
+      nc.eval_deriv(m, authentic_v[1], user_grid);
+    }));
+
+    benches.push_back(std::make_pair("eval_interacting_pairs_deriv", [&]() {
+      m.set(start);
+      std::fill(m.minus_forces.begin(), m.minus_forces.end(), vec(0, 0, 0));
+      bench_access::intramolecular_deriv(m, prec, authentic_v[0]);
+    }));
+
+    benches.push_back(std::make_pair("heterotree_derivative", [&]() {
+      m.ligands.derivative(m.coords, m.minus_forces, g.ligands);
+    }));
+
+    benches.push_back(std::make_pair("bfgs", [&]() {
+      minimization_params minparms;
+      minparms.maxiters = unsigned((25 + m.num_movable_atoms()) / 3);
+      quasi_newton quasi_newton_par(minparms);
+      output_type out(start, max_fl);
+      quasi_newton_par(m, prec, c, out, g, authentic_v, user_grid);
+    }));
+
+    benches.push_back(std::make_pair("gridmaker_set_atoms_cpu", [&]() {
+      gmaker.zeroGridsCPU(cnngrids);
+      gmaker.setAtomsCPU(ainfo, gridindex, GridMaker::quaternion(1, 0, 0, 0),
+          cnngrids);
+    }));
+
+    //the default model; the first score sets up its grid input for the
+    //benchmarks that run only part of the net
+    std::unique_ptr<CNNScorer> cnn;
+    auto need_cnn = [&]() {
+      if (cnn) return;
+      cnn_options cnnopts;
+      cnnopts.cnn_scoring = true;
+      cnnopts.seed = opts.seed;
+      cnn.reset(new CNNScorer(cnnopts));
+      cnn->set_center_from_model(m);
+      m.set(start);
+      cnn->score(m);
+    };
+
+    //a whole score: setting the atoms, gridding them and the net
+    benches.push_back(std::make_pair("cnn_score", [&]() {
+      need_cnn();
+      m.set(start);
+      cnn->score(m);
+    }));
+
+    //just gridding the atoms, the net's input layer
+    benches.push_back(std::make_pair("cnn_grid", [&]() {
+      need_cnn();
+      bench_access::cnn_net(*cnn).ForwardFromTo(0, 0);
+    }));
+
+    //just the layers after the input, on the grids left by the last score
+    benches.push_back(std::make_pair("cnn_forward", [&]() {
+      need_cnn();
+      caffe::Net<float>& net = bench_access::cnn_net(*cnn);
+      net.ForwardFromTo(1, net.layers().size() - 1);
+    }));
+
+    if (opts.list) {
+      VINA_FOR_IN(i, benches)
+        std::cout << benches[i].first << "\n";
+      return 0;
+    }
+
+    boost::regex filter(opts.filter.size() ? opts.filter : ".*");
+    std::vector<bench_result> results;
+    VINA_FOR_IN(i, benches) {
+      if (!boost::regex_search(benches[i].first, filter)) continue;
+      results.push_back(run_bench(benches[i].first, benches[i].second, opts));
+    }
+
+    if (opts.json.size() > 0) {
+      ofile out(opts.json);
+      write_json(out, opts, results);
+    } else
+      write_json(std::cout, opts, results);
+  } catch (file_error& e) {
+    std::cerr << "\n\nError: could not open \"" << e.name.string()
+        << "\" for " << (e.in ? "reading" : "writing") << ".\n";
+    return -1;
+  } catch (usage_error& e) {
+    std::cerr << "\n\nUsage error: " << e.what() << "\n";
+    return -1;
+  } catch (parse_error& e) {
+    std::cerr << "\n\nParse error on line " << e.line << " in file \""
+        << e.file.string() << "\": " << e.reason << '\n';
+    return -1;
+  }
+  return 0;
+}
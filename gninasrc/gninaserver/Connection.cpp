@@ -0,0 +1,265 @@
+/*
+ * Connection.cpp
+ */
+
+#include "Connection.h"
+
+Connection::Connection(boost::asio::io_service& s,
+    boost::asio::thread_pool& e, Listener& l, cmd_map& c)
+    : io(s), executor(e), socket(s), deadline(s), listener(l), commands(c),
+        counted(false), writing(false), closing(false) {
+}
+
+void Connection::start() {
+  //first line is command
+  expectData();
+  boost::asio::async_read_until(socket, cmdline, '\n',
+      boost::bind(&Connection::handleCommand, shared_from_this(),
+          boost::asio::placeholders::error));
+}
+
+//close the connection if the pending read gets nothing in time
+void Connection::expectData() {
+  deadline.expires_from_now(
+      boost::posix_time::seconds(listener.getTimeout()));
+  deadline.async_wait(
+      boost::bind(&Connection::timedOut, shared_from_this(),
+          boost::asio::placeholders::error));
+}
+
+void Connection::timedOut(const boost::system::error_code& err) {
+  //the wait may have completed just before the read did; the read then
+  //pushed the deadline out
+  if (err || deadline.expires_at()
+      > boost::asio::deadline_timer::traits_type::now()) return;
+  close(); //the pending read fails
+}
+
+void Connection::handleCommand(const boost::system::error_code& err) {
+  deadline.expires_at(boost::posix_time::pos_infin);
+  if (err) {
+    close();
+    return;
+  }
+
+  string cmd;
+  istream in(&cmdline);
+  getline(in, cmd);
+  trim(cmd);
+  //whatever came in after the command line
+  request.assign(boost::asio::buffers_begin(cmdline.data()),
+      boost::asio::buffers_end(cmdline.data()));
+  cmdline.consume(cmdline.size());
+
+  if (commands.count(cmd) == 0) {
+    reply = "ERROR\nInvalid command: " + cmd + "\n";
+    writing = true;
+    boost::asio::async_write(socket, boost::asio::buffer(reply),
+        boost::bind(&Connection::handleWrite, shared_from_this(),
+            boost::asio::placeholders::error));
+    finish();
+    return;
+  }
+  command = commands[cmd];
+  listener.acquire(shared_from_this());
+}
+
+void Connection::admitted() {
+  counted = true;
+  if (!socket.is_open()) {
+    release();
+    return;
+  }
+  readRequest(false);
+}
+
+//read until the command has all of its request
+void Connection::readRequest(bool eof) {
+  if (command->ready(request, eof)) {
+    //nothing else is pending on this connection until ran
+    boost::asio::post(executor,
+        boost::bind(&Connection::run, shared_from_this()));
+  } else {
+    expectData();
+    socket.async_read_some(boost::asio::buffer(buffer),
+        boost::bind(&Connection::handleRequest, shared_from_this(),
+            boost::asio::placeholders::error,
+            boost::asio::placeholders::bytes_transferred));
+  }
+}
+
+void Connection::handleRequest(const boost::system::error_code& err, size_t n) {
+  deadline.expires_at(boost::posix_time::pos_infin);
+  request.append(buffer, n);
+  if (err && err != boost::asio::error::eof) {
+    close();
+    return;
+  }
+  readRequest(!!err);
+}
+
+void Connection::run() {
+  stringstream in(request);
+  stringstream out;
+  try {
+    query = command->execute(in, out);
+  } catch (std::exception& e) {
+    out << "ERROR\nException " << e.what() << "\n";
+  }
+  reply = out.str();
+  if (query) {
+    streamoff used = in.tellg();
+    rest = used < 0 ? string() : request.substr(used);
+  }
+  request.clear();
+
+  boost::asio::post(io, boost::bind(&Connection::ran, shared_from_this()));
+}
+
+void Connection::ran() {
+  writing = true;
+  boost::asio::async_write(socket, boost::asio::buffer(reply),
+      boost::bind(&Connection::handleWrite, shared_from_this(),
+          boost::asio::placeholders::error));
+
+  if (!query) {
+    finish();
+    return;
+  }
+
+  //stays counted against the concurrency limit until its input ends
+  query->execute(boost::bind(&Connection::resumeLigands, shared_from_this()),
+      boost::bind(&Connection::queryFinished, shared_from_this()));
+  if (rest.size() == 0)
+    readLigands();
+  else
+    boost::asio::post(executor,
+        boost::bind(&Connection::addLigands, shared_from_this(), rest.data(),
+            rest.size(), false));
+}
+
+void Connection::handleWrite(const boost::system::error_code& err) {
+  writing = false;
+  reply.clear();
+  if (err || closing) close();
+}
+
+void Connection::readLigands() {
+  rest.clear(); //decoded by now
+  if (!socket.is_open()) return;
+  expectData();
+  socket.async_read_some(boost::asio::buffer(buffer),
+      boost::bind(&Connection::handleLigands, shared_from_this(),
+          boost::asio::placeholders::error,
+          boost::asio::placeholders::bytes_transferred));
+}
+
+void Connection::handleLigands(const boost::system::error_code& err, size_t n) {
+  deadline.expires_at(boost::posix_time::pos_infin);
+  //buffer is not read into again until the executor is done with it
+  boost::asio::post(executor,
+      boost::bind(&Connection::addLigands, shared_from_this(), buffer, n,
+          !!err));
+}
+
+void Connection::addLigands(const char* data, size_t n, bool end) {
+  //when the query has enough waiting it stops us until it resumes us
+  bool more = n == 0 || query->addData(data, n);
+  if (end) {
+    query->endInput();
+    //only minimization is left
+    boost::asio::post(io,
+        boost::bind(&Connection::release, shared_from_this()));
+  } else
+    if (more)
+      boost::asio::post(io,
+          boost::bind(&Connection::readLigands, shared_from_this()));
+}
+
+void Connection::resumeLigands() {
+  boost::asio::post(io,
+      boost::bind(&Connection::readLigands, shared_from_this()));
+}
+
+void Connection::queryFinished() {
+  boost::asio::post(io, boost::bind(&Connection::finish, shared_from_this()));
+}
+
+void Connection::finish() {
+  closing = true;
+  if (!writing) close();
+}
+
+void Connection::close() {
+  release();
+  deadline.expires_at(boost::posix_time::pos_infin);
+  if (socket.is_open()) {
+    boost::system::error_code ignored;
+    socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+    socket.close(ignored);
+  }
+}
+
+void Connection::release() {
+  if (counted) {
+    counted = false;
+    listener.release();
+  }
+}
+
+Listener::Listener(boost::asio::io_service& s, boost::asio::thread_pool& e,
+    unsigned port, cmd_map& c, Logger& l, unsigned maxc, unsigned t)
+    : io(s), executor(e),
+        acceptor(s,
+            boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port)),
+        retry(s), commands(c), log(l), maxConcurrent(std::max(maxc, 1U)),
+        timeout(std::max(t, 1U)), active(0) {
+  accept();
+}
+
+//connections that haven't sent a command yet aren't limited, only timed out
+void Listener::accept() {
+  boost::shared_ptr<Connection> c(
+      new Connection(io, executor, *this, commands));
+  acceptor.async_accept(c->getSocket(),
+      boost::bind(&Listener::handleAccept, this, c,
+          boost::asio::placeholders::error));
+}
+
+void Listener::handleAccept(boost::shared_ptr<Connection> c,
+    const boost::system::error_code& err) {
+  if (err) {
+    //e.g. out of file descriptors; accepting again at once would just spin
+    log.log("Error accepting connection: %s\n", err.message().c_str());
+    retry.expires_from_now(boost::posix_time::milliseconds(100));
+    retry.async_wait(
+        boost::bind(&Listener::retryAccept, this,
+            boost::asio::placeholders::error));
+    return;
+  }
+  c->start();
+  accept();
+}
+
+void Listener::retryAccept(const boost::system::error_code& err) {
+  accept();
+}
+
+void Listener::acquire(boost::shared_ptr<Connection> c) {
+  if (active < maxConcurrent) {
+    active++;
+    c->admitted();
+  } else
+    waiting.push_back(c);
+}
+
+void Listener::release() {
+  active--;
+  if (!waiting.empty()) {
+    boost::shared_ptr<Connection> c = waiting.front();
+    waiting.pop_front();
+    active++;
+    //not from inside the releasing connection's handler
+    boost::asio::post(io, boost::bind(&Connection::admitted, c));
+  }
+}
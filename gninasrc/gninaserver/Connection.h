@@ -0,0 +1,112 @@
+/*
+ * Connection.h
+ *
+ *  The server's networking.  A Listener accepts clients and each Connection
+ *  reads its request and writes the reply as asynchronous operations on a
+ *  single io_service, so a client that is idle or slow costs neither a
+ *  thread nor any polling.  The command itself (parsing a receptor,
+ *  formatting molecules) runs on a small executor so it never stalls the
+ *  other connections.  A startmin connection then streams its ligand data
+ *  into the query as it arrives, decoding it on the executor as well.
+ *  Clients that stop sending are disconnected after a timeout.
+ */
+
+#ifndef CONNECTION_H_
+#define CONNECTION_H_
+
+#include <deque>
+#include <boost/enable_shared_from_this.hpp>
+#include "server_common.h"
+#include "servercmds.h"
+#include "Logger.h"
+
+class Listener;
+
+class Connection : public boost::enable_shared_from_this<Connection> {
+    boost::asio::io_service& io;
+    boost::asio::thread_pool& executor; //runs the commands
+    boost::asio::ip::tcp::socket socket;
+    boost::asio::deadline_timer deadline; //for the pending read
+    Listener& listener;
+    cmd_map& commands;
+    bool counted; //against the listener's concurrency limit
+
+    boost::asio::streambuf cmdline;
+    boost::shared_ptr<Command> command;
+    string request; //received after the command line
+    string reply;
+    string rest; //ligand data that came with a startmin request
+    bool writing;
+    bool closing; //once reply is written
+
+    QueryPtr query; //that the rest of the data is for, if any
+    char buffer[65536];
+
+    void expectData(); //from the client within the timeout
+    void timedOut(const boost::system::error_code& err);
+
+    void handleCommand(const boost::system::error_code& err);
+    void readRequest(bool eof);
+    void handleRequest(const boost::system::error_code& err, size_t n);
+    void run(); //on the executor
+    void ran(); //back on the io_service
+    void handleWrite(const boost::system::error_code& err);
+
+    void readLigands();
+    void handleLigands(const boost::system::error_code& err, size_t n);
+    void addLigands(const char* data, size_t n, bool end); //on the executor
+    //called from minimization workers
+    void resumeLigands();
+    void queryFinished();
+
+    void finish(); //close once the reply is out
+    void close();
+    void release();
+  public:
+    Connection(boost::asio::io_service& s, boost::asio::thread_pool& e,
+        Listener& l, cmd_map& c);
+
+    boost::asio::ip::tcp::socket& getSocket() {
+      return socket;
+    }
+
+    void start();
+    //the listener has counted us, go on with the request
+    void admitted();
+};
+
+//accept connections and run at most maxConcurrent requests at a time; a
+//connection counts once its command has been read and until its request,
+//including any ligand streaming, is done, and past the limit it waits for
+//a slot
+class Listener {
+    boost::asio::io_service& io;
+    boost::asio::thread_pool& executor;
+    boost::asio::ip::tcp::acceptor acceptor;
+    boost::asio::deadline_timer retry; //after a failed accept
+    cmd_map& commands;
+    Logger& log;
+    unsigned maxConcurrent;
+    unsigned timeout; //seconds a client may go without sending
+    unsigned active;
+    std::deque<boost::shared_ptr<Connection> > waiting; //for a slot
+
+    void accept();
+    void handleAccept(boost::shared_ptr<Connection> c,
+        const boost::system::error_code& err);
+    void retryAccept(const boost::system::error_code& err);
+  public:
+    Listener(boost::asio::io_service& s, boost::asio::thread_pool& e,
+        unsigned port, cmd_map& c, Logger& l, unsigned maxc, unsigned t);
+
+    unsigned getTimeout() const {
+      return timeout;
+    }
+
+    //a connection has a command to run; admits it now or once a slot frees
+    void acquire(boost::shared_ptr<Connection> c);
+    //a connection is done with its request
+    void release();
+};
+
+#endif /* CONNECTION_H_ */
@@ -0,0 +1,91 @@
+/*
+ * MinimizationPool.cpp
+ */
+
+#include "MinimizationPool.h"
+
+MinimizationPool::MinimizationPool(unsigned nthreads)
+    : generation(0), stopping(false) {
+  if (nthreads == 0) nthreads = 1;
+  for (unsigned t = 0; t < nthreads; t++)
+    workers.create_thread(boost::bind(&MinimizationPool::thread_work, this));
+}
+
+MinimizationPool::~MinimizationPool() {
+  {
+    boost::lock_guard<boost::mutex> L(mu);
+    stopping = true;
+  }
+  ready.notify_all();
+  workers.join_all();
+}
+
+void MinimizationPool::add(const QueryPtr& q) {
+  {
+    boost::lock_guard<boost::mutex> L(mu);
+    boost::unordered_map<MinimizationQuery*, unsigned>::iterator pos =
+        wakeups.find(q.get());
+    if (pos != wakeups.end()) {
+      pos->second++;
+    } else {
+      wakeups[q.get()] = 0;
+      runnable.push_back(q);
+    }
+    generation++;
+  }
+  ready.notify_all(); //several workers can share a query's chunks
+}
+
+void MinimizationPool::released() {
+  {
+    boost::lock_guard<boost::mutex> L(mu);
+    generation++;
+  }
+  ready.notify_all();
+}
+
+void MinimizationPool::thread_work() {
+  unsigned skipped = 0; //queries found busy in a row, since seen
+  unsigned long seen_generation = 0;
+  while (true) {
+    QueryPtr q;
+    unsigned seen = 0;
+    {
+      boost::unique_lock<boost::mutex> L(mu);
+      //sleep when there is nothing, or everything was busy and still is
+      while (!stopping
+          && (runnable.empty()
+              || (skipped >= runnable.size() && generation == seen_generation)))
+        ready.wait(L);
+      if (stopping) return;
+      if (generation != seen_generation) {
+        seen_generation = generation;
+        skipped = 0;
+      }
+      q = runnable.front();
+      runnable.pop_front();
+      runnable.push_back(q);
+      seen = wakeups[q.get()];
+    }
+
+    MinimizationQuery::ChunkStatus status = q->minimizeChunk();
+    if (status == MinimizationQuery::Busy) {
+      //leave it in the ring and move on to the next query; its release
+      //bumps the generation if it happens after this try
+      skipped++;
+      continue;
+    }
+    skipped = 0;
+    if (status != MinimizationQuery::Minimized) {
+      boost::lock_guard<boost::mutex> L(mu);
+      boost::unordered_map<MinimizationQuery*, unsigned>::iterator pos =
+          wakeups.find(q.get());
+      //workers still on a chunk of a done query finish it
+      if (pos != wakeups.end()
+          && (status == MinimizationQuery::Done || pos->second == seen)) {
+        wakeups.erase(pos);
+        runnable.remove(q);
+      }
+    }
+  }
+}
@@ -0,0 +1,45 @@
+/*
+ * MinimizationPool.h
+ *
+ *  A fixed set of worker threads shared by every minimization query on the
+ *  server.  Queries with decoded ligands waiting are kept in a ring and each
+ *  worker takes the query at the front, moves it to the back, and minimizes
+ *  one chunk of its ligands, so queries get chunks in turn no matter how
+ *  many are active and the server never runs more minimizations than it has
+ *  workers.  A query leaves the ring when it runs out of ligands and is
+ *  added back when more arrive, so waiting on a client costs nothing.
+ *  Workers skip a query that another thread holds; once every query in the
+ *  ring has been skipped they sleep until one is released or added.
+ */
+
+#ifndef MINIMIZATIONPOOL_H_
+#define MINIMIZATIONPOOL_H_
+
+#include <list>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include "MinimizationQuery.h"
+
+class MinimizationPool {
+    boost::mutex mu; //protects everything but workers
+    boost::condition_variable ready;
+    std::list<QueryPtr> runnable; //next to get a chunk is at the front
+    //queries in runnable and how many times each was added since, so a
+    //worker that found one starved can tell if ligands came in meanwhile
+    boost::unordered_map<MinimizationQuery*, unsigned> wakeups;
+    unsigned long generation; //of adds and releases, for workers that skipped
+    bool stopping;
+    boost::thread_group workers;
+
+    void thread_work();
+  public:
+    MinimizationPool(unsigned nthreads);
+    ~MinimizationPool(); //waits for chunks in progress
+
+    //q has ligands to minimize; safe to call any number of times
+    void add(const QueryPtr& q);
+    //a query that a worker skipped because another thread held it is free
+    void released();
+};
+
+#endif /* MINIMIZATIONPOOL_H_ */
@@ -6,19 +6,23 @@
  */
 
 #include <sstream>
+#include <climits>
 
 #include "MinimizationQuery.h"
+#include "MinimizationPool.h"
 #include "conf.h"
 #include "non_cache.h"
 #include "quasi_newton.h"
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/unordered_set.hpp>
 #include <boost/timer/timer.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
 
 using namespace boost;
 
 MinimizationParameters::MinimizationParameters()
-    : wt(NULL), nthreads(1) {
+    : wt(NULL) {
   //default settings
   minparms.maxiters = 10000;
   minparms.type = minimization_params::BFGSAccurateLineSearch;
@@ -34,64 +38,82 @@ MinimizationParameters::MinimizationParameters()
   wt = new weighted_terms(&t, t.weights());
   prec = new precalculate_splines(*wt, 10.0);
   exact_prec = new precalculate_exact(*wt);
-  nnc = new naive_non_cache(exact_prec);
 }
 
 MinimizationParameters::~MinimizationParameters() {
   if (wt) delete wt;
   if (prec) delete prec;
   if (exact_prec) delete exact_prec;
-  if (nnc) delete nnc;
+}
+
+//how many chunks of decoded ligands can wait for a worker before the
+//connection stops reading, which pushes back on the client
+static const unsigned maxReadyChunks = 16;
+
+MinimizationQuery::MinimizationQuery(const MinimizationParameters& minp,
+    MinimizationPool& p, ReceptorPtr rec, bool hasR, bool isF, unsigned numR,
+    unsigned chunks)
+    : minparm(minp), isFinished(false), minTime(0), stopQuery(false),
+        lastAccessed(time(NULL)), chunk_size(chunks), readAllData(false),
+        hasReorient(hasR), isFrag(isF), numProteinAtoms(numR), receptor(rec),
+        nnc(minp.exact_prec, rec->index.get()), pool(p), io_position(0),
+        io_mutex(p),
+        byScore(ResultLess(MinimizationFilters::Score)),
+        byRMSD(ResultLess(MinimizationFilters::RMSD)),
+        byOrigPos(ResultLess(MinimizationFilters::OrigPos)),
+        worstScore(-HUGE_VAL), worstRMSD(-HUGE_VAL), paused(false),
+        activeWorkers(0) {
+  //set up ligand decompression
+  memset(&inflater, 0, sizeof(inflater));
+  if (inflateInit2(&inflater, 16 + MAX_WBITS) != Z_OK) //gzip header
+    throw std::runtime_error("Could not initialize decompression");
 }
 
 MinimizationQuery::~MinimizationQuery() {
-  checkThread();
-  assert(minimizationSpawner == NULL); //should not be deleted while minimization is running
+  //the pool holds a reference while minimizing, so this is never still running
+  inflateEnd(&inflater);
   for (unsigned i = 0, n = allResults.size(); i < n; i++) {
     delete allResults[i];
   }
   allResults.clear();
 }
 
-void MinimizationQuery::checkThread() {
-  //clean up minimizer threads
-  if (minimizationSpawner != NULL) {
-    if (minimizationSpawner->timed_join(posix_time::time_duration(0, 0, 0))) {
-      delete minimizationSpawner;
-      minimizationSpawner = NULL; // thread is done
-    }
-  }
-}
-
 //return true if down minimizing
 bool MinimizationQuery::finished() {
-  checkThread();
+  boost::lock_guard<io_lock> L(io_mutex);
   return isFinished; //do not want to return true before minimization even starts
 }
 
-//execute the query - set up the minimization threads and communication queue
-void MinimizationQuery::execute(bool block/*=false*/) {
-  assert(minimizationSpawner == NULL);
-  minimizationSpawner = new thread(thread_startMinimization, this);
-
-  if (block) minimizationSpawner->join();
+void MinimizationQuery::execute(const boost::function<void()>& resume,
+    const boost::function<void()>& finish) {
+  boost::lock_guard<io_lock> L(io_mutex);
+  resumeInput = resume;
+  finishOutput = finish;
+  mintime.start();
 }
 
-//launch and wait for the minimization threads
-void MinimizationQuery::thread_startMinimization(MinimizationQuery *query) {
-  //generate a thread for each set of databases
-  thread_group minthreads;
-
-  timer::cpu_timer mintime;
-
-  for (unsigned t = 0; t < query->minparm.nthreads; t++) {
-    minthreads.add_thread(new thread(thread_minimize, query));
-  }
-  minthreads.join_all(); //block till all done
+void MinimizationQuery::cancel() {
+  boost::lock_guard<boost::mutex> D(input_mutex);
+  boost::lock_guard<io_lock> L(io_mutex);
+  stopQuery = true;
+  //drop whatever hasn't been minimized and stop reading
+  readAllData = true;
+  decoded.clear();
+  ready.clear();
+  finishIfDone();
+}
 
-  query->minTime = mintime.elapsed().wall / 1e9;
-  query->io->close();
-  query->isFinished = true;
+void MinimizationQuery::finishIfDone() {
+  if (isFinished || !readAllData || !ready.empty() || activeWorkers > 0)
+    return;
+  minTime = mintime.elapsed().wall / 1e9;
+  isFinished = true;
+
+  //the callbacks reference the connection, which references us
+  boost::function<void()> finish;
+  finish.swap(finishOutput);
+  resumeInput.clear();
+  if (finish) finish();
 }
 
 //thread safe minimization of m
@@ -137,7 +159,7 @@ MinimizationQuery::Result* MinimizationQuery::minimize(model& m) {
   } else { //standard ligand stuff
     fl intramolecular_energy = m.eval_intramolecular(*minparm.exact_prec,
         authentic_v, out.c);
-    e = m.eval_adjusted(*minparm.wt, *minparm.exact_prec, *minparm.nnc,
+    e = m.eval_adjusted(*minparm.wt, *minparm.exact_prec, nnc,
         authentic_v, out.c, intramolecular_energy, empty_grid);
   }
 
@@ -171,94 +193,173 @@ MinimizationQuery::Result* MinimizationQuery::minimize(model& m) {
   return result;
 }
 
-//read a chunk of ligands at a time
-//return false if there's definitely nothing else to read
-bool MinimizationQuery::thread_safe_read(vector<LigandData>& ligands) {
-  ligands.clear();
-  boost::unique_lock<boost::mutex> lock(io_mutex);
-
-  if (!io_strm) return false;
-
-  boost::archive::binary_iarchive serialin(io_strm,
-      boost::archive::no_header | boost::archive::no_tracking);
-
-  for (unsigned i = 0; i < chunk_size; i++) {
-    try {
-      LigandData data;
-
-      if (hasReorient) data.reorient.read(io_strm);
-      serialin >> data.numtors;
-      serialin >> data.p;
-      serialin >> data.c;
-      data.origpos = io_position;
-      io_position++;
-
-      ligands.push_back(data);
-    } catch (boost::archive::archive_exception& e) {
-      return ligands.size() > 0; //need to minimize last set of ligands
-    } catch (...) {
-      return false; //give up
+//read a ligand from the front of the data that has arrived
+//return false if it isn't all here
+bool MinimizationQuery::decodeLigand(size_t& used, LigandData& data) {
+  boost::iostreams::stream<boost::iostreams::array_source> in(
+      decoded.data() + used, decoded.size() - used);
+  try {
+    if (hasReorient) {
+      data.reorient.read(in);
+      if (!in) return false;
     }
+    boost::archive::binary_iarchive serialin(in,
+        boost::archive::no_header | boost::archive::no_tracking);
+    serialin >> data.numtors;
+    serialin >> data.p;
+    serialin >> data.c;
+  } catch (boost::archive::archive_exception& e) {
+    return false; //truncated
   }
-  return !!io_strm;
+  used += in.tellg();
+  return true;
 }
 
-//read chunks of ligands, minimize them, and store the result
-void MinimizationQuery::thread_minimize(MinimizationQuery* q) {
-  unsigned cnt = 0;
+bool MinimizationQuery::addData(const char* data, size_t n) {
+  bool added = false, more = false;
+  boost::lock_guard<boost::mutex> D(input_mutex);
+  {
+    boost::lock_guard<io_lock> L(io_mutex);
+    if (readAllData) return false;
+  }
+
+  //inflate and decode without io_mutex so workers are never held up by it
+  char out[65536];
+  bool corrupt = false;
+  inflater.next_in = (Bytef*) data;
+  inflater.avail_in = n;
+  int ret = Z_OK;
+  do {
+    inflater.next_out = (Bytef*) out;
+    inflater.avail_out = sizeof(out);
+    ret = inflate(&inflater, Z_NO_FLUSH);
+    decoded.append(out, sizeof(out) - inflater.avail_out);
+  } while (ret == Z_OK && (inflater.avail_in > 0 || inflater.avail_out == 0));
+  //the end of the gzip stream is the end of the ligands; if the data is
+  //corrupt, give up on the rest
+  if (ret != Z_OK && ret != Z_BUF_ERROR) corrupt = true;
+
+  deque<LigandData> arrived;
+  size_t used = 0;
   try {
-    vector<LigandData> ligands;
-    while (q->thread_safe_read(ligands)) {
-      if (q->stopQuery) //cancelled
-        return;
-      else
-        if (ligands.size() == 0) //nothing to do yet
-          usleep(10);
-        else //let's minimize!
-        {
-          vector<Result*> results;
-          for (unsigned i = 0, n = ligands.size(); i < n; i++) {
-            //construct model
-            cnt++;
-            LigandData& l = ligands[i];
-            model m = q->initm;
-
-            if (q->hasReorient) l.reorient.reorient(l.p);
-
-            non_rigid_parsed nr;
-            pdbqt_initializer tmp;
-
-            if (q->isFrag) {
-              //treat as residue
-              postprocess_residue(nr, l.p, l.c);
-            } else {
-              postprocess_ligand(nr, l.p, l.c, l.numtors);
-            }
-
-            tmp.initialize_from_nrp(nr, l.c, !q->isFrag);
-            tmp.initialize(nr.mobility_matrix());
-            m.set_name(l.c.sdftext.name);
-
-            m.append(tmp.m);
-
-            Result *result = q->minimize(m);
-            result->orig_position = l.origpos;
-            if (result != NULL) results.push_back(result);
-          }
-
-          //add computed results
-          boost::lock_guard<shared_mutex> lock(q->results_mutex);
-          for (unsigned i = 0, n = results.size(); i < n; i++) {
-            results[i]->position = q->allResults.size();
-            q->allResults.push_back(results[i]);
-          }
-        }
+    while (true) {
+      arrived.push_back(LigandData());
+      if (!decodeLigand(used, arrived.back())) {
+        arrived.pop_back();
+        break;
+      }
+      arrived.back().origpos = io_position++;
+    }
+  } catch (...) {
+    arrived.pop_back();
+    corrupt = true; //give up
+  }
+  decoded.erase(0, used);
+  if (corrupt) decoded.clear();
+
+  {
+    boost::lock_guard<io_lock> L(io_mutex);
+    if (readAllData) return false; //cancelled while decoding
+    added = !arrived.empty();
+    ready.insert(ready.end(), arrived.begin(), arrived.end());
+    if (corrupt) {
+      readAllData = true;
+      finishIfDone();
+    } else {
+      paused = ready.size() >= maxReadyChunks * chunk_size;
+      more = !paused;
+    }
+  }
+  if (added) pool.add(shared_from_this());
+  return more;
+}
+
+void MinimizationQuery::endInput() {
+  boost::lock_guard<boost::mutex> D(input_mutex);
+  boost::lock_guard<io_lock> L(io_mutex);
+  readAllData = true;
+  decoded.clear(); //partial ligand
+  finishIfDone();
+}
+
+bool MinimizationQuery::io_lock::try_lock() {
+  if (m.try_lock()) return true;
+  //a release from here on sees the flag; one just before it lets us in now
+  skipped = true;
+  return m.try_lock();
+}
+
+void MinimizationQuery::io_lock::unlock() {
+  m.unlock();
+  if (skipped.exchange(false)) pool.released();
+}
+
+//minimize a chunk of ligands and store the results
+MinimizationQuery::ChunkStatus MinimizationQuery::minimizeChunk() {
+  vector<LigandData> ligands;
+  boost::function<void()> resume;
+  {
+    //skip the query rather than wait while another thread holds it
+    boost::unique_lock<io_lock> L(io_mutex, boost::try_to_lock);
+    if (!L.owns_lock()) return Busy;
+    while (ligands.size() < chunk_size && !ready.empty()) {
+      ligands.push_back(ready.front());
+      ready.pop_front();
+    }
+    if (ligands.empty()) {
+      finishIfDone();
+      return readAllData ? Done : Starved;
+    }
+    activeWorkers++;
+    if (paused && ready.size() <= maxReadyChunks * chunk_size / 2) {
+      paused = false;
+      resume = resumeInput;
+    }
+  }
+  if (resume) resume();
+
+  try {
+    vector<Result*> results;
+    for (unsigned i = 0, n = ligands.size(); i < n; i++) {
+      //construct model
+      LigandData& l = ligands[i];
+      model m = receptor->initm;
+
+      if (hasReorient) l.reorient.reorient(l.p);
+
+      non_rigid_parsed nr;
+      pdbqt_initializer tmp;
+
+      if (isFrag) {
+        //treat as residue
+        postprocess_residue(nr, l.p, l.c);
+      } else {
+        postprocess_ligand(nr, l.p, l.c, l.numtors);
+      }
+
+      tmp.initialize_from_nrp(nr, l.c, !isFrag);
+      tmp.initialize(nr.mobility_matrix());
+      m.set_name(l.c.sdftext.name);
 
+      m.append(tmp.m);
+
+      Result *result = minimize(m);
+      if (result != NULL) {
+        result->orig_position = l.origpos;
+        results.push_back(result);
+      }
     }
+
+    addResults(results);
   } catch (...) //don't die
   {
-    q->cancel();
+    cancel();
   }
+
+  boost::lock_guard<io_lock> L(io_mutex);
+  activeWorkers--;
+  finishIfDone();
+  return readAllData && ready.empty() ? Done : Minimized;
 }
 
 //output the mol at position pos
@@ -276,95 +377,110 @@ void MinimizationQuery::outputMol(unsigned pos, ostream& out) {
   }
 }
 
-//comparison object for results
-class MinimizationQuery::ResultsSorter {
-    const MinimizationFilters& filter;
-
-  public:
-    ResultsSorter(const MinimizationFilters& f)
-        : filter(f) {
-    }
-
-    bool operator()(const Result* lhs, const Result* rhs) const {
-      bool res = false;
-      switch (filter.sort) {
-      case MinimizationFilters::Score:
-        res = lhs->score < rhs->score;
-        break;
-      case MinimizationFilters::RMSD:
-        res = lhs->rmsd < rhs->rmsd;
-        break;
-      case MinimizationFilters::OrigPos:
-        res = lhs->orig_position < rhs->orig_position;
-        break;
-      }
-
-      if (filter.reverseSort) res = !res;
-      return res;
-    }
+bool MinimizationQuery::ResultLess::operator()(const Result* lhs,
+    const Result* rhs) const {
+  switch (sort) {
+  case MinimizationFilters::RMSD:
+    if (lhs->rmsd != rhs->rmsd) return lhs->rmsd < rhs->rmsd;
+    break;
+  case MinimizationFilters::OrigPos:
+    if (lhs->orig_position != rhs->orig_position)
+      return lhs->orig_position < rhs->orig_position;
+    break;
+  default:
+    if (lhs->score != rhs->score) return lhs->score < rhs->score;
+    break;
+  }
+  return lhs->position < rhs->position;
+}
 
-};
-//copies allResults (safely) into results which is then sorted and filter according
-//to filter; returns the total number of results _before_filtering
-//does not truncate results by start/num of filter
-unsigned MinimizationQuery::loadResults(const MinimizationFilters& filter,
-    vector<Result*>& results) {
-  results_mutex.lock_shared();
-  results = allResults;
-  results_mutex.unlock_shared();
+const MinimizationQuery::ResultIndex& MinimizationQuery::sortedBy(
+    MinimizationFilters::SortType sort) const {
+  switch (sort) {
+  case MinimizationFilters::RMSD:
+    return byRMSD;
+  case MinimizationFilters::OrigPos:
+    return byOrigPos;
+  default:
+    return byScore;
+  }
+}
 
-  //filter
-  unsigned total = results.size();
-  unsigned i = 0;
-  while (i < results.size()) {
+//add computed results and index them
+void MinimizationQuery::addResults(const vector<Result*>& results) {
+  boost::lock_guard<shared_mutex> lock(results_mutex);
+  for (unsigned i = 0, n = results.size(); i < n; i++) {
     Result *res = results[i];
-    if (res->rmsd > filter.maxRMSD || res->score > filter.maxScore) {
-      //needs to be removed
-      swap(results[i], results.back());
-      results.pop_back();
-      //do NOT increment i, it's a new one
-    } else {
-      i++; //go to next
-    }
+    res->position = allResults.size();
+    allResults.push_back(res);
+    byScore.insert(res);
+    byRMSD.insert(res);
+    byOrigPos.insert(res);
+    worstScore = max(worstScore, res->score);
+    worstRMSD = max(worstRMSD, res->rmsd);
   }
+}
 
-  //now sort
-  ResultsSorter sorter(filter);
-  sort(results.begin(), results.end(), sorter);
-
-  //uniquification, take best after sort
-  if (filter.unique) {
-    unordered_set<string> seen;
-    vector<Result*> tmpres;
-    tmpres.reserve(results.size());
-
-    for (unsigned i = 0, n = results.size(); i < n; i++) {
-      Result *res = results[i];
-      if (seen.count(res->name) == 0) //first time we've seen it
-          {
-        tmpres.push_back(res);
-        seen.insert(res->name);
-      }
-    }
-    swap(results, tmpres);
+//the view is read from the index of the sort key, which is already
+//filtered by the key's own bound; only if the other bound removes something
+//or names must be unique is the view walked to apply them
+unsigned MinimizationQuery::selectResults(const MinimizationFilters& filter,
+    vector<Result*>& results, unsigned& total) {
+  results.clear();
+  boost::shared_lock<shared_mutex> lock(results_mutex);
+  total = allResults.size();
+
+  const ResultIndex& index = sortedBy(filter.sort);
+  unsigned n = index.size();
+  bool filterScore = filter.maxScore < worstScore;
+  bool filterRMSD = filter.maxRMSD < worstRMSD;
+  if (filter.sort == MinimizationFilters::Score && filterScore) {
+    n = index.partition_rank(
+        [&](const Result* r) {return r->score <= filter.maxScore;});
+    filterScore = false;
+  } else if (filter.sort == MinimizationFilters::RMSD && filterRMSD) {
+    n = index.partition_rank(
+        [&](const Result* r) {return r->rmsd <= filter.maxRMSD;});
+    filterRMSD = false;
+  }
 
+  unsigned start = filter.start;
+  unsigned end = filter.num == 0 || filter.num > UINT_MAX - start ?
+      UINT_MAX : start + filter.num;
+  if (!filterScore && !filterRMSD && !filter.unique) {
+    index.page(n, start, end, filter.reverseSort, results);
+    return n;
   }
-  return total;
+
+  vector<Result*> view;
+  view.reserve(n);
+  index.range(0, n, view);
+  if (filter.reverseSort) reverse(view.begin(), view.end());
+
+  //uniquification, take best in the order
+  unordered_set<string> seen;
+  unsigned count = 0;
+  for (unsigned i = 0; i < n; i++) {
+    Result *res = view[i];
+    if (res->rmsd > filter.maxRMSD || res->score > filter.maxScore) continue;
+    if (filter.unique && !seen.insert(res->name).second) continue;
+    if (count >= start && count < end) results.push_back(res);
+    count++;
+  }
+  return count;
 }
 
 //output text formated data
 void MinimizationQuery::outputData(const MinimizationFilters& f, ostream& out) {
-  checkThread();
+  bool done = finished(); //checked first, so if done all results are in
   vector<Result*> results;
-  unsigned total = loadResults(f, results);
+  unsigned total = 0;
+  unsigned filtered = selectResults(f, results, total);
 
   //first line is status header with doneness and number done and filtered number
-  out << finished() << " " << total << " " << results.size() << " " << minTime
-      << "\n";
+  out << done << " " << total << " " << filtered << " " << minTime << "\n";
 
-  unsigned end = f.start + f.num;
-  if (end > results.size() || f.num == 0) end = results.size();
-  for (unsigned i = f.start; i < end; i++) {
+  for (unsigned i = 0, n = results.size(); i < n; i++) {
     Result *res = results[i];
     out << res->position << "," << res->orig_position << "," << res->name << ","
         << res->score << "," << res->rmsd << "\n";
@@ -374,35 +490,57 @@ void MinimizationQuery::outputData(const MinimizationFilters& f, ostream& out) {
 //output json formated data, based off of datatables, does not include opening/closing brackets
 void MinimizationQuery::outputJSONData(const MinimizationFilters& f, int draw,
     ostream& out) {
-  checkThread();
+  bool done = finished();
   vector<Result*> results;
-  unsigned total = loadResults(f, results);
+  unsigned total = 0;
+  unsigned filtered = selectResults(f, results, total);
 
   //first line is status header with doneness and number done and filtered number
   out << "{\n";
-  out << "\"finished\": " << finished() << ",\n";
+  out << "\"finished\": " << done << ",\n";
   out << "\"recordsTotal\": " << total << ",\n";
-  out << "\"recordsFiltered\": " << results.size() << ",\n";
+  out << "\"recordsFiltered\": " << filtered << ",\n";
   out << "\"time\": " << minTime << ",\n";
   out << "\"draw\": " << draw << ",\n";
   out << "\"data\": [\n";
 
-  unsigned end = f.start + f.num;
-  if (end > results.size() || f.num == 0) end = results.size();
-  for (unsigned i = f.start; i < end; i++) {
+  for (unsigned i = 0, n = results.size(); i < n; i++) {
     Result *res = results[i];
     out << "[" << res->position << "," << res->orig_position << ",\""
         << res->name << "\"," << res->score << "," << res->rmsd << "]";
-    if (i != end - 1) out << ",";
+    if (i != n - 1) out << ",";
     out << "\n";
   }
   out << "]}\n";
 }
 
+//output the results after cursor in the order they were minimized
+void MinimizationQuery::outputNewData(unsigned cursor, ostream& out) {
+  bool done = finished();
+  vector<Result*> results;
+  results_mutex.lock_shared();
+  if (cursor < allResults.size())
+    results.assign(allResults.begin() + cursor, allResults.end());
+  unsigned next = allResults.size();
+  results_mutex.unlock_shared();
+
+  //first line is status header with doneness, the next cursor and time
+  out << done << " " << next << " " << minTime << "\n";
+  for (unsigned i = 0, n = results.size(); i < n; i++) {
+    Result *res = results[i];
+    out << res->position << "," << res->orig_position << "," << res->name << ","
+        << res->score << "," << res->rmsd << "\n";
+  }
+}
+
 //write out all results in sdf.gz format
 void MinimizationQuery::outputMols(const MinimizationFilters& f, ostream& out) {
+  MinimizationFilters all = f; //start/num don't apply
+  all.start = 0;
+  all.num = 0;
   vector<Result*> results;
-  loadResults(f, results);
+  unsigned total = 0;
+  selectResults(all, results, total);
 
   //gzip output
   boost::iostreams::filtering_stream<boost::iostreams::output> strm;
@@ -9,6 +9,11 @@
 #define MINIMIZATIONQUERY_H_
 
 #include <vector>
+#include <deque>
+#include <atomic>
+#include <zlib.h>
+#include <boost/function.hpp>
+#include <boost/enable_shared_from_this.hpp>
 
 #include "Reorienter.h"
 #include "server_common.h"
@@ -19,6 +24,11 @@
 #include "weighted_terms.h"
 #include "precalculate.h"
 #include "naive_non_cache.h"
+#include "ReceptorCache.h"
+#include "OrderedIndex.h"
+#include <boost/timer/timer.hpp>
+
+class MinimizationPool;
 
 //store various things that only have to be initialized once for any minimization
 struct MinimizationParameters {
@@ -27,8 +37,6 @@ struct MinimizationParameters {
     weighted_terms *wt;
     precalculate *prec;
     precalculate_exact *exact_prec;
-    naive_non_cache *nnc; //for scoring
-    unsigned nthreads;
 
     MinimizationParameters();
     ~MinimizationParameters();
@@ -77,10 +85,11 @@ struct MinimizationFilters {
     }
 };
 
-class MinimizationQuery {
+class MinimizationQuery : public boost::enable_shared_from_this<
+    MinimizationQuery> {
 
   private:
-    class ResultsSorter;
+    struct ResultLess;
 
     const MinimizationParameters& minparm;
     bool isFinished;
@@ -89,17 +98,42 @@ class MinimizationQuery {
     time_t lastAccessed; //last time accessed
 
     unsigned chunk_size; //how many ligands to process at a time, performance seems relatively insensitive to this
-    bool readAllData; //try after we have consumed all the ligands
+    bool readAllData; //true once no more ligand data will arrive
     bool hasReorient; //try if ligand data is prefaced by rotation/translation
     bool isFrag; //treat as residue
     unsigned numProteinAtoms; //if nonzero, indicates how many atoms in the receptor belong to the protein as opposed to the "unfrag" - it is assumed these atoms come first
-    model initm;
-
-    stream_ptr io;
-    boost::iostreams::filtering_stream<boost::iostreams::input> io_strm; //uncompressed
-
-    unsigned io_position; //guarded by io_mutex as well
-    boost::mutex io_mutex; //protects io
+    ReceptorPtr receptor; //shared with other queries on the same target
+    naive_non_cache nnc; //for scoring, against the receptor's index
+
+    MinimizationPool& pool;
+
+    //ligand data is pushed by the connection as it arrives and decoded
+    //without ever waiting on the client; the decoding state is guarded by
+    //input_mutex so that workers only wait on io_mutex, which guards the
+    //flags and ready queue below, for as long as it takes to hand off the
+    //decoded ligands; input_mutex is always taken before io_mutex
+    z_stream inflater; //data is gzipped
+    string decoded; //uncompressed bytes not yet making up a whole ligand
+    unsigned io_position;
+    boost::mutex input_mutex;
+
+    //a mutex that tells the pool when it is released after a worker failed
+    //to take it, so workers that skipped the query can sleep until then
+    class io_lock {
+        boost::mutex m;
+        std::atomic<bool> skipped;
+        MinimizationPool& pool;
+      public:
+        io_lock(MinimizationPool& p)
+            : skipped(false), pool(p) {
+        }
+        void lock() {
+          m.lock();
+        }
+        bool try_lock();
+        void unlock();
+    };
+    io_lock io_mutex;
 
     //holds the result of minimization
     struct Result {
@@ -119,14 +153,20 @@ class MinimizationQuery {
 
     vector<Result*> allResults; //order doesn't change, minimizers add to this
 
-    boost::shared_mutex results_mutex; //protects allResults
-
-    boost::thread *minimizationSpawner; //manages thread_group of minimization threads
-
-    static void thread_startMinimization(MinimizationQuery* q);
-    static void thread_minimize(MinimizationQuery* q);
+    //allResults in each sort order, ties broken by position
+    struct ResultLess {
+        MinimizationFilters::SortType sort;
+        ResultLess(MinimizationFilters::SortType s = MinimizationFilters::Score)
+            : sort(s) {
+        }
+        bool operator()(const Result* lhs, const Result* rhs) const;
+    };
+    typedef OrderedIndex<Result, ResultLess> ResultIndex;
+    ResultIndex byScore, byRMSD, byOrigPos;
+    //largest in allResults, so a filter that removes nothing can be skipped
+    double worstScore, worstRMSD;
 
-    void checkThread();
+    boost::shared_mutex results_mutex; //protects all of the results
 
     //this is what is read from the user
     struct LigandData {
@@ -137,33 +177,55 @@ class MinimizationQuery {
         unsigned origpos;
     };
 
-    //reads into ligands
-    //returns false iff there is no more data to read
-    bool thread_safe_read(vector<LigandData>& ligands);
-
-    unsigned loadResults(const MinimizationFilters& filter,
-        vector<Result*>& results);
+    deque<LigandData> ready; //decoded and waiting for a worker
+    bool paused; //the connection stopped reading until ready drains
+    unsigned activeWorkers; //pool workers currently on a chunk
+    boost::function<void()> resumeInput; //ask the connection for more data
+    boost::function<void()> finishOutput; //tell the connection we're done
+
+    boost::timer::cpu_timer mintime;
+
+    //decode one ligand from decoded starting at used, advancing used;
+    //false if the data for a whole ligand hasn't arrived yet
+    bool decodeLigand(size_t& used, LigandData& data);
+    //set isFinished if nothing more will be minimized, io_mutex must be held
+    void finishIfDone();
+
+    const ResultIndex& sortedBy(MinimizationFilters::SortType sort) const;
+    void addResults(const vector<Result*>& results);
+    //fill results with the page of filter's view of the results and return
+    //the size of the whole view; total is set to the number before filtering
+    unsigned selectResults(const MinimizationFilters& filter,
+        vector<Result*>& results, unsigned& total);
   public:
 
-    MinimizationQuery(const MinimizationParameters& minp, const string& recstr,
-        stream_ptr data, bool hasR, bool isF, unsigned numR, unsigned chunks =
-            10)
-        : minparm(minp), isFinished(false), minTime(0), stopQuery(false),
-            lastAccessed(time(NULL)), chunk_size(chunks), readAllData(false),
-            hasReorient(hasR), isFrag(isF), numProteinAtoms(numR), io(data),
-            io_position(0), minimizationSpawner(NULL) {
-      //create the initial model
-      stringstream rec(recstr);
-      initm = parse_receptor_pdbqt("rigid.pdbqt", rec);
-
-      //set up ligand decompression stream
-      io_strm.push(boost::iostreams::gzip_decompressor());
-      io_strm.push(*io);
-    }
+    MinimizationQuery(const MinimizationParameters& minp,
+        MinimizationPool& p, ReceptorPtr rec, bool hasR, bool isF,
+        unsigned numR, unsigned chunks = 10);
 
     ~MinimizationQuery();
 
-    void execute(bool block = false);
+    //start timing; resume is called (from any thread) when addData has
+    //returned false and the query is ready for more, finish once all the
+    //ligands are minimized
+    void execute(const boost::function<void()>& resume,
+        const boost::function<void()>& finish);
+
+    //add gzipped ligand data as it arrives and schedule the ligands it
+    //completes; returns false if no more should be sent until resume
+    bool addData(const char* data, size_t n);
+    //the client won't send anything more
+    void endInput();
+
+    enum ChunkStatus {
+      Minimized, //did a chunk, there may be more
+      Starved, //nothing to do until more data arrives
+      Busy, //another thread holds the query, try the next one
+      Done //all ligands are taken
+    };
+    //minimize the next chunk of decoded ligands on the calling pool worker;
+    //never waits for another thread to finish with the query's input
+    ChunkStatus minimizeChunk();
 
     //all of the result/output functions can be called while an asynchronous
     //query is running
@@ -171,6 +233,9 @@ class MinimizationQuery {
     //return all current results summarized
     void outputData(const MinimizationFilters& dp, ostream& out);
     void outputJSONData(const MinimizationFilters& dp, int draw, ostream& out);
+    //return the results minimized since cursor, which is the count of
+    //results returned by the previous call; the header has the next cursor
+    void outputNewData(unsigned cursor, ostream& out);
 
     //write out all results in sdf.gz format
     void outputMols(const MinimizationFilters& dp, ostream& out);
@@ -178,9 +243,7 @@ class MinimizationQuery {
     void outputMol(unsigned pos, ostream& out);
 
     //attempt to cancel,
-    void cancel() {
-      stopQuery = true;
-    }
+    void cancel();
     bool finished(); //done minimizing
     bool cancelled() {
       return stopQuery;
@@ -195,4 +258,6 @@ class MinimizationQuery {
 
 };
 
+typedef boost::shared_ptr<MinimizationQuery> QueryPtr;
+
 #endif /* MINIMIZATIONQUERY_H_ */
@@ -0,0 +1,106 @@
+/*
+ * OrderedIndex.h
+ *
+ *  An order statistics index over pointers, kept sorted as they are added.
+ *  Entries are stored in sorted blocks of bounded size, so an insert only
+ *  moves entries within one block, and finding the entry at a rank only
+ *  walks the block sizes.  Pages of a sorted view can then be read without
+ *  copying or sorting everything.
+ */
+
+#ifndef ORDEREDINDEX_H_
+#define ORDEREDINDEX_H_
+
+#include <vector>
+#include <algorithm>
+
+template<class T, class Less>
+class OrderedIndex {
+    static const unsigned BlockSize = 512; //blocks split at twice this
+
+    std::vector<std::vector<T*> > blocks; //none are empty
+    unsigned count;
+    Less less;
+
+  public:
+    OrderedIndex(const Less& l = Less())
+        : count(0), less(l) {
+    }
+
+    unsigned size() const {
+      return count;
+    }
+
+    void insert(T* x) {
+      if (blocks.empty()) blocks.push_back(std::vector<T*>());
+
+      //first block that ends with something not less than x, else the last
+      unsigned lo = 0, hi = blocks.size() - 1;
+      while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (less(blocks[mid].back(), x))
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      std::vector<T*>& blk = blocks[lo];
+      blk.insert(std::upper_bound(blk.begin(), blk.end(), x, less), x);
+      count++;
+
+      if (blk.size() >= 2 * BlockSize) {
+        std::vector<T*> upper(blk.begin() + BlockSize, blk.end());
+        blk.resize(BlockSize);
+        blocks.insert(blocks.begin() + lo + 1, upper);
+      }
+    }
+
+    //the number of leading entries for which pred is true; pred must be
+    //true for a prefix of the order and false after it
+    template<class Pred>
+    unsigned partition_rank(Pred pred) const {
+      unsigned rank = 0;
+      for (unsigned b = 0, nb = blocks.size(); b < nb; b++) {
+        const std::vector<T*>& blk = blocks[b];
+        if (!pred(blk.back()))
+          return rank
+              + (std::partition_point(blk.begin(), blk.end(), pred)
+                  - blk.begin());
+        rank += blk.size();
+      }
+      return rank;
+    }
+
+    //append the entries with ranks [first,last) to out in order
+    void range(unsigned first, unsigned last, std::vector<T*>& out) const {
+      unsigned rank = 0;
+      for (unsigned b = 0, nb = blocks.size(); b < nb && rank < last; b++) {
+        const std::vector<T*>& blk = blocks[b];
+        unsigned n = blk.size();
+        if (rank + n > first) {
+          unsigned from = first > rank ? first - rank : 0;
+          unsigned to = std::min(n, last - rank);
+          out.insert(out.end(), blk.begin() + from, blk.begin() + to);
+        }
+        rank += n;
+      }
+    }
+
+    //append entries [first,last) of the view of the n leading entries,
+    //in order or, if reversed, with the view read from its end; the page
+    //is clipped to the view
+    void page(unsigned n, unsigned first, unsigned last, bool reversed,
+        std::vector<T*>& out) const {
+      n = std::min(n, count);
+      first = std::min(first, n);
+      last = std::min(std::max(last, first), n);
+      if (reversed) {
+        unsigned from = out.size();
+        range(n - last, n - first, out);
+        std::reverse(out.begin() + from, out.end());
+      } else {
+        range(first, last, out);
+      }
+    }
+};
+
+#endif /* ORDEREDINDEX_H_ */
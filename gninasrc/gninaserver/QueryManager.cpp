@@ -9,14 +9,12 @@
 #include "Reorienter.h"
 #include "MinimizationQuery.h"
 #include <boost/algorithm/string.hpp>
-#include <openbabel/obconversion.h>
-#include <openbabel/mol.h>
 
 using namespace boost;
-using namespace OpenBabel;
 
 //add a query, return zero if unsuccessful
-unsigned QueryManager::add(unsigned oldqid, stream_ptr io) {
+unsigned QueryManager::add(unsigned oldqid, istream& in, ostream& out,
+    QueryPtr& q) {
   mu.lock();
   //explicitly remove old query
   if (oldqid > 0 && queries.count(oldqid) > 0) {
@@ -29,20 +27,20 @@ unsigned QueryManager::add(unsigned oldqid, stream_ptr io) {
 
   //read receptor info and rotation/translation info, but leave ligand for minimizer to stream
   string recline;
-  getline(*io, recline);
+  getline(in, recline);
   stringstream recstrm(recline);
   string str;
   recstrm >> str;
   if (str != "receptor") {
     cerr << "No receptor\n";
-    *io << "ERROR\nNo receptor\n";
+    out << "ERROR\nNo receptor\n";
     return 0;
   }
   unsigned rsize = 0; //size of receptor string, must be in pdbqt
   recstrm >> rsize;
   if (rsize == 0) {
     cerr << "invalid receptor size\n";
-    *io << "ERROR\nInvalid receptor size\n";
+    out << "ERROR\nInvalid receptor size\n";
     return 0;
   }
 
@@ -50,30 +48,10 @@ unsigned QueryManager::add(unsigned oldqid, stream_ptr io) {
   recstrm >> ispdbqt;
 
   string recstr(rsize, '\0'); //note that c++ strings are built with null at the end
-  io->read(&recstr[0], rsize);
-
-  if (!ispdbqt) {
-    //have to convert from vanilla pdb to get pdbqt w/correct atom types and
-    //partial charges
-    OBConversion conv;
-    conv.SetInFormat("PDB");
-    conv.SetOutFormat("PDBQT");
-    conv.AddOption("r", OBConversion::OUTOPTIONS); //rigid molecule, otherwise really slow and useless analysis is triggered
-    conv.AddOption("c", OBConversion::OUTOPTIONS); //single combined molecule
-
-    OBMol rec;
-    if (conv.ReadString(&rec, recstr)) {
-      rec.AddHydrogens(true);
-      //force partial charge calculation
-      FOR_ATOMS_OF_MOL(a, rec){
-      a->GetPartialCharge();
-    }
-      recstr = conv.WriteString(&rec);
-    }
-  }
+  in.read(&recstr[0], rsize);
 
   //next line is used for parameters
-  getline(*io, str);
+  getline(in, str);
   stringstream params(str);
 
   //does the ligand data have to be reoriented?
@@ -88,14 +66,14 @@ unsigned QueryManager::add(unsigned oldqid, stream_ptr io) {
   params >> numunfrag;
 
   //attempt to create query
-  QueryPtr q;
   try {
+    ReceptorPtr rec = receptors.get(recstr, ispdbqt);
     q = QueryPtr(
-        new MinimizationQuery(minparm, recstr, io, hasR, isFrag, numrec));
+        new MinimizationQuery(minparm, pool, rec, hasR, isFrag, numrec));
   } catch (parse_error& pe) //couldn't read receptor
   {
     cerr << "couldn't read receptor\n";
-    *io << "ERROR\n" << pe.reason << "\n";
+    out << "ERROR\n" << pe.reason << "\n";
     return 0;
   } catch (...) { //output below
   }
@@ -107,12 +85,10 @@ unsigned QueryManager::add(unsigned oldqid, stream_ptr io) {
     queries[id] = q;
     mu.unlock();
 
-    q->execute(); //don't wait for result
-
-    return id;
+    return id; //the caller starts it once it can feed it data
   } else //error,
   {
-    *io << "ERROR\nCould not construct minimization query\n";
+    out << "ERROR\nCould not construct minimization query\n";
     return 0;
   }
 }
@@ -14,12 +14,12 @@
 #include <boost/unordered_map.hpp>
 #include <boost/shared_ptr.hpp>
 #include "MinimizationQuery.h"
+#include "MinimizationPool.h"
+#include "ReceptorCache.h"
 
 using namespace boost;
 using namespace std;
 
-typedef boost::shared_ptr<MinimizationQuery> QueryPtr;
-
 //an instance of this classes manages all the extant minimization queries
 //each query is assigned a unique id for later reference
 class QueryManager {
@@ -34,17 +34,19 @@ class QueryManager {
     unsigned timeout; //seconds until purgeable
 
     MinimizationParameters minparm;
+    ReceptorCache receptors;
+    MinimizationPool pool; //last, so workers stop before anything they use goes
   public:
 
-    QueryManager(unsigned numt, unsigned tout = 60 * 30)
-        : nextID(1), timeout(tout) {
-      minparm.nthreads = numt;
+    QueryManager(unsigned numt, unsigned ncached, unsigned tout = 60 * 30)
+        : nextID(1), timeout(tout), receptors(ncached), pool(numt) {
     }
 
-    //add a query
-    //first parse the text and return 0 if invalid
+    //add a query from the header of a startmin request, which is read from
+    //in, leaving the ligand data to be passed to q as it arrives
+    //first parse the text and return 0 if invalid, with errors written to out
     //if oldqid is set, then deallocate/reuse it
-    unsigned add(unsigned oldqid, stream_ptr io);
+    unsigned add(unsigned oldqid, istream& in, ostream& out, QueryPtr& q);
 
     QueryPtr get(unsigned qid);
 
@@ -0,0 +1,85 @@
+/*
+ * ReceptorCache.cpp
+ */
+
+#include <sstream>
+#include <boost/functional/hash.hpp>
+#include <openbabel/obconversion.h>
+#include <openbabel/mol.h>
+#include "ReceptorCache.h"
+#include "parse_pdbqt.h"
+
+using namespace OpenBabel;
+
+ReceptorPtr ReceptorCache::parse(const std::string& text, bool ispdbqt) {
+  boost::shared_ptr<Receptor> rec(new Receptor());
+  rec->text = text;
+  rec->ispdbqt = ispdbqt;
+
+  std::string pdbqt = text;
+  if (!ispdbqt) {
+    //have to convert from vanilla pdb to get pdbqt w/correct atom types and
+    //partial charges
+    OBConversion conv;
+    conv.SetInFormat("PDB");
+    conv.SetOutFormat("PDBQT");
+    conv.AddOption("r", OBConversion::OUTOPTIONS); //rigid molecule, otherwise really slow and useless analysis is triggered
+    conv.AddOption("c", OBConversion::OUTOPTIONS); //single combined molecule
+
+    OBMol mol;
+    if (conv.ReadString(&mol, text)) {
+      mol.AddHydrogens(true);
+      //force partial charge calculation
+      FOR_ATOMS_OF_MOL(a, mol){
+      a->GetPartialCharge();
+    }
+      pdbqt = conv.WriteString(&mol);
+    }
+  }
+
+  std::stringstream str(pdbqt);
+  rec->initm = parse_receptor_pdbqt("rigid.pdbqt", str);
+  rec->index = boost::shared_ptr<receptor_index>(
+      new receptor_index(rec->initm.grid_atoms));
+  return rec;
+}
+
+//move the entry for text to the front and return it, or null if there is
+//none; mu must be held
+ReceptorPtr ReceptorCache::find(std::size_t hash, const std::string& text,
+    bool ispdbqt) {
+  for (std::list<Entry>::iterator itr = entries.begin(), end = entries.end();
+      itr != end; itr++) {
+    if (itr->hash == hash && itr->rec->ispdbqt == ispdbqt
+        && itr->rec->text == text) {
+      entries.splice(entries.begin(), entries, itr);
+      return itr->rec;
+    }
+  }
+  return ReceptorPtr();
+}
+
+ReceptorPtr ReceptorCache::get(const std::string& text, bool ispdbqt) {
+  std::size_t h = boost::hash<std::string>()(text);
+  {
+    boost::lock_guard<boost::mutex> L(mu);
+    ReceptorPtr rec = find(h, text, ispdbqt);
+    if (rec) return rec;
+  }
+
+  //parse without holding the lock so other receptors can be fetched; if two
+  //queries race on the same new receptor both parse it and one copy is kept
+  ReceptorPtr rec = parse(text, ispdbqt);
+  if (capacity == 0) return rec;
+
+  boost::lock_guard<boost::mutex> L(mu);
+  ReceptorPtr cached = find(h, text, ispdbqt);
+  if (cached) return cached;
+  Entry e;
+  e.hash = h;
+  e.rec = rec;
+  entries.push_front(e);
+  while (entries.size() > capacity)
+    entries.pop_back(); //queries still using it keep their own reference
+  return rec;
+}
@@ -0,0 +1,52 @@
+/*
+ * ReceptorCache.h
+ *
+ *  A least recently used cache of parsed receptors, keyed by the text the
+ *  client sent, so that queries against the same target share one model
+ *  and one neighbor index instead of each parsing their own.
+ */
+
+#ifndef RECEPTORCACHE_H_
+#define RECEPTORCACHE_H_
+
+#include <list>
+#include <string>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include "model.h"
+#include "receptor_index.h"
+
+//a parsed receptor; never modified once built, so queries read it without
+//locking
+struct Receptor {
+    std::string text; //as sent by the client, before any conversion
+    bool ispdbqt;
+    model initm;
+    boost::shared_ptr<receptor_index> index; //of initm's fixed atoms
+};
+
+typedef boost::shared_ptr<const Receptor> ReceptorPtr;
+
+class ReceptorCache {
+    struct Entry {
+        std::size_t hash;
+        ReceptorPtr rec;
+    };
+
+    boost::mutex mu; //protects entries
+    std::list<Entry> entries; //most recently used first
+    unsigned capacity;
+
+    static ReceptorPtr parse(const std::string& text, bool ispdbqt);
+    ReceptorPtr find(std::size_t hash, const std::string& text, bool ispdbqt);
+  public:
+    ReceptorCache(unsigned cap)
+        : capacity(cap) {
+    }
+
+    //return the parsed receptor for text, parsing it if it is not cached;
+    //throws parse_error if the receptor can't be read
+    ReceptorPtr get(const std::string& text, bool ispdbqt);
+};
+
+#endif /* RECEPTORCACHE_H_ */
@@ -11,6 +11,7 @@
 #include "Logger.h"
 #include "QueryManager.h"
 #include "servercmds.h"
+#include "Connection.h"
 
 using namespace std;
 using namespace boost;
@@ -23,35 +24,28 @@ cl::opt<unsigned> maxConcurrent("max-concurrent-requests",
         "block further incoming requests after this amount of concurrency"),
     cl::init(16));
 cl::opt<unsigned> minimizationThreads("threads",
-    cl::desc("number of threads to use for minimization"),
+    cl::desc("number of threads shared by all minimization queries"),
     cl::init(max(1U, thread::hardware_concurrency() / 2)));
+cl::opt<unsigned> commandThreads("command-threads",
+    cl::desc("number of threads running requests off the network thread"),
+    cl::init(4));
+cl::opt<unsigned> readTimeout("read-timeout",
+    cl::desc("seconds a client may go without sending before it is dropped"),
+    cl::init(60));
+cl::opt<unsigned> receptorCache("receptor-cache",
+    cl::desc("number of parsed receptors kept for reuse by later queries"),
+    cl::init(8));
 cl::opt<string> logfile("logfile", cl::desc("file for logging information"));
 
-typedef unordered_map<string, boost::shared_ptr<Command> > cmd_map;
-
-static void process_request(stream_ptr s, cmd_map& cmap) {
-  string cmd;
-  //first line is command
-  getline(*s, cmd);
-  trim(cmd);
-
-  try {
-    if (cmap.count(cmd) > 0) {
-      cmap[cmd]->execute(s);
-    } else {
-      *s << "ERROR\nInvalid command: " << cmd << "\n";
-    }
-  } catch (std::exception& e) {
-    *s << "ERROR\nException " << e.what() << "\n";
-  }
-}
-
 //periodically check for expired queries
-static void thread_purge_old_queries(QueryManager *qmgr) {
-  while (true) {
-    this_thread::sleep(posix_time::time_duration(0, 3, 0, 0));
-    unsigned npurged = qmgr->purgeOldQueries();
-  }
+static void purge_old_queries(QueryManager *qmgr,
+    boost::asio::deadline_timer *timer, const boost::system::error_code& err) {
+  if (err) return;
+  qmgr->purgeOldQueries();
+  timer->expires_from_now(posix_time::time_duration(0, 3, 0, 0));
+  timer->async_wait(
+      boost::bind(purge_old_queries, qmgr, timer,
+          boost::asio::placeholders::error));
 }
 
 int main(int argc, char *argv[]) {
@@ -59,31 +53,32 @@ int main(int argc, char *argv[]) {
 
   //setup log
   Logger log(logfile);
-  QueryManager queries(minimizationThreads); //initialize query manager
+  QueryManager queries(minimizationThreads, receptorCache); //initialize query manager
 
   //command map
   cmd_map commands = assign::map_list_of("startmin",
       boost::shared_ptr<Command>(new StartMinimization(queries, log)))("cancel",
       boost::shared_ptr<Command>(new CancelMinimization(queries, log)))(
       "getscores", boost::shared_ptr<Command>(new GetScores(queries, log)))(
+      "getnewscores",
+      boost::shared_ptr<Command>(new GetNewScores(queries, log)))(
       "getjsonscores",
       boost::shared_ptr<Command>(new GetJSONScores(queries, log)))("getmol",
       boost::shared_ptr<Command>(new GetMol(queries, log)))("getmols",
       boost::shared_ptr<Command>(new GetMols(queries, log)))("getstatus",
       boost::shared_ptr<Command>(new GetStatus(queries, log)));
 
-  //start listening
+  //the network is handled on this thread, requests on the command threads
   io_service io_service;
-  tcp::acceptor a(io_service, tcp::endpoint(tcp::v4(), port));
+  boost::asio::thread_pool commandPool(max(1U, (unsigned) commandThreads));
+  Listener listener(io_service, commandPool, port, commands, log,
+      maxConcurrent, readTimeout);
 
   cout << "Listening on port " << port << "\n";
 
-  //start up cleanup thread
-  thread cleanup(thread_purge_old_queries, &queries);
-  while (true) {
-    stream_ptr s = stream_ptr(new tcp::iostream());
-    a.accept(*s->rdbuf());
-    thread t(bind(process_request, s, commands));
-  }
+  //start up cleanup
+  boost::asio::deadline_timer purge(io_service);
+  purge_old_queries(&queries, &purge, boost::system::error_code());
 
+  io_service.run();
 }
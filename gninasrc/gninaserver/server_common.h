@@ -23,6 +23,4 @@
 #include <fstream>
 using namespace std;
 
-typedef boost::shared_ptr<boost::asio::ip::tcp::iostream> stream_ptr;
-
 #endif /* SERVER_COMMON_H_ */
@@ -14,20 +14,45 @@
 #include "QueryManager.h"
 #include "server_common.h"
 #include <fstream>
+#include <sstream>
+#include <cctype>
 
+//commands are only run once their whole request has arrived, so they can
+//read it with ordinary stream operations without ever waiting on a client
 class Command {
   protected:
 
     Logger& log;
+    unsigned nargs; //whitespace separated arguments after the command line
 
   public:
-    Command(Logger& l)
-        : log(l) {
+    Command(Logger& l, unsigned n = 0)
+        : log(l), nargs(n) {
     }
     virtual ~Command() {
     }
 
-    virtual void execute(stream_ptr io) = 0;
+    //true once args, everything received after the command line, holds all
+    //that execute will read; eof is set if the client won't send any more
+    virtual bool ready(const string& args, bool eof) const {
+      if (eof) return true;
+      //only an argument followed by whitespace is known to be complete
+      unsigned n = 0;
+      bool intoken = false;
+      for (unsigned i = 0, len = args.size(); i < len; i++) {
+        if (isspace(args[i])) {
+          if (intoken) n++;
+          intoken = false;
+        } else {
+          intoken = true;
+        }
+      }
+      return n >= nargs;
+    }
+
+    //process the request in in and write the reply to out; returns the
+    //query the rest of the connection's data is for, if any
+    virtual QueryPtr execute(istream& in, ostream& out) = 0;
 
 };
 
@@ -40,20 +65,41 @@ class StartMinimization : public Command {
         : Command(l), qmgr(q) {
     }
 
-    void execute(stream_ptr io) {
+    //an old qid line, a receptor line giving the size of the receptor
+    //text that follows it, and a parameter line
+    bool ready(const string& args, bool eof) const {
+      if (eof) return true;
+      size_t recline = args.find('\n');
+      if (recline == string::npos) return false;
+      size_t recstart = args.find('\n', recline + 1);
+      if (recstart == string::npos) return false;
+      recstart++;
+
+      stringstream rec(args.substr(recline + 1, recstart - recline - 1));
+      string str;
+      size_t rsize = 0;
+      rec >> str;
+      rec >> rsize;
+      if (str != "receptor" || rsize == 0) return true; //execute reports it
+      if (args.size() < recstart + rsize) return false;
+      return args.find('\n', recstart + rsize) != string::npos;
+    }
+
+    QueryPtr execute(istream& in, ostream& out) {
       //next line is an old qid
       string str;
-      getline(*io, str);
+      getline(in, str);
       trim(str);
       unsigned oldqid = atoi(str.c_str());
 
-      unsigned qid = qmgr.add(oldqid, io);
+      QueryPtr query;
+      unsigned qid = qmgr.add(oldqid, in, out, query);
       //return the query id (zero if there's a problem)
 
       log.log("startmin %d %d\n", oldqid, qid);
-      *io << qid << "\n";
-      io->flush();
-      //do not close io, need to finish reading
+      out << qid << "\n";
+      //the ligand data that follows is for query
+      return query;
     }
 };
 
@@ -63,13 +109,13 @@ class CancelMinimization : public Command {
 
   public:
     CancelMinimization(QueryManager& q, Logger& l)
-        : Command(l), qmgr(q) {
+        : Command(l, 1), qmgr(q) {
     }
 
-    void execute(stream_ptr io) {
+    QueryPtr execute(istream& in, ostream& out) {
       //next line is an old qid
       string str;
-      getline(*io, str);
+      getline(in, str);
       trim(str);
       unsigned oldqid = atoi(str.c_str());
       log.log("cancel %d\n", oldqid);
@@ -77,7 +123,7 @@ class CancelMinimization : public Command {
       if (query) {
         query->cancel();
       }
-      io->close();
+      return QueryPtr();
     }
 };
 
@@ -87,20 +133,20 @@ class GetScores : public Command {
 
   public:
     GetScores(QueryManager& q, Logger& l)
-        : Command(l), qmgr(q) {
+        : Command(l, 8), qmgr(q) {
     }
 
-    void execute(stream_ptr io) {
+    QueryPtr execute(istream& in, ostream& out) {
       //query id followed by filter params
       MinimizationFilters filters;
       unsigned qid = 0;
-      *io >> qid;
-      filters.read(*io);
+      in >> qid;
+      filters.read(in);
       QueryPtr query = qmgr.get(qid);
       if (query) {
-        query->outputData(filters, *io);
+        query->outputData(filters, out);
       }
-      io->close();
+      return QueryPtr();
     }
 };
 
@@ -110,21 +156,44 @@ class GetJSONScores : public Command {
 
   public:
     GetJSONScores(QueryManager& q, Logger& l)
-        : Command(l), qmgr(q) {
+        : Command(l, 9), qmgr(q) {
     }
 
-    void execute(stream_ptr io) {
+    QueryPtr execute(istream& in, ostream& out) {
       //query id followed by filter params
       MinimizationFilters filters;
       unsigned qid = 0, draw = 0;
-      *io >> qid;
-      *io >> draw; //datatable draw code
-      filters.read(*io);
+      in >> qid;
+      in >> draw; //datatable draw code
+      filters.read(in);
       QueryPtr query = qmgr.get(qid);
       if (query) {
-        query->outputJSONData(filters, draw, *io);
+        query->outputJSONData(filters, draw, out);
       }
-      io->close();
+      return QueryPtr();
+    }
+};
+
+//get the text scoring output of only the results added since the client's
+//last poll, so polling a long running query doesn't resend everything
+class GetNewScores : public Command {
+    QueryManager& qmgr;
+
+  public:
+    GetNewScores(QueryManager& q, Logger& l)
+        : Command(l, 2), qmgr(q) {
+    }
+
+    QueryPtr execute(istream& in, ostream& out) {
+      //query id followed by the cursor returned by the last call, 0 at first
+      unsigned qid = 0, cursor = 0;
+      in >> qid;
+      in >> cursor;
+      QueryPtr query = qmgr.get(qid);
+      if (query) {
+        query->outputNewData(cursor, out);
+      }
+      return QueryPtr();
     }
 };
 
@@ -134,19 +203,19 @@ class GetMol : public Command {
 
   public:
     GetMol(QueryManager& q, Logger& l)
-        : Command(l), qmgr(q) {
+        : Command(l, 2), qmgr(q) {
     }
 
-    void execute(stream_ptr io) {
+    QueryPtr execute(istream& in, ostream& out) {
       //first line query id and mol id
       unsigned qid = 0, molid = 0;
-      *io >> qid;
-      *io >> molid;
+      in >> qid;
+      in >> molid;
       QueryPtr query = qmgr.get(qid);
       if (query) {
-        query->outputMol(molid, *io);
+        query->outputMol(molid, out);
       }
-      io->close();
+      return QueryPtr();
     }
 };
 
@@ -156,20 +225,20 @@ class GetMols : public Command {
 
   public:
     GetMols(QueryManager& q, Logger& l)
-        : Command(l), qmgr(q) {
+        : Command(l, 8), qmgr(q) {
     }
 
-    void execute(stream_ptr io) {
+    QueryPtr execute(istream& in, ostream& out) {
       //query id followed by filter params
       MinimizationFilters filters;
       unsigned qid = 0;
-      *io >> qid;
-      filters.read(*io);
+      in >> qid;
+      filters.read(in);
       QueryPtr query = qmgr.get(qid);
       if (query) {
-        query->outputMols(filters, *io);
+        query->outputMols(filters, out);
       }
-      io->close();
+      return QueryPtr();
     }
 };
 
@@ -182,7 +251,7 @@ class GetStatus : public Command {
         : Command(l), qmgr(q) {
     }
 
-    void execute(stream_ptr io) {
+    QueryPtr execute(istream& in, ostream& out) {
       unsigned active, inactive, defunct;
       qmgr.getCounts(active, inactive, defunct);
       double load = 0;
@@ -190,10 +259,12 @@ class GetStatus : public Command {
       ifstream ldfile("/proc/loadavg");
       ldfile >> load;
 
-      *io << "Active " << active << "\nInactive " << inactive << "\nDefunct "
+      out << "Active " << active << "\nInactive " << inactive << "\nDefunct "
           << defunct << "\nLoad " << load << "\n";
-      io->close();
+      return QueryPtr();
     }
 };
 
+typedef unordered_map<string, boost::shared_ptr<Command> > cmd_map;
+
 #endif /* SERVERCMDS_H_ */
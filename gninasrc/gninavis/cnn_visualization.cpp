@@ -151,20 +151,21 @@ void cnn_visualization::setup() {
 
   std::stringstream rec_stream(rec_string);
   unmodified_receptor = parse_receptor_pdbqt("", rec_stream);
-  CNNScorer base_scorer(cnnopts);
+  scorer = CNNScorer(cnnopts);
 
   std::stringstream lig_stream(lig_string);
   unmodified_ligand = parse_ligand_stream_pdbqt("", lig_stream);
-  model temp_rec = unmodified_receptor;
+  complex = unmodified_receptor;
+  complex.append(unmodified_ligand);
 
-  temp_rec.append(unmodified_ligand);
+  model temp_rec = complex;
   float aff, loss;
   if (visopts.target == "pose") {
-    original_score = base_scorer.score(temp_rec, true, aff, loss);
+    original_score = scorer.score(temp_rec, true, aff, loss);
     std::cout << "CNN SCORE: " << original_score << "\n\n";
   } else
     if (visopts.target == "affinity") {
-      original_score = base_scorer.score(temp_rec, false, aff, loss);
+      original_score = scorer.score(temp_rec, false, aff, loss);
       original_score = aff;
       std::cout << "AFF: " << original_score << "\n\n";
     } else {
@@ -284,34 +285,6 @@ void cnn_visualization::process_molecules() {
   cenCoords[2] = cen.GetZ();
 }
 
-//scores provided receptor string against unmodified ligand
-float cnn_visualization::score_modified_receptor(
-    const std::string &modified_rec_string) {
-  std::stringstream rec_stream(modified_rec_string);
-  std::stringstream lig_stream(lig_string);
-
-  model m = parse_receptor_pdbqt("", rec_stream);
-
-  CNNScorer cnn_scorer(cnnopts);
-
-  model l = parse_ligand_stream_pdbqt("", lig_stream);
-  m.append(l);
-
-  float aff, loss;
-  float score_val = cnn_scorer.score(m, true, aff, loss);
-
-  //use affinity instead of cnn score if required
-  if (visopts.target == "affinity") {
-    score_val = aff;
-  }
-
-  if (visopts.verbose) {
-    std::cout << "SCORE: " << score_val << '\n';
-  }
-
-  return score_val;
-}
-
 //scores provided ligand string against unmodified ligand
 float cnn_visualization::score_modified_ligand(const std::string &mol_string) {
 
@@ -325,19 +298,11 @@ float cnn_visualization::score_modified_ligand(const std::string &mol_string) {
   std::stringstream rec_stream(rec_string);
 
   model temp = unmodified_receptor;
-  static CNNScorer cnn_scorer; //share same scorer across all ligands
-
-  static bool first = true;
-  if (first) {
-    cnn_scorer = CNNScorer(cnnopts);
-    first = false;
-  }
-
   model l = parse_ligand_stream_pdbqt("", lig_stream);
   temp.append(l);
 
   float aff, loss;
-  float score_val = cnn_scorer.score(temp, true, aff, loss);
+  float score_val = scorer.score(temp, true, aff, loss);
   if (visopts.verbose) {
     std::cout << "SCORE: " << score_val << '\n';
   }
@@ -531,9 +496,11 @@ std::string cnn_visualization::get_xyz(const std::string &line) {
 }
 
 //removes whole residues at a time, and scores the resulting receptor
+//the complex is parsed and loaded into the network once; residues are
+//taken out of its grid in batches of masks instead of rescoring a new
+//receptor for each one
 void cnn_visualization::remove_residues() {
   std::unordered_map<std::string, float> score_diffs;
-  std::unordered_set<std::string> atoms_to_remove;
   std::unordered_map<std::string, std::unordered_set<std::string> > residues;
 
   std::string mol_string = rec_string;
@@ -548,50 +515,55 @@ void cnn_visualization::remove_residues() {
     }
   }
 
-  int res_count = residues.size();
-  int counter = 1;
+  //receptor atoms of the complex by coordinates
+  std::unordered_map<std::string, sz> rec_atoms;
+  const atomv& fixed = complex.get_fixed_atoms();
+  VINA_FOR_IN(i, fixed) {
+    const vec& c = fixed[i].coords;
+    rec_atoms[xyz_to_string(c[0], c[1], c[2])] = i;
+  }
 
+  //residues in range, and the receptor atoms of each
+  std::vector<const std::unordered_set<std::string>*> removed;
+  std::vector<szv> masks;
   for (const auto& res : residues) {
-    if (!visopts.verbose) {
-      std::cout << "Scoring residues: " << counter << '/' << res_count << '\r'
-          << std::flush;
-      counter++;
+    if (!visopts.skip_bound_check && !check_in_range(res.second)) continue;
+    removed.push_back(&res.second);
+    masks.push_back(szv());
+    for (const auto& xyz : res.second) {
+      auto pos = rec_atoms.find(xyz);
+      if (pos != rec_atoms.end()) masks.back().push_back(pos->second);
     }
+  }
 
-    mol_stream.clear();
-    mol_stream.str(mol_string);
-
-    atoms_to_remove = res.second;
-
-    int counter = 0;
-    for (auto atom : atoms_to_remove) {
-      counter++;
+  unsigned batch = std::max(visopts.mask_batch, 1U);
+  std::vector<szv> chunk;
+  std::vector<float> scores, affinities;
+  for (sz start = 0; start < masks.size(); start += batch) {
+    sz end = std::min(masks.size(), start + batch);
+    if (!visopts.verbose) {
+      std::cout << "Scoring residues: " << end << '/' << masks.size() << '\r'
+          << std::flush;
     }
 
-    bool remove = true;
+    chunk.assign(masks.begin() + start, masks.begin() + end);
+    model m = complex;
+    scorer.score_masked(m, chunk, scores, affinities);
 
-    if (!visopts.skip_bound_check) {
-      //make set for check_in_range test
-      std::unordered_set<std::string> remove_set;
-      for (auto i : atoms_to_remove) {
-        remove_set.insert(i);
+    for (sz i = start; i < end; i++) {
+      //use affinity instead of cnn score if required
+      float score_val = visopts.target == "affinity" ?
+          affinities[i - start] : scores[i - start];
+      if (visopts.verbose) {
+        std::cout << "SCORE: " << score_val << '\n';
       }
 
-      remove = check_in_range(remove_set);
-    }
-
-    if (remove) {
-      std::string modified_mol_string = modify_pdbqt(atoms_to_remove, true);
-
-      float score_val = score_modified_receptor(modified_mol_string);
       float score_diff = original_score - score_val;
-      score_diff = score_diff / atoms_to_remove.size();
-
-      for (auto f : atoms_to_remove) {
+      score_diff = score_diff / removed[i]->size();
+      for (const auto& f : *removed[i]) {
         score_diffs[f] = score_diff;
       }
     }
-    atoms_to_remove.clear();
   }
 
   write_scores(score_diffs, true, "masking");
@@ -22,6 +22,7 @@ struct vis_options {
     bool skip_bound_check;
     bool zero_values;
     int gpu;
+    unsigned mask_batch; //masked receptors per CNN batch
 
     bool outputdx;
     float box_size;
@@ -30,7 +31,7 @@ struct vis_options {
     vis_options()
         : frags_only(false), atoms_only(false), verbose(false),
             output_files(false), skip_bound_check(false), outputdx(false),
-            gpu(0), box_size(23.5), score_scale(10) {
+            gpu(0), mask_batch(16), box_size(23.5), score_scale(10) {
     }
 };
 
@@ -54,6 +55,8 @@ class cnn_visualization {
     vec center;
     model unmodified_receptor;
     model unmodified_ligand;
+    model complex; //unmodified receptor with the ligand appended
+    CNNScorer scorer; //loaded once and used for every masked receptor
     bool frags_only, atoms_only, verbose;
     double score_scale;
 
@@ -68,7 +71,6 @@ class cnn_visualization {
     void process_molecules();
     std::string modify_pdbqt(
         const std::unordered_set<std::string> &atoms_to_remove, bool isRec);
-    float score_modified_receptor(const std::string &modified_rec_string);
     float score_modified_ligand(const std::string &modified_lig_string);
 
     float score(const std::string &molString, bool isRec);
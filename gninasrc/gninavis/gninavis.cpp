@@ -61,7 +61,9 @@ int main(int argc, char* argv[]) {
       bool_switch(&visopts.zero_values)->default_value(false),
       "only propagate values from dead nodes")
       ("score_scale", value<double>(&visopts.score_scale)->default_value(10.0),
-            "Amount to scale score output by (default 10.0)");
+            "Amount to scale score output by (default 10.0)")
+      ("mask_batch", value<unsigned>(&visopts.mask_batch)->default_value(16),
+            "number of masked receptors scored in each CNN batch (default 16)");
 
   options_description debug("Debug");
   debug.add_options()("output_files",
@@ -23,7 +23,8 @@
 #ifndef VINA_ARRAY3D_H
 #define VINA_ARRAY3D_H
 
-#include <exception> // std::bad_alloc#include "common.h"
+#include <exception> // std::bad_alloc
+#include "common.h"
 
 inline sz checked_multiply(sz i, sz j) {
   if (i == 0 || j == 0) return 0;
@@ -92,4 +93,44 @@ class array3d {
     }
 };
 
+//read-only view of data laid out like array3d but owned elsewhere
+//(e.g. a memory mapped file); the owner must outlive the view
+template<typename T>
+class array3d_view {
+    sz m_i, m_j, m_k;
+    const T* m_data;
+  public:
+    array3d_view()
+        : m_i(0), m_j(0), m_k(0), m_data(NULL) {
+    }
+    array3d_view(const T* data, sz i, sz j, sz k)
+        : m_i(i), m_j(j), m_k(k), m_data(data) {
+    }
+    sz dim0() const {
+      return m_i;
+    }
+    sz dim1() const {
+      return m_j;
+    }
+    sz dim2() const {
+      return m_k;
+    }
+    sz dim(sz i) const {
+      switch (i) {
+      case 0:
+        return m_i;
+      case 1:
+        return m_j;
+      case 2:
+        return m_k;
+      default:
+        assert(false);
+        return 0;
+      }
+    }
+    const T& operator()(sz i, sz j, sz k) const {
+      return m_data[i + m_i * (j + m_j * k)];
+    }
+};
+
 #endif
@@ -23,6 +23,9 @@
 #ifndef VINA_ATOM_H
 #define VINA_ATOM_H
 
+#include <atomic>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include "atom_base.h"
 
 struct atom_index {
@@ -86,4 +89,96 @@ struct atom : public atom_base {
 
 typedef std::vector<atom> atomv;
 
+//atoms of the rigid receptor; copies share one reference counted vector,
+//which is only cloned when a copy that does not own it alone is modified,
+//so copying a model does not copy its receptor
+class shared_atomv {
+    boost::shared_ptr<atomv> atoms; //null if empty
+    sz gen; //see generation()
+
+    static const atomv& no_atoms() {
+      static const atomv empty;
+      return empty;
+    }
+    static sz next_generation() {
+      static std::atomic<sz> last(0);
+      return ++last;
+    }
+  public:
+    typedef atomv::const_iterator const_iterator;
+
+    shared_atomv()
+        : gen(0) {
+    }
+    shared_atomv(const atomv& a)
+        : atoms(boost::make_shared<atomv>(a)), gen(next_generation()) {
+    }
+    shared_atomv& operator=(const atomv& a) {
+      atoms = boost::make_shared<atomv>(a);
+      gen = next_generation();
+      return *this;
+    }
+
+    //copies have the same generation, which changes (to a value never used
+    //before) whenever the atoms may be changed; equal generations mean
+    //equal atoms, but different ones don't mean the atoms differ
+    sz generation() const {
+      return gen;
+    }
+
+    const atomv& get() const {
+      return atoms ? *atoms : no_atoms();
+    }
+    sz size() const {
+      return atoms ? atoms->size() : 0;
+    }
+    bool empty() const {
+      return size() == 0;
+    }
+    const atom& operator[](sz i) const {
+      return (*atoms)[i];
+    }
+    const_iterator begin() const {
+      return get().begin();
+    }
+    const_iterator end() const {
+      return get().end();
+    }
+
+    //writable access, copies the atoms first if they are shared
+    atomv& modify() {
+      gen = next_generation();
+      if (!atoms)
+        atoms = boost::make_shared<atomv>();
+      else
+        if (!atoms.unique()) atoms = boost::make_shared<atomv>(*atoms);
+      return *atoms;
+    }
+    atom& modify(sz i) {
+      return modify()[i];
+    }
+    void push_back(const atom& a) {
+      modify().push_back(a);
+    }
+    //a's atoms move into a new vector of our own, and a gets ours, copied
+    //only if others still share them
+    void swap(atomv& a) {
+      boost::shared_ptr<atomv> mine = boost::make_shared<atomv>();
+      mine->swap(a);
+      gen = next_generation();
+      if (atoms) {
+        if (atoms.unique())
+          a.swap(*atoms);
+        else
+          a = *atoms;
+      }
+      atoms = mine;
+    }
+
+    //true if other models hold the same atoms
+    bool shared() const {
+      return atoms && !atoms.unique();
+    }
+};
+
 #endif
@@ -30,6 +30,7 @@
 
 //TODO: remove?
 #include "quasi_newton.h"
+#include "profiler.h"
 
 inline void minus_mat_vec_product(const flmat& m, const change& in,
     change& out) {
@@ -271,7 +272,10 @@ fl simple_gradient_ascent(F& f, Conf& x, Change& g,
     fl alpha = 0;
     set_to_neg(p, g, n);
 
-    alpha = accurate_line_search(f, n, x, g, f0, p, x_new, g_new, f1);
+    {
+      PROFILE_SCOPE(ProfileLineSearch);
+      alpha = accurate_line_search(f, n, x, g, f0, p, x_new, g_new, f1);
+    }
 
     if (params.outputframes > 0) {
       std::cout << "f1: " << f1 << "\n";
@@ -392,10 +396,13 @@ fl bfgs(F& f, Conf& x, Change& g, const fl average_required_improvement,
     fl f1 = 0;
     fl alpha;
 
-    if (params.type == minimization_params::BFGSAccurateLineSearch)
-      alpha = accurate_line_search(f, n, x, g, f0, p, x_new, g_new, f1);
-    else
-      alpha = fast_line_search(f, n, x, g, f0, p, x_new, g_new, f1);
+    {
+      PROFILE_SCOPE(ProfileLineSearch);
+      if (params.type == minimization_params::BFGSAccurateLineSearch)
+        alpha = accurate_line_search(f, n, x, g, f0, p, x_new, g_new, f1);
+      else
+        alpha = fast_line_search(f, n, x, g, f0, p, x_new, g_new, f1);
+    }
 
     if (params.outputframes > 0) {
       std::cout << "f1: " << f1 << "\n";
@@ -20,12 +20,15 @@
 
  */
 
-#include <algorithm> // fill, etc#if 0 // use binary cache// for some reason, binary archive gives four huge warnings in VC2008
+#include <algorithm> // fill, etc
+#if 0 // use binary cache
+// for some reason, binary archive gives four huge warnings in VC2008
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 typedef boost::archive::binary_iarchive iarchive;
 typedef boost::archive::binary_oarchive oarchive;
-#else // use text cache#include <boost/archive/text_oarchive.hpp>
+#else // use text cache
+#include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 typedef boost::archive::text_iarchive iarchive;
 typedef boost::archive::text_oarchive oarchive;
@@ -33,15 +36,49 @@ typedef boost::archive::text_oarchive oarchive;
 
 #include <boost/serialization/split_member.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <boost/static_assert.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <cstring>
 #include "cache.h"
 #include "file.h"
 #include "szv_grid.h"
+#include "my_pid.h"
+#include "profiler.h"
+
+//header of a binary grid file; values follow at page aligned offsets so
+//the file can be mapped and used in place
+struct grid_file_header {
+    char magic[8];
+    boost::uint32_t version;
+    boost::uint32_t type;
+    boost::uint64_t key;
+    double begin[3];
+    double end[3];
+    boost::uint64_t n[3];
+    boost::uint64_t data_offset;
+    boost::uint64_t chargedata_offset; //zero if no charge dependent terms
+    boost::uint32_t value_size;
+    boost::uint32_t reserved;
+
+    static const boost::uint32_t current_version = 1;
+};
+static const char grid_file_magic[8] = { 'G', 'N', 'I', 'N', 'A', 'G', 'R',
+    'D' };
+
+static boost::uint64_t page_align(boost::uint64_t off) {
+  const boost::uint64_t page =
+      boost::interprocess::mapped_region::get_page_size();
+  return (off + page - 1) / page * page;
+}
 
 cache::cache(const std::string& scoring_function_version_, const grid_dims& gd_,
     fl slope_)
     : scoring_function_version(scoring_function_version_), gd(gd_),
-        slope(slope_), grids(num_atom_types()) {
+        slope(slope_), grids(num_atom_types()), num_threads(1) {
 }
 
 fl cache::eval(const model& m, fl v) const { // needs m.coords
@@ -101,6 +138,7 @@ void cache::load(Archive& ar, const unsigned version) {
 void cache::populate(const model& m, const precalculate& p,
     const std::vector<smt>& atom_types_needed, grid& user_grid,
     bool display_progress) {
+  PROFILE_SCOPE(ProfilePopulate);
   std::vector<smt> needed;
   bool haschargeterms = p.has_components();
 
@@ -112,9 +150,7 @@ void cache::populate(const model& m, const precalculate& p,
     }
   }
   if (needed.empty()) return;
-  flv affinities(needed.size());
-  flv chargeaffinities;
-  if (haschargeterms) chargeaffinities.resize(needed.size());
+  const sz nneeded = needed.size();
 
   sz nat = num_atom_types();
 
@@ -123,50 +159,79 @@ void cache::populate(const model& m, const precalculate& p,
   const fl cutoff_sqr = p.cutoff_sqr();
 
   szv_grid_cache igcache(m, cutoff_sqr);
-  szv_grid ig(igcache, gd);
+  szv_grid ig(igcache, gd, num_threads);
+
+  //build the tables of every receptor/ligand type pair up front and in
+  //parallel so the slabs only read them
+  std::vector<smt> rtypes;
+  std::vector<bool> seen(nat, false);
+  VINA_FOR_IN(i, m.grid_atoms) {
+    smt t = m.grid_atoms[i].get();
+    if (t < nat && !seen[t]) {
+      seen[t] = true;
+      rtypes.push_back(t);
+    }
+  }
+  p.prepare(rtypes, needed, num_threads);
+
+  //fill in all needed grids at the points of one x slab; receptor atoms are
+  //accumulated in cell order, so every value is bit-identical to
+  //evaluating one pair at a time regardless of how slabs are distributed
+  auto slab = [&](sz x) {
+    flv affinities(nneeded);
+    flv chargeaffinities;
+    if (haschargeterms) chargeaffinities.resize(nneeded);
+    std::vector<result_components> vals(nneeded);
+    flv r2s;
 
-  VINA_FOR(x, g.data.dim0()) {
     VINA_FOR(y, g.data.dim1()) {
       VINA_FOR(z, g.data.dim2()) {
         std::fill(affinities.begin(), affinities.end(), 0);
         std::fill(chargeaffinities.begin(), chargeaffinities.end(), 0);
         vec probe_coords;
         probe_coords = g.index_to_argument(x, y, z);
-        const szv& possibilities = ig.possibilities(probe_coords);
-        VINA_FOR_IN(possibilities_i, possibilities) {
-          const sz i = possibilities[possibilities_i];
-          const atom& a = m.grid_atoms[i];
-          const smt t1 = a.get();
-          const fl r2 = vec_distance_sqr(a.coords, probe_coords);
-          if (r2 <= cutoff_sqr) {
-            VINA_FOR_IN(j, needed) {
-              const smt t2 = needed[j];
-              assert(t2 < nat);
-              //t1 is the receptor atom, a
-              //t2 is type from the ligand, not corresponding to any
-              //particular atom
-              result_components val = p.eval_fast(t1, t2, r2);
-              if (haschargeterms) {
-                //affinities contains the terms that are independent of
-                //the ligand atom charge
-
-                affinities[j] += val[result_components::TypeDependentOnly]
-                    + val[result_components::AbsAChargeDependent]
-                        * fabs(a.charge);
-                //this component must be multiplied by the ligand atom charge
-                chargeaffinities[j] +=
-                    val[result_components::AbsBChargeDependent]
-                        + val[result_components::ABChargeDependent] * a.charge; //not abs value
-              } else {
-                affinities[j] += val[result_components::TypeDependentOnly];
-              }
+        const receptor_cell cell = ig.cell(probe_coords);
+        const sz np = cell.size();
+
+        //distances to the whole batch of candidate receptor atoms first
+        r2s.resize(np);
+        for (sz k = 0; k < np; k++) {
+          const fl dx = cell.x[k] - probe_coords[0];
+          const fl dy = cell.y[k] - probe_coords[1];
+          const fl dz = cell.z[k] - probe_coords[2];
+          r2s[k] = dx * dx + dy * dy + dz * dz;
+        }
+
+        for (sz k = 0; k < np; k++) {
+          const fl r2 = r2s[k];
+          if (r2 > cutoff_sqr) continue;
+          //t1 is the receptor atom, needed are types from the ligand, not
+          //corresponding to any particular atom
+          p.eval_fast_types(cell.types[k], &needed[0], nneeded, r2, &vals[0]);
+          if (haschargeterms) {
+            //affinities contains the terms that are independent of
+            //the ligand atom charge
+            const fl abscharge = fabs(cell.charges[k]);
+            const fl charge = cell.charges[k]; //not abs value
+            for (sz j = 0; j < nneeded; j++) {
+              const result_components& val = vals[j];
+              affinities[j] += val[result_components::TypeDependentOnly]
+                  + val[result_components::AbsAChargeDependent] * abscharge;
+              //this component must be multiplied by the ligand atom charge
+              chargeaffinities[j] +=
+                  val[result_components::AbsBChargeDependent]
+                      + val[result_components::ABChargeDependent] * charge;
             }
+          } else {
+            for (sz j = 0; j < nneeded; j++)
+              affinities[j] += vals[j][result_components::TypeDependentOnly];
           }
         }
-        VINA_FOR_IN(j, needed) {
+
+        VINA_FOR(j, nneeded) {
           sz t = needed[j];
           assert(t < nat);
-          grids[t].data(x, y, z) = affinities[j]; //+ user_grid.evaluate_user(vec(x, y, z));
+          grids[t].data(x, y, z) = affinities[j];
           if (haschargeterms) grids[t].chargedata(x, y, z) =
               chargeaffinities[j];
           if (user_grid.initialized())
@@ -175,5 +240,102 @@ void cache::populate(const model& m, const precalculate& p,
         }
       }
     }
+  };
+
+  const sz nx = g.data.dim0();
+  const sz nthreads = std::min(num_threads, nx);
+  if (nthreads <= 1) {
+    VINA_FOR(x, nx)
+      slab(x);
+  } else {
+    //slabs are handed out dynamically since the receptor density (and so
+    //the cost) varies across the box
+    sz next = 0;
+    boost::thread_group workers;
+    VINA_FOR(i, nthreads)
+      workers.create_thread([&]() {
+        for (sz x; (x = __sync_fetch_and_add(&next, 1)) < nx;)
+          slab(x);
+      });
+    workers.join_all();
+  }
+}
+
+void cache::write_grid(smt t, boost::uint64_t key, const path& file) const {
+  const grid& g = grids[t];
+  VINA_CHECK(g.initialized() && !g.mapped());
+  sz npoints = g.data.dim0() * g.data.dim1() * g.data.dim2();
+
+  grid_file_header h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, grid_file_magic, sizeof(h.magic));
+  h.version = grid_file_header::current_version;
+  h.type = t;
+  h.key = key;
+  VINA_FOR(i, 3) {
+    h.begin[i] = gd[i].begin;
+    h.end[i] = gd[i].end;
+    h.n[i] = gd[i].n;
+  }
+  h.value_size = sizeof(fl);
+  h.data_offset = page_align(sizeof(h));
+  if (g.chargedata.dim0() > 0)
+    h.chargedata_offset = page_align(h.data_offset + npoints * sizeof(fl));
+
+  //write to a private file and rename so that concurrent readers (possibly
+  //in other processes) never see a partial grid
+  path tmp = file;
+  tmp += "." + boost::lexical_cast<std::string>(my_pid()) + ".tmp";
+  {
+    boost::filesystem::ofstream out(tmp, std::ios::binary);
+    if (!out) throw file_error(tmp, false);
+    out.write((const char*) &h, sizeof(h));
+    std::vector<char> pad(h.data_offset - sizeof(h), 0);
+    out.write(&pad[0], pad.size());
+    out.write((const char*) &g.data(0, 0, 0), npoints * sizeof(fl));
+    if (h.chargedata_offset) {
+      pad.assign(h.chargedata_offset - h.data_offset - npoints * sizeof(fl),
+          0);
+      if (!pad.empty()) out.write(&pad[0], pad.size());
+      out.write((const char*) &g.chargedata(0, 0, 0), npoints * sizeof(fl));
+    }
+    if (!out) throw file_error(tmp, false);
+  }
+  boost::filesystem::rename(tmp, file);
+}
+
+bool cache::map_grid(smt t, boost::uint64_t key, const path& file) {
+  using namespace boost::interprocess;
+  if (!boost::filesystem::exists(file)) return false;
+
+  boost::shared_ptr<mapped_region> region;
+  try {
+    file_mapping fm(file.string().c_str(), read_only);
+    region.reset(new mapped_region(fm, read_only));
+  } catch (interprocess_exception& e) {
+    return false;
   }
+  if (region->get_size() < sizeof(grid_file_header)) return false;
+
+  const char *base = (const char*) region->get_address();
+  const grid_file_header& h = *(const grid_file_header*) base;
+  if (std::memcmp(h.magic, grid_file_magic, sizeof(h.magic)) != 0
+      || h.version != grid_file_header::current_version || h.type != t
+      || h.key != key || h.value_size != sizeof(fl))
+    return false;
+  VINA_FOR(i, 3) {
+    if (h.n[i] != gd[i].n || fl(h.begin[i]) != gd[i].begin
+        || fl(h.end[i]) != gd[i].end) return false;
+  }
+
+  sz npoints = (gd[0].n + 1) * (gd[1].n + 1) * (gd[2].n + 1);
+  boost::uint64_t end = (h.chargedata_offset ? h.chargedata_offset : h.data_offset)
+      + npoints * sizeof(fl);
+  if (region->get_size() < end) return false;
+
+  const fl* values = (const fl*) (base + h.data_offset);
+  const fl* chargevalues =
+      h.chargedata_offset ? (const fl*) (base + h.chargedata_offset) : NULL;
+  grids[t].init_mapped(gd, region, values, chargevalues);
+  return true;
 }
@@ -24,11 +24,14 @@
 #define VINA_CACHE_H
 
 #include <string>
+#include <boost/cstdint.hpp>
 #include "igrid.h"
 #include "grid.h"
 #include "model.h"
 #include "array3d.h"
 
+struct bench_access;
+
 struct cache_mismatch {
 };
 struct rigid_mismatch : public cache_mismatch {
@@ -47,6 +50,21 @@ struct cache : public igrid {
     virtual void populate(const model& m, const precalculate& p,
         const std::vector<smt>& atom_types_needed, grid& user_grid,
         bool display_progress = true);
+
+    //number of threads populate splits the grid over
+    void set_num_threads(sz n) {
+      num_threads = n;
+    }
+
+    bool has_grid(smt t) const {
+      return grids[t].initialized();
+    }
+    //persist the grid for type t in a binary, page aligned file that can
+    //later be memory mapped; key identifies the receptor and scoring function
+    void write_grid(smt t, boost::uint64_t key, const path& file) const;
+    //map a grid written by write_grid read-only for type t; returns false
+    //if the file is missing or was written for a different key/grid
+    bool map_grid(smt t, boost::uint64_t key, const path& file);
     virtual ~cache() {
     }
     ;
@@ -56,8 +74,10 @@ struct cache : public igrid {
     grid_dims gd;
     fl slope; // does not get (de-)serialized
     std::vector<grid> grids;
+    sz num_threads; // does not get (de-)serialized
     friend class boost::serialization::access;
     friend class cache_gpu;
+    friend struct bench_access;
     template<class Archive>
     void save(Archive& ar, const unsigned version) const;
     template<class Archive>
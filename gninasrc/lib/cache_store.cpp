@@ -0,0 +1,125 @@
+#include <iomanip>
+#include <boost/filesystem/operations.hpp>
+#include "cache_store.h"
+
+boost::uint64_t cache_store::receptor_hash(const model& m) {
+  const atomv& atoms = m.get_fixed_atoms();
+  boost::uint64_t seed = stable_hash(NULL, 0);
+  VINA_FOR_IN(i, atoms) {
+    const atom& a = atoms[i];
+    smt t = a.get();
+    seed = stable_hash(&t, sizeof(t), seed);
+    seed = stable_hash(&a.charge, sizeof(a.charge), seed);
+    VINA_FOR(j, 3)
+      seed = stable_hash(&a.coords[j], sizeof(fl), seed);
+  }
+  return seed;
+}
+
+std::size_t cache_store::receptor_check(const model& m) {
+  const atomv& atoms = m.get_fixed_atoms();
+  std::size_t seed = atoms.size();
+  VINA_FOR_IN(i, atoms) {
+    const atom& a = atoms[i];
+    boost::hash_combine(seed, a.get());
+    boost::hash_combine(seed, a.charge);
+    VINA_FOR(j, 3)
+      boost::hash_combine(seed, a.coords[j]);
+  }
+  return seed;
+}
+
+boost::uint64_t cache_store::file_key(const key& k) const {
+  boost::uint64_t seed = stable_hash(&k.receptor, sizeof(k.receptor),
+      scoring_hash);
+  seed = stable_hash(&k.slope, sizeof(k.slope), seed);
+  VINA_FOR_IN(i, k.gd) {
+    seed = stable_hash(&k.gd[i].begin, sizeof(fl), seed);
+    seed = stable_hash(&k.gd[i].end, sizeof(fl), seed);
+    boost::uint64_t n = k.gd[i].n;
+    seed = stable_hash(&n, sizeof(n), seed);
+  }
+  return seed;
+}
+
+path cache_store::grid_file(boost::uint64_t fkey, smt t) const {
+  std::stringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0') << fkey << "_"
+      << smina_type_to_string(t) << ".grid";
+  return directory / name.str();
+}
+
+boost::shared_ptr<cache> cache_store::get(const model& m,
+    const precalculate& p, const grid_dims& gd, fl slope,
+    const std::vector<smt>& atom_types_needed, grid& user_grid) {
+  receptor_print r;
+  {
+    boost::lock_guard<boost::mutex> L(lock);
+    r = last_receptor;
+  }
+  if (r.generation != m.grid_atoms.generation()) {
+    //hashed outside the lock, it's the whole receptor
+    r.generation = m.grid_atoms.generation();
+    r.hash = receptor_hash(m);
+    r.check = receptor_check(m);
+  }
+
+  key k;
+  k.receptor = r.hash;
+  k.receptor_check = r.check;
+  k.receptor_atoms = m.get_fixed_atoms().size();
+  k.gd = gd;
+  k.p = p.id();
+  k.user_grid = user_grid.initialized() ? user_grid.generation() : 0;
+  k.slope = slope;
+
+  boost::shared_ptr<entry> e;
+  {
+    boost::lock_guard<boost::mutex> L(lock);
+    last_receptor = r;
+    boost::shared_ptr<entry>& slot = entries[k];
+    if (!slot) {
+      slot.reset(new entry(scoring_function_version, gd, slope));
+      slot->c.set_num_threads(num_threads);
+    }
+    slot->last_use = ++uses;
+    e = slot;
+
+    //drop the least recently used; whoever still holds it keeps it alive
+    while (entries.size() > std::max<sz>(max_entries, 1)) {
+      auto oldest = entries.begin();
+      for (auto i = entries.begin(); i != entries.end(); ++i)
+        if (i->second->last_use < oldest->second->last_use) oldest = i;
+      entries.erase(oldest);
+    }
+  }
+  boost::shared_ptr<cache> ret(e, &e->c);
+
+  //populate only touches the grids of types that are not yet initialized,
+  //so threads already evaluating other types of this cache are unaffected;
+  //threads needing a type that is being computed wait here for it
+  boost::lock_guard<boost::mutex> L(e->lock);
+  //user grids are not part of the key, so those maps are never persisted
+  bool persist = !directory.empty() && !user_grid.initialized();
+  boost::uint64_t fkey = persist ? file_key(k) : 0;
+
+  std::vector<smt> computed;
+  VINA_FOR_IN(i, atom_types_needed) {
+    smt t = atom_types_needed[i];
+    if (e->c.has_grid(t)) continue;
+    if (persist && e->c.map_grid(t, fkey, grid_file(fkey, t))) continue;
+    computed.push_back(t);
+  }
+  if (computed.empty()) return ret;
+
+  e->c.populate(m, p, computed, user_grid, false);
+
+  if (persist) {
+    boost::filesystem::create_directories(directory);
+    VINA_FOR_IN(i, computed) {
+      smt t = computed[i];
+      e->c.write_grid(t, fkey, grid_file(fkey, t));
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#include "cache.h"
+
+//process-wide store of precomputed receptor affinity grids
+//every ligand docked against the same receptor in the same box with the same
+//scoring function shares a single cache; each atom type map is computed at
+//most once, the first time a ligand needs it, and is read-only afterwards;
+//only the most recently used max_entries caches are kept
+class cache_store {
+  public:
+    cache_store(const std::string& scoring_function_version_,
+        sz max_entries_ = 8)
+        : scoring_function_version(scoring_function_version_),
+            scoring_hash(0), num_threads(1), max_entries(max_entries_),
+            uses(0) {
+    }
+
+    //also persist grids as binary files in dir and map them read-only when
+    //they already exist; scoring_description must capture everything that
+    //affects grid values (terms, weights, approximation, atom parameters)
+    cache_store(const std::string& scoring_function_version_, const path& dir,
+        const std::string& scoring_description, sz max_entries_ = 8)
+        : scoring_function_version(scoring_function_version_), directory(dir),
+            scoring_hash(stable_hash(scoring_function_version_,
+                stable_hash(scoring_description))), num_threads(1),
+            max_entries(max_entries_), uses(0) {
+    }
+
+    //return the shared cache for the receptor in m, populated with at least
+    //atom_types_needed; the returned cache must not be modified by the caller,
+    //and stays valid for as long as it is held even if the store drops it
+    boost::shared_ptr<cache> get(const model& m, const precalculate& p,
+        const grid_dims& gd, fl slope, const std::vector<smt>& atom_types_needed,
+        grid& user_grid);
+
+    //threads used to populate newly needed grids
+    void set_num_threads(sz n) {
+      num_threads = n;
+    }
+
+    //number of receptor/box/scoring combinations currently kept
+    sz size() const {
+      boost::lock_guard<boost::mutex> L(lock);
+      return entries.size();
+    }
+
+    //fingerprint of the rigid receptor atoms of m; stable between runs
+    static boost::uint64_t receptor_hash(const model& m);
+    //a second, independently computed fingerprint of the same atoms, so that
+    //a collision of receptor_hash alone can't pick another receptor's grids
+    static std::size_t receptor_check(const model& m);
+
+  private:
+    struct key {
+        boost::uint64_t receptor;
+        std::size_t receptor_check;
+        sz receptor_atoms;
+        grid_dims gd;
+        sz p; //precalculate::id()
+        sz user_grid; //its generation(), 0 if not initialized
+        fl slope;
+
+        bool operator==(const key& rhs) const {
+          return receptor == rhs.receptor
+              && receptor_check == rhs.receptor_check
+              && receptor_atoms == rhs.receptor_atoms && p == rhs.p
+              && user_grid == rhs.user_grid && slope == rhs.slope
+              && same_dims(gd, rhs.gd);
+        }
+        //exact comparison so that equality is consistent with the hash
+        static bool same_dims(const grid_dims& a, const grid_dims& b) {
+          VINA_FOR_IN(i, a)
+            if (a[i].n != b[i].n || a[i].begin != b[i].begin
+                || a[i].end != b[i].end) return false;
+          return true;
+        }
+        friend std::size_t hash_value(const key& k) {
+          std::size_t seed = boost::hash_value(k.receptor);
+          boost::hash_combine(seed, k.p);
+          boost::hash_combine(seed, k.user_grid);
+          boost::hash_combine(seed, k.slope);
+          VINA_FOR_IN(i, k.gd) {
+            boost::hash_combine(seed, k.gd[i].begin);
+            boost::hash_combine(seed, k.gd[i].end);
+            boost::hash_combine(seed, k.gd[i].n);
+          }
+          return seed;
+        }
+    };
+
+    struct entry {
+        boost::mutex lock; //held while grids are being populated
+        cache c;
+        sz last_use; //uses when it was last returned, for eviction
+        entry(const std::string& version, const grid_dims& gd, fl slope)
+            : c(version, gd, slope), last_use(0) {
+        }
+    };
+
+    //fingerprints of the receptor atoms of some generation
+    struct receptor_print {
+        sz generation;
+        boost::uint64_t hash;
+        std::size_t check;
+        receptor_print()
+            : generation(SIZE_MAX), hash(0), check(0) {
+        }
+    };
+
+    //64-bit FNV-1a, so file names do not depend on the boost version
+    static boost::uint64_t stable_hash(const void *data, sz n,
+        boost::uint64_t seed = 14695981039346656037ULL) {
+      const unsigned char *bytes = (const unsigned char*) data;
+      for (sz i = 0; i < n; i++) {
+        seed ^= bytes[i];
+        seed *= 1099511628211ULL;
+      }
+      return seed;
+    }
+    static boost::uint64_t stable_hash(const std::string& str,
+        boost::uint64_t seed = 14695981039346656037ULL) {
+      return stable_hash(str.data(), str.size(), seed);
+    }
+
+    boost::uint64_t file_key(const key& k) const;
+    path grid_file(boost::uint64_t fkey, smt t) const;
+
+    std::string scoring_function_version;
+    path directory; //empty if grids are not persisted
+    boost::uint64_t scoring_hash;
+    sz num_threads;
+    sz max_entries;
+    mutable boost::mutex lock; //protects the members below, not the entries
+    boost::unordered_map<key, boost::shared_ptr<entry> > entries;
+    sz uses; //calls to get
+    //the receptor atoms are only hashed again when their generation changes,
+    //so ligands sharing a receptor hash it once
+    receptor_print last_receptor;
+};
@@ -6,6 +6,7 @@
  */
 
 #include "cnn_scorer.h"
+#include "profiler.h"
 #include "gridoptions.h"
 
 #include "caffe/proto/caffe.pb.h"
@@ -24,7 +25,7 @@ using namespace std;
 //initialize from commandline options
 //throw error if missing required info
 CNNScorer::CNNScorer(const cnn_options& opts)
-    : mgrid(NULL), cnnopts(opts), mtx(new boost::recursive_mutex), current_center(NAN,NAN,NAN) {
+    : mgrid(NULL), cnnopts(opts), current_center(NAN,NAN,NAN) {
 
   if (cnnopts.cnn_scoring || cnnopts.cnn_refinement) {
     NetParameter param;
@@ -47,12 +48,13 @@ CNNScorer::CNNScorer(const cnn_options& opts)
     param.mutable_state()->set_phase(TEST);
 
     LayerParameter *first = param.mutable_layer(0);
-    mgridparam = first->mutable_molgrid_data_param();
+    MolGridDataParameter *mgridparam = first->mutable_molgrid_data_param();
     if (mgridparam == NULL) {
       throw usage_error("First layer of model must be MolGridData.");
     }
     mgridparam->set_inmemory(true);
     mgridparam->set_subgrid_dim(opts.subgrid_dim);
+    mgridparam->set_grid_threads(opts.grid_threads);
 
     if (cnnopts.cnn_model.size() == 0) {
       const char *recmap = cnn_models[cnnopts.cnn_model_name].recmap;
@@ -101,7 +103,7 @@ CNNScorer::CNNScorer(const cnn_options& opts)
     //check that network matches our expectations
     //the first layer must be MolGridLayer
     const vector<caffe::shared_ptr<Layer<Dtype> > >& layers = net->layers();
-    mgrid = dynamic_cast<MolGridDataLayer<Dtype>*>(layers[0].get());
+    set_net(net);
     if (mgrid == NULL) {
       throw usage_error("First layer of model must be MolGridDataLayer.");
     }
@@ -118,8 +120,93 @@ CNNScorer::CNNScorer(const cnn_options& opts)
       throw usage_error(
           "Model output layer does not have exactly two outputs.");
     }
+
+    nets.reset(new net_pool(param, net));
+  }
+
+}
+
+CNNScorer::CNNScorer(const CNNScorer& rhs)
+    : nets(rhs.nets), mgrid(NULL), cnnopts(rhs.cnnopts),
+        current_center(rhs.current_center) {
+  if (nets) set_net(nets->acquire());
+}
+
+CNNScorer& CNNScorer::operator=(const CNNScorer& rhs) {
+  if (this == &rhs) return *this;
+  if (nets) nets->release(net);
+  nets = rhs.nets;
+  cnnopts = rhs.cnnopts;
+  current_center = rhs.current_center;
+  set_net(nets ? nets->acquire() : caffe::shared_ptr<Net<Dtype> >());
+  return *this;
+}
+
+CNNScorer::CNNScorer(CNNScorer&& rhs)
+    : mgrid(NULL), current_center(NAN, NAN, NAN) {
+  swap(rhs);
+}
+
+//our old net goes back to the pool when rhs is destroyed
+CNNScorer& CNNScorer::operator=(CNNScorer&& rhs) {
+  swap(rhs);
+  return *this;
+}
+
+void CNNScorer::swap(CNNScorer& rhs) {
+  std::swap(nets, rhs.nets);
+  std::swap(net, rhs.net);
+  std::swap(mgrid, rhs.mgrid);
+  std::swap(cnnopts, rhs.cnnopts);
+  std::swap(gradient, rhs.gradient);
+  std::swap(atoms, rhs.atoms);
+  std::swap(channels, rhs.channels);
+  std::swap(current_center, rhs.current_center);
+}
+
+CNNScorer::~CNNScorer() {
+  if (nets) nets->release(net);
+}
+
+void CNNScorer::set_net(const caffe::shared_ptr<Net<Dtype> >& n) {
+  net = n;
+  mgrid = NULL;
+  if (net) mgrid = dynamic_cast<MolGridDataLayer<Dtype>*>(net->layers()[0].get());
+}
+
+CNNScorer::net_pool::net_pool(const NetParameter& p,
+    const caffe::shared_ptr<Net<Dtype> >& trained)
+    : param(p), weights(trained) {
+  //move the weights to where they will be read now, concurrent first
+  //reads of the shared blobs would race to sync them
+  const vector<caffe::shared_ptr<Blob<Dtype> > >& params = weights->params();
+  for (unsigned i = 0, n = params.size(); i < n; i++) {
+    if (Caffe::mode() == Caffe::GPU)
+      params[i]->gpu_data();
+    else
+      params[i]->cpu_data();
+  }
+}
+
+caffe::shared_ptr<Net<CNNScorer::Dtype> > CNNScorer::net_pool::acquire() {
+  {
+    boost::lock_guard<boost::mutex> L(lock);
+    if (available.size() > 0) {
+      caffe::shared_ptr<Net<Dtype> > ret = available.back();
+      available.pop_back();
+      return ret;
+    }
   }
+  //only the activations are allocated per net
+  caffe::shared_ptr<Net<Dtype> > ret(new Net<Dtype>(param));
+  ret->ShareTrainedLayersWith(weights.get());
+  return ret;
+}
 
+void CNNScorer::net_pool::release(const caffe::shared_ptr<Net<Dtype> >& n) {
+  if (!n) return;
+  boost::lock_guard<boost::mutex> L(lock);
+  available.push_back(n);
 }
 
 //returns gradient scores per atom
@@ -157,8 +244,6 @@ std::unordered_map<string, float> CNNScorer::get_scores_per_atom(bool receptor,
 
 void CNNScorer::lrp(const model& m, const string& layer_to_ignore,
     bool zero_values) {
-  boost::lock_guard<boost::recursive_mutex> guard(*mtx);
-
   caffe::Caffe::set_random_seed(cnnopts.seed); //same random rotations for each ligand..
 
   mgrid->setReceptor(m.get_fixed_atoms());
@@ -182,8 +267,6 @@ void CNNScorer::lrp(const model& m, const string& layer_to_ignore,
 //do forward and backward pass for gradient visualization
 void CNNScorer::gradient_setup(const model& m, const string& recname,
     const string& ligname, const string& layer_to_ignore) {
-  boost::lock_guard<boost::recursive_mutex> guard(*mtx);
-
   caffe::Caffe::set_random_seed(cnnopts.seed); //same random rotations for each ligand..
 
   mgrid->setReceptor(m.get_fixed_atoms());
@@ -260,7 +343,7 @@ void CNNScorer::set_center_from_model(model& m) {
   }
   current_center /= (float) m.coordinates().size();
 
-  //mgrid is shared across threads, so do not set center except when guarded by mutex
+  //the grid center is set from current_center when scoring
 
   if (cnnopts.verbose) {
     std::cout << "new center: ";
@@ -292,7 +375,6 @@ void CNNScorer::get_net_output(Dtype& score, Dtype& aff, Dtype& loss) {
 //ALERT: clears minus forces
 float CNNScorer::score(model& m, bool compute_gradient, float& affinity,
     float& loss) {
-  boost::lock_guard<boost::recursive_mutex> guard(*mtx);
   if (!initialized()) return -1.0;
 
   caffe::Caffe::set_random_seed(cnnopts.seed); //same random rotations for each ligand..
@@ -328,7 +410,10 @@ float CNNScorer::score(model& m, bool compute_gradient, float& affinity,
   unsigned cnt = 0;
   mgrid->setLabels(1); //for now pose optimization only
   for (unsigned r = 0, n = max(cnnopts.cnn_rotations, 1U); r < n; r++) {
-    net->Forward(); //do all rotations at once if requested
+    {
+      PROFILE_SCOPE(ProfileCNNForward);
+      net->Forward(); //do all rotations at once if requested
+    }
     get_net_output(s, a, l);
     score += s;
     affinity += a;
@@ -341,7 +426,10 @@ float CNNScorer::score(model& m, bool compute_gradient, float& affinity,
 
     if (compute_gradient || cnnopts.outputxyz) {
       mgrid->enableAtomGradients();
-      net->Backward();
+      {
+        PROFILE_SCOPE(ProfileCNNBackward);
+        net->Backward();
+      }
       mgrid->getLigandGradient(0, gradient);
       mgrid->getReceptorTransformationGradient(0, m.rec_change.position,
           m.rec_change.orientation);
@@ -388,6 +476,161 @@ float CNNScorer::score(model& m, bool compute_gradient, float& affinity,
   return score / cnt;
 }
 
+void CNNScorer::score(model& m, const std::vector<conf>& confs,
+    std::vector<float>& scores, std::vector<float>& affinities,
+    std::vector<std::vector<float3> > *gradients) {
+  //like score, -1 for both when there is no network
+  scores.assign(confs.size(), -1.0);
+  affinities.assign(confs.size(), -1.0);
+  if (gradients) gradients->assign(confs.size(), vector<float3>());
+  if (!initialized() || confs.empty()) return;
+  scores.assign(confs.size(), 0.0);
+  affinities.assign(confs.size(), 0.0);
+
+  //the batch shares one receptor transform, so poses that moved the
+  //receptor differently are scored one at a time
+  if (!cnnopts.move_minimize_frame) {
+    bool samerec = true;
+    VINA_FOR_IN(i, confs) {
+      if (!eq(confs[i].receptor.position, confs[0].receptor.position) ||
+          !eq(confs[i].receptor.orientation, confs[0].receptor.orientation)) {
+        samerec = false;
+        break;
+      }
+    }
+    if (!samerec) {
+      VINA_FOR_IN(i, confs) {
+        float loss = 0;
+        m.set(confs[i]);
+        scores[i] = score(m, gradients != NULL, affinities[i], loss);
+        if (gradients) {
+          //score leaves the averaged gradient of the heavy atoms in minus_forces
+          vector<float3>& g = (*gradients)[i];
+          VINA_FOR(j, m.num_movable_atoms()) {
+            if (m.movable_atom(j).is_hydrogen()) continue;
+            const vec& f = m.minus_forces[j];
+            g.push_back(float3(f[0], f[1], f[2]));
+          }
+        }
+      }
+      return;
+    }
+  }
+
+  caffe::Caffe::set_random_seed(cnnopts.seed); //same random rotations for each ligand..
+
+  if (!isnan(cnnopts.cnn_center[0])) {
+    mgrid->setCenter(cnnopts.cnn_center);
+    current_center = mgrid->getCenter();
+  } else {
+    mgrid->setCenter(current_center);
+  }
+
+  //one example per conf, centered the same way score centers a single pose
+  VINA_FOR_IN(i, confs) {
+    m.set(confs[i]);
+    if (i == 0)
+      mgrid->setLigand(m.get_movable_atoms(), m.coordinates(), cnnopts.move_minimize_frame);
+    else
+      mgrid->addLigand(m.get_movable_atoms(), m.coordinates(), cnnopts.move_minimize_frame);
+  }
+  if (!cnnopts.move_minimize_frame) {
+    mgrid->setReceptor(m.get_fixed_atoms(), m.rec_conf.position, m.rec_conf.orientation);
+  } else {
+    mgrid->setReceptor(m.get_fixed_atoms());
+    current_center = mgrid->getCenter();
+  }
+  mgrid->setLabels(1); //for now pose optimization only
+
+  const caffe::shared_ptr<Blob<Dtype> > outblob = net->blob_by_name("output");
+  const caffe::shared_ptr<Blob<Dtype> > affblob = net->blob_by_name("predaff");
+  unsigned cnt = max(cnnopts.cnn_rotations, 1U);
+  for (unsigned r = 0; r < cnt; r++) {
+    {
+      PROFILE_SCOPE(ProfileCNNForward);
+      net->Forward();
+    }
+    const Dtype *out = outblob->cpu_data();
+    VINA_FOR_IN(i, confs) {
+      scores[i] += out[2 * i + 1];
+      if (affblob) affinities[i] += affblob->cpu_data()[i];
+    }
+
+    if (gradients) {
+      mgrid->enableAtomGradients();
+      {
+        PROFILE_SCOPE(ProfileCNNBackward);
+        net->Backward();
+      }
+      VINA_FOR_IN(i, confs) {
+        mgrid->getLigandGradient(i, gradient);
+        vector<float3>& g = (*gradients)[i];
+        if (g.empty()) g.assign(gradient.size(), float3(0, 0, 0));
+        VINA_FOR_IN(j, gradient) {
+          g[j].x += gradient[j].x / cnt;
+          g[j].y += gradient[j].y / cnt;
+          g[j].z += gradient[j].z / cnt;
+        }
+      }
+    }
+  }
+
+  VINA_FOR_IN(i, confs) {
+    scores[i] /= cnt;
+    affinities[i] /= cnt;
+  }
+}
+
+void CNNScorer::score_masked(model& m, const std::vector<szv>& masks,
+    std::vector<float>& scores, std::vector<float>& affinities) {
+  scores.assign(masks.size(), -1.0);
+  affinities.assign(masks.size(), -1.0);
+  if (!initialized() || masks.empty()) return;
+  scores.assign(masks.size(), 0.0);
+  affinities.assign(masks.size(), 0.0);
+
+  caffe::Caffe::set_random_seed(cnnopts.seed); //same random rotations for each ligand..
+
+  if (!isnan(cnnopts.cnn_center[0])) {
+    mgrid->setCenter(cnnopts.cnn_center);
+    current_center = mgrid->getCenter();
+  } else {
+    mgrid->setCenter(current_center);
+  }
+
+  mgrid->setLigand(m.get_movable_atoms(), m.coordinates(), cnnopts.move_minimize_frame);
+  if (!cnnopts.move_minimize_frame) {
+    mgrid->setReceptor(m.get_fixed_atoms(), m.rec_conf.position, m.rec_conf.orientation);
+  } else {
+    mgrid->setReceptor(m.get_fixed_atoms());
+    current_center = mgrid->getCenter();
+  }
+  //example 0 is the unmasked complex, the masks follow it
+  VINA_FOR_IN(i, masks)
+    mgrid->addReceptorMask(std::vector<unsigned>(masks[i].begin(), masks[i].end()));
+  mgrid->setLabels(1); //for now pose optimization only
+
+  const caffe::shared_ptr<Blob<Dtype> > outblob = net->blob_by_name("output");
+  const caffe::shared_ptr<Blob<Dtype> > affblob = net->blob_by_name("predaff");
+  unsigned cnt = max(cnnopts.cnn_rotations, 1U);
+  for (unsigned r = 0; r < cnt; r++) {
+    {
+      PROFILE_SCOPE(ProfileCNNForward);
+      net->Forward();
+    }
+    const Dtype *out = outblob->cpu_data();
+    VINA_FOR_IN(i, masks) {
+      scores[i] += out[2 * (i + 1) + 1];
+      if (affblob) affinities[i] += affblob->cpu_data()[i + 1];
+    }
+  }
+
+  VINA_FOR_IN(i, masks) {
+    scores[i] /= cnt;
+    affinities[i] /= cnt;
+  }
+}
+
 //return only score
 float CNNScorer::score(model& m) {
   float aff = 0;
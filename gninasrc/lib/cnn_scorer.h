@@ -13,25 +13,41 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/molgrid_data_layer.hpp"
 #include "boost/thread/mutex.hpp"
-#include <boost/thread/recursive_mutex.hpp>
 
 #include "nngridder.h"
 #include "model.h"
 #include "cnn_data.h"
 
+struct bench_access;
+
 /* This class evaluates protein-ligand poses according to a provided
  * Caffe convolutional neural net (CNN) model.
  */
 
 class CNNScorer {
     typedef float Dtype;
-    caffe::shared_ptr<caffe::Net<Dtype> > net;
+
+    //nets built from one model that all share the weights of the first;
+    //every scorer checks a net out for as long as it lives, so copies of a
+    //scorer (one per thread or Monte Carlo chain) can score concurrently
+    //while the weights are only held once
+    class net_pool {
+        caffe::NetParameter param;
+        caffe::shared_ptr<caffe::Net<Dtype> > weights; //net the weights were loaded into
+        boost::mutex lock; //protects available
+        vector<caffe::shared_ptr<caffe::Net<Dtype> > > available;
+      public:
+        net_pool(const caffe::NetParameter& p,
+            const caffe::shared_ptr<caffe::Net<Dtype> >& trained);
+        caffe::shared_ptr<caffe::Net<Dtype> > acquire();
+        void release(const caffe::shared_ptr<caffe::Net<Dtype> >& n);
+    };
+
+    caffe::shared_ptr<net_pool> nets; //shared by every copy
+    caffe::shared_ptr<caffe::Net<Dtype> > net; //checked out of nets
     caffe::MolGridDataLayer<Dtype> *mgrid;
-    caffe::MolGridDataParameter *mgridparam;
     cnn_options cnnopts;
 
-    caffe::shared_ptr<boost::recursive_mutex> mtx; //todo, enable parallel scoring
-
     //scratch vectors to avoid memory reallocation
     vector<float3> gradient;
     vector<float4> atoms;
@@ -40,13 +56,20 @@ class CNNScorer {
 
   public:
     CNNScorer()
-        : mgrid(NULL), mtx(new boost::recursive_mutex), current_center(NAN,NAN,NAN) {
-    }
-    virtual ~CNNScorer() {
+        : mgrid(NULL), current_center(NAN,NAN,NAN) {
     }
+    virtual ~CNNScorer();
 
     CNNScorer(const cnn_options& opts);
 
+    //copies get their own net, sharing the weights of rhs
+    CNNScorer(const CNNScorer& rhs);
+    CNNScorer& operator=(const CNNScorer& rhs);
+    //moves take over the net of rhs instead of checking out another one
+    CNNScorer(CNNScorer&& rhs);
+    CNNScorer& operator=(CNNScorer&& rhs);
+    void swap(CNNScorer& rhs);
+
     bool initialized() const {
       return net.get();
     }
@@ -55,6 +78,18 @@ class CNNScorer {
 
     float score(model& m); //score only - no gradient
     float score(model& m, bool compute_gradient, float& affinity, float& loss);
+    //score each of confs of the ligand in m against the same receptor in a
+    //single batch; if gradients is set it gets the ligand atom gradient of
+    //every conf; leaves m in the last conf; confs with different receptor
+    //transforms (without move_minimize_frame) are scored one at a time
+    void score(model& m, const std::vector<conf>& confs,
+        std::vector<float>& scores, std::vector<float>& affinities,
+        std::vector<std::vector<float3> > *gradients = NULL);
+    //score the ligand of m against its receptor with each of masks (indices
+    //into the receptor atoms of m) taken out, in a single batch; the complex
+    //is gridded once and each mask only subtracts the density of its atoms
+    void score_masked(model& m, const std::vector<szv>& masks,
+        std::vector<float>& scores, std::vector<float>& affinities);
 
     void outputDX(const string& prefix, double scale = 1.0, bool relevance =
         false, string layer_to_ignore = "", bool zero_values = false);
@@ -86,11 +121,13 @@ class CNNScorer {
     }
 
   protected:
+    void set_net(const caffe::shared_ptr<caffe::Net<Dtype> >& n);
     void get_net_output(Dtype& score, Dtype& aff, Dtype& loss);
     void check_gradient();
     friend void test_set_atom_gradients();
     friend void test_vanilla_grids();
     friend void test_subcube_grids();
+    friend struct bench_access;
     template <typename atomT, typename MGridT, typename GridMakerT> 
       friend void set_cnn_grids(MGridT* mgrid, GridMakerT& gmaker, 
           std::vector<atom_params>& mol_atoms, std::vector<atomT>& mol_types);
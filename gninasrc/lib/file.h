@@ -30,6 +30,7 @@
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/device/null.hpp>
 #include "common.h"
+#include "parallel_gzip.h"
 
 struct file_error {
     path name;
@@ -118,7 +119,8 @@ class izfile : public boost::iostreams::filtering_stream<boost::iostreams::input
 };
 
 //dkoes - wrapper for an output file that will be gzipped if the file
-//name ends in .gz
+//name ends in .gz; with more than one gzip thread blocks of the output are
+//compressed concurrently as separate gzip members
 class ozfile : public boost::iostreams::filtering_stream<
     boost::iostreams::output> {
 
@@ -128,21 +130,29 @@ class ozfile : public boost::iostreams::filtering_stream<
     ozfile() {
     }
 
-    ozfile(const path& name) {
-      open(name);
+    ozfile(const path& name, unsigned gzip_threads = 1) {
+      open(name, gzip_threads);
     }
 
     //opens file name, with gzip filter if name ends with .gz
+    //if append is set, output is added to the end of an existing file
     //return non-gz extension
-    std::string open(const path& name) {
+    std::string open(const path& name, unsigned gzip_threads = 1,
+        bool append = false) {
       using namespace boost::filesystem;
-      uncompressed_outfile.open(name.c_str());
+      uncompressed_outfile.open(name.c_str(),
+          append ? std::ios::out | std::ios::app : std::ios::out);
       if (!uncompressed_outfile) throw file_error(name, false);
 
       std::string ext = boost::filesystem::extension(name);
       //should we gzip?
       if (ext == ".gz") {
         ext = extension(basename(name));
+        if (gzip_threads > 1) {
+          push(parallel_gzip_sink(uncompressed_outfile, gzip_threads));
+          if (!(*this)) throw file_error(name, false);
+          return ext;
+        }
         push(boost::iostreams::gzip_compressor());
       }
       push(uncompressed_outfile);
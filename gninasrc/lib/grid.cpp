@@ -19,6 +19,7 @@
  The Scripps Research Institute
 
  */
+#include <atomic>
 #include <string>
 #include "grid.h"
 #include "grid_dim.h"
@@ -27,6 +28,17 @@
 //evaluate using grid, if deriv is null, do not calc deriviative
 fl grid::evaluate(const atom& a, const vec& location, fl slope, fl c,
     vec *deriv /*=NULL*/) const {
+  if (mapping) {
+    fl ret = evaluate_aux(mdata, location, slope, c, deriv);
+    if (a.charge != 0 && mchargedata.dim0() > 0) {
+      vec cderiv(0, 0, 0);
+      ret += a.charge
+          * evaluate_aux(mchargedata, location, slope, c,
+              deriv ? &cderiv : NULL);
+      if (deriv) *deriv += a.charge * cderiv;
+    }
+    return ret;
+  }
   //charge indep
   fl ret = evaluate_aux(data, location, slope, c, deriv);
   if (a.charge != 0 && chargedata.dim0() > 0) {
@@ -47,26 +59,53 @@ fl grid::evaluate_user(const vec& location, fl slope, vec *deriv) const {
   return evaluate_aux(data, location, slope, (fl) 1000, deriv);
 }
 
-//allocate memory for grid (but don't fill in values)
-//only initialize charge dependent values if hashcharged is true
-void grid::init(const grid_dims& gd, bool hascharged) {
-  data.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
-  if (hascharged) chargedata.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
+//set coordinate mapping for a grid with n+1 points in each dimension
+void grid::set_dims(const grid_dims& gd) {
   m_init = vec(gd[0].begin, gd[1].begin, gd[2].begin);
   m_range = vec(gd[0].span(), gd[1].span(), gd[2].span());
   assert(m_range[0] > 0);
   assert(m_range[1] > 0);
   assert(m_range[2] > 0);
-  m_dim_fl_minus_1 = vec(data.dim0() - 1.0, data.dim1() - 1.0,
-      data.dim2() - 1.0);
+  m_dim_fl_minus_1 = vec(fl(gd[0].n), fl(gd[1].n), fl(gd[2].n));
   VINA_FOR(i, 3) {
     m_factor[i] = m_dim_fl_minus_1[i] / m_range[i];
     m_factor_inv[i] = 1 / m_factor[i];
   }
 }
 
+//allocate memory for grid (but don't fill in values)
+//only initialize charge dependent values if hashcharged is true
+sz grid::next_generation() {
+  static std::atomic<sz> last(0);
+  return ++last;
+}
+
+void grid::init(const grid_dims& gd, bool hascharged) {
+  gen = next_generation();
+  data.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
+  if (hascharged) chargedata.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
+  set_dims(gd);
+}
+
+void grid::init_mapped(const grid_dims& gd,
+    boost::shared_ptr<const void> mapping_, const fl* values,
+    const fl* chargevalues) {
+  gen = next_generation();
+  data = array3d<fl>();
+  chargedata = array3d<fl>();
+  mapping = mapping_;
+  mdata = array3d_view<fl>(values, gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
+  if (chargevalues)
+    mchargedata = array3d_view<fl>(chargevalues, gd[0].n + 1, gd[1].n + 1,
+        gd[2].n + 1);
+  else
+    mchargedata = array3d_view<fl>();
+  set_dims(gd);
+}
+
 void grid::init(const grid_dims& gd, std::istream& user_in,
     fl ug_scaling_factor) {
+  gen = next_generation();
   //set up the grid with the passed grid_dims
   data.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1); //was + 1
   m_init = vec(gd[0].begin, gd[1].begin, gd[2].begin);
@@ -92,7 +131,8 @@ void grid::init(const grid_dims& gd, std::istream& user_in,
   }
 }
 
-fl grid::evaluate_aux(const array3d<fl>& m_data, const vec& location, fl slope,
+template<typename Array>
+fl grid::evaluate_aux(const Array& m_data, const vec& location, fl slope,
     fl v, vec* deriv) const { // sets *deriv if not NULL
   vec s = elementwise_product(location - m_init, m_factor);
 
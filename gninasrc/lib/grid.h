@@ -23,6 +23,7 @@
 #ifndef VINA_GRID_H
 #define VINA_GRID_H
 
+#include <boost/shared_ptr.hpp>
 #include "array3d.h"
 #include "grid_dim.h"
 #include "curl.h"
@@ -37,6 +38,13 @@ class grid { // FIXME rm 'm_', consistent with my new style
     vec m_factor_inv;
     array3d<fl> data;
     array3d<fl> chargedata; //needs to be multiplied by atom charge
+    //if set, values are read from this shared read-only mapping through
+    //mdata/mchargedata instead of data/chargedata
+    boost::shared_ptr<const void> mapping;
+    array3d_view<fl> mdata;
+    array3d_view<fl> mchargedata;
+    sz gen; //see generation()
+    static sz next_generation();
 
     friend class cache;
     friend class non_cache;
@@ -44,26 +52,43 @@ class grid { // FIXME rm 'm_', consistent with my new style
   public:
     grid()
         : m_init(0, 0, 0), m_range(1, 1, 1), m_factor(1, 1, 1),
-            m_dim_fl_minus_1(-1, -1, -1), m_factor_inv(1, 1, 1) {
+            m_dim_fl_minus_1(-1, -1, -1), m_factor_inv(1, 1, 1),
+            gen(next_generation()) {
     } // not private
     grid(const grid_dims& gd, bool hascharged) {
       init(gd, hascharged);
     }
     void init(const grid_dims& gd, bool hascharged);
     void init(const grid_dims& gd, std::istream& user_in, fl ug_scaling_factor);
+    //use values owned by mapping (chargevalues may be NULL) instead of
+    //allocating memory; values must be laid out as in array3d
+    void init_mapped(const grid_dims& gd, boost::shared_ptr<const void> mapping_,
+        const fl* values, const fl* chargevalues);
+    bool mapped() const {
+      return bool(mapping);
+    }
     vec index_to_argument(sz x, sz y, sz z) const {
       return vec(m_init[0] + m_factor_inv[0] * x,
           m_init[1] + m_factor_inv[1] * y, m_init[2] + m_factor_inv[2] * z);
     }
+    //changes, to a value never used before, every time the grid is
+    //initialized; copies share it
+    sz generation() const {
+      return gen;
+    }
     bool initialized() const {
+      if (mapping)
+        return mdata.dim0() > 0 && mdata.dim1() > 0 && mdata.dim2() > 0;
       return data.dim0() > 0 && data.dim1() > 0 && data.dim2() > 0;
     }
     fl evaluate(const atom& a, const vec& location, fl slope, fl c, vec* deriv =
         NULL) const;
     fl evaluate_user(const vec& location, fl slope, vec* deriv = NULL) const;
   private:
-    fl evaluate_aux(const array3d<fl>& m_data, const vec& location, fl slope,
+    template<typename Array>
+    fl evaluate_aux(const Array& m_data, const vec& location, fl slope,
         fl v, vec* deriv) const; // sets *deriv if not NULL
+    void set_dims(const grid_dims& gd);
     friend class boost::serialization::access;
     template<class Archive>
     void serialize(Archive& ar, const unsigned version) {
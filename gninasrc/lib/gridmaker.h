@@ -12,6 +12,7 @@
 
 #include <vector>
 #include <cmath>
+#include <climits>
 #include <cuda.h>
 #include <stdarg.h>
 #include <device_types.h>
@@ -24,6 +25,7 @@
 #include "quaternion.h"
 #include "gridoptions.h"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/grid_threads.hpp"
 
 #ifndef VINA_ATOM_CONSTANTS_H
 #include "gninasrc/lib/atom_constants.h"
@@ -38,9 +40,11 @@ void set_atom_gradients(GridMakerT gmaker, const float4* ainfo, short* gridindic
     float3* agrads, float3 centroid, const qt Q, float3 translation, const Dtype* grids, 
     unsigned remainder_offset, bool isrelevance=false);
 
+//only grid points with x index in [xbegin,xend) are set
 template<typename Grids, typename GridMakerT, typename quaternion>
 void set_atom_cpu(float4 ainfo, int whichgrid, const quaternion& Q, 
-    Grids& grids, GridMakerT& gmaker);
+    Grids& grids, GridMakerT& gmaker, unsigned xbegin = 0,
+    unsigned xend = UINT_MAX);
 
 template<typename Grids, typename GridMakerT, typename quaternion>
 void set_atom_gradient_cpu(const float4& ainfo, int whichgrid,
@@ -58,11 +62,12 @@ class GridMaker {
     unsigned dim; //number of points on each side (grid)
     bool binary;
     bool spherize; //mask out atoms not within sphere of center
+    caffe::GridThreads *cpu_threads; //not owned, NULL to grid on the calling thread
   
   public:
     template<typename Grids, typename GridMakerT, typename quaternion> friend 
       void set_atom_cpu(float4 ainfo, int whichgrid, const quaternion& Q, 
-      Grids& grids, GridMakerT& gmaker);
+      Grids& grids, GridMakerT& gmaker, unsigned xbegin, unsigned xend);
 
     template<typename Grids, typename GridMakerT, typename quaternion> friend 
       void set_atom_gradient_cpu(const float4& ainfo, int whichgrid,
@@ -79,7 +84,7 @@ class GridMaker {
     GridMaker(float res = 0, float d = 0, float rm = 1.5, bool b = false,
         bool s = false)
         : radiusmultiple(rm), resolution(res), dimension(d), binary(b),
-            spherize(s) {
+            spherize(s), cpu_threads(NULL) {
       initialize(res,d,rm,b,s);
     }
   
@@ -110,6 +115,11 @@ class GridMaker {
 
     __host__ __device__ float get_radiusmultiple() {return radiusmultiple;}
 
+    //split setAtomsCPU across threads, each setting a slab of x planes
+    void setCPUThreads(caffe::GridThreads *threads) {
+      cpu_threads = threads;
+    }
+
     //mus set center before gridding
     virtual void setCenter(double x, double y, double z) {
       center.x = x;
@@ -136,6 +146,15 @@ class GridMaker {
       std::fill(grids.data(), grids.data() + grids.num_elements(), 0.0);
     }
 
+    //zero x planes [xbegin,xend) of every grid
+    template<typename Grids>
+    void zeroGridsCPU(Grids& grids, unsigned xbegin, unsigned xend) {
+      for (unsigned i = 0, n = grids.size(); i < n; i++) {
+        auto start = &grids[i][xbegin][0][0];
+        std::fill(start, start + (xend - xbegin) * dim * dim, 0.0);
+      }
+    }
+
     pair<unsigned, unsigned> getrange(const float2& d, double c, double r) {
       pair<unsigned, unsigned> ret(0, 0);
       double low = c - r - d.x;
@@ -223,6 +242,19 @@ class GridMaker {
     template<typename Grids>
     void setAtomsCPU(const vector<float4>& ainfo, const vector<short>& gridindex,  
         const quaternion& Q, Grids& grids) {
+      if (cpu_threads && cpu_threads->size() > 1) {
+        //every thread owns a slab of x planes in all channels and looks at
+        //every atom, so no two threads ever write the same point
+        cpu_threads->Run(dim, [&](unsigned xbegin, unsigned xend) {
+          zeroGridsCPU(grids, xbegin, xend);
+          for (unsigned i = 0, n = ainfo.size(); i < n; i++) {
+            int pos = gridindex[i];
+            if (pos >= 0)
+              set_atom_cpu(ainfo[i], pos, Q, grids, *this, xbegin, xend);
+          }
+        });
+        return;
+      }
       zeroGridsCPU(grids);
       for (unsigned i = 0, n = ainfo.size(); i < n; i++) {
         int pos = gridindex[i];
@@ -549,7 +581,7 @@ class SubcubeGridMaker : public GridMaker {
 
     template<typename Grids, typename GridMakerT, typename quaternion> friend 
       void set_atom_cpu(float4 ainfo, int whichgrid, const quaternion& Q, 
-      Grids& grids, GridMakerT& gmaker);
+      Grids& grids, GridMakerT& gmaker, unsigned xbegin, unsigned xend);
 
     template<typename Grids, typename GridMakerT, typename quaternion> friend 
       void set_atom_gradient_cpu(const float4& ainfo, int whichgrid,
@@ -772,7 +804,7 @@ class SubcubeGridMaker : public GridMaker {
 //set the relevant grid points for provided atom
 template<typename Grids, typename GridMakerT, typename quaternion>
 void set_atom_cpu(float4 ainfo, int whichgrid, const quaternion& Q, 
-    Grids& grids, GridMakerT& gmaker) {
+    Grids& grids, GridMakerT& gmaker, unsigned xbegin, unsigned xend) {
   float radius = ainfo.w;
   float r = radius * gmaker.radiusmultiple;
   float3 coords;
@@ -804,6 +836,8 @@ void set_atom_cpu(float4 ainfo, int whichgrid, const quaternion& Q,
   ranges[0] = gmaker.getrange(gmaker.dims[0], coords.x, r);
   ranges[1] = gmaker.getrange(gmaker.dims[1], coords.y, r);
   ranges[2] = gmaker.getrange(gmaker.dims[2], coords.z, r);
+  ranges[0].first = std::max(ranges[0].first, xbegin);
+  ranges[0].second = std::min(ranges[0].second, xend);
 
   //for every grid point possibly overlapped by this atom
   for (unsigned i = ranges[0].first, iend = ranges[0].second; i < iend; i++) {
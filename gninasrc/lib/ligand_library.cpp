@@ -0,0 +1,140 @@
+#include <cstring>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/filesystem/operations.hpp>
+#include "ligand_library.h"
+
+//header at the start of a library; all offsets are from the start of the file
+//index_offset is zero until the writer has finished
+struct ligand_library_header {
+    char magic[8];
+    boost::uint32_t version;
+    boost::uint32_t reserved;
+    boost::uint64_t count;
+    boost::uint64_t index_offset; //count+1 offsets, the last is the end of the records
+
+    static const boost::uint32_t current_version = 1;
+};
+static const char ligand_library_magic[8] = { 'G', 'N', 'I', 'N', 'A', 'L',
+    'I', 'B' };
+
+ligand_library_writer::ligand_library_writer(const path& name_)
+    : name(name_), out(name_, std::ios::binary), pos(0), closed(false) {
+  if (!out) throw file_error(name, false);
+  ligand_library_header h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, ligand_library_magic, sizeof(h.magic));
+  h.version = ligand_library_header::current_version;
+  out.write((const char*) &h, sizeof(h));
+  pos = sizeof(h);
+}
+
+//a library that was never closed is missing records, so don't leave it
+//where it could be mistaken for a finished one
+ligand_library_writer::~ligand_library_writer() {
+  if (closed) return;
+  out.close();
+  boost::system::error_code ignored;
+  boost::filesystem::remove(name, ignored);
+}
+
+void ligand_library_writer::add(const std::string& record) {
+  VINA_CHECK(!closed);
+  offsets.push_back(pos);
+  out.write(record.data(), record.size());
+  pos += record.size();
+  if (!out) throw file_error(name, false);
+}
+
+void ligand_library_writer::close() {
+  if (closed) return;
+  closed = true;
+
+  ligand_library_header h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, ligand_library_magic, sizeof(h.magic));
+  h.version = ligand_library_header::current_version;
+  h.count = offsets.size();
+
+  //align the index so it can be read in place
+  boost::uint64_t index = (pos + 7) / 8 * 8;
+  std::string pad(index - pos, 0);
+  out.write(pad.data(), pad.size());
+  h.index_offset = index;
+
+  offsets.push_back(pos);
+  out.write((const char*) &offsets[0], offsets.size() * sizeof(offsets[0]));
+  offsets.pop_back();
+
+  out.seekp(0);
+  out.write((const char*) &h, sizeof(h));
+  out.close();
+  if (!out) throw file_error(name, false);
+}
+
+ligand_library::ligand_library(const path& name_)
+    : name(name_), base(NULL), count(0), index_offset(0) {
+  using namespace boost::interprocess;
+  try {
+    file_mapping fm(name.string().c_str(), read_only);
+    region.reset(new mapped_region(fm, read_only));
+  } catch (interprocess_exception& e) {
+    throw file_error(name, true);
+  }
+  base = (const char*) region->get_address();
+  sz size = region->get_size();
+
+  ligand_library_header h;
+  if (size < sizeof(h)) throw parse_error(name, 0, "Not a ligand library");
+  std::memcpy(&h, base, sizeof(h));
+  if (std::memcmp(h.magic, ligand_library_magic, sizeof(h.magic)) != 0)
+    throw parse_error(name, 0, "Not a ligand library");
+  if (h.version != ligand_library_header::current_version)
+    throw parse_error(name, 0, "Unsupported ligand library version");
+  if (h.index_offset == 0)
+    throw parse_error(name, 0, "Incomplete ligand library");
+  if (h.index_offset < sizeof(h) || h.index_offset > size
+      || (size - h.index_offset) / sizeof(boost::uint64_t) < h.count + 1)
+    throw parse_error(name, 0, "Truncated ligand library");
+  count = h.count;
+  index_offset = h.index_offset;
+}
+
+boost::uint64_t ligand_library::offset(sz i) const {
+  boost::uint64_t off = 0;
+  std::memcpy(&off, base + index_offset + i * sizeof(off), sizeof(off));
+  return off;
+}
+
+void ligand_library::read(sz i, parsing_struct& p, context& c,
+    unsigned& torsdof) const {
+  VINA_CHECK(i < count);
+  boost::uint64_t begin = offset(i), end = offset(i + 1);
+  if (begin > end || end > index_offset || begin < sizeof(ligand_library_header))
+    throw parse_error(name, i, "Bad ligand library index");
+
+  namespace io = boost::iostreams;
+  io::filtering_stream<io::input> strm;
+  strm.push(io::gzip_decompressor());
+  strm.push(io::array_source(base + begin, end - begin));
+  try {
+    boost::archive::binary_iarchive serialin(strm,
+        boost::archive::no_header | boost::archive::no_tracking);
+    serialin >> torsdof;
+    serialin >> p;
+    serialin >> c;
+  } catch (boost::archive::archive_exception& e) {
+    throw parse_error(name, i, "Damaged ligand library record");
+  } catch (io::gzip_error& e) {
+    throw parse_error(name, i, "Damaged ligand library record");
+  }
+}
+
+bool ligand_library::is_library(const path& name) {
+  return boost::filesystem::extension(name) == ".gninalib";
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include "parsing.h"
+#include "file.h"
+
+namespace boost {
+namespace interprocess {
+class mapped_region;
+}
+}
+
+//indexed library of pre-parsed ligands (.gninalib)
+//the file is a header, the records, and an index of record offsets; each
+//record is one molecule exactly as written by GninaConverter::convertBinary
+//(a gzipped binary archive of torsdof, parsing_struct and context), so any
+//molecule can be decoded on its own without reading the ones before it
+
+//write a library; records are appended and the index is written on close,
+//without which the file is removed
+class ligand_library_writer {
+  public:
+    ligand_library_writer(const path& name);
+    ~ligand_library_writer();
+
+    //add an already converted record
+    void add(const std::string& record);
+    //write the index and header; the library is only valid after this
+    void close();
+
+    sz size() const {
+      return offsets.size();
+    }
+
+  private:
+    path name;
+    boost::filesystem::ofstream out;
+    std::vector<boost::uint64_t> offsets;
+    boost::uint64_t pos;
+    bool closed;
+};
+
+//read-only, memory mapped library; thread safe
+class ligand_library {
+  public:
+    //throws file_error if name can't be mapped, parse_error if it isn't a
+    //library
+    ligand_library(const path& name);
+
+    //number of molecules
+    sz size() const {
+      return count;
+    }
+
+    //decode molecule i (0 based); throws parse_error if the record is damaged
+    void read(sz i, parsing_struct& p, context& c, unsigned& torsdof) const;
+
+    //true if name has the library extension; libraries are never gzipped
+    //as a whole since each record already is
+    static bool is_library(const path& name);
+
+  private:
+    path name;
+    boost::shared_ptr<boost::interprocess::mapped_region> region;
+    const char *base;
+    boost::uint64_t count;
+    boost::uint64_t index_offset;
+
+    boost::uint64_t offset(sz i) const;
+};
@@ -5,7 +5,6 @@
 #include <boost/unordered_map.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include "non_cache_gpu.h"
-#include "loop_timer.h"
 
 /////////////////// begin MODEL::APPEND /////////////////////////
 
@@ -101,6 +100,24 @@ class appender {
         update(a[i]);
     }
 
+    //receptor atoms; a's atoms are only rewritten (and so copied, if shared)
+    //when one of their bonds is renumbered, which only happens for receptor
+    //atoms bonded to flexible residues
+    void append(shared_atomv& a, const shared_atomv& b) {
+      is_a = true;
+      VINA_FOR_IN(i, a) {
+        if (renumbered(a[i])) update(a.modify(i));
+      }
+
+      if (!b.empty()) {
+        atomv& atoms = a.modify();
+        sz a_sz = vector_append(atoms, b.get());
+        is_a = false;
+        VINA_RANGE(i, a_sz, atoms.size())
+          update(atoms[i]);
+      }
+    }
+
     //add b to a
     void append(context& a, const context& b) {
       append(a.pdbqttext, b.pdbqttext);
@@ -115,6 +132,14 @@ class appender {
         }
     }
 
+    bool renumbered(const atom& a) const {
+      VINA_FOR_IN(i, a.bonds) {
+        const atom_index& x = a.bonds[i].connected_atom_index;
+        if (!(operator()(x) == x)) return true;
+      }
+      return false;
+    }
+
     // internal_coords, coords, minus_forces, atoms
     template<typename T, typename A>
     void coords_append(std::vector<T, A>& a, const std::vector<T, A>& b) { // first arg becomes aaaaaaaabbbbbbbbbaab
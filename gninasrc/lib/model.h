@@ -281,6 +281,8 @@ struct conf_independent_inputs;
 struct pdbqt_initializer;
 // forward declaration - only declared in parse_pdbqt.cpp
 struct model_test;
+// forward declaration - only declared in gnina_bench.cpp
+struct bench_access;
 
 struct model {
 
@@ -484,7 +486,7 @@ struct model {
     fl clash_penalty() const;
 
     const atomv& get_fixed_atoms() const {
-      return grid_atoms;
+      return grid_atoms.get();
     }
     const atomv& get_movable_atoms() const {
       return atoms;
@@ -523,7 +525,7 @@ struct model {
     vector_mutable<ligand> ligands;
     sz m_num_movable_atoms;
     atomv atoms; // movable, inflex
-    atomv grid_atoms;
+    shared_atomv grid_atoms; //receptor, shared by copies of the model
     interacting_pairs other_pairs;
 
     //for cnn, allow rigid body movement of receptor
@@ -544,6 +546,7 @@ struct model {
     friend class appender;
     friend struct pdbqt_initializer;
     friend struct model_test;
+    friend struct bench_access;
     friend void test_eval_intra();
 
     const atom& get_atom(const atom_index& i) const {
@@ -551,7 +554,7 @@ struct model {
     }
 
     atom& get_atom(const atom_index& i) {
-      return (i.in_grid ? grid_atoms[i.i] : atoms[i.i]);
+      return (i.in_grid ? grid_atoms.modify(i.i) : atoms[i.i]);
     }
 
     void write_context(const context& c, std::ostream& out) const;
@@ -6,18 +6,23 @@
  */
 #include "molgetter.h"
 #include "parse_pdbqt.h"
+#include "parse_sdf.h"
 #include "parsing.h"
 #include <openbabel/mol.h>
 #include <openbabel/obconversion.h>
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/timer/timer.hpp>
+#include <boost/bind.hpp>
 #include "GninaConverter.h"
+#include "profiler.h"
+#include "caffe/util/grid_threads.hpp"
 
 //create the initial model from the specified receptor files
 //mostly because Matt kept complaining about it, this will automatically create
 //pdbqts if necessary using open babel
 void MolGetter::create_init_model(const std::string& rigid_name,
     const std::string& flex_name, FlexInfo& finfo, tee& log) {
+  PROFILE_SCOPE(ProfileReceptor);
   if (rigid_name.size() > 0) {
     //support specifying flexible residues explicitly as pdbqt, but only
     //in compatibility mode where receptor is pdbqt as well
@@ -96,37 +101,47 @@ void MolGetter::setInputFile(const std::string& fname) {
             {
           type = GNINA;
         } else
-          if (fname.length() > 0) //openbabel
-              {
-            type = OB;
-            //clear in case we had previous file
-            infileopener.clear();
-            infileopener.openForInput(conv, fname);
-            VINA_CHECK(conv.SetOutFormat("PDBQT"));
-
-          }
+          if (ligand_library::is_library(lpath)) {
+            type = LIBRARY;
+            library.reset(new ligand_library(lpath));
+            libpos = 0;
+          } else
+            if (native_sdf && infile.open(lpath, ".sdf")) {
+              type = SDF;
+              sdfbatch.clear();
+              //records the native parser rejects go through openbabel
+              VINA_CHECK(conv.SetInFormat("SDF"));
+              VINA_CHECK(conv.SetOutFormat("PDBQT"));
+              set_fixed_rotable_hydrogens(true); //as GninaConverter does
+            } else
+              if (fname.length() > 0) //openbabel
+                  {
+                type = OB;
+                //clear in case we had previous file
+                infileopener.clear();
+                infileopener.openForInput(conv, fname);
+                VINA_CHECK(conv.SetOutFormat("PDBQT"));
+
+              }
   }
 }
 
-//initialize model to initm and add next molecule
-//return false if no molecule available;
-bool MolGetter::readMoleculeIntoModel(model &m) {
-  //reinit the model
-  m = initm;
-  switch (type) {
-  case SMINA:
-  case GNINA: {
+void MolGetter::setParseThreads(unsigned n) {
+  parse_threads = std::max(n, 1U);
+  parsers.reset();
+}
+
+//parse records [begin,end) of the batch; anything that fails is left for
+//openbabel, which will report the problem
+void MolGetter::parseSDFRange(sz begin, sz end) {
+  for (sz i = begin; i < end; i++) {
+    sdf_record& r = sdfbatch[i];
     parsing_struct p;
     context c;
     unsigned torsdof = 0;
-    if (!infile) return false;
+    r.native = false;
     try {
-      boost::archive::binary_iarchive serialin(infile,
-          boost::archive::no_header | boost::archive::no_tracking);
-      serialin >> torsdof;
-      serialin >> p;
-      serialin >> c;
-
+      if (!parse_sdf_record(r.text, add_hydrogens, p, c, torsdof)) continue;
       non_rigid_parsed nr;
       postprocess_ligand(nr, p, c, torsdof);
       VINA_CHECK(nr.atoms_atoms_bonds.dim() == nr.atoms.size());
@@ -134,57 +149,204 @@ bool MolGetter::readMoleculeIntoModel(model &m) {
       pdbqt_initializer tmp;
       tmp.initialize_from_nrp(nr, c, true);
       tmp.initialize(nr.mobility_matrix());
+      if (strip_hydrogens) tmp.m.strip_hydrogens();
+      tmp.m.set_name(c.sdftext.name);
+      r.lig = tmp.m;
+      r.native = true;
+    } catch (parse_error& e) {
+    } catch (internal_error& e) {
+    }
+  }
+}
 
-      if (c.sdftext.valid()) {
-        //set name
-        m.set_name(c.sdftext.name);
-      }
+//read and parse the next batch of selected sdf records, one contiguous range
+//of records per parser thread; return false if there are no more records
+bool MolGetter::readSDFBatch() {
+  const unsigned per_thread = 16;
+  sdfbatch.clear();
+  sdf_record r;
+  while (sdfbatch.size() < parse_threads * per_thread
+      && !selection.past(recpos) && read_sdf_record(infile, r.text)) {
+    r.index = recpos++;
+    if (selection.selected(r.index)) sdfbatch.push_back(r);
+  }
+  sz n = sdfbatch.size();
+  if (n == 0) return false;
 
-      if (strip_hydrogens) tmp.m.strip_hydrogens();
-      m.append(tmp.m);
+  if (parse_threads == 1 || n < 2 * parse_threads)
+    parseSDFRange(0, n);
+  else {
+    //the threads are kept from batch to batch
+    if (!parsers) parsers.reset(new caffe::GridThreads(parse_threads));
+    parsers->Run(n, boost::bind(&MolGetter::parseSDFRange, this, _1, _2));
+  }
+  return true;
+}
+
+//move past the records before the next selected one; openbabel formats
+//that can are asked to just find where each record ends, the others
+//(SkipObjects not implemented) parse it as usual
+void MolGetter::skipOBRecords() {
+  sz next = selection.next(recpos);
+  OpenBabel::OBFormat *format = conv.GetInFormat();
+  while (recpos < next) {
+    int skipped = format ? format->SkipObjects(1, &conv) : 0;
+    if (skipped < 0) return; //end of the input
+    if (skipped == 0) {
+      OpenBabel::OBMol mol;
+      if (!conv.Read(&mol)) return;
+    }
+    recpos++;
+  }
+}
+
+//convert an openbabel molecule and append it to m
+//return false (after reporting) if it can't be converted
+bool MolGetter::appendOBMol(OpenBabel::OBMol& mol, model& m) {
+  std::string name = mol.GetTitle();
+  mol.StripSalts();
+  m.set_name(name);
+  try {
+    parsing_struct p;
+    context c;
+    unsigned torsdof = GninaConverter::convertParsing(mol, p, c,
+        add_hydrogens);
+    non_rigid_parsed nr;
+    postprocess_ligand(nr, p, c, torsdof);
+    VINA_CHECK(nr.atoms_atoms_bonds.dim() == nr.atoms.size());
+
+    pdbqt_initializer tmp;
+    tmp.initialize_from_nrp(nr, c, true);
+    tmp.initialize(nr.mobility_matrix());
+    if (strip_hydrogens) tmp.m.strip_hydrogens();
+
+    m.append(tmp.m);
+    return true;
+  } catch (parse_error& e) {
+    std::cerr << "\n\nParse error with molecule " << mol.GetTitle()
+        << " in file \"" << e.file.string() << "\": " << e.reason << '\n';
+    return false;
+  }
+}
 
+//build the ligand described by p and c and add it to m
+void MolGetter::appendParsed(model& m, parsing_struct& p, context& c,
+    unsigned torsdof) {
+  non_rigid_parsed nr;
+  postprocess_ligand(nr, p, c, torsdof);
+  VINA_CHECK(nr.atoms_atoms_bonds.dim() == nr.atoms.size());
+
+  pdbqt_initializer tmp;
+  tmp.initialize_from_nrp(nr, c, true);
+  tmp.initialize(nr.mobility_matrix());
+
+  if (c.sdftext.valid()) {
+    //set name
+    m.set_name(c.sdftext.name);
+  }
+
+  if (strip_hydrogens) tmp.m.strip_hydrogens();
+  m.append(tmp.m);
+}
+
+//initialize model to initm and add next molecule
+//return false if no molecule available;
+bool MolGetter::readMoleculeIntoModel(model &m) {
+  PROFILE_SCOPE(ProfileParse);
+  //reinit the model
+  m = initm;
+  switch (type) {
+  case SMINA:
+  case GNINA: {
+    for (;;) {
+      parsing_struct p;
+      context c;
+      unsigned torsdof = 0;
+      if (!infile || selection.past(recpos)) return false;
+      try {
+        boost::archive::binary_iarchive serialin(infile,
+            boost::archive::no_header | boost::archive::no_tracking);
+        serialin >> torsdof;
+        serialin >> p;
+        serialin >> c;
+      } catch (boost::archive::archive_exception& e) {
+        return false;
+      }
+      sz index = recpos++;
+      if (!selection.selected(index)) continue;
+
+      appendParsed(m, p, c, torsdof);
+      lastrec = index;
       return true;
-    } catch (boost::archive::archive_exception& e) {
-      return false;
     }
   }
     break;
   case PDBQT: {
     if (pdbqtdone) return false; //can only read one
+    pdbqtdone = true;
+    sz index = recpos++;
+    if (!selection.selected(index)) return false;
     model lig = parse_ligand_pdbqt(lpath);
     if (strip_hydrogens) lig.strip_hydrogens();
     m.append(lig);
-    pdbqtdone = true;
+    lastrec = index;
     return true;
   }
     break;
+  case LIBRARY: {
+    while (libpos < library->size() && !selection.past(recpos)) {
+      if (recpos < selection.begin) { //jump straight to the selection
+        sz skip = std::min(selection.begin - recpos, library->size() - libpos);
+        libpos += skip;
+        recpos += skip;
+        continue;
+      }
+      sz index = recpos++;
+      sz pos = libpos++;
+      if (!selection.selected(index)) continue;
+
+      parsing_struct p;
+      context c;
+      unsigned torsdof = 0;
+      library->read(pos, p, c, torsdof);
+      appendParsed(m, p, c, torsdof);
+      lastrec = index;
+      return true;
+    }
+    return false;
+  }
+    break;
+  case SDF: {
+    for (;;) {
+      if (sdfbatch.empty() && !readSDFBatch()) return false;
+      sdf_record& r = sdfbatch.front();
+      bool ok = false;
+      if (r.native) {
+        m.set_name(r.lig.get_name());
+        m.append(r.lig);
+        ok = true;
+      } else {
+        OpenBabel::OBMol mol;
+        if (conv.ReadString(&mol, r.text + "$$$$\n"))
+          ok = appendOBMol(mol, m);
+      }
+      if (ok) lastrec = r.index;
+      sdfbatch.pop_front();
+      if (ok) return true;
+    }
+  }
+    break;
   case OB: {
     OpenBabel::OBMol mol;
-    while (conv.Read(&mol)) //will return after first success
+    for (;;) //will return after first success
     {
-      std::string name = mol.GetTitle();
-      mol.StripSalts();
-      m.set_name(name);
-      try {
-        parsing_struct p;
-        context c;
-        unsigned torsdof = GninaConverter::convertParsing(mol, p, c,
-            add_hydrogens);
-        non_rigid_parsed nr;
-        postprocess_ligand(nr, p, c, torsdof);
-        VINA_CHECK(nr.atoms_atoms_bonds.dim() == nr.atoms.size());
-
-        pdbqt_initializer tmp;
-        tmp.initialize_from_nrp(nr, c, true);
-        tmp.initialize(nr.mobility_matrix());
-        if (strip_hydrogens) tmp.m.strip_hydrogens();
-
-        m.append(tmp.m);
+      skipOBRecords();
+      if (selection.past(recpos) || !conv.Read(&mol)) break;
+      sz index = recpos++;
+      if (!selection.selected(index)) continue;
+      if (appendOBMol(mol, m)) {
+        lastrec = index;
         return true;
-      } catch (parse_error& e) {
-        std::cerr << "\n\nParse error with molecule " << mol.GetTitle()
-            << " in file \"" << e.file.string() << "\": " << e.reason << '\n';
-        continue;
       }
     }
 
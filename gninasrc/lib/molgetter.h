@@ -8,19 +8,58 @@
 #ifndef MOLGETTER_H_
 #define MOLGETTER_H_
 
+#include <deque>
+#include <boost/shared_ptr.hpp>
 #include "model.h"
 #include "obmolopener.h"
 #include "flexinfo.h"
+#include "ligand_library.h"
+
+namespace caffe {
+class GridThreads;
+}
+
+//which input records to read; records are numbered from 0 over all the input
+//files given to a MolGetter, whether or not they can be parsed, so separate
+//runs over the same files can split the work between them
+struct ligand_selection {
+    sz begin, end; //only records in [begin,end)
+    sz shard, num_shards; //only records whose index % num_shards == shard
+
+    ligand_selection()
+        : begin(0), end(SIZE_MAX), shard(0), num_shards(1) {
+    }
+
+    bool selected(sz i) const {
+      return i >= begin && i < end && i % num_shards == shard;
+    }
+
+    //no record at or after i is selected
+    bool past(sz i) const {
+      return i >= end;
+    }
+
+    //the first selected record at or after i, end if there is none
+    sz next(sz i) const {
+      if (i < begin) i = begin;
+      sz r = i % num_shards;
+      if (r != shard) i += (shard + num_shards - r) % num_shards;
+      return std::min(i, end);
+    }
+};
 
 //this class abstracts reading molecules from a file
-//we have three means of input:
+//we have four means of input:
 //openbabel for general molecular data (default)
 //vina parse_pdbqt for pdbqt files (one ligand, obey rotational bonds)
 //smina format
+//native sdf parsing (opt in), falling back to openbabel for records it can't handle
+//indexed gnina libraries, which can be read from any position
+//only the records picked by the selection are parsed
 class MolGetter {
     model initm;
     enum Type {
-      OB, PDBQT, SMINA, GNINA, NONE
+      OB, PDBQT, SMINA, GNINA, SDF, LIBRARY, NONE
     }; //different inputs
 
     Type type;
@@ -37,20 +76,65 @@ class MolGetter {
     //pdbqt data
     bool pdbqtdone;
 
+    //records to read
+    ligand_selection selection;
+    sz recpos; //index of the next record over all input files
+    sz lastrec; //index of the record last read
+
+    //sdf data; records are read and parsed a batch at a time
+    struct sdf_record {
+        std::string text;
+        sz index;
+        bool native; //parsed into lig, otherwise left for openbabel
+        model lig;
+        sdf_record()
+            : index(0), native(false) {
+        }
+    };
+    std::deque<sdf_record> sdfbatch;
+    unsigned parse_threads;
+    boost::shared_ptr<caffe::GridThreads> parsers; //started on first use
+    bool native_sdf; //read .sdf with the native parser instead of openbabel
+
+    //library data
+    boost::shared_ptr<ligand_library> library;
+    sz libpos; //next molecule to read
+
+    void appendParsed(model& m, parsing_struct& p, context& c,
+        unsigned torsdof);
+
+    bool readSDFBatch();
+    void skipOBRecords();
+    void parseSDFRange(sz begin, sz end);
+    bool appendOBMol(OpenBabel::OBMol& mol, model& m);
+
   public:
 
     MolGetter(bool addH = true, bool stripH = true)
         : add_hydrogens(addH), strip_hydrogens(stripH), type(NONE),
-            pdbqtdone(false) {
+            pdbqtdone(false), recpos(0), lastrec(0), parse_threads(1),
+            native_sdf(false), libpos(0) {
     }
 
     MolGetter(const std::string& rigid_name, const std::string& flex_name,
         FlexInfo& finfo, bool addH, bool stripH, tee& log)
         : add_hydrogens(addH), strip_hydrogens(stripH), type(NONE),
-            pdbqtdone(false) {
+            pdbqtdone(false), recpos(0), lastrec(0), parse_threads(1),
+            native_sdf(false), libpos(0) {
       create_init_model(rigid_name, flex_name, finfo, log);
     }
 
+    //number of threads parsing sdf records with the native parser
+    void setParseThreads(unsigned n);
+
+    //parse sdf files natively; its typing and torsions follow openbabel's
+    //rules but are a reimplementation, so openbabel remains the default;
+    //test_parse_sdf checks the two agree, and other formats (e.g. mol2)
+    //always go through openbabel
+    void setNativeSDF(bool native) {
+      native_sdf = native;
+    }
+
     //create the initial model from the specified receptor files
     void create_init_model(const std::string& rigid_name,
         const std::string& flex_name, FlexInfo& finfo, tee& log);
@@ -58,6 +142,20 @@ class MolGetter {
     //setup for reading from fname
     void setInputFile(const std::string& fname);
 
+    //only read the selected records; the others are skipped without
+    //parsing them: sdf records, and the records of any openbabel format
+    //that can find where its records end (sdf, mol2, smiles, ...), are
+    //only scanned for that, but gnina/smina records still have to be
+    //deserialized, and libraries start directly at the selection
+    void setSelection(const ligand_selection& sel) {
+      selection = sel;
+    }
+
+    //index of the record the last molecule read came from
+    sz lastRecord() const {
+      return lastrec;
+    }
+
     //initialize model to initm and add next molecule
     //return false if no molecule available;
     bool readMoleculeIntoModel(model &m);
@@ -89,9 +89,12 @@ output_type monte_carlo::many_runs(model& m, const precalculate& p, igrid& ig,
 }
 
 // out is sorted
-void monte_carlo::operator()(model& m, output_container& out,
+unsigned monte_carlo::operator()(model& m, output_container& out,
     const precalculate& p, igrid& ig, const vec& corner1, const vec& corner2,
-    incrementable* increment_me, rng& generator, grid& user_grid) const {
+    incrementable* increment_me, rng& generator, grid& user_grid,
+    mc_step_budget* budget) const {
+  //smaller improvements of the best energy don't count as progress
+  const fl convergence_energy = 0.01;
   vec authentic_v(1000, 1000, 1000); // FIXME? this is here to avoid max_fl/max_fl
   conf_size s = m.get_size();
   change g(s, ig.move_receptor());
@@ -101,8 +104,11 @@ void monte_carlo::operator()(model& m, output_container& out,
   minimization_params minparms = ssd_par.minparm;
   if (minparms.maxiters == 0) minparms.maxiters = ssd_par.evals;
   quasi_newton quasi_newton_par(minparms);
-  VINA_U_FOR(step, num_steps) {
-    if (increment_me) ++(*increment_me);
+  unsigned limit = num_steps;
+  unsigned last_change = 0;
+  unsigned step = 0;
+  for (; step < limit; step++) {
+    if (increment_me && step < num_steps) ++(*increment_me);
     output_type candidate = tmp;
     mutate_conf(candidate.c, m, mutation_amplitude, generator);
     if (minparms.single_min) //use full v to begin with
@@ -123,11 +129,29 @@ void monte_carlo::operator()(model& m, output_container& out,
           m.set(tmp.c); // FIXME? useless?
         }
         tmp.coords = m.get_heavy_atom_movable_coords();
-        add_to_output_container(out, tmp, min_rmsd, num_saved_mins); // 20 - max size
-        if (tmp.e < best_e) best_e = tmp.e;
+        if (add_to_output_container(out, tmp, min_rmsd, num_saved_mins)) // 20 - max size
+          last_change = step;
+        if (tmp.e < best_e) {
+          if (tmp.e < best_e - convergence_energy) last_change = step;
+          best_e = tmp.e;
+        }
+      }
+    }
+
+    if (convergence_window > 0) {
+      if (step - last_change >= convergence_window) { //converged
+        step++;
+        break;
       }
+      if (step + 1 == limit && budget) //still improving, keep going if we can
+        limit += budget->take(convergence_window);
     }
   }
+  if (increment_me) //keep the progress bar consistent
+    for (unsigned i = step; i < num_steps; i++)
+      ++(*increment_me);
+  if (budget && step < num_steps) budget->give(num_steps - step);
   VINA_CHECK(!out.empty());
   VINA_CHECK(out.front().e <= out.back().e); // make sure the sorting worked in the correct order
+  return step;
 }
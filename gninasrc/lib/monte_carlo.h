@@ -26,8 +26,35 @@
 #include "ssd.h"
 #include "incrementable.h"
 
+//steps given up by chains that converged early, shared by the chains of one
+//search so that chains that are still improving can run longer
+struct mc_step_budget {
+    mc_step_budget()
+        : spare(0) {
+    }
+    void give(unsigned n) {
+      __sync_fetch_and_add(&spare, n);
+    }
+    //take up to n steps, returns how many were taken
+    unsigned take(unsigned n) {
+      unsigned have = spare;
+      while (have > 0) {
+        unsigned t = std::min(have, n);
+        unsigned prev = __sync_val_compare_and_swap(&spare, have, have - t);
+        if (prev == have) return t;
+        have = prev;
+      }
+      return 0;
+    }
+  private:
+    unsigned spare;
+};
+
 struct monte_carlo {
     unsigned num_steps;
+    //if nonzero, a chain stops once neither its best energy nor its set of
+    //distinct minima has changed for this many steps
+    unsigned convergence_window;
     fl temperature;
     vec hunt_cap;
     fl min_rmsd;
@@ -35,7 +62,8 @@ struct monte_carlo {
     fl mutation_amplitude;
     ssd ssd_par;
     monte_carlo()
-        : num_steps(2500), temperature(1.2), hunt_cap(10, 1.5, 10),
+        : num_steps(2500), convergence_window(0), temperature(1.2),
+            hunt_cap(10, 1.5, 10),
             min_rmsd(0.5), num_saved_mins(50), mutation_amplitude(2) {
     } // T = 600K, R = 2cal/(K*mol) -> temperature = RT = 1.2;  num_steps = 50*lig_atoms = 2500
 
@@ -49,9 +77,13 @@ struct monte_carlo {
     void single_run(model& m, output_type& out, const precalculate& p,
         igrid& ig, rng& generator, grid& user_grid) const;
     // out is sorted
-    void operator()(model& m, output_container& out, const precalculate& p,
+    // with a convergence window, unused steps are given to budget and a
+    // chain that is still improving after num_steps draws more from it;
+    // returns the number of steps taken
+    unsigned operator()(model& m, output_container& out, const precalculate& p,
         igrid& ig, const vec& corner1, const vec& corner2,
-        incrementable* increment_me, rng& generator, grid& user_grid) const;
+        incrementable* increment_me, rng& generator, grid& user_grid,
+        mc_step_budget* budget = NULL) const;
     void many_runs(model& m, output_container& out, const precalculate& p,
         igrid& ig, const vec& corner1, const vec& corner2, sz num_runs,
         rng& generator, grid& user_grid) const;
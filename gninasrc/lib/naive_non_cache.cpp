@@ -23,14 +23,39 @@
 #include "naive_non_cache.h"
 #include "curl.h"
 
-naive_non_cache::naive_non_cache(const precalculate* p_)
-    : p(p_) {
+naive_non_cache::naive_non_cache(const precalculate* p_,
+    const receptor_index* index_)
+    : p(p_), index(index_) {
 }
+
+//sums the pair energies of one ligand atom with the indexed receptor atoms
+struct naive_index_sum {
+    const precalculate* p;
+    const atomv& grid_atoms;
+    const atom& a;
+    const vec& a_coords;
+    fl cutoff_sqr;
+    fl& e;
+
+    naive_index_sum(const precalculate* p_, const atomv& g, const atom& a_,
+        const vec& c, fl cut, fl& e_)
+        : p(p_), grid_atoms(g), a(a_), a_coords(c), cutoff_sqr(cut), e(e_) {
+    }
+
+    void operator()(sz j, const vec& b_coords) const {
+      fl r2 = sqr(a_coords - b_coords);
+      if (r2 < cutoff_sqr) e += p->eval(a, grid_atoms[j], r2);
+    }
+};
+
 fl naive_non_cache::eval(const model& m, fl v) const { // needs m.coords
   fl e = 0;
   const fl cutoff_sqr = p->cutoff_sqr();
 
   sz n = num_atom_types();
+  const atomv& grid_atoms = m.grid_atoms.get();
+  const bool indexed = index && index->indexes(m.grid_atoms);
+  const fl cutoff = std::sqrt(cutoff_sqr);
 
   VINA_FOR(i, m.num_movable_atoms()) {
     fl this_e = 0;
@@ -39,17 +64,21 @@ fl naive_non_cache::eval(const model& m, fl v) const { // needs m.coords
     if (t1 >= n || is_hydrogen(t1)) continue;
     const vec& a_coords = m.coords[i];
 
-    VINA_FOR_IN(j, m.grid_atoms) {
-      const atom& b = m.grid_atoms[j];
-      smt t2 = b.get();
-      if (t2 >= n || is_hydrogen(t2)) continue;
-      vec r_ba;
-      r_ba = a_coords - b.coords;
-      fl r2 = sqr(r_ba);
-      if (r2 < cutoff_sqr) {
-        this_e += p->eval(a, b, r2);
+    if (indexed)
+      index->for_each_near(a_coords, cutoff,
+          naive_index_sum(p, grid_atoms, a, a_coords, cutoff_sqr, this_e));
+    else
+      VINA_FOR_IN(j, grid_atoms) {
+        const atom& b = grid_atoms[j];
+        smt t2 = b.get();
+        if (t2 >= n || is_hydrogen(t2)) continue;
+        vec r_ba;
+        r_ba = a_coords - b.coords;
+        fl r2 = sqr(r_ba);
+        if (r2 < cutoff_sqr) {
+          this_e += p->eval(a, b, r2);
+        }
       }
-    }
     curl(this_e, v);
     e += this_e;
   }
@@ -25,9 +25,13 @@
 
 #include "igrid.h"
 #include "model.h"
+#include "receptor_index.h"
 
+//exact evaluation straight from the precalculated terms; given an index of
+//the receptor only the receptor atoms near each ligand atom are visited
 struct naive_non_cache : public igrid {
-    naive_non_cache(const precalculate* p_);
+    naive_non_cache(const precalculate* p_,
+        const receptor_index* index_ = NULL);
     virtual fl eval(const model& m, fl v) const; // needs m.coords
     virtual fl eval_deriv(model& m, fl v, const grid& user_grid) const {
       VINA_CHECK(false);
@@ -37,6 +41,7 @@ struct naive_non_cache : public igrid {
     void eval_atoms(const model& m, std::vector<flv>& per_atom_values) const;
   private:
     const precalculate* p;
+    const receptor_index* index; //not owned, may be null
 };
 
 #endif
@@ -22,7 +22,7 @@
 
 #include "non_cache.h"
 #include "curl.h"
-#include "loop_timer.h"
+#include "pair_kernel.h"
 
 non_cache::non_cache(szv_grid_cache& gcache, const grid_dims& gd_,
     const precalculate* p_, fl slope_)
@@ -53,6 +53,8 @@ fl non_cache::eval(const model& m, fl v) const { // clean up
   fl e = 0;
   const fl cutoff_sqr = p->cutoff_sqr();
   sz n = num_atom_types();
+  pair_scratch pairs;
+  atom_base b;
   VINA_FOR(i, m.num_movable_atoms()) {
     const atom& a = m.atoms[i];
     smt t1 = a.get();
@@ -62,19 +64,17 @@ fl non_cache::eval(const model& m, fl v) const { // clean up
     vec adjusted_a_coords;
     fl out_of_bounds_penalty = check_bounds(gd, a_coords, adjusted_a_coords);
     fl this_e = 0;
-    const szv& possibilities = sgrid.possibilities(adjusted_a_coords);
-    VINA_FOR_IN(possibilities_j, possibilities) {
-      const sz j = possibilities[possibilities_j];
-      const atom& b = m.grid_atoms[j];
-      smt t2 = b.get();
-      vec r_ba;
-      r_ba = adjusted_a_coords - b.coords; // FIXME why b-a and not a-b ?
-      fl r2 = sqr(r_ba);
-      if (r2 < cutoff_sqr) {
-        //jac241 - Use adjusted_a_coords or just a_coords?
-        //also how to verify they're ligand coordinates (table lookup?)
-        this_e += p->eval(a, b, r2); // + user_grid.evaluate_user(adjusted_a_coords, slope, NULL);
-      }
+    const receptor_cell cell = sgrid.cell(adjusted_a_coords);
+    pairs.reserve(cell.size());
+    sz nhits = cutoff_hits(cell, adjusted_a_coords, cutoff_sqr,
+        &pairs.hits[0], &pairs.r2s[0]);
+    VINA_FOR(h, nhits) {
+      const unsigned j = pairs.hits[h];
+      b.sm = cell.types[j];
+      b.charge = cell.charges[j];
+      //jac241 - Use adjusted_a_coords or just a_coords?
+      //also how to verify they're ligand coordinates (table lookup?)
+      this_e += p->eval(a, b, pairs.r2s[h]); // + user_grid.evaluate_user(adjusted_a_coords, slope, NULL);
     }
     curl(this_e, v);
     e += this_e + out_of_bounds_penalty;
@@ -127,6 +127,7 @@ fl non_cache::eval_deriv(model& m, fl v, const grid& user_grid) const { // clean
   const fl cutoff_sqr = p->cutoff_sqr();
 
   sz n = num_atom_types();
+  pair_scratch pairs;
 
   VINA_FOR(i, m.num_movable_atoms()) {
     const atom& a = m.atoms[i];
@@ -144,26 +145,32 @@ fl non_cache::eval_deriv(model& m, fl v, const grid& user_grid) const { // clean
 
     fl this_e = 0;
     vec deriv(0, 0, 0);
-    const szv& possibilities = sgrid.possibilities(adjusted_a_coords);
-    VINA_FOR_IN(possibilities_j, possibilities) {
-      const sz j = possibilities[possibilities_j];
-      const atom& b = m.grid_atoms[j];
-      smt t2 = b.get();
-      vec r_ba;
-      r_ba = adjusted_a_coords - b.coords;
-      fl r2 = sqr(r_ba);
-      if (r2 < cutoff_sqr) {
-        if (r2 < epsilon_fl) {
-          throw std::runtime_error(
-              "Ligand atom exactly overlaps receptor atom.  I can't deal with this.");
-        }
-        //dkoes - the "derivative" value returned by eval_deriv
-        //is normalized by r (dor = derivative over r?)
-        pr e_dor = p->eval_deriv(a, b, r2);
-        this_e += e_dor.first;
-        deriv += e_dor.second * r_ba;
-        vec out_deriv = e_dor.second * r_ba;
+    //receptor atoms within the cutoff are found several at a time, then
+    //evaluated together
+    const receptor_cell cell = sgrid.cell(adjusted_a_coords);
+    pairs.reserve(cell.size());
+    sz nhits = cutoff_hits(cell, adjusted_a_coords, cutoff_sqr,
+        &pairs.hits[0], &pairs.r2s[0]);
+    VINA_FOR(h, nhits) {
+      const unsigned j = pairs.hits[h];
+      if (pairs.r2s[h] < epsilon_fl) {
+        throw std::runtime_error(
+            "Ligand atom exactly overlaps receptor atom.  I can't deal with this.");
       }
+      pairs.types[h] = cell.types[j];
+      pairs.charges[h] = cell.charges[j];
+    }
+    //dkoes - the "derivative" value returned by eval_deriv
+    //is normalized by r (dor = derivative over r?)
+    p->eval_deriv_many(a, &pairs.types[0], &pairs.charges[0], &pairs.r2s[0],
+        nhits, &pairs.values[0]);
+    VINA_FOR(h, nhits) {
+      const unsigned j = pairs.hits[h];
+      const pr& e_dor = pairs.values[h];
+      vec r_ba(adjusted_a_coords[0] - cell.x[j],
+          adjusted_a_coords[1] - cell.y[j], adjusted_a_coords[2] - cell.z[j]);
+      this_e += e_dor.first;
+      deriv += e_dor.second * r_ba;
     }
     if (user_grid.initialized()) {
       vec ug_deriv(0, 0, 0);
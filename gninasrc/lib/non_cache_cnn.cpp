@@ -22,7 +22,6 @@
 
 #include "non_cache_cnn.h"
 #include "curl.h"
-#include "loop_timer.h"
 
 non_cache_cnn::non_cache_cnn(szv_grid_cache& gcache, const grid_dims& gd_,
     const precalculate* p_, fl slope_, CNNScorer& cnn_scorer_)
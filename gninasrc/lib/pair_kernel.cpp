@@ -0,0 +1,139 @@
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PAIR_KERNEL_X86
+#include <immintrin.h>
+#endif
+#include "pair_kernel.h"
+
+//the vector paths are built for their instruction sets regardless of what
+//the rest of the build targets and picked when the cpu turns out to have
+//them; this file is compiled without fp contraction, so every path rounds
+//the squared distances identically
+
+//atoms [i,n) of the cell, one at a time
+static sz cutoff_hits_tail(const receptor_cell& cell, const vec& v,
+    fl cutoff_sqr, sz i, sz nhits, unsigned* hits, fl* r2s) {
+  const sz n = cell.size();
+  const fl *x = cell.x, *y = cell.y, *z = cell.z;
+  for (; i < n; i++) {
+    fl dx = v[0] - x[i], dy = v[1] - y[i], dz = v[2] - z[i];
+    fl r2 = dx * dx + dy * dy + dz * dz;
+    if (r2 < cutoff_sqr) {
+      hits[nhits] = i;
+      r2s[nhits] = r2;
+      nhits++;
+    }
+  }
+  return nhits;
+}
+
+static sz cutoff_hits_scalar(const receptor_cell& cell, const vec& v,
+    fl cutoff_sqr, unsigned* hits, fl* r2s) {
+  return cutoff_hits_tail(cell, v, cutoff_sqr, 0, 0, hits, r2s);
+}
+
+#ifdef PAIR_KERNEL_X86
+__attribute__((target("avx512f")))
+static sz cutoff_hits_avx512(const receptor_cell& cell, const vec& v,
+    fl cutoff_sqr, unsigned* hits, fl* r2s) {
+  const sz n = cell.size();
+  const fl *x = cell.x, *y = cell.y, *z = cell.z;
+  sz nhits = 0;
+  sz i = 0;
+  const __m512 vx = _mm512_set1_ps(v[0]), vy = _mm512_set1_ps(v[1]), vz =
+      _mm512_set1_ps(v[2]);
+  const __m512 cut = _mm512_set1_ps(cutoff_sqr);
+  const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+      11, 12, 13, 14, 15);
+  for (; i + 16 <= n; i += 16) {
+    __m512 dx = _mm512_sub_ps(vx, _mm512_loadu_ps(x + i));
+    __m512 dy = _mm512_sub_ps(vy, _mm512_loadu_ps(y + i));
+    __m512 dz = _mm512_sub_ps(vz, _mm512_loadu_ps(z + i));
+    __m512 r2 = _mm512_add_ps(
+        _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+        _mm512_mul_ps(dz, dz));
+    __mmask16 close = _mm512_cmp_ps_mask(r2, cut, _CMP_LT_OQ);
+    if (close) {
+      __m512i idx = _mm512_add_epi32(lanes, _mm512_set1_epi32(i));
+      _mm512_mask_compressstoreu_epi32(hits + nhits, close, idx);
+      _mm512_mask_compressstoreu_ps(r2s + nhits, close, r2);
+      nhits += __builtin_popcount(close);
+    }
+  }
+  return cutoff_hits_tail(cell, v, cutoff_sqr, i, nhits, hits, r2s);
+}
+
+__attribute__((target("avx2")))
+static sz cutoff_hits_avx2(const receptor_cell& cell, const vec& v,
+    fl cutoff_sqr, unsigned* hits, fl* r2s) {
+  const sz n = cell.size();
+  const fl *x = cell.x, *y = cell.y, *z = cell.z;
+  sz nhits = 0;
+  sz i = 0;
+  const __m256 vx = _mm256_set1_ps(v[0]), vy = _mm256_set1_ps(v[1]), vz =
+      _mm256_set1_ps(v[2]);
+  const __m256 cut = _mm256_set1_ps(cutoff_sqr);
+  float r2buf[8];
+  for (; i + 8 <= n; i += 8) {
+    __m256 dx = _mm256_sub_ps(vx, _mm256_loadu_ps(x + i));
+    __m256 dy = _mm256_sub_ps(vy, _mm256_loadu_ps(y + i));
+    __m256 dz = _mm256_sub_ps(vz, _mm256_loadu_ps(z + i));
+    __m256 r2 = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+        _mm256_mul_ps(dz, dz));
+    int close = _mm256_movemask_ps(_mm256_cmp_ps(r2, cut, _CMP_LT_OQ));
+    if (close) {
+      _mm256_storeu_ps(r2buf, r2);
+      for (; close; close &= close - 1) {
+        int k = __builtin_ctz(close);
+        hits[nhits] = i + k;
+        r2s[nhits] = r2buf[k];
+        nhits++;
+      }
+    }
+  }
+  return cutoff_hits_tail(cell, v, cutoff_sqr, i, nhits, hits, r2s);
+}
+#endif
+
+bool pair_kernel_supported(pair_kernel_isa isa) {
+  switch (isa) {
+  case PAIR_KERNEL_SCALAR:
+    return true;
+#ifdef PAIR_KERNEL_X86
+  case PAIR_KERNEL_AVX2:
+    return __builtin_cpu_supports("avx2");
+  case PAIR_KERNEL_AVX512:
+    return __builtin_cpu_supports("avx512f");
+#endif
+  default:
+    return false;
+  }
+}
+
+pair_kernel_isa pair_kernel_best() {
+  static const pair_kernel_isa best =
+      pair_kernel_supported(PAIR_KERNEL_AVX512) ? PAIR_KERNEL_AVX512 :
+      pair_kernel_supported(PAIR_KERNEL_AVX2) ? PAIR_KERNEL_AVX2 :
+                                                PAIR_KERNEL_SCALAR;
+  return best;
+}
+
+sz cutoff_hits(pair_kernel_isa isa, const receptor_cell& cell, const vec& v,
+    fl cutoff_sqr, unsigned* hits, fl* r2s) {
+  if (cell.size() == 0) return 0;
+  switch (isa) {
+#ifdef PAIR_KERNEL_X86
+  case PAIR_KERNEL_AVX512:
+    return cutoff_hits_avx512(cell, v, cutoff_sqr, hits, r2s);
+  case PAIR_KERNEL_AVX2:
+    return cutoff_hits_avx2(cell, v, cutoff_sqr, hits, r2s);
+#endif
+  default:
+    return cutoff_hits_scalar(cell, v, cutoff_sqr, hits, r2s);
+  }
+}
+
+sz cutoff_hits(const receptor_cell& cell, const vec& v, fl cutoff_sqr,
+    unsigned* hits, fl* r2s) {
+  return cutoff_hits(pair_kernel_best(), cell, v, cutoff_sqr, hits, r2s);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "szv_grid.h"
+
+//find the receptor atoms of cell that are closer than the cutoff to v;
+//their positions within the cell are stored in hits, in increasing order,
+//and their squared distances in r2s (both need room for cell.size()
+//entries); returns the number found
+//the distances are computed 16 atoms at a time with AVX-512, 8 with AVX2,
+//or one at a time, whichever the cpu running us supports
+sz cutoff_hits(const receptor_cell& cell, const vec& v, fl cutoff_sqr,
+    unsigned* hits, fl* r2s);
+
+//the ways cutoff_hits can compute distances; they all give the same hits
+enum pair_kernel_isa {
+  PAIR_KERNEL_SCALAR, PAIR_KERNEL_AVX2, PAIR_KERNEL_AVX512
+};
+
+//can isa be used on this cpu
+bool pair_kernel_supported(pair_kernel_isa isa);
+
+//the widest supported isa, which cutoff_hits uses
+pair_kernel_isa pair_kernel_best();
+
+//cutoff_hits with a particular (supported) isa
+sz cutoff_hits(pair_kernel_isa isa, const receptor_cell& cell, const vec& v,
+    fl cutoff_sqr, unsigned* hits, fl* r2s);
+
+//scratch space for pairs of one ligand atom, sized for the largest cell seen
+struct pair_scratch {
+    std::vector<unsigned> hits;
+    flv r2s;
+    std::vector<smt> types;
+    flv charges;
+    std::vector<pr> values;
+
+    void reserve(sz n) {
+      n = std::max<sz>(n, 1); //so &hits[0] etc. are always valid
+      if (hits.size() < n) {
+        hits.resize(n);
+        r2s.resize(n);
+        types.resize(n);
+        charges.resize(n);
+        values.resize(n);
+      }
+    }
+};
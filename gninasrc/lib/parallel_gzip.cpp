@@ -0,0 +1,143 @@
+#include <deque>
+#include <string>
+#include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include "parallel_gzip.h"
+
+struct parallel_gzip_sink::impl {
+    struct block {
+        std::string in;
+        std::string out;
+        bool done;
+        block()
+            : done(false) {
+        }
+    };
+
+    std::ostream& out;
+    std::size_t block_size;
+    unsigned max_blocks; //compressed or being compressed, but not written
+    std::string current; //block being filled
+    bool written; //anything submitted yet
+    bool stopping;
+
+    boost::mutex lock; //protects everything below
+    boost::condition changed; //a block was queued or finished
+    std::deque<boost::shared_ptr<block> > blocks; //in output order
+    std::deque<boost::shared_ptr<block> > pending; //not picked up by a thread
+    boost::thread_group threads;
+
+    impl(std::ostream& o, unsigned nthreads, std::size_t bsize)
+        : out(o), block_size(bsize), max_blocks(2 * nthreads), written(false),
+            stopping(false) {
+      current.reserve(block_size);
+      for (unsigned i = 0; i < nthreads; i++)
+        threads.create_thread(boost::bind(&impl::run, this));
+    }
+
+    ~impl() {
+      {
+        boost::mutex::scoped_lock L(lock);
+        stopping = true;
+        changed.notify_all();
+      }
+      threads.join_all();
+    }
+
+    //queue current for compression
+    void submit() {
+      boost::shared_ptr<block> b = boost::make_shared<block>();
+      b->in.swap(current);
+      current.reserve(block_size);
+      written = true;
+
+      boost::mutex::scoped_lock L(lock);
+      blocks.push_back(b);
+      pending.push_back(b);
+      changed.notify_all();
+      write_ready(L, false);
+    }
+
+    //write finished blocks at the front; wait for the front block if there
+    //are too many outstanding, or for all of them if all is set
+    void write_ready(boost::mutex::scoped_lock& L, bool all) {
+      while (!blocks.empty()) {
+        boost::shared_ptr<block> b = blocks.front();
+        if (b->done) {
+          blocks.pop_front();
+          L.unlock();
+          out.write(b->out.data(), b->out.size());
+          L.lock();
+        } else
+          if (all || blocks.size() >= max_blocks)
+            changed.wait(L);
+          else
+            break;
+      }
+    }
+
+    void close() {
+      if (current.size() > 0 || !written) submit(); //an empty file is still a gzip member
+      boost::mutex::scoped_lock L(lock);
+      write_ready(L, true);
+      L.unlock();
+      out.flush();
+    }
+
+    static void compress(const std::string& in, std::string& out) {
+      namespace io = boost::iostreams;
+      io::filtering_ostream z;
+      z.push(io::gzip_compressor());
+      z.push(io::back_inserter(out));
+      z.write(in.data(), in.size());
+      z.reset(); //finishes the member
+    }
+
+    void run() {
+      for (;;) {
+        boost::shared_ptr<block> b;
+        {
+          boost::mutex::scoped_lock L(lock);
+          while (pending.empty() && !stopping)
+            changed.wait(L);
+          if (pending.empty()) return;
+          b = pending.front();
+          pending.pop_front();
+        }
+
+        compress(b->in, b->out);
+        std::string().swap(b->in);
+
+        boost::mutex::scoped_lock L(lock);
+        b->done = true;
+        changed.notify_all();
+      }
+    }
+};
+
+parallel_gzip_sink::parallel_gzip_sink(std::ostream& out, unsigned nthreads,
+    std::size_t block_size)
+    : pimpl(new impl(out, std::max(nthreads, 1U), block_size)) {
+}
+
+std::streamsize parallel_gzip_sink::write(const char* s, std::streamsize n) {
+  std::streamsize left = n;
+  while (left > 0) {
+    std::size_t room = pimpl->block_size - pimpl->current.size();
+    std::size_t len = std::min<std::size_t>(room, left);
+    pimpl->current.append(s, len);
+    s += len;
+    left -= len;
+    if (pimpl->current.size() >= pimpl->block_size) pimpl->submit();
+  }
+  return n;
+}
+
+void parallel_gzip_sink::close() {
+  pimpl->close();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <ostream>
+#include <boost/shared_ptr.hpp>
+#include <boost/iostreams/categories.hpp>
+
+//boost iostreams sink that gzips fixed size blocks of its input on several
+//threads and writes them to out, in order, as consecutive gzip members;
+//gunzip (and izfile) read the result back as a single stream
+//compressed blocks are written as soon as all blocks before them are, and
+//at most a few blocks per thread are buffered; everything is flushed on close
+class parallel_gzip_sink {
+  public:
+    typedef char char_type;
+    struct category : boost::iostreams::sink_tag,
+        boost::iostreams::closable_tag {
+    };
+
+    parallel_gzip_sink(std::ostream& out, unsigned nthreads,
+        std::size_t block_size = 1 << 20);
+
+    std::streamsize write(const char* s, std::streamsize n);
+    void close();
+
+  private:
+    struct impl; //threads are kept out of the header for nvcc
+    boost::shared_ptr<impl> pimpl; //copies (boost iostreams makes them) share
+};
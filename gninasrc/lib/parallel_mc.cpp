@@ -33,8 +33,9 @@ struct parallel_mc_task {
     model m;
     output_container out;
     rng generator;
+    unsigned steps;
     parallel_mc_task(const model& m_, int seed)
-        : m(m_), generator(static_cast<rng::result_type>(seed)) {
+        : m(m_), generator(static_cast<rng::result_type>(seed)), steps(0) {
       if (m_.gpu_initialized()) {
         //TODO: need to ensure that worker threads using these copies can't
         //deallocate GPU memory - race condition in
@@ -68,11 +69,12 @@ struct parallel_mc_aux {
     const vec* corner2;
     parallel_progress* pg;
     grid* user_grid;
+    mc_step_budget* budget;
     parallel_mc_aux(const monte_carlo* mc_, const precalculate* p_, igrid* ig_,
         const vec* corner1_, const vec* corner2_, parallel_progress* pg_,
-        grid* user_grid_)
+        grid* user_grid_, mc_step_budget* budget_)
         : mc(mc_), p(p_), ig(ig_), corner1(corner1_), corner2(corner2_),
-            pg(pg_), user_grid(user_grid_) {
+            pg(pg_), user_grid(user_grid_), budget(budget_) {
     }
 
     void operator()(parallel_mc_task& t) const {
@@ -142,16 +144,16 @@ struct parallel_mc_aux {
         t.m.gdata.bfs_order_dfs_indices = bfs_order_dfs_indices;
       }
       if (cnn) {
-        CNNScorer cnn_scorer(cnn->get_scorer().options());
+        CNNScorer cnn_scorer(cnn->get_scorer()); //own net, shared weights
         const precalculate* p = cnn->get_precalculate();
         szv_grid_cache gridcache(t.m, p->cutoff_sqr());
         non_cache_cnn new_cnn(gridcache, cnn->get_grid_dims(), p,
             cnn->getSlope(), cnn_scorer);
-        (*mc)(t.m, t.out, *p, new_cnn, *corner1, *corner2, pg, t.generator,
-            *user_grid);
+        t.steps = (*mc)(t.m, t.out, *p, new_cnn, *corner1, *corner2, pg,
+            t.generator, *user_grid, budget);
       } else
-        (*mc)(t.m, t.out, *p, *ig, *corner1, *corner2, pg, t.generator,
-            *user_grid);
+        t.steps = (*mc)(t.m, t.out, *p, *ig, *corner1, *corner2, pg,
+            t.generator, *user_grid, budget);
     }
 };
 
@@ -171,18 +173,42 @@ void merge_output_containers(const parallel_mc_task_container& many,
   out.sort();
 }
 
+static void get_chain_steps(const parallel_mc_task_container& many,
+    std::vector<unsigned>& steps) {
+  steps.clear();
+  VINA_FOR_IN(i, many)
+    steps.push_back(many[i].steps);
+}
+
 void parallel_mc::operator()(const model& m, output_container& out,
     const precalculate& p, igrid& ig, const vec& corner1, const vec& corner2,
-    rng& generator, grid& user_grid) const {
+    rng& generator, grid& user_grid, std::vector<unsigned>* chain_steps) const {
   parallel_progress pp;
+  mc_step_budget budget; //only used with a convergence window
   parallel_mc_aux parallel_mc_aux_instance(&mc, &p, &ig, &corner1, &corner2,
-      (display_progress ? (&pp) : NULL), &user_grid);
+      (display_progress ? (&pp) : NULL), &user_grid, &budget);
   parallel_mc_task_container task_container;
   VINA_FOR(i, num_tasks)
     task_container.push_back(
         new parallel_mc_task(m, random_int(0, 1000000, generator)));
   if (display_progress) pp.init(num_tasks * mc.num_steps);
 
+  if (pool) {
+    //chains are queued on this thread and taken by any idle ligand worker
+    task_pool::group chains;
+    VINA_FOR_IN(i, task_container) {
+      parallel_mc_task& t = task_container[i];
+      pool->spawn(chains, [&parallel_mc_aux_instance, &t]() {
+        parallel_mc_aux_instance(t);
+      });
+    }
+    pool->wait(chains);
+    merge_output_containers(task_container, out, mc.min_rmsd,
+        mc.num_saved_mins);
+    if (chain_steps) get_chain_steps(task_container, *chain_steps);
+    return;
+  }
+
   auto thread_init = [&]() {if (m.gdata.device_on) {
       caffe::Caffe::SetDevice(m.gdata.device_id);
       caffe::Caffe::set_mode(caffe::Caffe::GPU);
@@ -195,5 +221,6 @@ void parallel_mc::operator()(const model& m, output_container& out,
   parallel_iter_instance.run(task_container);
 
   merge_output_containers(task_container, out, mc.min_rmsd, mc.num_saved_mins);
+  if (chain_steps) get_chain_steps(task_container, *chain_steps);
 
 }
@@ -24,18 +24,22 @@
 #define VINA_PARALLEL_MC_H
 
 #include "monte_carlo.h"
+#include "task_pool.h"
 
 struct parallel_mc {
     monte_carlo mc;
     sz num_tasks;
     sz num_threads;
     bool display_progress;
+    task_pool* pool; //if set, run the tasks in the shared pool, not own threads
     parallel_mc()
-        : num_tasks(8), num_threads(1), display_progress(true) {
+        : num_tasks(8), num_threads(1), display_progress(true), pool(NULL) {
     }
+    //if chain_steps is set, it receives the steps taken by each chain
     void operator()(const model& m, output_container& out,
         const precalculate& p, igrid& ig, const vec& corner1,
-        const vec& corner2, rng& generator, grid& user_grid) const;
+        const vec& corner2, rng& generator, grid& user_grid,
+        std::vector<unsigned>* chain_steps = NULL) const;
 };
 
 #endif
@@ -0,0 +1,901 @@
+/*
+ * parse_sdf.cpp
+ *
+ *  Native sdf ligand reader.  The perception done here (polar hydrogens,
+ *  aromaticity, hydrogen bond acceptors, rotatable bonds, choice of root,
+ *  Gasteiger charges) follows what GninaConverter gets from OpenBabel so that
+ *  molecules are typed and split into torsions the same way.
+ */
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <istream>
+#include "parse_sdf.h"
+
+namespace {
+
+struct sdf_atom {
+    vec coords;
+    char elem[3];
+    int charge;
+    int isotope;
+    unsigned implicit_h; //hydrogens OpenBabel would add
+    bool aromatic;
+    unsigned hyb; //1 sp, 2 sp2, 3 sp3
+    double partial;
+
+    sdf_atom()
+        : coords(0, 0, 0), charge(0), isotope(0), implicit_h(0),
+            aromatic(false), hyb(3), partial(0) {
+      elem[0] = elem[1] = elem[2] = 0;
+    }
+
+    bool is(const char *e) const {
+      return strcmp(elem, e) == 0;
+    }
+    bool hydrogen() const {
+      return is("H");
+    }
+};
+
+struct sdf_bond {
+    unsigned a, b;
+    unsigned order;
+    bool ring;
+};
+
+struct neighbor {
+    unsigned atom, bond;
+    neighbor(unsigned a, unsigned b)
+        : atom(a), bond(b) {
+    }
+};
+
+struct molecule {
+    std::string name;
+    std::vector<sdf_atom> atoms;
+    std::vector<sdf_bond> bonds;
+    std::vector<std::vector<neighbor> > nbrs;
+
+    void connect() {
+      nbrs.assign(atoms.size(), std::vector<neighbor>());
+      VINA_FOR_IN(i, bonds) {
+        nbrs[bonds[i].a].push_back(neighbor(bonds[i].b, i));
+        nbrs[bonds[i].b].push_back(neighbor(bonds[i].a, i));
+      }
+    }
+
+    unsigned heavy_degree(unsigned a) const {
+      unsigned n = 0;
+      VINA_FOR_IN(i, nbrs[a])
+        if (!atoms[nbrs[a][i].atom].hydrogen()) n++;
+      return n;
+    }
+
+    unsigned bond_order_sum(unsigned a) const {
+      unsigned n = 0;
+      VINA_FOR_IN(i, nbrs[a])
+        n += bonds[nbrs[a][i].bond].order;
+      return n;
+    }
+
+    bool nonpolar_hydrogen(unsigned a) const {
+      if (!atoms[a].hydrogen()) return false;
+      VINA_FOR_IN(i, nbrs[a])
+        if (atoms[nbrs[a][i].atom].is("C")) return true;
+      return false;
+    }
+};
+
+//record lines, with any trailing \r removed
+class line_reader {
+    const std::string& text;
+    sz pos;
+  public:
+    line_reader(const std::string& t)
+        : text(t), pos(0) {
+    }
+    bool next(const char*& line, sz& len) {
+      if (pos >= text.size()) return false;
+      sz end = text.find('\n', pos);
+      if (end == std::string::npos) end = text.size();
+      line = text.data() + pos;
+      len = end - pos;
+      if (len > 0 && line[len - 1] == '\r') len--;
+      pos = end + 1;
+      return true;
+    }
+};
+
+//fixed column fields; a missing or blank field is an error unless optional
+bool field_double(const char *line, sz len, sz start, sz width, double& v) {
+  if (start >= len) return false;
+  char buf[32];
+  sz n = std::min(std::min(width, len - start), sizeof(buf) - 1);
+  memcpy(buf, line + start, n);
+  buf[n] = 0;
+  char *end = NULL;
+  v = strtod(buf, &end);
+  return end != buf;
+}
+
+bool field_int(const char *line, sz len, sz start, sz width, int& v,
+    bool optional = false) {
+  v = 0;
+  if (start >= len) return optional;
+  char buf[32];
+  sz n = std::min(std::min(width, len - start), sizeof(buf) - 1);
+  memcpy(buf, line + start, n);
+  buf[n] = 0;
+  char *end = NULL;
+  v = strtol(buf, &end, 10);
+  if (end == buf) {
+    //blank is fine for optional fields
+    for (char *c = buf; *c; c++)
+      if (!isspace(*c)) return false;
+    return optional;
+  }
+  return true;
+}
+
+bool starts_with(const char *line, sz len, const char *prefix) {
+  sz n = strlen(prefix);
+  return len >= n && strncmp(line, prefix, n) == 0;
+}
+
+//elements with smina types we can perceive without help
+bool known_element(const char *e) {
+  static const char *known[] = { "H", "C", "N", "O", "F", "P", "S", "Cl",
+      "Br", "I", "B" };
+  for (unsigned i = 0; i < sizeof(known) / sizeof(known[0]); i++)
+    if (strcmp(e, known[i]) == 0) return true;
+  return false;
+}
+
+bool read_molfile(const std::string& record, molecule& mol) {
+  line_reader lines(record);
+  const char *line = NULL;
+  sz len = 0;
+
+  if (!lines.next(line, len)) return false;
+  mol.name.assign(line, len);
+  if (!lines.next(line, len) || !lines.next(line, len)) return false;
+  if (!lines.next(line, len)) return false; //counts
+  if (len >= 39 && strncmp(line + 34, "V3000", 5) == 0) return false;
+  int natoms = 0, nbonds = 0;
+  if (!field_int(line, len, 0, 3, natoms) || !field_int(line, len, 3, 3, nbonds))
+    return false;
+  if (natoms <= 0 || natoms >= USHRT_MAX || nbonds < 0) return false;
+
+  mol.atoms.resize(natoms);
+  VINA_FOR(i, natoms) {
+    if (!lines.next(line, len)) return false;
+    sdf_atom& a = mol.atoms[i];
+    double x = 0, y = 0, z = 0;
+    if (!field_double(line, len, 0, 10, x) || !field_double(line, len, 10, 10, y)
+        || !field_double(line, len, 20, 10, z)) return false;
+    a.coords = vec(x, y, z);
+
+    sz e = 0;
+    for (sz c = 31; c < 34 && c < len && e < 2; c++) {
+      if (isspace(line[c])) continue;
+      a.elem[e] = e == 0 ? toupper(line[c]) : tolower(line[c]);
+      e++;
+    }
+    if (!known_element(a.elem)) return false;
+
+    int massdiff = 0, chg = 0;
+    if (!field_int(line, len, 34, 2, massdiff, true)
+        || !field_int(line, len, 36, 3, chg, true)) return false;
+    if (massdiff != 0) return false;
+    if (chg == 4) return false; //doublet radical
+    if (chg != 0) a.charge = 4 - chg;
+  }
+
+  mol.bonds.resize(nbonds);
+  VINA_FOR(i, nbonds) {
+    if (!lines.next(line, len)) return false;
+    int a = 0, b = 0, order = 0;
+    if (!field_int(line, len, 0, 3, a) || !field_int(line, len, 3, 3, b)
+        || !field_int(line, len, 6, 3, order)) return false;
+    if (a < 1 || b < 1 || a > natoms || b > natoms || a == b) return false;
+    if (order < 1 || order > 3) return false; //aromatic and query bonds
+    sdf_bond& bond = mol.bonds[i];
+    bond.a = a - 1;
+    bond.b = b - 1;
+    bond.order = order;
+    bond.ring = false;
+  }
+
+  //property block
+  bool chgreset = false;
+  while (lines.next(line, len)) {
+    if (starts_with(line, len, "M  END")) break;
+    bool chg = starts_with(line, len, "M  CHG");
+    bool iso = starts_with(line, len, "M  ISO");
+    if (chg || iso) {
+      if (chg && !chgreset) {
+        //any CHG line supersedes the atom block charges
+        VINA_FOR_IN(i, mol.atoms)
+          mol.atoms[i].charge = 0;
+        chgreset = true;
+      }
+      int n = 0;
+      if (!field_int(line, len, 6, 3, n)) return false;
+      VINA_FOR(k, n) {
+        int a = 0, v = 0;
+        if (!field_int(line, len, 9 + 8 * k, 4, a)
+            || !field_int(line, len, 13 + 8 * k, 4, v)) return false;
+        if (a < 1 || a > natoms) return false;
+        if (chg)
+          mol.atoms[a - 1].charge = v;
+        else
+          mol.atoms[a - 1].isotope = v;
+      }
+    } else
+      if (starts_with(line, len, "M  ")) {
+        //radicals, query features, sgroups and so on
+        return false;
+      }
+  }
+  mol.connect();
+  return true;
+}
+
+//keep only the largest connected piece, like OBMol::StripSalts
+void strip_salts(molecule& mol) {
+  std::vector<int> comp(mol.atoms.size(), -1);
+  std::vector<unsigned> sizes;
+  VINA_FOR_IN(i, mol.atoms) {
+    if (comp[i] >= 0) continue;
+    int c = sizes.size();
+    unsigned n = 0;
+    std::vector<unsigned> stack(1, i);
+    comp[i] = c;
+    while (!stack.empty()) {
+      unsigned a = stack.back();
+      stack.pop_back();
+      n++;
+      VINA_FOR_IN(j, mol.nbrs[a]) {
+        unsigned b = mol.nbrs[a][j].atom;
+        if (comp[b] < 0) {
+          comp[b] = c;
+          stack.push_back(b);
+        }
+      }
+    }
+    sizes.push_back(n);
+  }
+  if (sizes.size() < 2) return;
+
+  int keep = std::max_element(sizes.begin(), sizes.end()) - sizes.begin();
+  std::vector<bool> del(mol.atoms.size());
+  VINA_FOR_IN(i, comp)
+    del[i] = comp[i] != keep;
+
+  std::vector<int> newidx(mol.atoms.size(), -1);
+  std::vector<sdf_atom> atoms;
+  VINA_FOR_IN(i, mol.atoms)
+    if (!del[i]) {
+      newidx[i] = atoms.size();
+      atoms.push_back(mol.atoms[i]);
+    }
+  std::vector<sdf_bond> bonds;
+  VINA_FOR_IN(i, mol.bonds) {
+    sdf_bond b = mol.bonds[i];
+    if (del[b.a]) continue;
+    b.a = newidx[b.a];
+    b.b = newidx[b.b];
+    bonds.push_back(b);
+  }
+  mol.atoms.swap(atoms);
+  mol.bonds.swap(bonds);
+  mol.connect();
+}
+
+//hydrogens needed to reach the lowest normal valence that fits
+unsigned implicit_hydrogens(const molecule& mol, unsigned a) {
+  const sdf_atom& at = mol.atoms[a];
+  int used = mol.bond_order_sum(a);
+  int charge = at.charge;
+  static const int none[] = { 0 };
+  static const int c[] = { 4 }, n[] = { 3, 5 }, o[] = { 2 }, s[] = { 2, 4, 6 },
+      p[] = { 3, 5 }, b[] = { 3 }, x[] = { 1 };
+  const int *vals = none;
+  unsigned nvals = 0;
+  int adjust = 0;
+  if (at.is("C")) {
+    vals = c;
+    nvals = 1;
+    adjust = -abs(charge);
+  } else
+    if (at.is("N") || at.is("P")) {
+      vals = at.is("N") ? n : p;
+      nvals = 2;
+      adjust = charge;
+    } else
+      if (at.is("O")) {
+        vals = o;
+        nvals = 1;
+        adjust = charge;
+      } else
+        if (at.is("S")) {
+          vals = s;
+          nvals = 3;
+          adjust = charge;
+        } else
+          if (at.is("B")) {
+            vals = b;
+            nvals = 1;
+            adjust = -charge;
+          } else
+            if (!at.hydrogen()) {
+              vals = x;
+              nvals = 1;
+              adjust = charge;
+            }
+  for (unsigned i = 0; i < nvals; i++) {
+    int v = vals[i] + adjust;
+    if (v >= used) return v - used;
+  }
+  return 0;
+}
+
+//ring bonds are exactly the bonds that are not bridges
+void find_ring_bonds(molecule& mol) {
+  unsigned n = mol.atoms.size();
+  std::vector<int> order(n, -1), low(n, 0);
+  //edges off the dfs tree always close a ring; tree edges are checked below
+  VINA_FOR_IN(i, mol.bonds)
+    mol.bonds[i].ring = true;
+  int counter = 0;
+  for (unsigned root = 0; root < n; root++) {
+    if (order[root] >= 0) continue;
+    //iterative dfs: atom, bond we came in by, next neighbor to visit
+    std::vector<std::pair<std::pair<unsigned, int>, unsigned> > stack;
+    stack.push_back(std::make_pair(std::make_pair(root, -1), 0));
+    order[root] = low[root] = counter++;
+    while (!stack.empty()) {
+      unsigned a = stack.back().first.first;
+      int inbond = stack.back().first.second;
+      unsigned& next = stack.back().second;
+      if (next < mol.nbrs[a].size()) {
+        const neighbor& nb = mol.nbrs[a][next++];
+        if ((int) nb.bond == inbond) continue;
+        if (order[nb.atom] < 0) {
+          order[nb.atom] = low[nb.atom] = counter++;
+          stack.push_back(std::make_pair(std::make_pair(nb.atom, (int) nb.bond),
+              0));
+        } else
+          low[a] = std::min(low[a], order[nb.atom]);
+      } else {
+        stack.pop_back();
+        if (!stack.empty()) {
+          unsigned parent = stack.back().first.first;
+          low[parent] = std::min(low[parent], low[a]);
+          mol.bonds[inbond].ring = low[a] <= order[parent];
+        }
+      }
+    }
+  }
+}
+
+//smallest ring through each ring bond
+void find_rings(const molecule& mol, std::vector<std::vector<unsigned> >& rings) {
+  std::vector<std::vector<unsigned> > sorted;
+  VINA_FOR_IN(i, mol.bonds) {
+    const sdf_bond& bond = mol.bonds[i];
+    if (!bond.ring) continue;
+    //bfs from a to b without using this bond
+    std::vector<int> prev(mol.atoms.size(), -2);
+    std::vector<unsigned> queue(1, bond.a);
+    prev[bond.a] = -1;
+    for (sz q = 0; q < queue.size() && prev[bond.b] == -2; q++) {
+      unsigned a = queue[q];
+      VINA_FOR_IN(j, mol.nbrs[a]) {
+        const neighbor& nb = mol.nbrs[a][j];
+        if (nb.bond == i || prev[nb.atom] != -2 || !mol.bonds[nb.bond].ring)
+          continue;
+        prev[nb.atom] = a;
+        queue.push_back(nb.atom);
+      }
+    }
+    if (prev[bond.b] == -2) continue;
+    std::vector<unsigned> ring;
+    for (int a = bond.b; a >= 0; a = prev[a])
+      ring.push_back(a);
+    std::vector<unsigned> key(ring);
+    std::sort(key.begin(), key.end());
+    if (std::find(sorted.begin(), sorted.end(), key) == sorted.end()) {
+      sorted.push_back(key);
+      rings.push_back(ring);
+    }
+  }
+}
+
+//pi electrons atom a contributes to ring, or -1 if it breaks aromaticity
+int pi_electrons(const molecule& mol, unsigned a,
+    const std::vector<bool>& inring, const std::vector<bool>& aromatic) {
+  const sdf_atom& at = mol.atoms[a];
+  bool ringdouble = false, aromdouble = false, otherdouble = false;
+  VINA_FOR_IN(i, mol.nbrs[a]) {
+    const neighbor& nb = mol.nbrs[a][i];
+    unsigned order = mol.bonds[nb.bond].order;
+    if (order == 3) return -1;
+    if (order != 2) continue;
+    if (inring[nb.atom])
+      ringdouble = true;
+    else
+      if (aromatic[nb.atom])
+        aromdouble = true;
+      else
+        otherdouble = true;
+  }
+  unsigned degree = mol.nbrs[a].size() + at.implicit_h;
+  if (at.is("C")) {
+    if (ringdouble || aromdouble) return 1;
+    if (otherdouble) return 0;
+    if (at.charge == -1) return 2;
+    if (at.charge == 1) return 0;
+    return -1;
+  }
+  if (at.is("N") || at.is("P")) {
+    if (ringdouble || aromdouble) return 1;
+    if (degree == 3 && at.charge == 0) return 2;
+    if (degree == 2 && at.charge == -1) return 2;
+    return -1;
+  }
+  if (at.is("O") || at.is("S")) {
+    if (ringdouble && at.charge == 1) return 1;
+    if (!ringdouble && !aromdouble && !otherdouble && degree == 2
+        && at.charge == 0) return 2;
+    return -1;
+  }
+  return -1;
+}
+
+//Hueckel rule on each smallest ring, repeated so that rings whose kekule
+//double bonds are shared with an aromatic neighbor are picked up; returns
+//false for conjugated rings larger than 8, which are left to openbabel
+bool find_aromatic(molecule& mol) {
+  std::vector<std::vector<unsigned> > rings;
+  find_rings(mol, rings);
+  std::vector<bool> aromatic(mol.atoms.size(), false);
+  std::vector<bool> ringdone(rings.size(), false);
+  std::vector<bool> inring(mol.atoms.size(), false);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    VINA_FOR_IN(r, rings) {
+      if (ringdone[r]) continue;
+      const std::vector<unsigned>& ring = rings[r];
+      VINA_FOR_IN(i, ring)
+        inring[ring[i]] = true;
+      int electrons = 0;
+      VINA_FOR_IN(i, ring) {
+        int e = pi_electrons(mol, ring[i], inring, aromatic);
+        if (e < 0) {
+          electrons = -1;
+          break;
+        }
+        electrons += e;
+      }
+      VINA_FOR_IN(i, ring)
+        inring[ring[i]] = false;
+      if (ring.size() > 8) {
+        if (electrons >= 0) return false;
+        continue;
+      }
+      if (electrons > 0 && electrons % 4 == 2) {
+        ringdone[r] = true;
+        changed = true;
+        VINA_FOR_IN(i, ring)
+          aromatic[ring[i]] = true;
+      }
+    }
+  }
+  VINA_FOR_IN(i, mol.atoms)
+    mol.atoms[i].aromatic = aromatic[i];
+  return true;
+}
+
+void find_hybridization(molecule& mol) {
+  VINA_FOR_IN(i, mol.atoms) {
+    sdf_atom& at = mol.atoms[i];
+    unsigned doubles = 0, triples = 0;
+    VINA_FOR_IN(j, mol.nbrs[i]) {
+      unsigned order = mol.bonds[mol.nbrs[i][j].bond].order;
+      if (order == 2) doubles++;
+      if (order == 3) triples++;
+    }
+    if (triples > 0 || doubles > 1)
+      at.hyb = 1;
+    else
+      if (doubles > 0 || at.aromatic)
+        at.hyb = 2;
+      else
+        at.hyb = 3;
+  }
+  //amide and aniline like nitrogens are planar
+  VINA_FOR_IN(i, mol.atoms) {
+    sdf_atom& at = mol.atoms[i];
+    if (!at.is("N") || at.hyb != 3 || mol.nbrs[i].size() + at.implicit_h > 3)
+      continue;
+    VINA_FOR_IN(j, mol.nbrs[i]) {
+      const sdf_atom& nb = mol.atoms[mol.nbrs[i][j].atom];
+      if (!nb.hydrogen() && nb.hyb < 3) {
+        at.hyb = 2;
+        break;
+      }
+    }
+  }
+}
+
+//same test as OBAtom::IsHbondAcceptor
+bool hbond_acceptor(const molecule& mol, unsigned a) {
+  const sdf_atom& at = mol.atoms[a];
+  if (at.is("O") || at.is("F")) return true;
+  if (at.is("N")) {
+    unsigned degree = mol.nbrs[a].size() + at.implicit_h;
+    return !((degree == 4 && at.hyb == 3) || (degree == 3 && at.hyb == 2));
+  }
+  if (at.is("S")) return at.charge == -1;
+  return false;
+}
+
+//Gasteiger-Marsili parameters (a, b, c) by element and hybridization
+bool gasteiger_parameters(const sdf_atom& at, double& a, double& b,
+    double& c) {
+  struct param {
+      const char *elem;
+      unsigned hyb;
+      double a, b, c;
+  };
+  static const param params[] = { { "H", 0, 7.17, 6.24, -0.56 }, { "C", 3,
+      7.98, 9.18, 1.88 }, { "C", 2, 8.79, 9.32, 1.51 }, { "C", 1, 10.39, 9.45,
+      0.73 }, { "N", 3, 11.54, 10.82, 1.36 }, { "N", 2, 12.87, 11.15, 0.85 }, {
+      "N", 1, 15.68, 11.70, -0.27 }, { "O", 3, 14.18, 12.92, 1.39 }, { "O", 2,
+      17.07, 13.79, 0.47 }, { "F", 0, 14.66, 13.85, 2.31 }, { "Cl", 0, 11.00,
+      9.69, 1.35 }, { "Br", 0, 10.08, 8.47, 1.16 }, { "I", 0, 9.90, 7.96,
+      0.96 }, { "S", 0, 10.14, 9.13, 1.38 }, { "P", 0, 8.90, 8.24, 0.96 } };
+  unsigned hyb = at.hyb;
+  if (at.is("O") && hyb == 1) hyb = 2;
+  for (unsigned i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+    const param& p = params[i];
+    if (!at.is(p.elem) || (p.hyb != 0 && p.hyb != hyb)) continue;
+    a = p.a;
+    b = p.b;
+    c = p.c;
+    return true;
+  }
+  return false;
+}
+
+//Gasteiger-Marsili charges, with implicit hydrogens taking part as extra
+//atoms whose charge ends up on their heavy atom
+void gasteiger_charges(molecule& mol) {
+  const unsigned iterations = 6;
+  const double damping = 0.5;
+  const double hdenom = 20.02; //positive ion electronegativity of hydrogen
+
+  unsigned n = mol.atoms.size();
+  std::vector<double> a, b, c, denom, q, chi;
+  std::vector<bool> known;
+  std::vector<std::pair<unsigned, unsigned> > pairs;
+  sdf_atom hydrogen;
+  strcpy(hydrogen.elem, "H");
+
+  VINA_FOR(i, n) {
+    double pa = 0, pb = 0, pc = 0;
+    known.push_back(gasteiger_parameters(mol.atoms[i], pa, pb, pc));
+    a.push_back(pa);
+    b.push_back(pb);
+    c.push_back(pc);
+    denom.push_back(mol.atoms[i].hydrogen() ? hdenom : pa + pb + pc);
+    q.push_back(mol.atoms[i].charge);
+  }
+  VINA_FOR_IN(i, mol.bonds)
+    pairs.push_back(std::make_pair(mol.bonds[i].a, mol.bonds[i].b));
+  std::vector<unsigned> owner; //heavy atom of each implicit hydrogen
+  VINA_FOR(i, n)
+    VINA_FOR(h, mol.atoms[i].implicit_h) {
+      double pa = 0, pb = 0, pc = 0;
+      gasteiger_parameters(hydrogen, pa, pb, pc);
+      pairs.push_back(std::make_pair(i, (unsigned) a.size()));
+      owner.push_back(i);
+      known.push_back(true);
+      a.push_back(pa);
+      b.push_back(pb);
+      c.push_back(pc);
+      denom.push_back(hdenom);
+      q.push_back(0);
+    }
+
+  chi.resize(q.size());
+  double alpha = 1.0;
+  VINA_FOR(it, iterations) {
+    alpha *= damping;
+    VINA_FOR_IN(i, q)
+      chi[i] = a[i] + b[i] * q[i] + c[i] * q[i] * q[i];
+    VINA_FOR_IN(k, pairs) {
+      unsigned i = pairs[k].first, j = pairs[k].second;
+      if (!known[i] || !known[j]) continue;
+      double d = chi[i] >= chi[j] ? denom[j] : denom[i];
+      double dq = (chi[i] - chi[j]) / d * alpha;
+      q[i] -= dq;
+      q[j] += dq;
+    }
+  }
+
+  VINA_FOR(i, n)
+    mol.atoms[i].partial = q[i];
+  VINA_FOR_IN(h, owner)
+    mol.atoms[owner[h]].partial += q[n + h];
+}
+
+//same test as IsRotBond_PDBQT
+bool rotatable(const molecule& mol, unsigned bondi) {
+  const sdf_bond& bond = mol.bonds[bondi];
+  if (bond.order != 1 || bond.ring) return false;
+  if (mol.heavy_degree(bond.a) <= 1 || mol.heavy_degree(bond.b) <= 1)
+    return false;
+  //amide: carbonyl carbon to nitrogen
+  unsigned c = bond.a, n = bond.b;
+  if (!mol.atoms[c].is("C")) std::swap(c, n);
+  if (mol.atoms[c].is("C") && mol.atoms[n].is("N")) {
+    VINA_FOR_IN(i, mol.nbrs[c]) {
+      const neighbor& nb = mol.nbrs[c][i];
+      if (mol.atoms[nb.atom].is("O") && mol.bonds[nb.bond].order == 2)
+        return false;
+    }
+  }
+  return true;
+}
+
+//atom whose removal leaves the smallest largest piece, as in FindFragments
+unsigned best_root(const molecule& mol) {
+  unsigned n = mol.atoms.size();
+  unsigned best = 0, bestsize = n;
+  std::vector<unsigned> seen(n, n);
+  std::vector<unsigned> stack;
+  VINA_FOR(del, n) {
+    unsigned largest = 0;
+    VINA_FOR(start, n) {
+      if (start == del || seen[start] == del) continue;
+      unsigned size = 0;
+      seen[start] = del;
+      stack.assign(1, start);
+      while (!stack.empty()) {
+        unsigned a = stack.back();
+        stack.pop_back();
+        size++;
+        VINA_FOR_IN(j, mol.nbrs[a]) {
+          unsigned b = mol.nbrs[a][j].atom;
+          if (b != del && seen[b] != del) {
+            seen[b] = del;
+            stack.push_back(b);
+          }
+        }
+      }
+      largest = std::max(largest, size);
+    }
+    if (largest < bestsize) {
+      bestsize = largest;
+      best = del;
+    }
+  }
+  return best;
+}
+
+//ad4 style name used to pick the initial smina type, as in OutputAtom
+const char* type_name(const molecule& mol, unsigned a) {
+  const sdf_atom& at = mol.atoms[a];
+  if (at.hydrogen()) return "HD";
+  if (at.is("C") && at.aromatic) return "A";
+  if (at.is("O")) return "OA";
+  if (at.is("N") && hbond_acceptor(mol, a)) return "NA";
+  if (at.is("S") && hbond_acceptor(mol, a)) return "SA";
+  return at.elem;
+}
+
+struct fragment_tree {
+    const molecule& mol;
+    std::vector<int> frag; //fragment of each atom
+    std::vector<std::vector<unsigned> > atoms; //of each fragment
+    std::vector<unsigned> number; //output number of each atom
+    std::vector<bool> used;
+    std::vector<unsigned> order; //atoms in output order
+    context& c;
+
+    fragment_tree(const molecule& m, context& c_)
+        : mol(m), c(c_) {
+    }
+
+    //pieces of the molecule left when rotatable bonds are cut
+    void split() {
+      frag.assign(mol.atoms.size(), -1);
+      VINA_FOR_IN(i, mol.atoms) {
+        if (frag[i] >= 0) continue;
+        int f = atoms.size();
+        atoms.push_back(std::vector<unsigned>());
+        std::vector<unsigned> stack(1, i);
+        frag[i] = f;
+        while (!stack.empty()) {
+          unsigned a = stack.back();
+          stack.pop_back();
+          atoms[f].push_back(a);
+          VINA_FOR_IN(j, mol.nbrs[a]) {
+            const neighbor& nb = mol.nbrs[a][j];
+            if (frag[nb.atom] < 0 && !rotatable(mol, nb.bond)) {
+              frag[nb.atom] = f;
+              stack.push_back(nb.atom);
+            }
+          }
+        }
+        std::sort(atoms[f].begin(), atoms[f].end());
+      }
+    }
+
+    //number atoms depth first from the root fragment, children in
+    //fragment order
+    void number_atoms(unsigned f, unsigned& next) {
+      used[f] = true;
+      VINA_FOR_IN(i, atoms[f])
+        number[atoms[f][i]] = next++;
+      VINA_FOR_IN(child, atoms)
+        if (!used[child] && bonded(f, child)) number_atoms(child, next);
+    }
+
+    bool bonded(unsigned f, unsigned child, unsigned *pa = NULL,
+        unsigned *ca = NULL) const {
+      VINA_FOR_IN(i, atoms[f]) {
+        unsigned a = atoms[f][i];
+        VINA_FOR_IN(j, mol.nbrs[a]) {
+          unsigned b = mol.nbrs[a][j].atom;
+          if (frag[b] == (int) child) {
+            if (pa) *pa = a;
+            if (ca) *ca = b;
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+
+    void add_atom(unsigned a, parsing_struct& p, unsigned immobile) {
+      const sdf_atom& at = mol.atoms[a];
+      smt sm = string_to_smina_type(type_name(mol, a));
+      parsed_atom patom(sm, at.partial, at.coords, number[a]);
+      if (patom.number == immobile) p.immobile_atom = p.atoms.size();
+      p.add(patom, c, order.size());
+      order.push_back(a);
+    }
+
+    //mirrors OutputTree: branches made only of mobile hydrogens are folded
+    //into their parent
+    void build(unsigned f, parsing_struct& p, unsigned immobile) {
+      used[f] = true;
+      VINA_FOR_IN(i, atoms[f])
+        add_atom(atoms[f][i], p, immobile);
+      VINA_FOR_IN(child, atoms) {
+        unsigned pa = 0, ca = 0;
+        if (used[child] || !bonded(f, child, &pa, &ca)) continue;
+        parsing_struct branch;
+        build(child, branch, number[ca]);
+        if (branch.mobile_hydrogens_only())
+          p.mergeInto(branch);
+        else {
+          sz pos = 0;
+          while (pos < p.atoms.size() && p.atoms[pos].a.number != number[pa])
+            pos++;
+          VINA_CHECK(pos < p.atoms.size());
+          p.atoms[pos].ps.push_back(branch);
+        }
+      }
+    }
+
+    unsigned make(parsing_struct& p) {
+      split();
+      unsigned root = frag[best_root(mol)];
+      number.assign(mol.atoms.size(), 0);
+      used.assign(atoms.size(), false);
+      unsigned next = 1;
+      number_atoms(root, next);
+      used.assign(atoms.size(), false);
+      build(root, p, UINT_MAX);
+      return atoms.size() - 1;
+    }
+};
+
+void make_sdf_context(const molecule& mol, const std::vector<unsigned>& order,
+    sdfcontext& sc) {
+  sc.atoms.clear();
+  sc.bonds.clear();
+  sc.properties.clear();
+  sc.name = mol.name;
+
+  std::vector<unsigned> pos(mol.atoms.size());
+  VINA_FOR_IN(i, order) {
+    const sdf_atom& at = mol.atoms[order[i]];
+    pos[order[i]] = i;
+    sc.atoms.push_back(sdfcontext::sdfatom(at.elem));
+    if (at.charge) sc.properties.push_back(sdfcontext::sdfprop(i, 'c', at.charge));
+    if (at.isotope) sc.properties.push_back(sdfcontext::sdfprop(i, 'i', at.isotope));
+  }
+  VINA_FOR_IN(i, mol.bonds) {
+    const sdf_bond& b = mol.bonds[i];
+    sc.bonds.push_back(sdfcontext::sdfbond(pos[b.a], pos[b.b], b.order));
+  }
+}
+
+} //anonymous namespace
+
+bool parse_sdf_record(const std::string& record, bool addH, parsing_struct& p,
+    context& c, unsigned& torsdof) {
+  molecule mol;
+  if (!read_molfile(record, mol)) return false;
+  strip_salts(mol);
+
+  VINA_FOR_IN(i, mol.atoms) {
+    sdf_atom& at = mol.atoms[i];
+    if (at.hydrogen()) continue;
+    at.implicit_h = implicit_hydrogens(mol, i);
+    //OpenBabel would have to place these, and without addH it still counts
+    //them when typing, which is only mirrored here for added hydrogens
+    if (at.implicit_h > 0 && (!addH || !at.is("C"))) return false;
+  }
+
+  find_ring_bonds(mol);
+  if (!find_aromatic(mol)) return false;
+  find_hybridization(mol);
+  gasteiger_charges(mol);
+
+  //drop nonpolar hydrogens, giving their charge to the carbon
+  std::vector<bool> del(mol.atoms.size(), false);
+  VINA_FOR_IN(i, mol.atoms)
+    if (mol.nonpolar_hydrogen(i)) {
+      del[i] = true;
+      unsigned carbon = mol.nbrs[i][0].atom;
+      mol.atoms[carbon].partial += mol.atoms[i].partial;
+    }
+  molecule kept;
+  kept.name = mol.name;
+  std::vector<int> newidx(mol.atoms.size(), -1);
+  VINA_FOR_IN(i, mol.atoms)
+    if (!del[i]) {
+      newidx[i] = kept.atoms.size();
+      kept.atoms.push_back(mol.atoms[i]);
+    }
+  VINA_FOR_IN(i, mol.bonds) {
+    sdf_bond b = mol.bonds[i];
+    if (del[b.a] || del[b.b]) continue;
+    b.a = newidx[b.a];
+    b.b = newidx[b.b];
+    kept.bonds.push_back(b);
+  }
+  kept.connect();
+  if (kept.atoms.empty()) return false;
+
+  c = context();
+  p = parsing_struct();
+  fragment_tree tree(kept, c);
+  torsdof = tree.make(p);
+  make_sdf_context(kept, tree.order, c.sdftext);
+  return true;
+}
+
+bool read_sdf_record(std::istream& in, std::string& record) {
+  record.clear();
+  std::string line;
+  bool any = false;
+  while (std::getline(in, line)) {
+    any = true;
+    if (line.compare(0, 4, "$$$$") == 0) return true;
+    record += line;
+    record += '\n';
+  }
+  //a final record without a terminator still counts
+  return any && record.find_first_not_of(" \t\r\n") != std::string::npos;
+}
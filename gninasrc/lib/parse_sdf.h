@@ -0,0 +1,29 @@
+/*
+ * parse_sdf.h
+ *
+ *  Native reader for ligands in MDL molfile (V2000) format, as found in sdf
+ *  files.  Builds the same parse tree that GninaConverter produces from an
+ *  OBMol (polar hydrogens only, Gasteiger charges, one rigid fragment per
+ *  group of atoms not separated by a rotatable bond) without going through
+ *  OpenBabel.
+ */
+
+#pragma once
+
+#include <string>
+#include "parsing.h"
+
+//parse a single sdf record (everything up to, but not including, $$$$)
+//into p and c, setting torsdof; returns false if the record uses anything
+//the native reader does not handle (V3000, query atoms, aromatic bond types,
+//radicals, unusual elements, or hydrogens that would have to be placed
+//because addH is set and a heteroatom has implicit hydrogens),
+//in which case the record should be given to OpenBabel instead
+//like GninaConverter, this expects set_fixed_rotable_hydrogens(true); it is
+//not set here since records may be parsed on several threads
+bool parse_sdf_record(const std::string& record, bool addH, parsing_struct& p,
+    context& c, unsigned& torsdof);
+
+//read the next record of an sdf stream into record, without the $$$$ line;
+//returns false at the end of the stream
+bool read_sdf_record(std::istream& in, std::string& record);
@@ -0,0 +1,169 @@
+#include <atomic>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include "precalculate.h"
+#include "file.h"
+#include "my_pid.h"
+
+static const std::string precalculate_file_version = "gnina_precalculate 1";
+
+sz precalculate::next_id() {
+  static std::atomic<sz> last(0);
+  return ++last;
+}
+
+void precalculate::prepare(const std::vector<smt>& types1,
+    const std::vector<smt>& types2, unsigned nthreads) const {
+  std::vector<std::pair<smt, smt> > pairs;
+  VINA_FOR_IN(i, types1)
+    VINA_FOR_IN(j, types2) {
+      smt t1 = std::min(types1[i], types2[j]);
+      smt t2 = std::max(types1[i], types2[j]);
+      if (t2 < num_atom_types()) pairs.push_back(std::make_pair(t1, t2));
+    }
+  std::sort(pairs.begin(), pairs.end());
+  pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+  const sz npairs = pairs.size();
+  nthreads = std::min<sz>(nthreads, npairs);
+  if (nthreads <= 1) {
+    VINA_FOR(i, npairs)
+      build_pair(pairs[i].first, pairs[i].second);
+  } else {
+    sz next = 0;
+    boost::thread_group workers;
+    VINA_FOR(t, nthreads)
+      workers.create_thread([&]() {
+        for (sz i; (i = __sync_fetch_and_add(&next, 1)) < npairs;)
+          build_pair(pairs[i].first, pairs[i].second);
+      });
+    workers.join_all();
+  }
+}
+
+void precalculate::save_tables(const path& file,
+    const std::string& description) const {
+  //write to a private file and rename so that concurrent readers never see
+  //a partial file
+  path tmp = file;
+  tmp += "." + boost::lexical_cast<std::string>(my_pid()) + ".tmp";
+  {
+    boost::filesystem::ofstream out(tmp, std::ios::binary);
+    if (!out) throw file_error(tmp, false);
+    boost::archive::binary_oarchive ar(out,
+        boost::archive::no_header | boost::archive::no_tracking);
+    std::string version = precalculate_file_version;
+    std::string desc = description;
+    ar << version << desc;
+    write_tables(ar);
+    if (!out) throw file_error(tmp, false);
+  }
+  boost::filesystem::rename(tmp, file);
+}
+
+bool precalculate::load_tables(const path& file,
+    const std::string& description) {
+  if (!boost::filesystem::exists(file)) return false;
+  boost::filesystem::ifstream in(file, std::ios::binary);
+  if (!in) throw file_error(file, true);
+  try {
+    boost::archive::binary_iarchive ar(in,
+        boost::archive::no_header | boost::archive::no_tracking);
+    std::string version, desc;
+    ar >> version;
+    if (version != precalculate_file_version) return false;
+    ar >> desc;
+    if (desc != description) return false;
+    return read_tables(ar);
+  } catch (boost::archive::archive_exception& e) {
+    return false; //damaged, so rebuild
+  }
+}
+
+sz precalculate_linear::num_tables() const {
+  sz ret = 0;
+  VINA_FOR(t1, data.dim())
+    VINA_RANGE(t2, t1, data.dim())
+      if (data(t1, t2).get()) ret++;
+  return ret;
+}
+
+//only the sampled values are saved, the rest is derived from them
+void precalculate_linear::write_tables(
+    boost::archive::binary_oarchive& ar) const {
+  sz ntables = num_tables();
+  ar << n << num_components << ntables;
+  VINA_FOR(t1, data.dim())
+    VINA_RANGE(t2, t1, data.dim()) {
+      const precalculate_linear_element* p = data(t1, t2).get();
+      if (p == NULL) continue;
+      unsigned types[2] = { unsigned(t1), unsigned(t2) };
+      ar << types;
+      for (sz c = 0; c < num_components; c++)
+        VINA_FOR(i, n)
+          ar << p->smooth[c][i].first;
+    }
+}
+
+bool precalculate_linear::read_tables(boost::archive::binary_iarchive& ar) {
+  sz fn = 0, fcomponents = 0, ntables = 0;
+  ar >> fn >> fcomponents >> ntables;
+  if (fn != n || fcomponents != num_components) return false;
+  VINA_FOR(k, ntables) {
+    unsigned types[2];
+    ar >> types;
+    if (types[0] > types[1] || types[1] >= data.dim()) return false;
+    precalculate_linear_element* p = new precalculate_linear_element(n,
+        num_components, factor);
+    for (sz c = 0; c < num_components; c++)
+      VINA_FOR(i, n)
+        ar >> p->smooth[c][i].first;
+    p->init_from_smooth_fst(num_components, rs);
+    data(types[0], types[1]).publish(p);
+  }
+  return true;
+}
+
+sz precalculate_splines::num_tables() const {
+  sz ret = 0;
+  VINA_FOR(t1, data.dim())
+    VINA_RANGE(t2, t1, data.dim())
+      if (data(t1, t2).built()) ret++;
+  return ret;
+}
+
+void precalculate_splines::write_tables(
+    boost::archive::binary_oarchive& ar) const {
+  sz ntables = num_tables();
+  ar << ntables;
+  VINA_FOR(t1, data.dim())
+    VINA_RANGE(t2, t1, data.dim()) {
+      const std::vector<Spline>* s = data(t1, t2).built();
+      if (s == NULL) continue;
+      unsigned types[2] = { unsigned(t1), unsigned(t2) };
+      ar << types;
+      ar << *s;
+    }
+}
+
+bool precalculate_splines::read_tables(boost::archive::binary_iarchive& ar) {
+  sz ntables = 0;
+  ar >> ntables;
+  VINA_FOR(k, ntables) {
+    unsigned types[2];
+    ar >> types;
+    if (types[0] > types[1] || types[1] >= data.dim()) return false;
+    std::vector<Spline>* s = new std::vector<Spline>();
+    ar >> *s;
+    if (s->size() != scoring.num_used_components()) {
+      delete s;
+      return false;
+    }
+    data(types[0], types[1]).load(s);
+  }
+  return true;
+}
@@ -23,27 +23,88 @@
 #ifndef VINA_PRECALCULATE_H
 #define VINA_PRECALCULATE_H
 
-#include <boost/thread/mutex.hpp>
-#include <boost/thread/locks.hpp>
 #include "scoring_function.h"
 #include "matrix.h"
 #include "splines.h"
 
+namespace boost {
+namespace archive {
+class binary_oarchive;
+class binary_iarchive;
+}
+}
+
+//pointer that is set once, by whichever thread first needs the value;
+//reads never lock, and a value built by a thread that loses the race to
+//publish is discarded; copies start out unset
+template<typename T>
+class lazy_ptr {
+    mutable T* ptr;
+  public:
+    lazy_ptr()
+        : ptr(NULL) {
+    }
+    lazy_ptr(const lazy_ptr&)
+        : ptr(NULL) {
+    }
+    ~lazy_ptr() {
+      delete ptr;
+    }
+
+    const T* get() const {
+      return __atomic_load_n(&ptr, __ATOMIC_ACQUIRE);
+    }
+
+    //publish val (taking ownership) unless another thread already did;
+    //return the published value
+    const T* publish(T* val) const {
+      T* expected = NULL;
+      if (__atomic_compare_exchange_n(&ptr, &expected, val, false,
+          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return val;
+      delete val;
+      return expected;
+    }
+  private:
+    lazy_ptr& operator=(const lazy_ptr&);
+};
+
 //base class for precaluting classes
 class precalculate {
   public:
     //return just the fast evaluation of types, no derivative
     virtual result_components eval_fast(smt t1, smt t2, fl r2) const = 0;
 
+    //fast evaluation of t1 against each of the n types in t2s at the same
+    //distance; same values as n calls to eval_fast with one virtual dispatch
+    virtual void eval_fast_types(smt t1, const smt* t2s, sz n, fl r2,
+        result_components* out) const {
+      for (sz i = 0; i < n; i++)
+        out[i] = eval_fast(t1, t2s[i], r2);
+    }
+
     //return value and derivative
     //IMPORTANT: derivative is scaled by sqrt(r2) so that when
     //multiplied by the direction vector the result is normalized
     virtual pr eval_deriv(const atom_base& a, const atom_base& b,
         fl r2) const = 0;
 
+    //value and derivative of a against n atoms given by their types and
+    //charges, at squared distances r2s; same values as n calls to
+    //eval_deriv with one virtual dispatch
+    virtual void eval_deriv_many(const atom_base& a, const smt* types,
+        const fl* charges, const fl* r2s, sz n, pr* out) const {
+      atom_base b;
+      for (sz i = 0; i < n; i++) {
+        b.sm = types[i];
+        b.charge = charges[i];
+        out[i] = eval_deriv(a, b, r2s[i]);
+      }
+    }
+
     precalculate(const scoring_function& sf)
         : // sf should not be discontinuous, even near cutoff, for the sake of the derivatives
-            m_cutoff(sf.cutoff()), m_cutoff_sqr(sqr(sf.cutoff())), scoring(sf) {
+            m_cutoff(sf.cutoff()), m_cutoff_sqr(sqr(sf.cutoff())), scoring(sf),
+            m_id(next_id()) {
 
     }
 
@@ -54,6 +115,11 @@ class precalculate {
     fl cutoff_sqr() const {
       return m_cutoff_sqr;
     }
+    //different for every precalculate constructed (copies share it), so
+    //unlike its address it can't name another one later
+    sz id() const {
+      return m_id;
+    }
     bool has_components() const {
       return scoring.num_used_components() > 1;
     } //dkoes
@@ -71,10 +137,56 @@ class precalculate {
       fl ret = eval_fast(a.get(), b.get(), r2).eval(a, b);
       return ret + eval_slow(a, b, r2);
     }
+
+    //tables are built for a pair of types the first time it is evaluated;
+    //this builds the tables of every pair of a type in types1 with a type
+    //in types2 right away, spread over nthreads threads
+    void prepare(const std::vector<smt>& types1,
+        const std::vector<smt>& types2, unsigned nthreads) const;
+
+    //number of pairs of types whose tables have been built
+    virtual sz num_tables() const {
+      return 0;
+    }
+
+    //save every table built so far, labeled with description, which must
+    //capture everything that affects the values (terms, weights,
+    //approximation, atom parameters)
+    void save_tables(const path& file, const std::string& description) const;
+
+    //load tables written by save_tables with the same description; returns
+    //false, loading nothing, if file doesn't exist or has another description
+    bool load_tables(const path& file, const std::string& description);
+
   protected:
     fl m_cutoff;
     fl m_cutoff_sqr;
     const scoring_function& scoring;
+    sz m_id;
+    static sz next_id();
+
+    //build the table for t1 <= t2 unless it already exists
+    virtual void build_pair(smt t1, smt t2) const {
+    }
+    //write the built tables, or read them
+    virtual void write_tables(boost::archive::binary_oarchive& ar) const {
+    }
+    //false if the tables don't fit this precalculate
+    virtual bool read_tables(boost::archive::binary_iarchive& ar) {
+      return true;
+    }
+
+    //eval_deriv_many for a subclass P, calling its eval_deriv directly
+    template<class P>
+    static void eval_deriv_each(const P& p, const atom_base& a,
+        const smt* types, const fl* charges, const fl* r2s, sz n, pr* out) {
+      atom_base b;
+      for (sz i = 0; i < n; i++) {
+        b.sm = types[i];
+        b.charge = charges[i];
+        out[i] = p.P::eval_deriv(a, b, r2s[i]);
+      }
+    }
 
 };
 
@@ -166,42 +278,50 @@ class precalculate_linear : public precalculate {
     //evaluate data while properly swapping types
     result_components eval_fast_data(smt t1, smt t2, fl r2) const {
       if (t1 <= t2) {
-        return data(t1, t2).eval_fast(r2);
+        return element(t1, t2).eval_fast(r2);
       } else {
-        result_components ret = data(t2, t1).eval_fast(r2);
+        result_components ret = element(t2, t1).eval_fast(r2);
         ret.swapOrder();
         return ret;
       }
     }
 
+    //table for t1 <= t2, built the first time it is needed
+    const precalculate_linear_element& element(smt t1, smt t2) const {
+      const lazy_ptr<precalculate_linear_element>& e = data(t1, t2);
+      const precalculate_linear_element* ret = e.get();
+      if (ret == NULL) ret = e.publish(compute_element(t1, t2));
+      return *ret;
+    }
+
+    precalculate_linear_element* compute_element(smt t1, smt t2) const {
+      precalculate_linear_element* p = new precalculate_linear_element(n,
+          num_components, factor);
+      // init smooth[].first
+      VINA_FOR(i, n) {
+        result_components res = scoring.eval_fast(t1, t2, rs[i]);
+        for (sz c = 0; c < num_components; c++)
+          p->smooth[c][i].first = res[c];
+      }
+      // init the rest
+      p->init_from_smooth_fst(num_components, rs);
+      return p;
+    }
+
   public:
     precalculate_linear(const scoring_function& sf, fl factor_)
         :
             // sf should not be discontinuous, even near cutoff, for the sake of the derivatives
             precalculate(sf), n(sz(factor_ * m_cutoff_sqr) + 3), // sz(factor * r^2) + 1 <= sz(factor * cutoff_sqr) + 2 <= n-1 < n  // see assert below
-            data(num_atom_types(),
-                precalculate_linear_element(n, sf.num_used_components(),
-                    factor_)), num_components(sf.num_used_components()),
-            factor(factor_) {
+            data(num_atom_types(), lazy_ptr<precalculate_linear_element>()),
+            num_components(sf.num_used_components()), factor(factor_) {
       VINA_CHECK(factor > epsilon_fl);
       VINA_CHECK(sz(m_cutoff_sqr * factor) + 1 < n);
       // cutoff_sqr * factor is the largest float we may end up converting into sz, then 1 can be added to the result
       VINA_CHECK(m_cutoff_sqr * factor + 1 < n);
 
       calculate_rs();
-
-      VINA_FOR(t1, data.dim())
-        VINA_RANGE(t2, t1, data.dim()) {
-          precalculate_linear_element& p = data(t1, t2);
-          // init smooth[].first
-          VINA_FOR(i, n) {
-            result_components res = sf.eval_fast((smt) t1, (smt) t2, rs[i]);
-            for (sz c = 0; c < num_components; c++)
-              p.smooth[c][i].first = res[c];
-          }
-          // init the rest
-          p.init_from_smooth_fst(num_components, rs);
-        }
+      //tables are only built for the pairs of types actually used
     }
 
     result_components eval_fast(smt t1, smt t2, fl r2) const {
@@ -209,15 +329,31 @@ class precalculate_linear : public precalculate {
       return eval_fast_data(t1, t2, r2);
     }
 
+    void eval_fast_types(smt t1, const smt* t2s, sz n, fl r2,
+        result_components* out) const {
+      assert(r2 <= m_cutoff_sqr);
+      //every table uses the same factor, so one index serves all the types
+      sz idx = sz(factor * r2);
+      for (sz i = 0; i < n; i++) {
+        smt t2 = t2s[i];
+        if (t1 <= t2)
+          out[i] = element(t1, t2).fast[idx];
+        else {
+          out[i] = element(t2, t1).fast[idx];
+          out[i].swapOrder();
+        }
+      }
+    }
+
     pr eval_deriv(const atom_base& a, const atom_base& b, fl r2) const {
       assert(r2 <= m_cutoff_sqr);
       smt t1 = a.get();
       smt t2 = b.get();
       pr ret;
       if (t1 <= t2)
-        ret = data(t1, t2).eval_deriv(num_components, a, b, r2);
+        ret = element(t1, t2).eval_deriv(num_components, a, b, r2);
       else
-        ret = data(t2, t1).eval_deriv(num_components, b, a, r2);
+        ret = element(t2, t1).eval_deriv(num_components, b, a, r2);
 
       if (scoring.has_slow()) {
         //dkoes - recompute "derivative" computation on the fly,
@@ -256,9 +392,23 @@ class precalculate_linear : public precalculate {
       return ret;
     }
 
+    void eval_deriv_many(const atom_base& a, const smt* types,
+        const fl* charges, const fl* r2s, sz n, pr* out) const {
+      eval_deriv_each(*this, a, types, charges, r2s, n, out);
+    }
+
+    sz num_tables() const;
+
+  protected:
+    void build_pair(smt t1, smt t2) const {
+      element(t1, t2);
+    }
+    void write_tables(boost::archive::binary_oarchive& ar) const;
+    bool read_tables(boost::archive::binary_iarchive& ar);
+
   private:
     sz n;
-    triangular_matrix<precalculate_linear_element> data;
+    triangular_matrix<lazy_ptr<precalculate_linear_element> > data;
     flv rs; //actual distance of index locations
     sz num_components;
     fl factor;
@@ -279,11 +429,8 @@ class spline_cache {
     fl cutoff;
     sz n;
     smt t1, t2;
-    //the following are only computed when needed
-    mutable Spline *splines; //one for each component
-    mutable unsigned num_splines; //size of splines
-    mutable bool valid;
-    mutable boost::mutex lock; //make thread safe
+    //one for each component, only computed when needed
+    lazy_ptr<std::vector<Spline> > splines;
 
     //create control points for spline
     //poitns indexed by component first; nonzero indexec by component
@@ -319,18 +466,7 @@ class spline_cache {
 
     spline_cache()
         : sf(NULL), cutoff(0), n(0), t1(smina_atom_type::NumTypes),
-            t2(smina_atom_type::NumTypes), splines(NULL), num_splines(0),
-            valid(false) {
-    }
-
-    //need explicit copy constructor to deal with mutex vairable
-    spline_cache(const spline_cache& rhs)
-        : sf(rhs.sf), cutoff(rhs.cutoff), n(rhs.n), t1(rhs.t1), t2(rhs.t2),
-            splines(NULL), num_splines(0), valid(false) { //mutable member do not get copied
-    }
-
-    ~spline_cache() {
-      if (splines) delete[] splines;
+            t2(smina_atom_type::NumTypes) {
     }
 
     //intialize values to approprate types etc - do not compute spline
@@ -344,30 +480,40 @@ class spline_cache {
       if (t1 > t2) std::swap(t1, t2);
     }
 
-    component_pair eval(fl r) const {
-      if (splines == NULL) {
-        //create spline, thread safe
-        boost::lock_guard<boost::mutex> L(lock);
-
-        if (splines == NULL) //another thread didn't fix it for us
-        {
-          std::vector<std::vector<pr> > points;
-          std::vector<bool> nonzero;
-          setup_points(points, nonzero);
-
-          num_splines = sf->num_used_components();
-          Spline *tmpsplines = new Spline[num_splines];
-          for (sz i = 0, n = num_splines; i < n; i++) {
-            if (nonzero[i]) //worth interpolating
-              tmpsplines[i].initialize(points[i]);
-          }
-          splines = tmpsplines; //this is assumed atomic
+    //the splines, computing them if this is the first use
+    const std::vector<Spline>& get() const {
+      const std::vector<Spline>* ret = splines.get();
+      if (ret == NULL) {
+        std::vector<std::vector<pr> > points;
+        std::vector<bool> nonzero;
+        setup_points(points, nonzero);
+
+        std::vector<Spline>* tmpsplines = new std::vector<Spline>(
+            sf->num_used_components());
+        for (sz i = 0, n = tmpsplines->size(); i < n; i++) {
+          if (nonzero[i]) //worth interpolating
+            (*tmpsplines)[i].initialize(points[i]);
         }
+        ret = splines.publish(tmpsplines);
       }
+      return *ret;
+    }
+
+    //splines computed so far, or NULL
+    const std::vector<Spline>* built() const {
+      return splines.get();
+    }
+
+    //use previously computed splines
+    void load(std::vector<Spline>* s) const {
+      splines.publish(s);
+    }
 
+    component_pair eval(fl r) const {
+      const std::vector<Spline>& s = get();
       result_components val, deriv;
-      for (sz i = 0, n = num_splines; i < n; i++) {
-        pr ret = splines[i].eval_deriv(r);
+      for (sz i = 0, n = s.size(); i < n; i++) {
+        pr ret = s[i].eval_deriv(r);
         val[i] = ret.first;
         deriv[i] = ret.second;
       }
@@ -410,6 +556,14 @@ class precalculate_splines : public precalculate {
       return evaldata(t1, t2, r).first;
     }
 
+    void eval_fast_types(smt t1, const smt* t2s, sz n, fl r2,
+        result_components* out) const {
+      assert(r2 <= m_cutoff_sqr);
+      fl r = sqrt(r2);
+      for (sz i = 0; i < n; i++)
+        out[i] = evaldata(t1, t2s[i], r).first;
+    }
+
     pr eval_deriv(const atom_base& a, const atom_base& b, fl r2) const {
       assert(r2 <= m_cutoff_sqr);
       smt t1 = a.get();
@@ -441,6 +595,20 @@ class precalculate_splines : public precalculate {
       return ret;
     }
 
+    void eval_deriv_many(const atom_base& a, const smt* types,
+        const fl* charges, const fl* r2s, sz n, pr* out) const {
+      eval_deriv_each(*this, a, types, charges, r2s, n, out);
+    }
+
+    sz num_tables() const;
+
+  protected:
+    void build_pair(smt t1, smt t2) const {
+      data(t1, t2).get();
+    }
+    void write_tables(boost::archive::binary_oarchive& ar) const;
+    bool read_tables(boost::archive::binary_iarchive& ar);
+
   private:
 
     triangular_matrix<spline_cache> data;
@@ -488,6 +656,11 @@ class precalculate_exact : public precalculate {
       return pr(X, dx / r);
     }
 
+    void eval_deriv_many(const atom_base& a, const smt* types,
+        const fl* charges, const fl* r2s, sz n, pr* out) const {
+      eval_deriv_each(*this, a, types, charges, r2s, n, out);
+    }
+
   private:
 
     fl delta;
@@ -0,0 +1,130 @@
+#include <cstring>
+#include <iomanip>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include "profiler.h"
+
+bool profiler::enabled_ = false;
+
+static const char* profile_names[ProfileNumPhases] = { "parse",
+    "receptor_setup", "grid_populate", "mc_mutate", "bfgs_line_search",
+    "eval_deriv", "cnn_forward", "cnn_backward", "output" };
+
+//counters are never freed so that threads that have exited still count
+static boost::mutex profile_lock;
+static std::vector<profile_counters*> profile_threads;
+
+profile_counters::profile_counters()
+    : current(ProfileNumPhases) {
+  std::memset(calls, 0, sizeof(calls));
+  std::memset(nanoseconds, 0, sizeof(nanoseconds));
+}
+
+void profile_counters::add(const profile_counters& rhs) {
+  for (unsigned p = 0; p <= ProfileNumPhases; p++)
+    for (unsigned i = 0; i < ProfileNumPhases; i++) {
+      calls[p][i] += rhs.calls[p][i];
+      nanoseconds[p][i] += rhs.nanoseconds[p][i];
+    }
+}
+
+profile_counters& profiler::local() {
+  static thread_local profile_counters* mine = NULL;
+  if (mine == NULL) {
+    mine = new profile_counters();
+    boost::lock_guard<boost::mutex> guard(profile_lock);
+    profile_threads.push_back(mine);
+  }
+  return *mine;
+}
+
+void profiler::total(profile_counters& out) {
+  out = profile_counters();
+  boost::lock_guard<boost::mutex> guard(profile_lock);
+  for (unsigned i = 0, n = profile_threads.size(); i < n; i++)
+    out.add(*profile_threads[i]);
+}
+
+//totals of a phase over everywhere it was called from, and the time spent
+//in the phases it calls
+struct profile_summary {
+    boost::uint64_t calls, nanoseconds, child_nanoseconds;
+
+    profile_summary(const profile_counters& c, unsigned phase)
+        : calls(0), nanoseconds(0), child_nanoseconds(0) {
+      for (unsigned p = 0; p <= ProfileNumPhases; p++) {
+        calls += c.calls[p][phase];
+        nanoseconds += c.nanoseconds[p][phase];
+      }
+      //a phase nested in itself is already part of the outer time
+      for (unsigned i = 0; i < ProfileNumPhases; i++)
+        if (i != phase) child_nanoseconds += c.nanoseconds[phase][i];
+      nanoseconds -= c.nanoseconds[phase][phase];
+    }
+
+    double seconds() const {
+      return nanoseconds / 1e9;
+    }
+    double self_seconds() const {
+      return nanoseconds > child_nanoseconds ?
+          (nanoseconds - child_nanoseconds) / 1e9 : 0;
+    }
+};
+
+void profiler::report(std::ostream& out) {
+  profile_counters c;
+  total(c);
+  std::ios::fmtflags flags = out.flags();
+  std::streamsize prec = out.precision();
+  out << "Profile (wall seconds summed over threads)\n";
+  out << std::left << std::setw(24) << "phase" << std::right << std::setw(12)
+      << "calls" << std::setw(12) << "total" << std::setw(12) << "self"
+      << "\n";
+  out << std::fixed << std::setprecision(3);
+  for (unsigned i = 0; i < ProfileNumPhases; i++) {
+    profile_summary s(c, i);
+    if (s.calls == 0) continue;
+    out << std::left << std::setw(24) << profile_names[i] << std::right
+        << std::setw(12) << s.calls << std::setw(12) << s.seconds()
+        << std::setw(12) << s.self_seconds() << "\n";
+    for (unsigned j = 0; j < ProfileNumPhases; j++) {
+      if (j == i || c.calls[i][j] == 0) continue;
+      out << "  " << std::left << std::setw(22) << profile_names[j]
+          << std::right << std::setw(12) << c.calls[i][j] << std::setw(12)
+          << c.nanoseconds[i][j] / 1e9 << "\n";
+    }
+  }
+  out.flags(flags);
+  out.precision(prec);
+}
+
+void profiler::write_json(std::ostream& out) {
+  profile_counters c;
+  total(c);
+  std::streamsize prec = out.precision();
+  out << std::setprecision(9);
+  out << "{\n  \"phases\": [";
+  bool first = true;
+  for (unsigned i = 0; i < ProfileNumPhases; i++) {
+    profile_summary s(c, i);
+    if (s.calls == 0) continue;
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "    {\"name\": \"" << profile_names[i] << "\", \"calls\": "
+        << s.calls << ", \"seconds\": " << s.seconds()
+        << ", \"self_seconds\": " << s.self_seconds() << ", \"children\": [";
+    bool firstchild = true;
+    for (unsigned j = 0; j < ProfileNumPhases; j++) {
+      if (j == i || c.calls[i][j] == 0) continue;
+      out << (firstchild ? "" : ", ");
+      firstchild = false;
+      out << "{\"name\": \"" << profile_names[j] << "\", \"calls\": "
+          << c.calls[i][j] << ", \"seconds\": " << c.nanoseconds[i][j] / 1e9
+          << "}";
+    }
+    out << "]}";
+  }
+  out << "\n  ]\n}\n";
+  out.precision(prec);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <boost/cstdint.hpp>
+
+//hierarchical profiler for the docking hot paths
+//each thread counts the calls and wall time of every phase, keyed by the
+//phase it was entered from, in counters of its own, so nothing is shared
+//while timing; the counters of all threads are summed when reporting
+//timing is off unless profiler::enable is called, and PROFILE_SCOPE
+//compiles to nothing unless GNINA_PROFILE is defined
+
+enum profile_phase {
+  ProfileParse,
+  ProfileReceptor,
+  ProfilePopulate,
+  ProfileMutate,
+  ProfileLineSearch,
+  ProfileEvalDeriv,
+  ProfileCNNForward,
+  ProfileCNNBackward,
+  ProfileOutput,
+  ProfileNumPhases
+};
+
+struct profile_counters {
+    //indexed by the enclosing phase (ProfileNumPhases if none), then phase
+    boost::uint64_t calls[ProfileNumPhases + 1][ProfileNumPhases];
+    boost::uint64_t nanoseconds[ProfileNumPhases + 1][ProfileNumPhases];
+    unsigned current; //innermost phase being timed, ProfileNumPhases if none
+
+    profile_counters();
+    void add(const profile_counters& rhs);
+};
+
+class profiler {
+  public:
+    static void enable() {
+      enabled_ = true;
+    }
+    static bool enabled() {
+      return enabled_;
+    }
+
+    //counters of the calling thread, created on first use
+    static profile_counters& local();
+    //sum over all threads; only exact once the timed threads are done
+    static void total(profile_counters& out);
+
+    static void report(std::ostream& out);
+    static void write_json(std::ostream& out);
+
+  private:
+    static bool enabled_;
+};
+
+//times the enclosing block as phase
+class profile_scope {
+    profile_counters* counters;
+    unsigned phase, parent;
+    std::chrono::steady_clock::time_point start;
+  public:
+    explicit profile_scope(profile_phase p)
+        : counters(NULL), phase(p), parent(ProfileNumPhases) {
+      if (profiler::enabled()) {
+        counters = &profiler::local();
+        parent = counters->current;
+        counters->current = phase;
+        start = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~profile_scope() {
+      if (counters) {
+        std::chrono::nanoseconds t = std::chrono::steady_clock::now() - start;
+        counters->calls[parent][phase]++;
+        counters->nanoseconds[parent][phase] += t.count();
+        counters->current = parent;
+      }
+    }
+};
+
+#ifdef GNINA_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(phase) profile_scope PROFILE_CONCAT(profile_scope_, __LINE__)(phase)
+#else
+#define PROFILE_SCOPE(phase)
+#endif
@@ -0,0 +1,116 @@
+#include <cmath>
+#include "receptor_index.h"
+#include "atom_constants.h"
+
+//cells grow past the requested size if there would otherwise be more than
+//this many per indexed atom (e.g. because of one far outlying atom)
+#define MAX_CELLS_PER_ATOM 8
+
+receptor_index::receptor_index(const shared_atomv& shared, fl cell_size)
+    : generation(shared.generation()), verified(shared.generation()),
+        count(0), cell(cell_size) {
+  VINA_CHECK(cell > 0);
+  const atomv& atoms = shared.get();
+  const sz n = num_atom_types();
+  szv kept;
+  types.resize(atoms.size());
+  VINA_FOR_IN(i, atoms) {
+    smt t = types[i] = atoms[i].get();
+    if (t < n && !is_hydrogen(t)) kept.push_back(i);
+  }
+  count = kept.size();
+  VINA_FOR(d, 3)
+    dims[d] = 1;
+  if (count == 0) {
+    offsets.assign(2, 0);
+    return;
+  }
+
+  vec lo = atoms[kept[0]].coords, hi = lo;
+  VINA_FOR_IN(i, kept)
+    VINA_FOR(d, 3) {
+      lo[d] = std::min(lo[d], atoms[kept[i]].coords[d]);
+      hi[d] = std::max(hi[d], atoms[kept[i]].coords[d]);
+    }
+  origin = lo;
+  const double max_cells = std::max(double(MAX_CELLS_PER_ATOM) * count,
+      4096.0);
+  for (;;) {
+    double cells = 1;
+    VINA_FOR(d, 3)
+      cells *= std::floor((hi[d] - lo[d]) / cell) + 1;
+    if (cells <= max_cells) break;
+    cell *= std::max(1.01, std::cbrt(cells / max_cells));
+  }
+  VINA_FOR(d, 3)
+    dims[d] = int((hi[d] - lo[d]) / cell) + 1;
+
+  //counting sort by cell, which keeps atoms in index order within a cell
+  const sz ncells = sz(dims[0]) * dims[1] * dims[2];
+  szv cellof(count);
+  offsets.assign(ncells + 1, 0);
+  VINA_FOR(e, count) {
+    const vec& c = atoms[kept[e]].coords;
+    sz ijk[3];
+    VINA_FOR(d, 3)
+      ijk[d] = std::min(sz((c[d] - origin[d]) / cell), sz(dims[d] - 1));
+    cellof[e] = (ijk[0] * dims[1] + ijk[1]) * dims[2] + ijk[2];
+    offsets[cellof[e] + 1]++;
+  }
+  VINA_FOR(c, ncells)
+    offsets[c + 1] += offsets[c];
+  szv fill(offsets.begin(), offsets.end() - 1);
+  indices.resize(count);
+  coords.resize(count);
+  VINA_FOR(e, count) {
+    sz pos = fill[cellof[e]]++;
+    indices[pos] = kept[e];
+    coords[pos] = atoms[kept[e]].coords;
+  }
+}
+
+bool receptor_index::same_atoms(const shared_atomv& shared) const {
+  const atomv& atoms = shared.get();
+  if (atoms.size() != types.size()) return false;
+  VINA_FOR_IN(i, atoms)
+    if (atoms[i].get() != types[i]) return false;
+  VINA_FOR(e, count) {
+    const vec& c = atoms[indices[e]].coords;
+    if (c[0] != coords[e][0] || c[1] != coords[e][1] || c[2] != coords[e][2])
+      return false;
+  }
+  verified.store(shared.generation(), std::memory_order_relaxed);
+  return true;
+}
+
+//cells that overlap [begin-r,end+r], false if there are none
+bool receptor_index::cell_range(const vec& begin, const vec& end, fl r,
+    int lo[3], int hi[3]) const {
+  VINA_FOR(d, 3) {
+    //in floating point until clamped, so far away points can't overflow
+    double l = std::floor((begin[d] - r - origin[d]) / cell);
+    double h = std::floor((end[d] + r - origin[d]) / cell);
+    if (h < 0 || l >= dims[d]) return false;
+    lo[d] = int(std::max(l, 0.0));
+    hi[d] = int(std::min(h, double(dims[d] - 1)));
+  }
+  return true;
+}
+
+void receptor_index::near_box(const vec& begin, const vec& end, fl r,
+    szv& out) const {
+  if (count == 0) return;
+  int lo[3], hi[3];
+  if (!cell_range(begin, end, r, lo, hi)) return;
+  const fl rsq = r * r;
+  sz start = out.size();
+  for (int i = lo[0]; i <= hi[0]; i++)
+    for (int j = lo[1]; j <= hi[1]; j++)
+      for (int k = lo[2]; k <= hi[2]; k++) {
+        sz c = (sz(i) * dims[1] + j) * dims[2] + k;
+        for (sz e = offsets[c], n = offsets[c + 1]; e < n; e++)
+          if (brick_distance_sqr(begin, end, coords[e]) < rsq)
+            out.push_back(indices[e]);
+      }
+  std::sort(out.begin() + start, out.end());
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include "atom.h"
+#include "brick.h"
+
+//cell list of the receptor atoms that exact scoring looks at (heavy atoms of
+//a known type), so that a pose is evaluated against its neighborhood instead
+//of the whole receptor; it is built once per receptor and then only read, so
+//any number of threads can share it across all poses
+class receptor_index {
+  public:
+    receptor_index(const shared_atomv& atoms, fl cell_size = 4);
+
+    //true if this indexes exactly these atoms; copies of the indexed atoms
+    //are recognized by their generation, and atoms of any other generation
+    //(e.g. receptor atoms rewritten when flexible residues are appended) by
+    //comparing them with the indexed ones, which is remembered for the
+    //generation last compared
+    bool indexes(const shared_atomv& atoms) const {
+      sz g = atoms.generation();
+      return g == generation || g == verified.load(std::memory_order_relaxed)
+          || same_atoms(atoms);
+    }
+
+    //call f(j, coords of j) for every indexed atom j in the cells that come
+    //within r of p; this is a superset of the atoms within r
+    template<typename F>
+    void for_each_near(const vec& p, fl r, F f) const {
+      if (count == 0) return;
+      int lo[3], hi[3];
+      if (!cell_range(p, p, r, lo, hi)) return;
+      const fl rsq = r * r;
+      for (int i = lo[0]; i <= hi[0]; i++)
+        for (int j = lo[1]; j <= hi[1]; j++)
+          for (int k = lo[2]; k <= hi[2]; k++) {
+            vec begin, end;
+            cell_bounds(i, j, k, begin, end);
+            if (brick_distance_sqr(begin, end, p) >= rsq) continue;
+            sz c = (sz(i) * dims[1] + j) * dims[2] + k;
+            for (sz e = offsets[c], n = offsets[c + 1]; e < n; e++)
+              f(indices[e], coords[e]);
+          }
+    }
+
+    //append, in increasing order, every indexed atom closer than r to the
+    //box [begin,end]
+    void near_box(const vec& begin, const vec& end, fl r, szv& out) const;
+
+  private:
+    sz generation; //of the indexed atoms
+    mutable std::atomic<sz> verified; //generation last found to have them too
+    std::vector<smt> types; //of every atom, indexed or not
+    sz count;
+    fl cell;
+    vec origin;
+    int dims[3];
+    std::vector<sz> offsets; //cell c holds entries [offsets[c],offsets[c+1])
+    szv indices; //into the atoms, increasing within a cell
+    vecv coords;
+
+    bool same_atoms(const shared_atomv& atoms) const;
+    bool cell_range(const vec& begin, const vec& end, fl r, int lo[3],
+        int hi[3]) const;
+    void cell_bounds(int i, int j, int k, vec& begin, vec& end) const {
+      int idx[3] = { i, j, k };
+      VINA_FOR(d, 3) {
+        begin[d] = origin[d] + idx[d] * cell;
+        end[d] = begin[d] + cell;
+      }
+    }
+};
@@ -10,6 +10,15 @@
 #include <openbabel/obconversion.h>
 #include <cstring>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+//results are rendered by every worker thread, but OBConversion looks up and
+//lazily initializes formats in OpenBabel's global plugin maps and the
+//formats keep per-conversion state, so the conversions themselves are
+//serialized; native sdf and pdbqt output never takes the lock, while
+//other formats (e.g. mol2, pdb) only render in parallel outside of it
+static boost::mutex ob_mutex;
 
 void result_info::setMolecule(const model& m) {
   std::stringstream str;
@@ -44,10 +53,11 @@ void result_info::writeAtomValues(std::ostream& out,
 }
 
 //computes per-atom term values and formats them into the atominfo string
-void result_info::setAtomValues(const model& m, const weighted_terms *wt) {
+void result_info::setAtomValues(const model& m, const weighted_terms *wt,
+    const receptor_index* index) {
   std::vector<flv> values;
   const terms *t = wt->unweighted_terms();
-  t->evale_robust(m, values);
+  t->evale_robust(m, values, index);
   std::stringstream str;
   vecv coords = m.get_ligand_coords();
   assert(values.size() == coords.size());
@@ -86,6 +96,7 @@ static void setMolData(OpenBabel::OBFormat *format, OpenBabel::OBMol& mol,
 //output flexible residue conformers
 void result_info::writeFlex(std::ostream& out, std::string& ext, int modelnum) {
   using namespace OpenBabel;
+  boost::unique_lock<boost::mutex> L(ob_mutex);
   OBMol mol;
   OBConversion outconv;
   OBFormat *format = outconv.FormatFromExt(ext);
@@ -96,10 +107,12 @@ void result_info::writeFlex(std::ostream& out, std::string& ext, int modelnum) {
   outconv.SetInFormat("PDBQT");
   outconv.SetOutFormat(format);
   outconv.ReadString(&mol, flexstr); //otherwise keep orig mol
+  L.unlock();
   mol.SetTitle(name); //same name as cmpd
   outconv.SetLast(false);
   outconv.SetOutputIndex(modelnum + 1); //for pdb multi model output, workaround OB bug with ignoring model 1
 
+  L.lock();
   outconv.Write(&mol, &out);
 }
 
@@ -108,6 +121,7 @@ void result_info::writeFlex(std::ostream& out, std::string& ext, int modelnum) {
 void result_info::write(std::ostream& out, std::string& ext,
     bool include_atom_terms, const weighted_terms *wt, int modelnum) {
   using namespace OpenBabel;
+  boost::unique_lock<boost::mutex> L(ob_mutex);
   OBMol mol;
   OBConversion outconv;
 
@@ -117,6 +131,7 @@ void result_info::write(std::ostream& out, std::string& ext,
     throw usage_error("Invalid format: "+ext);
   }
   if (sdfvalid && strcmp(format->GetID(), "sdf") == 0) { //use native sdf
+    L.unlock();
     out << molstr;
     //now sd data
     out << "> <minimizedAffinity>\n";
@@ -147,6 +162,7 @@ void result_info::write(std::ostream& out, std::string& ext,
     out << "$$$$\n";
   } else
     if (!sdfvalid && ext == ".pdbqt") {
+      L.unlock();
       out << "MODEL " << boost::lexical_cast<std::string>(modelnum) << "\n";
       out << "REMARK minimizedAffinity "
           << boost::lexical_cast<std::string>((float) energy);
@@ -170,6 +186,7 @@ void result_info::write(std::ostream& out, std::string& ext,
       outconv.SetOutFormat(format);
 
       outconv.ReadString(&mol, molstr); //otherwise keep orig mol
+      L.unlock(); //the sd data only touches our own mol
       mol.DeleteData(OBGenericDataType::PairData); //remove remarks
 
       setMolData(format, mol, "minimizedAffinity",
@@ -196,6 +213,7 @@ void result_info::write(std::ostream& out, std::string& ext,
       mol.SetTitle(name); //otherwise lose space separated names
       outconv.SetLast(false);
       outconv.SetOutputIndex(modelnum + 1); //for pdb multi model output, workaround OB bug with ignoring model 1
+      L.lock();
       outconv.Write(&mol, &out);
     }
 }
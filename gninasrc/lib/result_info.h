@@ -43,7 +43,8 @@ class result_info {
     void writeAtomValues(std::ostream& out, const weighted_terms *wt) const;
 
     //computes per-atom term values and formats them into the atominfo string
-    void setAtomValues(const model& m, const weighted_terms *wt);
+    void setAtomValues(const model& m, const weighted_terms *wt,
+        const receptor_index* index = NULL);
 
     void write(std::ostream& out, std::string& ext, bool include_atom_terms,
         const weighted_terms *wt = NULL, int modelnum = 0);
@@ -0,0 +1,66 @@
+#include <sstream>
+#include "run_checkpoint.h"
+#include "parse_error.h"
+
+static const char checkpoint_magic[] = "gnina_checkpoint 1";
+
+bool run_checkpoint::read(const path& name) {
+  if (!boost::filesystem::exists(name)) return false;
+  ifile in(name);
+  std::string line;
+  if (!std::getline(in, line) || line != checkpoint_magic)
+    throw parse_error(name, 1, "Not a gnina checkpoint");
+
+  bool haveseed = false, havenext = false;
+  sizes.clear();
+  for (unsigned lineno = 2; std::getline(in, line); lineno++) {
+    std::istringstream str(line);
+    std::string key;
+    str >> key;
+    if (key == "seed") {
+      haveseed = static_cast<bool>(str >> seed);
+    } else
+      if (key == "next_record") {
+        havenext = static_cast<bool>(str >> next_record);
+      } else
+        if (key == "complete") {
+          if (!(str >> complete)) throw parse_error(name, lineno, "Bad complete flag");
+        } else
+          if (key == "selection") {
+            str.get(); //separating space
+            std::getline(str, selection);
+          } else
+            if (key == "output") {
+              boost::uint64_t size = 0;
+              std::string fname;
+              if (!(str >> size)) throw parse_error(name, lineno, "Bad output size");
+              str.get();
+              std::getline(str, fname);
+              sizes[fname] = size;
+            } else
+              if (key.size() > 0)
+                throw parse_error(name, lineno, "Unknown checkpoint entry " + key);
+  }
+  if (!haveseed || !havenext)
+    throw parse_error(name, 0, "Incomplete gnina checkpoint");
+  return true;
+}
+
+void run_checkpoint::write(const path& name) const {
+  path tmp = name;
+  tmp += ".tmp";
+  {
+    ofile out(tmp);
+    out << checkpoint_magic << "\n";
+    out << "seed " << seed << "\n";
+    out << "selection " << selection << "\n";
+    out << "next_record " << next_record << "\n";
+    out << "complete " << complete << "\n";
+    for (std::map<std::string, boost::uint64_t>::const_iterator i =
+        sizes.begin(); i != sizes.end(); ++i)
+      out << "output " << i->second << " " << i->first << "\n";
+    out.close();
+    if (!out) throw file_error(tmp, false);
+  }
+  boost::filesystem::rename(tmp, name); //atomic on posix
+}
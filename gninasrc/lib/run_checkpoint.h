@@ -0,0 +1,30 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
+#include "file.h"
+
+//progress of a screening run, written periodically so that a run that is
+//interrupted can be restarted where it stopped; every output is truncated
+//back to the size recorded here and appended to, so outputs must not be
+//gzipped
+struct run_checkpoint {
+    int seed; //a resumed run must use the same seed
+    std::string selection; //which ligands the run reads; must match on resume
+    sz next_record; //every selected input record before this was written
+    bool complete; //the whole run finished
+    std::map<std::string, boost::uint64_t> sizes; //bytes in each output file
+
+    run_checkpoint()
+        : seed(0), next_record(0), complete(false) {
+    }
+
+    //read the checkpoint in name; return false if there is none
+    //throws parse_error if it is damaged
+    bool read(const path& name);
+
+    //replace name with this checkpoint; the previous checkpoint stays
+    //intact until the new one has been completely written
+    void write(const path& name) const;
+};
@@ -1,18 +1,20 @@
 #include <semaphore.h>
 
 struct sem {
-    sem();
+    sem(unsigned value = 0);
     ~sem();
 
     void wait();
+    // Returns false instead of blocking if the count is zero.
+    bool try_wait();
     void signal();
 
   private:
     sem_t pthread_sem;
 };
 
-sem::sem() {
-  sem_init(&pthread_sem, 0, 0);
+sem::sem(unsigned value) {
+  sem_init(&pthread_sem, 0, value);
 }
 
 sem::~sem() {
@@ -25,6 +27,10 @@ void sem::wait() {
   assert(ret == 0);
 }
 
+bool sem::try_wait() {
+  return sem_trywait(&pthread_sem) == 0;
+}
+
 void sem::signal() {
   int ret = sem_post(&pthread_sem);
   // We don't expect to overflow the signal count.
@@ -17,6 +17,15 @@
 typedef fl fltype;
 struct SplineData {
     fltype x, a, b, c, d;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned version) {
+      ar & x;
+      ar & a;
+      ar & b;
+      ar & c;
+      ar & d;
+    }
 };
 
 class Spline {
@@ -135,5 +144,12 @@ class Spline {
     fltype getCutoff() const {
       return cutoff;
     }
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned version) {
+      ar & data;
+      ar & cutoff;
+      ar & fraction;
+    }
 };
 
@@ -23,3 +23,88 @@
 #include "szv_grid.h"
 #include "brick.h"
 
+#include <boost/thread/thread.hpp>
+
+szv_grid::szv_grid(const szv_grid_cache& c, const grid_dims& gd,
+    unsigned nthreads) {
+  szv_grid_cache::get_local_dims(gd, offset, range);
+  const model& m = c.getModel();
+  const fl cutoff_sqr = c.get_cutoff_sqr();
+  const fl cutoff = std::sqrt(cutoff_sqr);
+
+  szv relevant;
+  c.compute_relevant(gd, relevant);
+
+  //each x slab of cells is filled in on its own, considering only the
+  //atoms within the cutoff of the slab, then the slabs are concatenated
+  const sz nx = range[0], ny = range[1], nz = range[2];
+  std::vector<szv> slab_atoms(nx);
+  std::vector<std::vector<sz> > slab_counts(nx);
+  auto slab = [&](sz i) {
+    vec lower, upper;
+    szv_grid_cache::cell_bounds(i, 0, 0, offset, lower, upper);
+    szv near;
+    VINA_FOR_IN(r, relevant) {
+      fl ax = m.grid_atoms[relevant[r]].coords[0];
+      if (ax > lower[0] - cutoff && ax < upper[0] + cutoff)
+        near.push_back(relevant[r]);
+    }
+
+    szv& atoms = slab_atoms[i];
+    std::vector<sz>& counts = slab_counts[i];
+    counts.resize(ny * nz);
+    VINA_FOR(j, ny)
+      VINA_FOR(k, nz) {
+        szv_grid_cache::cell_bounds(i, j, k, offset, lower, upper);
+        sz before = atoms.size();
+        VINA_FOR_IN(r, near) {
+          if (brick_distance_sqr(lower, upper,
+              m.grid_atoms[near[r]].coords) < cutoff_sqr)
+            atoms.push_back(near[r]);
+        }
+        counts[j * nz + k] = atoms.size() - before;
+      }
+  };
+
+  nthreads = std::max(1U, std::min<unsigned>(nthreads, nx));
+  if (nthreads == 1) {
+    VINA_FOR(i, nx)
+      slab(i);
+  } else {
+    //slabs are handed out dynamically since the receptor density (and so
+    //the cost) varies across the box
+    sz next = 0;
+    boost::thread_group workers;
+    VINA_FOR(t, nthreads)
+      workers.create_thread([&]() {
+        for (sz i; (i = __sync_fetch_and_add(&next, 1)) < nx;)
+          slab(i);
+      });
+    workers.join_all();
+  }
+
+  offsets.reserve(nx * ny * nz + 1);
+  offsets.push_back(0);
+  VINA_FOR(i, nx) {
+    VINA_FOR_IN(cc, slab_counts[i])
+      offsets.push_back(offsets.back() + slab_counts[i][cc]);
+    indices.insert(indices.end(), slab_atoms[i].begin(), slab_atoms[i].end());
+    szv().swap(slab_atoms[i]);
+  }
+
+  const sz n = indices.size();
+  x.resize(n + 1);
+  y.resize(n + 1);
+  z.resize(n + 1);
+  types.resize(n + 1);
+  charges.resize(n + 1);
+  VINA_FOR(e, n) {
+    const atom& a = m.grid_atoms[indices[e]];
+    x[e] = a.coords[0];
+    y[e] = a.coords[1];
+    z[e] = a.coords[2];
+    types[e] = a.get();
+    charges[e] = a.charge;
+  }
+  indices.push_back(0); //padding so the arrays are never empty
+}
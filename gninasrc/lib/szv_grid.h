@@ -28,32 +28,28 @@
 #include "array3d.h"
 #include "brick.h"
 
-#include <boost/unordered_map.hpp>
-#include <boost/functional/hash.hpp>
-
-namespace boost {
-//overload for using array3 as hash key
-inline bool operator==(const array<int, 3> &a, const array<int, 3> &b) {
-  return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
-}
-
-// hash value
-inline std::size_t hash_value(const array<int, 3> &e) {
-  std::size_t seed = 0;
-  boost::hash_combine(seed, e[0]);
-  boost::hash_combine(seed, e[1]);
-  boost::hash_combine(seed, e[2]);
-  return seed;
-}
-}
-
-//dkoes - this is a 'global' cache of receptor atoms that are within a cutoff
-//distance from global grid points; the atom lists are calculated on demand
-//and stored in a hash
+
+//receptor atoms that may be within the cutoff of a point in one grid cell;
+//besides their indices into grid_atoms, their coordinates, types and
+//charges are packed into separate arrays so that distances can be computed
+//for several receptor atoms at once (see pair_kernel.h)
+//this is a view into the arrays of an szv_grid and is valid as long as it is
+struct receptor_cell {
+    const sz* indices;
+    const fl *x, *y, *z;
+    const smt* types;
+    const fl* charges;
+    sz n;
+
+    sz size() const {
+      return n;
+    }
+};
+
+//dkoes - the receptor atoms and cutoff that szv_grids are built from, along
+//with how space is divided into cells
 class szv_grid_cache {
     typedef boost::array<int, 3> ijk;
-    typedef boost::unordered_map<ijk, szv*> cache_type;
-    mutable cache_type cache;
     const model& m;
     fl cutoff_sqr;
     static constexpr fl granularity = 3.0; //good balance of cache locality and avoiding redundant computation
@@ -63,21 +59,14 @@ class szv_grid_cache {
 
     }
 
-    ~szv_grid_cache() {
-      //clear out szv vectors
-      for (cache_type::iterator itr = cache.begin(), end = cache.end();
-          itr != end; ++itr) {
-        if (itr->second != NULL) {
-          delete itr->second;
-          itr->second = NULL;
-        }
-      }
-    }
-
     const model& getModel() const {
       return m;
     }
 
+    fl get_cutoff_sqr() const {
+      return cutoff_sqr;
+    }
+
     //compute all the receptor atoms that may be reachable by passed grid dims
     void compute_relevant(const grid_dims& gd, szv& relevant_indices) const {
       vec start, end;
@@ -112,36 +101,14 @@ class szv_grid_cache {
       return ret;
     }
 
-    //return pointer to possibilities vector from cache
-    //the value is generated on-demand looking just at the receptor
-    //atoms in relvant_indices if necessary
-    const szv* get(const vec& coord, const szv& relevant_indices) const {
-      //get unique global index for coord
-      ijk index;
-      for (sz i = 0; i < 3; i++) {
-        index[i] = std::floor(coord[i] / granularity);
-      }
-
-      if (cache.count(index) == 0) {
-        //fill out the list of close enough receptor atoms
-        szv *atoms = new szv();
-        //compute lower and upper coordinates of this grid point
-        vec lower, upper;
-        for (sz i = 0; i < 3; i++) {
-          lower[i] = std::floor(coord[i] / granularity) * granularity;
-          upper[i] = std::ceil(coord[i] / granularity) * granularity;
-        }
-        VINA_FOR_IN(ri, relevant_indices) {
-          const sz i = relevant_indices[ri];
-          const atom& a = m.grid_atoms[i];
-          if (!a.is_hydrogen() && a.acceptable_type()) {
-            if (brick_distance_sqr(lower, upper, a.coords) < cutoff_sqr)
-              atoms->push_back(i);
-          }
-        }
-        cache[index] = atoms;
+    //lower and upper corners of the cell with local index (i,j,k)
+    static void cell_bounds(sz i, sz j, sz k, const ijk& offset, vec& lower,
+        vec& upper) {
+      sz idx[3] = { i, j, k };
+      for (sz d = 0; d < 3; d++) {
+        lower[d] = (offset[d] + fl(idx[d])) * granularity;
+        upper[d] = lower[d] + granularity;
       }
-      return cache[index];
     }
 
     //return the dimension of the grid for given dimensions
@@ -160,37 +127,42 @@ class szv_grid_cache {
 };
 
 //dkoes - this keeps track of what receptor atoms are possibly close enough
-//to grid points to matter and caches their indices
+//to each cell of a grid to matter
+//every cell is filled in when the grid is built (on nthreads threads) and
+//the atoms of all cells are stored contiguously, cell after cell, with
+//offsets marking where each cell starts, so lookups never allocate and any
+//number of threads can read it at once
 struct szv_grid {
-    szv_grid(szv_grid_cache& c, const grid_dims& gd)
-        : cache(c) {
-      cache.get_local_dims(gd, offset, range);
-      m_data.resize(range[0], range[1], range[2]);
-
-      cache.compute_relevant(gd, relevant_indexes);
-      //don't precompute - this is particularly inefficient for minimization
+    szv_grid(const szv_grid_cache& c, const grid_dims& gd,
+        unsigned nthreads = 1);
+
+    const receptor_cell cell(const vec& coords) const {
+      boost::array<int, 3> index = szv_grid_cache::local_index(coords, offset);
+      assert(index[0] >= 0 && index[0] < range[0]);
+      assert(index[1] >= 0 && index[1] < range[1]);
+      assert(index[2] >= 0 && index[2] < range[2]);
+      sz c = (sz(index[0]) * range[1] + index[1]) * range[2] + index[2];
+      sz begin = offsets[c];
+      receptor_cell ret;
+      ret.indices = &indices[0] + begin;
+      ret.x = &x[0] + begin;
+      ret.y = &y[0] + begin;
+      ret.z = &z[0] + begin;
+      ret.types = &types[0] + begin;
+      ret.charges = &charges[0] + begin;
+      ret.n = offsets[c + 1] - begin;
+      return ret;
     }
 
-    const szv& possibilities(const vec& coords) const {
-      boost::array<int, 3> index = cache.local_index(coords, offset);
-      assert(index[0] < m_data.dim0());
-      assert(index[1] < m_data.dim1());
-      assert(index[2] < m_data.dim2());
-      const szv* ret = m_data(index[0], index[1], index[2]);
-      if (ret == NULL) {
-        //fetch from cache
-        ret = cache.get(coords, relevant_indexes);
-        m_data(index[0], index[1], index[2]) = ret;
-      }
-      return *ret;
-    }
   private:
-    szv_grid_cache& cache;
-    szv relevant_indexes; //rec atoms within distance of docking grid
-    mutable array3d<const szv*> m_data; //this is updated as needed, does NOT own memory
     boost::array<int, 3> offset;
     boost::array<int, 3> range;
-
+    std::vector<sz> offsets; //cell c holds entries [offsets[c],offsets[c+1])
+    //per entry; never empty so the pointers above are always valid
+    szv indices; //into grid_atoms
+    flv x, y, z;
+    std::vector<smt> types;
+    flv charges;
 };
 
 #endif
@@ -0,0 +1,135 @@
+#include <boost/make_shared.hpp>
+#include "task_pool.h"
+
+task_pool::worker& task_pool::self() {
+  if (!index.get()) {
+    boost::mutex::scoped_lock L(lock);
+    index.reset(new sz(workers.size()));
+    workers.push_back(boost::make_shared<worker>());
+  }
+  boost::mutex::scoped_lock L(lock);
+  return *workers[*index];
+}
+
+void task_pool::join() {
+  self();
+  boost::mutex::scoped_lock L(lock);
+  active++;
+}
+
+void task_pool::finish() {
+  {
+    boost::mutex::scoped_lock L(lock);
+    VINA_CHECK(active > 0);
+    active--;
+    changed.notify_all();
+  }
+  //the last ligands may still be in their Monte Carlo search
+  item t;
+  for (;;) {
+    if (take(t)) {
+      run(t);
+      continue;
+    }
+    boost::mutex::scoped_lock L(lock);
+    if (queued <= 0) {
+      if (active == 0) return;
+      changed.wait(L);
+    }
+  }
+}
+
+void task_pool::spawn(group& g, const task& f) {
+  worker& w = self();
+  __sync_fetch_and_add(&g.pending, 1);
+  {
+    boost::mutex::scoped_lock L(w.lock);
+    w.tasks.push_back(item(f, &g));
+  }
+  boost::mutex::scoped_lock L(lock);
+  queued++;
+  changed.notify_all();
+}
+
+void task_pool::wait(group& g) {
+  item t;
+  while (!g.done()) {
+    if (take(t)) {
+      run(t);
+      continue;
+    }
+    boost::mutex::scoped_lock L(lock);
+    while (queued <= 0 && !g.done())
+      changed.wait(L);
+  }
+
+  if (g.error) {
+    std::exception_ptr e = g.error;
+    g.error = std::exception_ptr();
+    std::rethrow_exception(e);
+  }
+}
+
+//newest task from our own deque, otherwise the oldest from someone else's
+bool task_pool::take(item& t) {
+  worker& me = self();
+  bool found = false, stolen = false;
+  {
+    boost::mutex::scoped_lock L(me.lock);
+    if (!me.tasks.empty()) {
+      t = me.tasks.back();
+      me.tasks.pop_back();
+      found = true;
+    }
+  }
+
+  if (!found) {
+    std::deque<boost::shared_ptr<worker> > victims;
+    {
+      boost::mutex::scoped_lock L(lock);
+      if (queued <= 0) return false;
+      victims = workers;
+    }
+    sz n = victims.size();
+    for (sz i = 1; i < n && !found; i++) {
+      worker& w = *victims[(*index + i) % n];
+      boost::mutex::scoped_lock L(w.lock);
+      if (!w.tasks.empty()) {
+        t = w.tasks.front();
+        w.tasks.pop_front();
+        found = stolen = true;
+      }
+    }
+  }
+
+  if (found) {
+    boost::mutex::scoped_lock L(lock);
+    queued--;
+    run_count++;
+    if (stolen) steal_count++;
+  }
+  return found;
+}
+
+void task_pool::run(item& t) {
+  group& g = *t.g;
+  try {
+    t.f();
+  } catch (...) {
+    boost::mutex::scoped_lock L(g.error_lock);
+    if (!g.error) g.error = std::current_exception();
+  }
+  t = item();
+
+  //g may be destroyed by its owner as soon as it is done
+  if (__sync_sub_and_fetch(&g.pending, 1) == 0) {
+    boost::mutex::scoped_lock L(lock);
+    changed.notify_all();
+  }
+}
+
+void task_pool::report(std::ostream& out) const {
+  boost::mutex::scoped_lock L(lock);
+  out << "Task pool: " << workers.size() << " workers ran " << run_count
+      << " tasks, " << steal_count << " stolen\n";
+}
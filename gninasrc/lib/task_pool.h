@@ -0,0 +1,84 @@
+#pragma once
+
+#include <deque>
+#include <exception>
+#include <ostream>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/tss.hpp>
+#include "common.h"
+
+//work stealing pool shared by every thread that processes ligands
+//each participating thread has its own deque of tasks: it pushes and pops
+//its own work at the back and, when it runs out while waiting for a group to
+//finish, steals from the front of the other deques; so Monte Carlo chains of
+//one ligand are picked up by threads that are done with theirs
+//the pool has no threads of its own, the ligand workers are its threads
+class task_pool {
+  public:
+    typedef boost::function<void()> task;
+
+    //set of spawned tasks that can be waited on together
+    class group {
+        friend class task_pool;
+        mutable unsigned pending;
+        std::exception_ptr error; //first exception thrown by a task
+        boost::mutex error_lock;
+      public:
+        group()
+            : pending(0) {
+        }
+        bool done() const {
+          return __sync_fetch_and_add(&pending, 0) == 0;
+        }
+    };
+
+    task_pool()
+        : queued(0), active(0), run_count(0), steal_count(0) {
+    }
+
+    //register the calling thread as a worker of the pool
+    void join();
+    //help other workers until every worker has called finish
+    void finish();
+
+    //queue t on the calling worker's deque as part of g
+    void spawn(group& g, const task& t);
+    //run queued tasks until all of g is done; rethrows the first exception
+    //thrown by a task of g
+    void wait(group& g);
+
+    void report(std::ostream& out) const;
+
+  private:
+    struct item {
+        task f;
+        group* g;
+        item()
+            : g(NULL) {
+        }
+        item(const task& f, group* g)
+            : f(f), g(g) {
+        }
+    };
+
+    struct worker {
+        boost::mutex lock;
+        std::deque<item> tasks;
+    };
+
+    worker& self();
+    bool take(item& t);
+    void run(item& t);
+
+    boost::thread_specific_ptr<sz> index; //of the calling thread in workers
+    mutable boost::mutex lock; //protects everything below
+    boost::condition changed; //work was queued, a group or worker finished
+    std::deque<boost::shared_ptr<worker> > workers;
+    long queued; //tasks waiting in any deque
+    sz active; //workers that have joined but not finished
+    unsigned long run_count;
+    unsigned long steal_count;
+};
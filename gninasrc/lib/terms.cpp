@@ -205,7 +205,8 @@ void terms::eval_additive_aux(const model& m, const atom_index& i,
 //dkoes - evaluate from terms directly with no precomputation
 //also, fill out each atom's contribution
 //this routine is not intended to be efficient (see precalc)
-flv terms::evale_robust(const model& m, std::vector<flv>& per_atom) const {
+flv terms::evale_robust(const model& m, std::vector<flv>& per_atom,
+    const receptor_index* index) const {
   flv tmp(size(), 0);
   // only single-ligand systems are supported by this procedure
   if (m.ligands.size() == 0) //nolig
@@ -222,13 +223,20 @@ flv terms::evale_robust(const model& m, std::vector<flv>& per_atom) const {
 
   std::vector<atom_index> relevant_atoms;
 
-  VINA_FOR_IN(j, m.grid_atoms) {
-    const atom& a = m.grid_atoms[j];
-    const smt t = a.get();
-    if (brick_distance_sqr(box_begin, box_end, a.coords) < max_r_cutoff_sqr
-        && t < n && !is_hydrogen(t)) // exclude, say, Hydrogens
-    relevant_atoms.push_back(atom_index(j, true));
-  }
+  if (index && index->indexes(m.grid_atoms)) {
+    //same atoms in the same order as the scan below
+    szv near;
+    index->near_box(box_begin, box_end, max_r_cutoff(), near);
+    VINA_FOR_IN(k, near)
+      relevant_atoms.push_back(atom_index(near[k], true));
+  } else
+    VINA_FOR_IN(j, m.grid_atoms) {
+      const atom& a = m.grid_atoms[j];
+      const smt t = a.get();
+      if (brick_distance_sqr(box_begin, box_end, a.coords) < max_r_cutoff_sqr
+          && t < n && !is_hydrogen(t)) // exclude, say, Hydrogens
+      relevant_atoms.push_back(atom_index(j, true));
+    }
 
   per_atom.clear();
   per_atom.resize(m.atoms.size(), flv(size(), 0));
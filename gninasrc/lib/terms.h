@@ -26,6 +26,7 @@
 #include <boost/ptr_container/ptr_vector.hpp> 
 #include <boost/regex.hpp>
 #include "model.h"
+#include "receptor_index.h"
 #include "result_components.h"
 
 //thrown when can't parse name of term
@@ -325,10 +326,13 @@ struct terms {
     }
     sz size_conf_independent(bool enabled_only) const; // number of parameters does not necessarily equal the number of operators
     fl max_r_cutoff() const;
-    flv evale_robust(const model& m, std::vector<flv>& per_atom) const;
-    flv evale_robust(const model& m) const {
+    //index, if it covers the receptor of m, narrows the receptor atoms
+    //considered without changing the result
+    flv evale_robust(const model& m, std::vector<flv>& per_atom,
+        const receptor_index* index = NULL) const;
+    flv evale_robust(const model& m, const receptor_index* index = NULL) const {
       std::vector<flv> pa;
-      return evale_robust(m, pa);
+      return evale_robust(m, pa, index);
     }
     fl eval_conf_independent(const conf_independent_inputs& in, fl x,
         flv::const_iterator& it) const;
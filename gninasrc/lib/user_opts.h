@@ -12,6 +12,7 @@ struct cnn_options {
     vec cnn_center;
     fl resolution; //this isn't specified in model file, so be careful about straying from default
     unsigned cnn_rotations; //do we want to score multiple orientations?
+    unsigned grid_threads; //threads used to grid each pose on the cpu
     double subgrid_dim;
     bool cnn_scoring; //if true, do cnn_scoring of final pose
     bool cnn_refinement;
@@ -26,7 +27,7 @@ struct cnn_options {
 
     cnn_options()
         : cnn_model_name("default2017"), cnn_center(NAN, NAN, NAN), resolution(0.5), cnn_rotations(0),
-            subgrid_dim(0.0), cnn_scoring(false), cnn_refinement(false), outputdx(false),
+            grid_threads(1), subgrid_dim(0.0), cnn_scoring(false), cnn_refinement(false), outputdx(false),
             outputxyz(false), gradient_check(false), move_minimize_frame(false),
             fix_receptor(true), verbose(false), seed(0) {
     }
@@ -45,6 +46,7 @@ struct user_settings {
 
     int exhaustiveness;
     int num_mc_steps;
+    unsigned mc_convergence_window; //0 to always take num_mc_steps
     bool score_only;
     bool randomize_only;
     bool local_only;
@@ -58,7 +60,7 @@ struct user_settings {
     user_settings()
         : energy_range(2.0), num_modes(9), out_min_rmsd(1), forcecap(1000),
             seed(auto_seed()), verbosity(1), cpu(1), device(0),
-            exhaustiveness(10), num_mc_steps(0), score_only(false),
+            exhaustiveness(10), num_mc_steps(0), mc_convergence_window(0), score_only(false),
             randomize_only(false), local_only(false), dominimize(false),
             include_atom_info(false), gpu_on(false) {
 
@@ -18,8 +18,11 @@
 #include "file.h"
 #include "cache.h"
 #include "cache_gpu.h"
+#include "cache_store.h"
+#include "task_pool.h"
 #include "non_cache.h"
 #include "naive_non_cache.h"
+#include "receptor_index.h"
 #include "non_cache_gpu.h"
 #include "non_cache_cnn.h"
 #include "parse_error.h"
@@ -57,6 +60,8 @@
 #include <boost/unordered_map.hpp>
 #include "sem.h"
 #include "user_opts.h"
+#include "run_checkpoint.h"
+#include "profiler.h"
 
 #include <cuda_profiler_api.h>
 
@@ -221,6 +226,37 @@ static void get_cnn_info(model& m, CNNScorer& cnn, tee& log, float& cnnscore,
   }
 }
 
+//get_cnn_info for every pose of out_cont, scored in one batch; this is only
+//equivalent when each pose is centered on itself (move_minimize_frame)
+static void get_cnn_info(model& m, const output_container& out_cont,
+    CNNScorer& cnn, tee& log)
+    {
+  std::vector<conf> confs;
+  VINA_FOR_IN(i, out_cont)
+    confs.push_back(out_cont[i].c);
+  std::vector<float> cnnscores, cnnaffinities;
+  cnn.score(m, confs, cnnscores, cnnaffinities);
+
+  VINA_FOR_IN(i, confs)
+  {
+    if (cnnscores[i] < 0) continue;
+    if (cnn.options().verbose) {
+      log << "CNNscore1: " << std::fixed << std::setprecision(10) << cnnscores[i];
+      log.endl();
+      log << "CNNaffinity1: " << std::fixed << std::setprecision(10)
+          << cnnaffinities[i];
+      log.endl();
+    }
+    log << "CNNscore: " << std::fixed << std::setprecision(10) << cnnscores[i];
+    log.endl();
+    log << "CNNaffinity: " << std::fixed << std::setprecision(10)
+        << cnnaffinities[i];
+    log.endl();
+  }
+  if (!confs.empty() && cnn.initialized())
+    cnn.set_center_from_model(m); //m is in the last pose
+}
+
 //dkoes - return all energies and rmsds to original conf with result
 void do_search(model& m, const boost::optional<model>& ref,
     const weighted_terms& sf, const precalculate& prec, igrid& ig,
@@ -229,7 +265,7 @@ void do_search(model& m, const boost::optional<model>& ref,
     const parallel_mc& par, const user_settings& settings,
     bool compute_atominfo, tee& log,
     const terms *t, grid& user_grid, CNNScorer& cnn,
-    std::vector<result_info>& results)
+    std::vector<result_info>& results, const receptor_index* receptor)
     {
   boost::timer::cpu_timer time;
 
@@ -250,7 +286,7 @@ void do_search(model& m, const boost::optional<model>& ref,
   {
     intramolecular_energy = m.eval_intramolecular(exact_prec,
         authentic_v, c);
-    naive_non_cache nnc(&exact_prec); // for out of grid issues
+    naive_non_cache nnc(&exact_prec, receptor); // for out of grid issues
     e = m.eval_adjusted(sf, exact_prec, nnc, authentic_v, c,
         intramolecular_energy, user_grid);
 
@@ -261,7 +297,7 @@ void do_search(model& m, const boost::optional<model>& ref,
     get_cnn_info(m, cnn, log, cnnscore, cnnaffinity, cnnforces);
 
     std::vector<flv> atominfo;
-    flv term_values = t->evale_robust(m);
+    flv term_values = t->evale_robust(m, receptor);
     log << "Intramolecular energy: " << std::fixed << std::setprecision(5)
         << intramolecular_energy << "\n";
 
@@ -288,7 +324,7 @@ void do_search(model& m, const boost::optional<model>& ref,
     results.push_back(result_info(e, cnnscore, cnnaffinity, cnnforces, -1, m));
 
     if (compute_atominfo)
-      results.back().setAtomValues(m, &sf);
+      results.back().setAtomValues(m, &sf, receptor);
   }
   else if (settings.local_only)
   {
@@ -301,7 +337,7 @@ void do_search(model& m, const boost::optional<model>& ref,
     m.set(out.c);
 
     //be as exact as possible for final score
-    naive_non_cache nnc(&exact_prec); // for out of grid issues
+    naive_non_cache nnc(&exact_prec, receptor); // for out of grid issues
 
     fl intramolecular_energy = m.eval_intramolecular(exact_prec,
         authentic_v,
@@ -333,7 +369,7 @@ void do_search(model& m, const boost::optional<model>& ref,
         result_info(e, cnnscore, cnnaffinity, cnnforces, rmsd, m));
 
     if (compute_atominfo)
-      results.back().setAtomValues(m, &sf);
+      results.back().setAtomValues(m, &sf, receptor);
   }
   else
   {
@@ -342,14 +378,26 @@ void do_search(model& m, const boost::optional<model>& ref,
     log.endl();
     output_container out_cont;
     doing(settings.verbosity, "Performing search", log);
-    par(m, out_cont, prec, ig, corner1, corner2, generator, user_grid);
+    std::vector<unsigned> chain_steps;
+    par(m, out_cont, prec, ig, corner1, corner2, generator, user_grid,
+        &chain_steps);
     done(settings.verbosity, log);
+    if (par.mc.convergence_window > 0) {
+      log << "Monte carlo steps per chain (of " << par.mc.num_steps << "):";
+      VINA_FOR_IN(i, chain_steps)
+        log << " " << chain_steps[i];
+      log.endl();
+    }
     doing(settings.verbosity, "Refining results", log);
+    bool batch_cnn = cnn.options().move_minimize_frame;
     VINA_FOR_IN(i, out_cont) {
       refine_structure(m, prec, nc, out_cont[i], authentic_v,
           par.mc.ssd_par.minparm, user_grid, settings.gpu_on);
-      get_cnn_info(m, cnn, log, cnnscore, cnnaffinity, cnnforces);
+      if (!batch_cnn)
+        get_cnn_info(m, cnn, log, cnnscore, cnnaffinity, cnnforces);
     }
+    if (batch_cnn)
+      get_cnn_info(m, out_cont, cnn, log);
 
     if (!out_cont.empty())
     {
@@ -385,6 +433,7 @@ void do_search(model& m, const boost::optional<model>& ref,
       best_mode_model.set(out_cont.front().c);
 
     sz how_many = 0;
+    std::vector<conf> confs;
     VINA_FOR_IN(i, out_cont)
     {
       if (how_many >= settings.num_modes || !not_max(out_cont[i].e)
@@ -401,19 +450,35 @@ void do_search(model& m, const boost::optional<model>& ref,
           << std::setw(9) << std::setprecision(3) << ub; // FIXME need user-readable error messages in case of failures
 
       log.endl();
+      confs.push_back(out_cont[i].c);
+    }
 
-      float cnnaffinity = -1;
-      float cnnforces = -1;
-      float loss = 0;
-      cnnscore = cnn.score(m, true, cnnaffinity, loss);
-      cnnforces = m.get_minus_forces_sum_magnitude();
+    //score every reported pose in one forward pass when each pose is
+    //centered on itself, otherwise one at a time as refinement does
+    std::vector<float> cnnscores, cnnaffinities;
+    std::vector<std::vector<float3> > cnngradients;
+    if (batch_cnn)
+      cnn.score(m, confs, cnnscores, cnnaffinities, &cnngradients);
+    VINA_FOR_IN(i, confs)
+    {
+      m.set(confs[i]);
+      if (batch_cnn) {
+        m.clear_minus_forces();
+        if (cnngradients[i].size() > 0)
+          m.add_minus_forces(cnngradients[i]);
+      } else {
+        float cnnaffinity = -1;
+        float loss = 0;
+        cnnscores.push_back(cnn.score(m, true, cnnaffinity, loss));
+        cnnaffinities.push_back(cnnaffinity);
+      }
+      float cnnforces = m.get_minus_forces_sum_magnitude();
       //dkoes - setup result_info
       results.push_back(
-          result_info(out_cont[i].e, cnnscore, cnnaffinity, cnnforces, -1, m));
+          result_info(out_cont[i].e, cnnscores[i], cnnaffinities[i], cnnforces, -1, m));
 
       if (compute_atominfo)
-        results.back().setAtomValues(m, &sf);
-
+        results.back().setAtomValues(m, &sf, receptor);
     }
     done(settings.verbosity, log);
 
@@ -454,7 +519,9 @@ void main_procedure(model& m, precalculate& prec,
     bool no_cache, bool compute_atominfo,
     const grid_dims& gd, minimization_params minparm,
     const weighted_terms& wt, tee& log,
-    std::vector<result_info>& results, grid& user_grid, CNNScorer& cnn)
+    std::vector<result_info>& results, grid& user_grid, CNNScorer& cnn,
+    cache_store* store = NULL, task_pool* pool = NULL,
+    const receptor_index* receptor = NULL)
     {
   doing(settings.verbosity, "Setting up the scoring function", log);
 
@@ -471,6 +538,7 @@ void main_procedure(model& m, precalculate& prec,
   if (settings.num_mc_steps > 0) {
     par.mc.num_steps = settings.num_mc_steps;
   }
+  par.mc.convergence_window = settings.mc_convergence_window;
 
   par.mc.ssd_par.evals = unsigned((25 + m.num_movable_atoms()) / 3);
   if (minparm.maxiters == 0)
@@ -481,7 +549,8 @@ void main_procedure(model& m, precalculate& prec,
   par.mc.hunt_cap = vec(10, 10, 10);
   par.num_tasks = settings.exhaustiveness;
   par.num_threads = settings.cpu;
-  par.display_progress = true;
+  par.pool = pool;
+  par.display_progress = !pool; //several ligands may be searched at once
 
   szv_grid_cache gridcache(m, prec.cutoff_sqr());
   const fl slope = 1e3; // FIXME: too large? used to be 100
@@ -528,32 +597,51 @@ void main_procedure(model& m, precalculate& prec,
       do_search(m, ref, wt, prec, *nc, *nc, corner1, corner2, par,
           settings, compute_atominfo, log,
           wt.unweighted_terms(), user_grid, cnn,
-          results);
+          results, receptor);
     }
     else
     {
       bool cache_needed = !(settings.score_only || settings.randomize_only
           || settings.local_only);
 
+      bool gpu_cache = settings.gpu_on
+          && !(settings.cnnopts.cnn_scoring || settings.cnnopts.cnn_refinement);
+
       if (cache_needed)
         doing(settings.verbosity, "Analyzing the binding site", log);
-      std::unique_ptr<cache> c(
-          (settings.gpu_on &&
-              !(settings.cnnopts.cnn_scoring ||
-                  settings.cnnopts.cnn_refinement)) ?
-              new cache_gpu("scoring_function_version001",
-                  gd, slope, dynamic_cast<precalculate_gpu*>(&prec)) :
-              new cache("scoring_function_version001", gd, slope));
-      if (cache_needed)
+      std::unique_ptr<cache> c;
+      boost::shared_ptr<cache> shared; //held while docking, the store may drop it
+      cache *ca = NULL;
+      if (cache_needed && store && !gpu_cache)
       {
+        //grids are shared with every other ligand docked against this
+        //receptor, only types not seen before are computed
         std::vector<smt> atom_types_needed;
         m.get_movable_atom_types(atom_types_needed);
-        c->populate(m, prec, atom_types_needed, user_grid);
+        shared = store->get(m, prec, gd, slope, atom_types_needed, user_grid);
+        ca = shared.get();
         done(settings.verbosity, log);
       }
-      do_search(m, ref, wt, prec, *c, *nc, corner1, corner2, par,
+      else
+      {
+        c.reset(gpu_cache ?
+            new cache_gpu("scoring_function_version001",
+                gd, slope, dynamic_cast<precalculate_gpu*>(&prec)) :
+            new cache("scoring_function_version001", gd, slope));
+        //with a pool every cpu already docks a ligand of its own
+        c->set_num_threads(pool ? 1 : settings.cpu);
+        if (cache_needed)
+        {
+          std::vector<smt> atom_types_needed;
+          m.get_movable_atom_types(atom_types_needed);
+          c->populate(m, prec, atom_types_needed, user_grid);
+          done(settings.verbosity, log);
+        }
+        ca = c.get();
+      }
+      do_search(m, ref, wt, prec, *ca, *nc, corner1, corner2, par,
           settings, compute_atominfo, log,
-          wt.unweighted_terms(), user_grid, cnn, results);
+          wt.unweighted_terms(), user_grid, cnn, results, receptor);
     }
 
     delete nc;
@@ -766,6 +854,31 @@ std::istream& operator>>(std::istream& in, ApproxType& type)
   return in;
 }
 
+//parse K/N into the shard of selection
+void parse_shard(const std::string& str, ligand_selection& selection)
+    {
+  std::istringstream in(str);
+  char slash = 0;
+  if (!(in >> selection.shard >> slash >> selection.num_shards) || slash != '/'
+      || !in.eof() || selection.num_shards == 0
+      || selection.shard >= selection.num_shards)
+    throw usage_error("shard must be K/N with 0 <= K < N, not " + str);
+}
+
+//parse B:E (E optional) into the range of selection
+void parse_ligand_range(const std::string& str, ligand_selection& selection)
+    {
+  std::istringstream in(str);
+  char colon = 0;
+  if (!(in >> selection.begin >> colon) || colon != ':')
+    throw usage_error("ligand_range must be B:E, not " + str);
+  selection.end = SIZE_MAX;
+  if (in.peek() != EOF && (!(in >> selection.end) || !in.eof()))
+    throw usage_error("ligand_range must be B:E, not " + str);
+  if (selection.end <= selection.begin)
+    throw usage_error("ligand_range " + str + " is empty");
+}
+
 //set the default device to device and exit with error if there are any problems
 void initializeCUDA(int device)
     {
@@ -811,21 +924,22 @@ void initializeCUDA(int device)
 struct worker_job
 {
     unsigned int molid;
+    sz record; //input record the ligand came from
     model* m;
     std::vector<result_info>* results;
     grid_dims gd;
 
-    worker_job(unsigned int molid, model* m, std::vector<result_info>* results,
-        grid_dims gd)
+    worker_job(unsigned int molid, sz record, model* m,
+        std::vector<result_info>* results, grid_dims gd)
         :
-            molid(molid), m(m), results(results), gd(gd)
+            molid(molid), record(record), m(m), results(results), gd(gd)
     {
     }
     ;
 
     worker_job()
         :
-            molid(0), m(NULL), results(NULL)
+            molid(0), record(0), m(NULL), results(NULL)
     {
       for (int i = 0; i < 3; i++)
           {
@@ -836,22 +950,32 @@ struct worker_job
 
 };
 
+//output of one ligand, rendered by its worker so that the writer only has
+//to put ligands in order
+struct rendered_ligand
+{
+    std::string mol;
+    std::string flex;
+    std::string atoms;
+};
+
 //writer queue job format
 struct writer_job
 {
     unsigned int molid;
-    std::vector<result_info>* results;
+    sz record;
+    rendered_ligand* out;
 
-    writer_job(unsigned int molid, std::vector<result_info>* results)
+    writer_job(unsigned int molid, sz record, rendered_ligand* out)
         :
-            molid(molid), results(results)
+            molid(molid), record(record), out(out)
     {
     }
     ;
 
     writer_job()
         :
-            molid(0), results(NULL)
+            molid(0), record(0), out(NULL)
     {
     }
     ;
@@ -860,15 +984,29 @@ struct writer_job
 template<typename T>
 struct job_queue
 {
-    job_queue()
+    // A capacity of zero means unbounded; otherwise push blocks while
+    // capacity jobs are waiting to be popped.
+    job_queue(unsigned capacity = 0)
         :
-            jobs(0)
+            jobs(capacity), has_space(capacity), capacity(capacity), depth(0),
+            max_depth(0), stalls(0), stall_time(0)
     {
     }
     ;
 
     void push(T& job) {
+      if (capacity > 0 && !has_space.try_wait()) {
+        // Full, so the producer is outpacing the consumers; wait for room.
+        boost::timer::cpu_timer t;
+        has_space.wait();
+        __sync_fetch_and_add(&stalls, 1);
+        __sync_fetch_and_add(&stall_time, t.elapsed().wall);
+      }
       jobs.push(job);
+      unsigned d = __sync_add_and_fetch(&depth, 1);
+      for (unsigned m = max_depth; d > m;
+          m = __sync_val_compare_and_swap(&max_depth, m, d))
+        ;
       has_work.signal();
     }
 
@@ -876,7 +1014,10 @@ struct job_queue
     // closed. Should not be called again in the same thread afterwards.
     bool wait_and_pop(T& job) {
       has_work.wait();
-      return !jobs.pop(job);
+      if (!jobs.pop(job)) return true;
+      __sync_sub_and_fetch(&depth, 1);
+      if (capacity > 0) has_space.signal();
+      return false;
     }
 
     // Signal that all jobs are done. num_possible_waiters will be waiting
@@ -887,8 +1028,23 @@ struct job_queue
         has_work.signal();
     }
 
+    // Summarize depth and producer stalls.
+    void report(std::ostream& out, const std::string& name) const {
+      out << name << " queue: max depth " << max_depth;
+      if (capacity > 0)
+        out << " of " << capacity << ", producer stalled " << stalls
+            << " times for " << stall_time / 1000000000.0 << "s";
+      out << "\n";
+    }
+
     sem has_work;
     boost::lockfree::queue<T> jobs;
+    sem has_space;
+    unsigned capacity;
+    unsigned depth; // jobs currently waiting
+    unsigned max_depth;
+    unsigned long stalls; // pushes that had to wait for room
+    boost::timer::nanosecond_type stall_time;
 };
 
 //A struct of parameters that define the current run. These are packed together
@@ -904,30 +1060,40 @@ struct global_state
     grid* user_grid;
     tee* log;
     std::ofstream* atomoutfile;
+    std::string outext; //empty if there is no output file
+    std::string outfext; //empty if there is no flexible residue output
     cnn_options cnnopts;
+    cache_store* grids; //receptor grids shared by all ligands
+    task_pool* pool; //monte carlo chains of all ligands, NULL if not docking
+    const receptor_index* receptor; //neighbor lookup for exact scoring
 
     global_state(user_settings* settings, boost::shared_ptr<precalculate> prec,
         minimization_params* minparms, weighted_terms* wt,
-        grid* user_grid, tee* log, std::ofstream* atomoutfile, const cnn_options& co):
+        grid* user_grid, tee* log, std::ofstream* atomoutfile,
+        const std::string& outext, const std::string& outfext, const cnn_options& co,
+        cache_store* grids, task_pool* pool, const receptor_index* receptor):
         settings(settings), prec(prec), minparms(minparms), wt(wt),
             user_grid(user_grid), log(log), atomoutfile(atomoutfile),
-            cnnopts(co)
+            outext(outext), outfext(outfext), cnnopts(co), grids(grids), pool(pool),
+            receptor(receptor)
     {
     }
     ;
 };
 
 //function to occupy the worker threads with individual ligands from the work queue
-//TODO: see if implementing weight sharing between CNNScorer instances results
-//in enough memory efficiency to avoid using a single one
+void render_out(std::vector<result_info> &results, const global_state& gs,
+    rendered_ligand& out);
+
 void threads_at_work(job_queue<worker_job>* wrkq,
     job_queue<writer_job>* writerq, global_state* gs,
-    MolGetter* mols, int* nligs, CNNScorer cnn_scorer) //copy cnn_scorer so it can maintain state
+    MolGetter* mols, int* nligs, CNNScorer cnn_scorer) //copy cnn_scorer so each thread has its own net
     {
   if (gs->settings->gpu_on) {
     initializeCUDA(gs->settings->device);
     thread_buffer.init(free_mem(gs->settings->cpu));
   }
+  if (gs->pool) gs->pool->join();
 
   worker_job j;
   while (!wrkq->wait_and_pop(j))
@@ -940,72 +1106,148 @@ void threads_at_work(job_queue<worker_job>* wrkq,
         gs->atomoutfile->is_open()
             || gs->settings->include_atom_info, j.gd,
         *gs->minparms, *gs->wt, *gs->log, *(j.results),
-        *gs->user_grid, cnn_scorer);
+        *gs->user_grid, cnn_scorer, gs->grids, gs->pool, gs->receptor);
 
-    writer_job k(j.molid, j.results);
+    rendered_ligand* out = new rendered_ligand();
+    try {
+      render_out(*j.results, *gs, *out);
+    } catch (usage_error& e) {
+      std::cerr << "\n\nUsage error: " << e.what() << "\n";
+    } catch (std::exception& e) {
+      //still hand the (partial) output on so the writer doesn't wait for it
+      std::cerr << "\n\nError writing " << j.m->get_name() << ": " << e.what()
+          << "\n";
+    }
+    writer_job k(j.molid, j.record, out);
     writerq->push(k);
+    delete j.results;
     delete j.m;
   }
+
+  //out of ligands, but others may still have chains to run
+  if (gs->pool) gs->pool->finish();
 }
 
-void write_out(std::vector<result_info> &results, ozfile &outfile,
-    std::string &outext,
-    user_settings &settings, const weighted_terms &wt, ozfile &outflex,
-    std::string &outfext, std::ofstream &atomoutfile)
+//format the results of a ligand for every output file that is open
+void render_out(std::vector<result_info> &results, const global_state& gs,
+    rendered_ligand& out)
     {
-  if (outfile)
+  PROFILE_SCOPE(ProfileOutput);
+  if (gs.outext.size() > 0)
   {
     //write out molecular data
+    std::ostringstream str;
+    std::string outext = gs.outext;
     for (unsigned j = 0, nr = results.size(); j < nr; j++) {
-      results[j].write(outfile, outext, settings.include_atom_info, &wt,
+      results[j].write(str, outext, gs.settings->include_atom_info, gs.wt,
           j + 1);
     }
+    out.mol = str.str();
   }
-  if (outflex)
+  if (gs.outfext.size() > 0)
   {
     //write out flexible residue data data
+    std::ostringstream str;
+    std::string outfext = gs.outfext;
     for (unsigned j = 0, nr = results.size(); j < nr; j++) {
-      results[j].writeFlex(outflex, outfext, j + 1);
+      results[j].writeFlex(str, outfext, j + 1);
     }
+    out.flex = str.str();
   }
-  if (atomoutfile)
+  if (gs.atomoutfile->is_open())
   {
+    std::ostringstream str;
     for (unsigned j = 0, m = results.size(); j < m; j++) {
-      results[j].writeAtomValues(atomoutfile, &wt);
+      results[j].writeAtomValues(str, gs.wt);
     }
+    out.atoms = str.str();
   }
 }
 
+void write_out(const rendered_ligand& out, ozfile &outfile, ozfile &outflex,
+    std::ofstream &atomoutfile)
+    {
+  PROFILE_SCOPE(ProfileOutput);
+  if (outfile) outfile << out.mol;
+  if (outflex) outflex << out.flex;
+  if (atomoutfile) atomoutfile << out.atoms;
+}
+
+//keeps the checkpoint of a run up to date with what has been written
+struct checkpointer
+{
+    path name;
+    run_checkpoint state;
+    std::vector<std::string> outputs; //names of the open output files
+    boost::timer::nanosecond_type interval;
+    boost::timer::cpu_timer since; //last save
+
+    checkpointer(const path& name, unsigned seconds)
+        :
+            name(name), interval(seconds * 1000000000LL)
+    {
+    }
+
+    //flush the outputs and record their sizes, along with the fact that
+    //every selected record before next has been written
+    void save(sz next, ozfile& outfile, ozfile& outflex,
+        std::ofstream& atomoutfile, bool complete = false)
+        {
+      if (outfile) outfile.flush();
+      if (outflex) outflex.flush();
+      if (atomoutfile) atomoutfile.flush();
+      state.next_record = next;
+      state.complete = complete;
+      VINA_FOR_IN(i, outputs)
+      {
+        state.sizes[outputs[i]] = boost::filesystem::file_size(outputs[i]);
+      }
+      state.write(name);
+      since.start();
+    }
+
+    bool due() const
+    {
+      return since.elapsed().wall >= interval;
+    }
+};
+
 //function for the writing thread to write ligands in order to output file
+//the workers have already formatted the output
 void thread_a_writing(job_queue<writer_job>* writerq,
     global_state* gs,
-    ozfile* outfile, std::string* outext, ozfile* outflex,
-    std::string* outfext,
-    int* nligs) {
+    ozfile* outfile, ozfile* outflex,
+    int* nligs, checkpointer* checkpoint) {
   try {
     int nwritten = 0;
-    boost::unordered_map<int, std::vector<result_info>*> proc_out;
+    sz next = checkpoint ? checkpoint->state.next_record : 0;
+    boost::unordered_map<int, writer_job> proc_out;
     writer_job j;
     while (!writerq->wait_and_pop(j))
     {
       if (j.molid == nwritten) {
-        write_out(*j.results, *outfile, *outext, *gs->settings, *gs->wt,
-            *outflex, *outfext, *gs->atomoutfile);
+        write_out(*j.out, *outfile, *outflex, *gs->atomoutfile);
         nwritten++;
-        delete j.results;
-        for (boost::unordered_map<int, std::vector<result_info>*>::iterator i;
+        next = j.record + 1;
+        delete j.out;
+        for (boost::unordered_map<int, writer_job>::iterator i;
             (i = proc_out.find(nwritten)) != proc_out.end();)
             {
-          write_out(*i->second, *outfile, *outext, *gs->settings,
-              *gs->wt, *outflex, *outfext, *gs->atomoutfile);
+          write_out(*i->second.out, *outfile, *outflex, *gs->atomoutfile);
           nwritten++;
-          delete i->second;
+          next = i->second.record + 1;
+          delete i->second.out;
+          proc_out.erase(i);
         }
+        if (checkpoint && checkpoint->due())
+          checkpoint->save(next, *outfile, *outflex, *gs->atomoutfile);
       }
       else {
-        proc_out[j.molid] = j.results;
+        proc_out[j.molid] = j;
       }
     }
+    if (checkpoint) //progress so far; main marks it complete
+      checkpoint->save(next, *outfile, *outflex, *gs->atomoutfile);
   } catch (file_error& e)
   {
     std::cerr << "\n\nError: could not open \"" << e.name.string()
@@ -1064,6 +1306,11 @@ Thank you!\n";
     std::string atomconstants_file;
     std::string custom_file_name;
     std::string usergrid_file_name;
+    std::string grid_cache_dir;
+    std::string precalc_cache;
+    std::string shard, ligand_range;
+    std::string checkpoint_name;
+    unsigned checkpoint_interval = 60;
     std::string flex_res;
     double flex_dist = -1.0;
     fl center_x = 0, center_y = 0, center_z = 0, size_x = 0, size_y = 0,
@@ -1088,8 +1335,11 @@ Thank you!\n";
     bool flex_hydrogens = false;
     bool print_terms = false;
     bool print_atom_types = false;
+    bool profile = false;
+    std::string profile_json;
     bool add_hydrogens = true;
     bool strip_hydrogens = false;
+    bool native_sdf = false;
     bool no_lig = false;
 
     user_settings settings;
@@ -1098,6 +1348,8 @@ Thank you!\n";
     minimization_params minparms;
     ApproxType approx = LinearApprox;
     fl approx_factor = 32;
+    unsigned queue_depth = 0;
+    unsigned gzip_threads = 1;
 
     positional_options_description positional; // remains empty
 
@@ -1114,7 +1366,11 @@ Thank you!\n";
     ("flexdist_ligand", value<std::string>(&flexdist_ligand),
         "Ligand to use for flexdist")
     ("flexdist", value<double>(&flex_dist),
-        "set all side chains within specified distance to flexdist_ligand to flexible");
+        "set all side chains within specified distance to flexdist_ligand to flexible")
+    ("shard", value<std::string>(&shard),
+        "K/N: only process ligands whose index modulo N is K (0 <= K < N); ligands are numbered from 0 over all ligand files")
+    ("ligand_range", value<std::string>(&ligand_range),
+        "B:E: only process ligands with index from B up to, but not including, E (E may be omitted)");
 
     //options_description search_area("Search area (required, except with --score_only)");
     options_description search_area("Search space (required)");
@@ -1139,12 +1395,19 @@ Thank you!\n";
         "output file name, format taken from file extension")
     ("out_flex", value<std::string>(&outf_name),
         "output file for flexible receptor residues")
+    ("gzip_threads", value<unsigned>(&gzip_threads)->default_value(1),
+        "threads compressing .gz output; with more than one the output is written as a multi-member gzip")
     ("log", value<std::string>(&log_name), "optionally, write log file")
     ("atom_terms", value<std::string>(&atom_name),
         "optionally write per-atom interaction term values")
     ("atom_term_data",
         bool_switch(&settings.include_atom_info)->default_value(false),
-        "embedded per-atom interaction terms in output sd data");
+        "embedded per-atom interaction terms in output sd data")
+    ("checkpoint", value<std::string>(&checkpoint_name),
+        "record progress in this file and, if it exists, resume the run it describes; outputs may not be gzipped")
+    ("checkpoint_interval",
+        value<unsigned>(&checkpoint_interval)->default_value(60),
+        "seconds between checkpoint updates");
 
     options_description scoremin("Scoring and minimization options");
     scoremin.add_options()
@@ -1164,6 +1427,9 @@ Thank you!\n";
         "generate random poses, attempting to avoid clashes")
     ("num_mc_steps", value<int>(&settings.num_mc_steps),
         "number of monte carlo steps to take in each chain")
+    ("mc_convergence_window",
+        value<unsigned>(&settings.mc_convergence_window),
+        "stop a monte carlo chain when it finds no new minimum in this many steps and give the remaining steps to chains that are still improving (results then depend on thread timing)")
     ("minimize_iters",
         value<unsigned>(&minparms.maxiters)->default_value(0),
         "number iterations of steepest descent; default scales with rotors and usually isn't sufficient for convergence")
@@ -1184,6 +1450,10 @@ Thank you!\n";
         "Autodock map file for user grid data based calculations")
     ("user_grid_lambda", value<fl>(&user_grid_lambda)->default_value(-1.0),
         "Scales user_grid and functional scoring")
+    ("grid_cache", value<std::string>(&grid_cache_dir),
+        "directory for precomputed receptor grids; grids are reused (memory mapped) across runs with the same receptor, box and scoring")
+    ("precalc_cache", value<std::string>(&precalc_cache),
+        "file of precomputed approximation tables; tables are reused across runs with the same scoring and extended with any new atom type pairs")
     ("print_terms", bool_switch(&print_terms),
         "Print all available terms with default parameterizations")
     ("print_atom_types", bool_switch(&print_atom_types),
@@ -1212,6 +1482,8 @@ Thank you!\n";
         "resolution of grids, don't change unless you really know what you are doing")
     ("cnn_rotation", value<unsigned>(&cnnopts.cnn_rotations)->default_value(0),
         "evaluate multiple rotations of pose (max 24)")
+    ("cnn_grid_threads", value<unsigned>(&cnnopts.grid_threads)->default_value(1),
+        "threads used to build the CNN input grids when not using a GPU")
     ("cnn_scoring", bool_switch(&cnnopts.cnn_scoring),
         "Use a convolutional neural network to score final pose.")
     ("cnn_refinement", bool_switch(&cnnopts.cnn_refinement),
@@ -1240,6 +1512,8 @@ Thank you!\n";
     misc.add_options()
     ("cpu", value<int>(&settings.cpu),
         "the number of CPUs to use (the default is to try to detect the number of CPUs or, failing that, use 1)")
+    ("queue_depth", value<unsigned>(&queue_depth),
+        "maximum number of parsed ligands waiting to be processed (default is 4 per worker thread)")
     ("seed", value<int>(&settings.seed), "explicit random seed")
     ("exhaustiveness",
         value<int>(&settings.exhaustiveness)->default_value(8),
@@ -1255,9 +1529,15 @@ Thank you!\n";
         "automatically add hydrogens in ligands (on by default)")
     ("stripH", value<bool>(&strip_hydrogens),
         "remove hydrogens from molecule _after_ performing atom typing for efficiency (on by default)")
+    ("native_sdf", bool_switch(&native_sdf),
+        "read sdf ligands with the built-in parser instead of OpenBabel (experimental; typing and torsions may differ from OpenBabel's for some molecules, other formats such as mol2 always use OpenBabel)")
     ("device", value<int>(&settings.device)->default_value(0),
         "GPU device to use")
-    ("gpu", bool_switch(&settings.gpu_on), "Turn on GPU acceleration");
+    ("gpu", bool_switch(&settings.gpu_on), "Turn on GPU acceleration")
+    ("profile", bool_switch(&profile),
+        "report the time spent in each phase of docking")
+    ("profile_json", value<std::string>(&profile_json),
+        "also write the profile as JSON to this file");
 
     options_description config("Configuration file (optional)");
     config.add_options()("config", value<std::string>(&config_name),
@@ -1346,6 +1626,80 @@ Thank you!\n";
 #if (OB_VERSION > OB_VERSION_CHECK(2, 3, 2))
     OpenBabel::OBPlugin::LoadAllPlugins(); //for some reason loading on demand can be slow
 #endif
+    ligand_selection selection;
+    if (shard.size() > 0)
+      parse_shard(shard, selection);
+    if (ligand_range.size() > 0)
+      parse_ligand_range(ligand_range, selection);
+
+    //a checkpoint left by an earlier run fixes the seed and the outputs and
+    //tells which ligands are left
+    boost::shared_ptr<checkpointer> checkpoint;
+    bool resuming = false;
+    if (checkpoint_name.size() > 0)
+    {
+      if (boost::filesystem::extension(out_name) == ".gz"
+          || boost::filesystem::extension(outf_name) == ".gz")
+        throw usage_error("Outputs of a checkpointed run can't be gzipped");
+      checkpoint.reset(new checkpointer(checkpoint_name, checkpoint_interval));
+      std::vector<std::string>& outputs = checkpoint->outputs;
+      if (out_name.size() > 0) outputs.push_back(out_name);
+      if (outf_name.size() > 0) outputs.push_back(outf_name);
+      if (atom_name.size() > 0) outputs.push_back(atom_name);
+
+      std::ostringstream sel;
+      sel << "shard " << selection.shard << "/" << selection.num_shards
+          << " range " << selection.begin << ":" << selection.end << " ligands";
+      VINA_FOR_IN(i, ligand_names)
+      {
+        sel << " " << ligand_names[i];
+      }
+
+      run_checkpoint& cp = checkpoint->state;
+      resuming = cp.read(checkpoint_name);
+      if (resuming)
+      {
+        if (cp.complete)
+        {
+          std::cout << "The run recorded in " << checkpoint_name
+              << " is already complete.\n";
+          return 0;
+        }
+        if (cp.selection != sel.str())
+          throw usage_error(
+              "Ligands or their selection differ from those in checkpoint "
+                  + checkpoint_name);
+        if (vm.count("seed") && settings.seed != cp.seed)
+          throw usage_error(
+              "Seed differs from the one in checkpoint " + checkpoint_name);
+        settings.seed = cp.seed;
+
+        //drop anything written after the checkpoint
+        if (cp.sizes.size() != outputs.size())
+          throw usage_error(
+              "Outputs differ from those in checkpoint " + checkpoint_name);
+        VINA_FOR_IN(i, outputs)
+        {
+          if (cp.sizes.count(outputs[i]) == 0)
+            throw usage_error(
+                "Outputs differ from those in checkpoint " + checkpoint_name);
+          boost::uint64_t size = cp.sizes[outputs[i]];
+          if (!boost::filesystem::exists(outputs[i])
+              || boost::filesystem::file_size(outputs[i]) < size)
+            throw usage_error(
+                outputs[i] + " is shorter than recorded in checkpoint "
+                    + checkpoint_name);
+          boost::filesystem::resize_file(outputs[i], size);
+        }
+        selection.begin = std::max(selection.begin, (sz) cp.next_record);
+      }
+      else
+      {
+        cp.seed = settings.seed;
+        cp.selection = sel.str();
+      }
+    }
+
     cnnopts.seed = settings.seed;
 
     set_fixed_rotable_hydrogens(!flex_hydrogens);
@@ -1439,7 +1793,8 @@ Thank you!\n";
 
     std::ofstream atomoutfile;
     if (vm.count("atom_terms") > 0)
-      atomoutfile.open(atom_name.c_str());
+      atomoutfile.open(atom_name.c_str(),
+          resuming ? std::ios::out | std::ios::app : std::ios::out);
 
     if (autobox_ligand.length() > 0)
         {
@@ -1499,14 +1854,7 @@ Thank you!\n";
       }
     }
     else
-    {
-      t.add("gauss(o=0,_w=0.5,_c=8)", -0.035579);
-      t.add("gauss(o=3,_w=2,_c=8)", -0.005156);
-      t.add("repulsion(o=0,_c=8)", 0.840245);
-      t.add("hydrophobic(g=0.5,_b=1.5,_c=8)", -0.035069);
-      t.add("non_dir_h_bond(g=-0.7,_b=0,_c=8)", -0.587439);
-      t.add("num_tors_div", 5 * 0.05846 / 0.1 - 1);
-    }
+      builtin_scoring_functions.set(t, "default");
 
     log << std::setw(12) << std::left << "Weights" << " Terms\n" << t
         << "\n";
@@ -1551,6 +1899,16 @@ Thank you!\n";
     }
     if (settings.cpu < 1)
       settings.cpu = 1;
+    if (profile_json.size() > 0)
+      profile = true;
+    if (profile)
+    {
+#ifdef GNINA_PROFILE
+      profiler::enable();
+#else
+      std::cerr << "WARNING: this build does not include profiling\n";
+#endif
+    }
     if (settings.verbosity > 1 && settings.exhaustiveness < settings.cpu)
       log
           << "WARNING: at low exhaustiveness, it may be impossible to utilize all CPUs\n";
@@ -1558,6 +1916,9 @@ Thank you!\n";
     //dkoes - parse in receptor once
     MolGetter mols(rigid_name, flex_name, finfo, add_hydrogens, strip_hydrogens,
         log);
+    mols.setParseThreads(settings.cpu);
+    mols.setNativeSDF(native_sdf);
+    mols.setSelection(selection);
 
     //dkoes, hoist precalculation outside of loop
     weighted_terms wt(&t, t.weights());
@@ -1579,19 +1940,38 @@ Thank you!\n";
       prec = boost::shared_ptr<precalculate>(
           new precalculate_exact(wt));
 
+    //everything that changes grid or table values must be part of the
+    //description
+    std::stringstream sfdesc;
+    sfdesc << t << "\napproximation " << approx << " " << approx_factor
+        << "\n";
+    print_atom_info(sfdesc);
+
+    //tables are otherwise built as type pairs are first needed
+    sz precalc_loaded = 0;
+    if (precalc_cache.size() > 0)
+    {
+      if (prec->load_tables(precalc_cache, sfdesc.str()))
+        precalc_loaded = prec->num_tables();
+      else
+        if (settings.verbosity > 1)
+          log << "Rebuilding approximation tables in " << precalc_cache
+              << "\n";
+    }
+
     //setup single outfile
     using namespace OpenBabel;
     ozfile outfile;
     std::string outext;
     if (out_name.length() > 0) {
-      outext = outfile.open(out_name);
+      outext = outfile.open(out_name, gzip_threads, resuming);
     }
 
     ozfile outflex;
     std::string outfext;
     if (outf_name.length() > 0)
     {
-      outfext = outflex.open(outf_name);
+      outfext = outflex.open(outf_name, gzip_threads, resuming);
     }
 
     if (settings.score_only) //output header
@@ -1610,18 +1990,49 @@ Thank you!\n";
       log << "\n";
     }
 
-    job_queue<worker_job> wrkq;
-    job_queue<writer_job> writerq;
     int nligs = 0;
     size_t nthreads = settings.cpu;
+    boost::shared_ptr<cache_store> grids;
+    if (grid_cache_dir.size() > 0)
+    {
+      grids.reset(new cache_store("scoring_function_version001",
+          grid_cache_dir, sfdesc.str()));
+    }
+    else
+      grids.reset(new cache_store("scoring_function_version001"));
+
+    //when docking on the cpu, every worker docks its own ligand and the
+    //monte carlo chains of all ligands are balanced over all workers, so
+    //cores don't idle when exhaustiveness is below the number of cpus
+    std::unique_ptr<task_pool> pool;
+    bool docking = !(settings.score_only || settings.local_only
+        || settings.randomize_only);
+    if (docking && !settings.gpu_on)
+      pool.reset(new task_pool());
+    else
+      if (!settings.local_only)
+        nthreads = 1; //docking is multithreaded already, don't add additional parallelism other than pipeline
+    //the ligand workers and the grid population share the cpus: a grid is
+    //only split over threads when a single worker would be computing it
+    grids->set_num_threads(nthreads > 1 ? 1 : settings.cpu);
+
+    //every ligand model shares the receptor atoms of the initial model, so
+    //one index serves all the exact rescoring
+    receptor_index receptor(mols.getInitModel().grid_atoms);
+
     global_state gs(&settings, prec, &minparms, &wt, &user_grid,
-        &log, &atomoutfile, cnnopts);
+        &log, &atomoutfile, outext, outfext, cnnopts, grids.get(), pool.get(),
+        &receptor);
     boost::thread_group worker_threads;
     boost::timer::cpu_timer time;
-    CNNScorer cnn_scorer(cnnopts); //shared network
+    CNNScorer cnn_scorer(cnnopts); //weights shared by every copy
 
-    if (!settings.local_only)
-      nthreads = 1; //docking is multithreaded already, don't add additional parallelism other than pipeline
+    //bound the number of parsed ligands (each a full model) held in memory
+    //so that reading can't outpace docking without limit
+    if (queue_depth == 0)
+      queue_depth = 4 * nthreads;
+    job_queue<worker_job> wrkq(queue_depth);
+    job_queue<writer_job> writerq;
 
     //launch worker threads to process ligands in the work queue
     for (int i = 0; i < nthreads; i++)
@@ -1633,10 +2044,11 @@ Thank you!\n";
 
     //launch writer thread to write results wherever they go
     boost::thread writer_thread(thread_a_writing, &writerq, &gs, &outfile,
-        &outext, &outflex, &outfext, &nligs);
+        &outflex, &nligs, checkpoint.get());
 
     try {
       //loop over input ligands, adding them to the work queue
+      unsigned nread = 0; //over all files, so the writer sees every ligand
       for (unsigned l = 0, nl = ligand_names.size(); l < nl; l++) {
         doing(settings.verbosity, "Reading input", log);
         const std::string ligand_name = ligand_names[l];
@@ -1664,9 +2076,10 @@ Thank you!\n";
           done(settings.verbosity, log);
           std::vector<result_info>* results =
               new std::vector<result_info>();
-          worker_job j(i, m, results, gd);
+          worker_job j(nread, mols.lastRecord(), m, results, gd);
           wrkq.push(j);
 
+          nread++;
           i++;
           if (no_lig)
             break;
@@ -1688,10 +2101,31 @@ Thank you!\n";
     worker_threads.join_all();
     writerq.close(1);
     writer_thread.join();
+    if (checkpoint)
+      checkpoint->save(checkpoint->state.next_record, outfile, outflex,
+          atomoutfile, true);
+    if (precalc_cache.size() > 0 && prec->num_tables() > precalc_loaded)
+      prec->save_tables(precalc_cache, sfdesc.str());
 
     cudaDeviceSynchronize();
 
     std::cout << "Loop time " << time.elapsed().wall / 1000000000.0 << "\n";
+    //queue stats are diagnostics, keep them out of the normal output
+    if (settings.verbosity > 1 || profiler::enabled())
+    {
+      wrkq.report(std::cout, "Ligand");
+      writerq.report(std::cout, "Output");
+      if (pool) pool->report(std::cout);
+    }
+    if (profiler::enabled())
+    {
+      profiler::report(std::cout);
+      if (profile_json.size() > 0)
+      {
+        ofile json(profile_json);
+        profiler::write_json(json);
+      }
+    }
 
   } catch (file_error& e)
   {
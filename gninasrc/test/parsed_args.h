@@ -9,6 +9,7 @@ struct parsed_args {
     unsigned iter_count;
     tee log;
     std::vector<unsigned> params;
+    std::string sdf; //extra ligands for the native sdf reader test
 
     parsed_args(bool quiet = true)
         : many_iters(false), iter_count(0), log(quiet) {
@@ -9,9 +9,12 @@
 #include "quaternion.h"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/layers/flex_lstm_layer.hpp"
+#include "caffe/util/grid_threads.hpp"
 #include "caffe/util/rng.hpp"
 #include "caffe/util/device_alternate.hpp"
 #include <boost/multi_array/multi_array_ref.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/timer/timer.hpp>
 #define BOOST_TEST_DYN_LINK
 #include <boost/test/unit_test.hpp>
 #include <boost/test/floating_point_comparison.hpp>
@@ -467,3 +470,58 @@ void test_strided_cube_datagetter() {
     BOOST_CHECK_EQUAL(failed, false);
   }
 }
+
+void test_threaded_grids() {
+  //check that splitting the CPU grids across threads gives the same result
+  //as the serial path, and log how long each takes at the default resolution
+  p_args.log << "CNN Threaded Grids Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << '\n';
+  p_args.log << "Iteration " << p_args.iter_count << '\n';
+  std::mt19937 engine(p_args.seed);
+
+  float resolution = 0.5;
+  float dimension = 24;
+  float radiusmultiple = 1.5;
+  unsigned dim = std::round(dimension / resolution) + 1;
+  unsigned ntypes = smt::NumTypes;
+  unsigned nthreads = std::max(boost::thread::hardware_concurrency(), 2U);
+  std::vector<atom_params> mol_atoms;
+  std::vector<smt> mol_types;
+  make_mol(mol_atoms, mol_types, engine, 0, 1000, 5000, 12, 12, 12);
+
+  std::vector<float4> atoms;
+  std::vector<short> whichGrid;
+  for (size_t i = 0; i < mol_atoms.size(); ++i) {
+    atom_params& ainfo = mol_atoms[i];
+    atoms.push_back(make_float4(ainfo.coords.x, ainfo.coords.y, ainfo.coords.z,
+        xs_radius(mol_types[i])));
+    whichGrid.push_back(mol_types[i]);
+  }
+  caffe::Caffe::set_random_seed(p_args.seed);
+  caffe::BaseMolGridDataLayer<float, GridMaker>::mol_transform transform;
+  transform.set_random_quaternion(caffe::caffe_rng());
+
+  GridMaker gmaker;
+  gmaker.initialize(resolution, dimension, radiusmultiple);
+  gmaker.setCenter(0, 0, 0);
+
+  unsigned gsize = ntypes * dim * dim * dim;
+  std::vector<float> serial(gsize, 1), threaded(gsize, 1);
+  boost::timer::cpu_timer timer;
+  gmaker.setAtomsCPU(atoms, whichGrid, transform.Q.boost(), &serial[0], ntypes);
+  boost::timer::nanosecond_type serial_time = timer.elapsed().wall;
+
+  caffe::GridThreads threads(nthreads);
+  gmaker.setCPUThreads(&threads);
+  timer.start();
+  gmaker.setAtomsCPU(atoms, whichGrid, transform.Q.boost(), &threaded[0], ntypes);
+  boost::timer::nanosecond_type threaded_time = timer.elapsed().wall;
+
+  p_args.log << atoms.size() << " atoms, " << dim << "^3 points, serial "
+      << serial_time / 1e6 << "ms, " << nthreads << " threads "
+      << threaded_time / 1e6 << "ms\n";
+
+  for (size_t i = 0; i < gsize; ++i) {
+    BOOST_REQUIRE_SMALL(serial[i] - threaded[i], TOL);
+  }
+}
@@ -4,3 +4,4 @@ void test_set_atom_gradients();
 void test_vanilla_grids();
 void test_subcube_grids();
 void test_strided_cube_datagetter();
+void test_threaded_grids();
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <climits>
+#include <random>
+#include <vector>
+#include "gninasrc/gninaserver/OrderedIndex.h"
+#include "parsed_args.h"
+#include "test_ordered_index.h"
+#include "test_utils.h"
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+//a result of the minimization server reduced to its sort key and position
+struct ranked {
+    int key;
+    unsigned position;
+};
+
+//ties broken by position, as the server does
+struct ranked_less {
+    bool operator()(const ranked* lhs, const ranked* rhs) const {
+      if (lhs->key != rhs->key) return lhs->key < rhs->key;
+      return lhs->position < rhs->position;
+    }
+};
+
+typedef OrderedIndex<ranked, ranked_less> ranked_index;
+
+//the whole index against a sorted copy, every rank near a block boundary
+//and random ranges across them
+static void check_index(const ranked_index& index,
+    const std::vector<ranked*>& sorted, std::mt19937& engine) {
+  unsigned n = sorted.size();
+  BOOST_REQUIRE_EQUAL(index.size(), n);
+
+  std::vector<ranked*> all;
+  index.range(0, n, all);
+  BOOST_REQUIRE(all == sorted);
+
+  std::vector<unsigned> ranks;
+  for (unsigned b = 0; b <= n + 512; b += 512)
+    for (unsigned d = 0; d < 3; d++)
+      if (b + d >= 1 && b + d - 1 <= n) ranks.push_back(b + d - 1);
+  std::uniform_int_distribution<unsigned> rank_dist(0, n);
+  for (unsigned i = 0; i < 20; i++)
+    ranks.push_back(rank_dist(engine));
+
+  for (unsigned i = 0, m = ranks.size(); i < m; i++) {
+    unsigned first = ranks[i], last = ranks[rank_dist(engine) % m];
+    if (first > last) std::swap(first, last);
+    std::vector<ranked*> got;
+    index.range(first, last, got);
+    BOOST_REQUIRE(
+        got == std::vector<ranked*>(sorted.begin() + first, sorted.begin() + last));
+  }
+
+  //filters keep a prefix of the order
+  std::uniform_int_distribution<int> key_dist(-2, 102);
+  for (unsigned i = 0; i < 20; i++) {
+    int maxkey = key_dist(engine);
+    unsigned expected = 0;
+    while (expected < n && sorted[expected]->key <= maxkey)
+      expected++;
+    BOOST_REQUIRE_EQUAL(
+        index.partition_rank([&](const ranked* r) {return r->key <= maxkey;}),
+        expected);
+  }
+}
+
+void test_ordered_index_insert() {
+  p_args.log << "Ordered Index Insert Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+
+  //few distinct keys so ties are common, several block splits
+  std::uniform_int_distribution<int> key_dist(0, 100);
+  const unsigned total = 5000;
+  std::vector<ranked> items(total);
+  ranked_index index;
+  std::vector<ranked*> sorted;
+  const unsigned checks[] = { 1, 1023, 1024, 1025, 2047, 2048, 3071, total };
+  unsigned next = 0;
+  for (unsigned i = 0; i < total; i++) {
+    items[i].key = key_dist(engine);
+    items[i].position = i;
+    index.insert(&items[i]);
+    sorted.insert(
+        std::upper_bound(sorted.begin(), sorted.end(), &items[i],
+            ranked_less()), &items[i]);
+    if (i + 1 == checks[next]) {
+      check_index(index, sorted, engine);
+      next++;
+    }
+  }
+
+  //everything at the end or the front of the order
+  ranked_index ascending, descending;
+  std::vector<ranked> up(total), down(total);
+  std::vector<ranked*> up_sorted, down_sorted;
+  for (unsigned i = 0; i < total; i++) {
+    up[i].key = i;
+    up[i].position = i;
+    ascending.insert(&up[i]);
+    up_sorted.push_back(&up[i]);
+    down[i].key = total - i;
+    down[i].position = i;
+    descending.insert(&down[i]);
+    down_sorted.insert(down_sorted.begin(), &down[i]);
+  }
+  check_index(ascending, up_sorted, engine);
+  check_index(descending, down_sorted, engine);
+}
+
+void test_ordered_index_page() {
+  p_args.log << "Ordered Index Page Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+
+  std::uniform_int_distribution<unsigned> size_dist(0, 3000);
+  std::uniform_int_distribution<int> key_dist(0, 100);
+  const unsigned total = size_dist(engine);
+  std::vector<ranked> items(total);
+  ranked_index index;
+  for (unsigned i = 0; i < total; i++) {
+    items[i].key = key_dist(engine);
+    items[i].position = i;
+    index.insert(&items[i]);
+  }
+  std::vector<ranked*> sorted;
+  for (unsigned i = 0; i < total; i++)
+    sorted.push_back(&items[i]);
+  std::stable_sort(sorted.begin(), sorted.end(), ranked_less());
+
+  //pages of a filtered view, as the server's selectResults asks for them
+  std::uniform_int_distribution<unsigned> page_dist(0, total + 10);
+  std::uniform_int_distribution<unsigned> num_dist(0, 100);
+  for (unsigned i = 0; i < 200; i++) {
+    int maxkey = key_dist(engine);
+    unsigned n = index.partition_rank(
+        [&](const ranked* r) {return r->key <= maxkey;});
+    std::vector<ranked*> view;
+    for (unsigned j = 0; j < total; j++)
+      if (sorted[j]->key <= maxkey) view.push_back(sorted[j]);
+    BOOST_REQUIRE_EQUAL(n, view.size());
+
+    bool reversed = engine() % 2;
+    if (reversed) std::reverse(view.begin(), view.end());
+    unsigned first = page_dist(engine);
+    unsigned num = num_dist(engine);
+    unsigned last = num == 0 ? UINT_MAX : first + num;
+
+    std::vector<ranked*> expected;
+    for (unsigned j = first; j < view.size() && j < last; j++)
+      expected.push_back(view[j]);
+    std::vector<ranked*> got;
+    index.page(n, first, last, reversed, got);
+    BOOST_REQUIRE(got == expected);
+  }
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+void test_ordered_index_insert();
+void test_ordered_index_page();
@@ -0,0 +1,87 @@
+#include <cmath>
+#include <random>
+#include <vector>
+#include "common.h"
+#include "pair_kernel.h"
+#include "parsed_args.h"
+#include "test_pair_kernel.h"
+#include "test_utils.h"
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+//cells (of every size up to a few vectors' worth, so the partial vectors
+//are covered) per iteration
+#define N_CELLS 200
+
+//every isa the cpu supports against the scalar path on cells whose atoms
+//mostly sit within a few ulps of the cutoff
+void test_pair_kernel_cutoff() {
+  p_args.log << "Pair Kernel Cutoff Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+
+  const pair_kernel_isa isas[] = { PAIR_KERNEL_AVX2, PAIR_KERNEL_AVX512 };
+  const char* names[] = { "avx2", "avx512" };
+  VINA_FOR(k, 2)
+    p_args.log << names[k] << ": "
+        << (pair_kernel_supported(isas[k]) ? "checked" : "not supported")
+        << "\n";
+
+  const fl cutoff = 8;
+  const fl cutoff_sqr = cutoff * cutoff;
+  std::uniform_real_distribution<float> pos(-20, 20);
+  std::uniform_real_distribution<float> unit(-1, 1);
+  std::uniform_int_distribution<int> ulps(-4, 4);
+  std::bernoulli_distribution random_atom(0.25);
+
+  VINA_FOR(c, N_CELLS) {
+    sz n = c % 70;
+    vec v(pos(engine), pos(engine), pos(engine));
+    flv x(n + 1), y(n + 1), z(n + 1);
+    VINA_FOR(i, n) {
+      vec d(unit(engine), unit(engine), unit(engine));
+      fl len = std::sqrt(sqr(d));
+      if (len < 1e-3) d = vec(1, 0, 0), len = 1;
+      fl r = cutoff;
+      if (random_atom(engine))
+        r *= 1.5 * (unit(engine) + 1) / 2;
+      else { //a few ulps either side of the cutoff
+        int steps = ulps(engine);
+        for (; steps > 0; steps--)
+          r = std::nextafter(r, r + 1);
+        for (; steps < 0; steps++)
+          r = std::nextafter(r, r - 1);
+      }
+      x[i] = v[0] + d[0] * (r / len);
+      y[i] = v[1] + d[1] * (r / len);
+      z[i] = v[2] + d[2] * (r / len);
+    }
+    receptor_cell cell;
+    cell.indices = NULL;
+    cell.types = NULL;
+    cell.charges = NULL;
+    cell.x = &x[0];
+    cell.y = &y[0];
+    cell.z = &z[0];
+    cell.n = n;
+
+    std::vector<unsigned> expected_hits(n + 1);
+    flv expected_r2s(n + 1);
+    sz expected = cutoff_hits(PAIR_KERNEL_SCALAR, cell, v, cutoff_sqr,
+        &expected_hits[0], &expected_r2s[0]);
+
+    VINA_FOR(k, 2) {
+      if (!pair_kernel_supported(isas[k])) continue;
+      std::vector<unsigned> hits(n + 1);
+      flv r2s(n + 1);
+      sz found = cutoff_hits(isas[k], cell, v, cutoff_sqr, &hits[0], &r2s[0]);
+      BOOST_REQUIRE_EQUAL(expected, found);
+      VINA_FOR(i, found) {
+        BOOST_REQUIRE_EQUAL(expected_hits[i], hits[i]);
+        BOOST_REQUIRE_EQUAL(expected_r2s[i], r2s[i]);
+      }
+    }
+  }
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+void test_pair_kernel_cutoff();
@@ -0,0 +1,588 @@
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include "molgetter.h"
+#include "parse_sdf.h"
+#include "parsed_args.h"
+#include "test_parse_sdf.h"
+#include "test_utils.h"
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+//small ligands with the polar hydrogens written out, as prepared screening
+//sets have them: acids and esters, amides, a pyridine and an
+//imidazole, charged groups and a nitro group, a salt, halogens, a nitrile,
+//a sulfonamide, a fused ring system and a saturated heterocycle
+static const char *ligands_sdf = R"SDF(aspirin
+  handmade          3D
+
+ 14 14  0  0  0  0  0  0  0  0999 V2000
+    0.4779    2.0619   -2.4240 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.5098    1.1193   -1.9984 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.2346   -0.2446   -2.3490 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.1289    1.3314   -0.7433 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.3417    1.5542    0.3996 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.4207    2.7717    0.4685 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.9276    3.0725    1.8026 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.5465    1.9255    2.4545 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.7097    0.7320    2.4210 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.2087    0.4218    1.0870 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.1200   -0.3613    0.3067 C   0  0  0  0  0  0  0  0  0  0  0  0
+    2.3505    0.3110   -0.0302 O   0  0  0  0  0  0  0  0  0  0  0  0
+    1.3254   -1.6995    0.8074 O   0  0  0  0  0  0  0  0  0  0  0  0
+    0.9031   -2.3464    0.1724 H   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  2  3  2  0
+  2  4  1  0
+  4  5  1  0
+  5  6  2  0
+  6  7  1  0
+  7  8  2  0
+  8  9  1  0
+  9 10  2  0
+  5 10  1  0
+ 10 11  1  0
+ 11 12  2  0
+ 11 13  1  0
+ 13 14  1  0
+M  END
+$$$$
+ibuprofen
+  handmade          3D
+
+ 16 16  0  0  0  0  0  0  0  0999 V2000
+   -3.8554    1.4976    0.8188 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -3.2718    0.6713   -0.2228 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -2.9565    1.4606   -1.4020 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -2.1154   -0.0540    0.2551 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.9146   -1.3287   -0.4045 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.8727   -2.0956    0.2815 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.4579   -1.5795    0.0978 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.7766   -0.9068   -1.1290 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.2820   -0.5756   -2.0382 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.5785   -1.1649   -1.8172 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.7414    0.1432   -0.9605 C   0  0  0  0  0  0  0  0  0  0  0  0
+    2.4755    0.5013   -2.1437 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.3834    1.2383   -0.1247 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.1691    1.9286   -0.4725 O   0  0  0  0  0  0  0  0  0  0  0  0
+    1.4914    0.9626    1.2896 O   0  0  0  0  0  0  0  0  0  0  0  0
+    2.2471    1.5020    1.6613 H   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  2  3  1  0
+  2  4  1  0
+  4  5  1  0
+  5  6  2  0
+  6  7  1  0
+  7  8  2  0
+  8  9  1  0
+  9 10  2  0
+  5 10  1  0
+  8 11  1  0
+ 11 12  1  0
+ 11 13  1  0
+ 13 14  2  0
+ 13 15  1  0
+ 15 16  1  0
+M  END
+$$$$
+paracetamol
+  handmade          3D
+
+ 13 13  0  0  0  0  0  0  0  0999 V2000
+    0.6344    3.8057    0.9419 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.6950    2.4135    1.3377 C   0  0  0  0  0  0  0  0  0  0  0  0
+    2.0345    2.0047    1.6926 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.0100    1.5440    0.4580 N   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.6234    0.9364    0.9253 H   0  0  0  0  0  0  0  0  0  0  0  0
+    0.5720    1.1862   -0.7564 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.2184    1.2016   -1.9555 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.4262   -0.0691   -2.6069 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.3357   -1.1844   -2.1593 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.1980   -2.4822   -2.2661 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.7872   -2.7740   -1.5170 H   0  0  0  0  0  0  0  0  0  0  0  0
+    1.5298   -0.9722   -1.4148 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.7007    0.2972   -0.7524 C   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  2  3  2  0
+  2  4  1  0
+  4  5  1  0
+  4  6  1  0
+  6  7  2  0
+  7  8  1  0
+  8  9  2  0
+  9 10  1  0
+ 10 11  1  0
+  9 12  1  0
+ 12 13  2  0
+  6 13  1  0
+M  END
+$$$$
+nicotinamide
+  handmade          3D
+
+ 11 11  0  0  0  0  0  0  0  0999 V2000
+   -1.0055    1.6108   -1.8269 N   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.2648    2.2445   -2.1740 H   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.9492    1.2800   -2.0844 H   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.5757    1.0247   -0.6140 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.0711   -0.2460   -0.6092 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.9145    1.5967    0.6392 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -2.0436    0.9490    1.2883 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.6631   -0.2330    2.0517 N   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.5463    0.0137    2.9565 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.5891    0.6426    2.2916 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.2134    1.8251    1.5254 C   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  1  3  1  0
+  1  4  1  0
+  4  5  2  0
+  4  6  1  0
+  6  7  2  0
+  7  8  1  0
+  8  9  2  0
+  9 10  1  0
+ 10 11  2  0
+  6 11  1  0
+M  END
+$$$$
+benzoate
+  handmade          3D
+
+  9  9  0  0  0  0  0  0  0  0999 V2000
+   -2.0596   -1.8939    0.6384 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.2305   -0.8443    0.0898 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.0510    0.2583    1.0038 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.0204   -1.3237   -0.5104 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.5815   -0.3640   -1.4226 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.3963    0.6362   -0.7430 C   0  0  0  0  0  0  0  0  0  0  0  0
+    2.3547    0.0489    0.1861 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.7380   -0.8961    1.1098 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.9220   -1.8977    0.4336 C   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  2  3  2  0
+  2  4  1  0
+  4  5  2  0
+  5  6  1  0
+  6  7  2  0
+  7  8  1  0
+  8  9  2  0
+  4  9  1  0
+M  CHG  1   1  -1
+M  END
+$$$$
+tyramine
+  handmade          3D
+
+ 14 14  0  0  0  0  0  0  0  0999 V2000
+    0.2138    0.6442    2.0644 N   0  0  0  0  0  0  0  0  0  0  0  0
+    1.1384    0.0297    2.2707 H   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.5930    0.5028    2.8033 H   0  0  0  0  0  0  0  0  0  0  0  0
+    0.4254    1.6602    1.6926 H   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.2332   -0.0834    0.9061 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.3668    0.1615    0.0900 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.0762    0.5863   -1.2603 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.4301   -0.4394   -2.0435 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.0083   -0.4072   -2.1064 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.6781    0.6692   -1.4396 C   0  0  0  0  0  0  0  0  0  0  0  0
+    3.0805    0.7787   -1.7308 O   0  0  0  0  0  0  0  0  0  0  0  0
+    3.5995    0.5136   -0.9154 H   0  0  0  0  0  0  0  0  0  0  0  0
+    0.9861    1.9192   -1.3397 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.4537    1.8879   -1.3141 C   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  1  3  1  0
+  1  4  1  0
+  1  5  1  0
+  5  6  1  0
+  6  7  1  0
+  7  8  2  0
+  8  9  1  0
+  9 10  2  0
+ 10 11  1  0
+ 11 12  1  0
+ 10 13  1  0
+ 13 14  2  0
+  7 14  1  0
+M  CHG  1   1   1
+M  END
+$$$$
+tosylamide
+  handmade          3D
+
+ 13 13  0  0  0  0  0  0  0  0999 V2000
+    3.4085   -0.7007    2.1142 C   0  0  0  0  0  0  0  0  0  0  0  0
+    2.6275   -0.8147    0.8894 C   0  0  0  0  0  0  0  0  0  0  0  0
+    2.1743    0.4917    0.4487 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.1859    0.4623   -0.6070 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.1140   -0.4930   -0.4224 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.5869   -1.8016   -0.0144 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.5713   -1.7972    1.0452 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.0392   -0.0009    0.3340 S   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.5945    1.1921   -0.4179 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -2.1817   -0.9580    0.0469 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.7908    0.2322    1.7140 N   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.8278   -0.6068    2.3455 H   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.3128    1.1376    1.9560 H   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  2  3  2  0
+  3  4  1  0
+  4  5  2  0
+  5  6  1  0
+  6  7  2  0
+  2  7  1  0
+  5  8  1  0
+  8  9  2  0
+  8 10  2  0
+  8 11  1  0
+ 11 12  1  0
+ 11 13  1  0
+M  END
+$$$$
+butylimidazole
+  handmade          3D
+
+ 10 10  0  0  0  0  0  0  0  0999 V2000
+   -3.3759   -2.2218   -0.3336 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -3.5311   -1.4096   -1.5247 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -2.2642   -1.1957   -2.1968 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.5388   -0.0755   -1.6298 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.9639   -0.4064   -0.3404 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.4978    0.4765    0.7056 N   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.3641    1.1539    1.3492 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.8693    0.6904    0.6991 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.4956   -0.2468   -0.3679 N   0  0  0  0  0  0  0  0  0  0  0  0
+    0.8893   -1.1332   -0.1270 H   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  2  3  1  0
+  3  4  1  0
+  4  5  1  0
+  5  6  2  0
+  6  7  1  0
+  7  8  2  0
+  8  9  1  0
+  9 10  1  0
+  5  9  1  0
+M  END
+$$$$
+phenethylamine_hcl
+  handmade          3D
+
+ 12 11  0  0  0  0  0  0  0  0999 V2000
+    1.4735   -0.2092   -1.3741 N   0  0  0  0  0  0  0  0  0  0  0  0
+    1.6006   -1.0092   -2.0126 H   0  0  0  0  0  0  0  0  0  0  0  0
+    2.0097    0.4624   -0.8038 H   0  0  0  0  0  0  0  0  0  0  0  0
+    0.3097    0.5102   -1.8549 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.9119    0.2428   -1.1217 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.8699    0.8026    0.2154 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -2.2034    1.1849    0.6677 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -3.0272    0.0349    1.0237 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -2.3579   -0.8721    1.9495 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.0233   -1.2523    1.5002 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.2002   -0.1018    1.1440 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.0441   -2.9649   -3.7020 Cl  0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  1  3  1  0
+  1  4  1  0
+  4  5  1  0
+  5  6  1  0
+  6  7  2  0
+  7  8  1  0
+  8  9  2  0
+  9 10  1  0
+ 10 11  2  0
+  6 11  1  0
+M  CHG  1  12  -1
+M  END
+$$$$
+ethyl_hexanoate
+  handmade          3D
+
+ 10  9  0  0  0  0  0  0  0  0999 V2000
+    1.4789   -2.4320   -2.1374 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.7570   -3.2266   -0.9563 C   0  0  0  0  0  0  0  0  0  0  0  0
+    2.6042   -2.5147   -0.0195 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.8395   -1.6284    0.8360 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.3720   -0.4599    0.1206 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.1606    0.0923    0.6607 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.0764    1.4562    0.2489 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.9985   -0.7438    0.5891 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.3698   -1.1735   -0.7356 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.8896   -0.0980   -1.5518 C   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  2  3  1  0
+  3  4  1  0
+  4  5  1  0
+  5  6  1  0
+  6  7  2  0
+  6  8  1  0
+  8  9  1  0
+  9 10  1  0
+M  END
+$$$$
+halophenethanol
+  handmade          3D
+
+ 12 12  0  0  0  0  0  0  0  0999 V2000
+   -1.5378    0.9247    0.7124 F   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.6497   -0.0049    1.3321 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.0362   -1.3941    1.1921 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.2456   -2.2866    2.0315 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.1808   -2.0532    1.9619 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.8216   -2.8153    0.9180 Br  0  0  0  0  0  0  0  0  0  0  0  0
+    1.5900   -0.6691    1.9925 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.7547    0.2461    1.2346 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.2710    0.5072   -0.0796 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.1444   -0.6126   -0.9856 C   0  0  0  0  0  0  0  0  0  0  0  0
+    2.2898   -0.7257   -1.8681 O   0  0  0  0  0  0  0  0  0  0  0  0
+    2.7841   -1.5620   -1.6313 H   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  2  3  2  0
+  3  4  1  0
+  4  5  2  0
+  5  6  1  0
+  5  7  1  0
+  7  8  2  0
+  2  8  1  0
+  8  9  1  0
+  9 10  1  0
+ 10 11  1  0
+ 11 12  1  0
+M  END
+$$$$
+methoxybenzonitrile
+  handmade          3D
+
+ 10 10  0  0  0  0  0  0  0  0999 V2000
+   -0.3500    0.3792    2.6626 N   0  0  0  0  0  0  0  0  0  0  0  0
+    0.2405   -0.7511    1.9804 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.1137   -0.8541    0.5924 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.3999    0.2377   -0.2169 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.4259    1.4368   -0.1521 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.8398    1.1778   -0.3414 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -2.2396    1.1434   -1.7199 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.6847    0.0355   -2.4661 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -2.3545    0.0711    0.4413 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.5244   -1.1249    0.3752 C   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  3  0
+  2  3  1  0
+  3  4  2  0
+  4  5  1  0
+  5  6  2  0
+  6  7  1  0
+  7  8  1  0
+  6  9  1  0
+  9 10  2  0
+  3 10  1  0
+M  END
+$$$$
+nitrothioanisole
+  handmade          3D
+
+ 11 11  0  0  0  0  0  0  0  0999 V2000
+    1.0156   -0.0455    2.3389 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.2351    0.7544    1.4192 S   0  0  0  0  0  0  0  0  0  0  0  0
+    0.6266    0.5378    0.0363 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.1629   -0.7615   -0.4393 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.2619   -0.8463   -0.6229 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.9662    0.3297   -1.0571 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.3006    1.5980   -1.0026 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.1270    1.6169   -0.8122 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -3.3127    0.3627   -0.5282 N   0  0  0  0  0  0  0  0  0  0  0  0
+   -3.3747    0.6301    0.8890 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -4.2263    1.1668   -1.2983 O   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  2  3  1  0
+  3  4  2  0
+  4  5  1  0
+  5  6  2  0
+  6  7  1  0
+  7  8  2  0
+  3  8  1  0
+  6  9  1  0
+  9 10  2  0
+  9 11  1  0
+M  CHG  2   9   1  11  -1
+M  END
+$$$$
+naphthol
+  handmade          3D
+
+ 12 13  0  0  0  0  0  0  0  0999 V2000
+   -1.0052   -2.8851   -1.2052 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.2822   -3.5322   -0.9751 H   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.7106   -1.5269   -0.9599 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.9383   -0.9917    0.3376 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.4576    0.3356    0.6265 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.2212    0.5350    2.0512 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.2354    1.8841    2.3655 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.3575    2.3125    1.5384 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.1152    2.1130    0.1108 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.6730    0.7633   -0.1914 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.4666    0.5378   -1.6040 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.0239   -0.7752   -1.9514 C   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  1  3  1  0
+  3  4  2  0
+  4  5  1  0
+  5  6  2  0
+  6  7  1  0
+  7  8  2  0
+  8  9  1  0
+  9 10  2  0
+  5 10  1  0
+ 10 11  1  0
+ 11 12  2  0
+  3 12  1  0
+M  END
+$$$$
+acetylpiperazine
+  handmade          3D
+
+ 10 10  0  0  0  0  0  0  0  0999 V2000
+   -0.0844    2.4225   -0.1071 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.2411    1.1740    0.5451 C   0  0  0  0  0  0  0  0  0  0  0  0
+    1.3889    0.5233   -0.0403 O   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.8918    0.3190    0.7450 N   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.6622   -0.7023    1.7555 C   0  0  0  0  0  0  0  0  0  0  0  0
+    0.0515   -1.8642    1.2386 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.5397   -2.3925    0.0146 N   0  0  0  0  0  0  0  0  0  0  0  0
+    0.1020   -3.0594   -0.3643 H   0  0  0  0  0  0  0  0  0  0  0  0
+   -0.7512   -1.3654   -0.9988 C   0  0  0  0  0  0  0  0  0  0  0  0
+   -1.4640   -0.2017   -0.4845 C   0  0  0  0  0  0  0  0  0  0  0  0
+  1  2  1  0
+  2  3  2  0
+  2  4  1  0
+  4  5  1  0
+  5  6  1  0
+  6  7  1  0
+  7  8  1  0
+  7  9  1  0
+  9 10  1  0
+  4 10  1  0
+M  END
+$$$$
+)SDF";
+
+//atoms of a rigid piece of a ligand, as indices into the atoms of one model
+typedef std::vector<sz> piece;
+
+template<typename T>
+static void add_pieces(const T& t, const szv& index, const piece& parent,
+    std::map<piece, piece>& pieces) {
+  piece p;
+  for (sz i = t.node.begin; i < t.node.end; i++)
+    p.push_back(index[i]);
+  std::sort(p.begin(), p.end());
+  pieces[p] = parent;
+  VINA_FOR_IN(i, t.children)
+    add_pieces(t.children[i], index, p, pieces);
+}
+
+//the torsion tree of a single ligand model as a map from each rigid piece to
+//the piece it hangs from
+static void torsion_tree(const model& m, const szv& index,
+    std::map<piece, piece>& pieces) {
+  BOOST_REQUIRE_EQUAL(m.ligands.size(), 1U);
+  add_pieces(m.ligands[0], index, piece(), pieces);
+}
+
+//the native model must have the same atoms at the same positions, with the
+//same types and charges, split into the same torsion tree as openbabel's
+static void compare_ligands(const model& ob, const model& native) {
+  const std::string& name = ob.get_name();
+  BOOST_CHECK_EQUAL(name, native.get_name());
+  BOOST_REQUIRE_EQUAL(ob.atoms.size(), native.atoms.size());
+  BOOST_REQUIRE_EQUAL(ob.num_movable_atoms(), native.num_movable_atoms());
+  BOOST_CHECK_EQUAL(ob.ligands[0].degrees_of_freedom,
+      native.ligands[0].degrees_of_freedom);
+
+  //the two may order atoms differently
+  szv to_ob(native.atoms.size(), native.atoms.size());
+  std::vector<bool> matched(ob.atoms.size(), false);
+  VINA_FOR_IN(i, native.atoms) {
+    VINA_FOR_IN(j, ob.atoms) {
+      if (!matched[j] && sqr(native.coords[i] - ob.coords[j]) < 1e-6) {
+        to_ob[i] = j;
+        matched[j] = true;
+        break;
+      }
+    }
+    BOOST_REQUIRE_MESSAGE(to_ob[i] < ob.atoms.size(),
+        name << ": no openbabel atom at the position of native atom " << i);
+    const atom& a = ob.atoms[to_ob[i]];
+    const atom& b = native.atoms[i];
+    BOOST_CHECK_MESSAGE(a.sm == b.sm,
+        name << " atom " << i << ": openbabel type " << smina_type_to_string(a.sm)
+            << ", native " << smina_type_to_string(b.sm));
+    BOOST_CHECK_MESSAGE(std::abs(a.charge - b.charge) < 1e-3,
+        name << " atom " << i << ": openbabel charge " << a.charge
+            << ", native " << b.charge);
+  }
+
+  szv identity(ob.atoms.size());
+  VINA_FOR_IN(i, identity)
+    identity[i] = i;
+  std::map<piece, piece> ob_tree, native_tree;
+  torsion_tree(ob, identity, ob_tree);
+  torsion_tree(native, to_ob, native_tree);
+  BOOST_CHECK_MESSAGE(ob_tree == native_tree,
+      name << ": openbabel and native torsion trees differ");
+}
+
+//read sdf through openbabel and through the native reader on a few threads
+//and compare every ligand; returns how many the native reader parsed itself
+static unsigned compare_readers(const std::string& sdf) {
+  using namespace boost::filesystem;
+  path file = temp_directory_path() / unique_path("%%%%-%%%%-%%%%.sdf");
+  {
+    std::ofstream out(file.string().c_str());
+    out << sdf;
+  }
+
+  unsigned native = 0;
+  std::istringstream records(sdf);
+  std::string record;
+  while (read_sdf_record(records, record)) {
+    parsing_struct p;
+    context c;
+    unsigned torsdof = 0;
+    if (parse_sdf_record(record, true, p, c, torsdof)) native++;
+  }
+
+  MolGetter ob, nat;
+  ob.setInputFile(file.string());
+  nat.setNativeSDF(true);
+  nat.setParseThreads(3);
+  nat.setInputFile(file.string());
+  model obm, natm;
+  unsigned n = 0;
+  while (ob.readMoleculeIntoModel(obm)) {
+    BOOST_REQUIRE(nat.readMoleculeIntoModel(natm));
+    compare_ligands(obm, natm);
+    n++;
+  }
+  BOOST_CHECK(!nat.readMoleculeIntoModel(natm));
+  remove(file);
+
+  p_args.log << n << " ligands compared, " << native << " parsed natively\n";
+  return native;
+}
+
+void test_parse_sdf_openbabel() {
+  p_args.log << "Native SDF Reader Test \n";
+  p_args.log.endl();
+
+  //with polar hydrogens present nothing here needs openbabel
+  set_fixed_rotable_hydrogens(true);
+  BOOST_CHECK_EQUAL(compare_readers(ligands_sdf), 15);
+
+  //a representative screening set, if given
+  if (p_args.sdf.size()) {
+    std::ifstream in(p_args.sdf.c_str());
+    BOOST_REQUIRE_MESSAGE(in, "Could not read " << p_args.sdf);
+    std::stringstream sdf;
+    sdf << in.rdbuf();
+    compare_readers(sdf.str());
+  }
+}
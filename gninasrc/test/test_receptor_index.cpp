@@ -0,0 +1,240 @@
+#include <numeric>
+#include <cmath>
+#include <random>
+#include "common.h"
+#include "model.h"
+#include "brick.h"
+#include "weighted_terms.h"
+#include "custom_terms.h"
+#include "precalculate.h"
+#include "naive_non_cache.h"
+#include "receptor_index.h"
+#include "parsed_args.h"
+#include "test_receptor_index.h"
+#include "test_utils.h"
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+#include <boost/test/floating_point_comparison.hpp>
+
+//number of random poses (each with its own receptor) per iteration
+#define N_POSES 10
+
+//random unit vector
+static vec random_direction(std::mt19937& engine) {
+  std::normal_distribution<float> n(0, 1);
+  vec d(0, 0, 0);
+  while (sqr(d) < 1e-6)
+    d = vec(n(engine), n(engine), n(engine));
+  return (1 / std::sqrt(sqr(d))) * d;
+}
+
+//ligand of random atoms translated so that it may sit inside, across the
+//edge of, or entirely outside the receptor's extent
+static void make_pose(std::mt19937& engine, model& m, fl extent) {
+  std::vector<atom_params> lig_atoms;
+  std::vector<smt> lig_types;
+  make_mol(lig_atoms, lig_types, std::mt19937(engine()), 0, 10, 40, 4, 4, 4);
+  std::uniform_real_distribution<float> shift(-extent, extent);
+  vec offset(shift(engine), shift(engine), shift(engine));
+
+  m.m_num_movable_atoms = lig_atoms.size();
+  m.minus_forces = std::vector<vec>(m.m_num_movable_atoms);
+  for (size_t i = 0; i < lig_atoms.size(); ++i) {
+    vec c = *(vec*) &lig_atoms[i] + offset;
+    m.coords.push_back(c);
+    m.atoms.push_back(atom());
+    m.atoms[i].sm = lig_types[i];
+    m.atoms[i].charge = lig_atoms[i].charge;
+    m.atoms[i].coords = c;
+  }
+}
+
+//receptor of random atoms plus atoms placed just inside and just outside
+//distance r of the given points
+static void make_receptor(std::mt19937& engine, model& m,
+    const vecv& near, fl r) {
+  std::vector<atom_params> rec_atoms;
+  std::vector<smt> rec_types;
+  make_mol(rec_atoms, rec_types, std::mt19937(engine()), 0, 500, 2000, 15, 15, 15);
+  std::uniform_int_distribution<int> type_dist(0, smina_atom_type::NumTypes - 1);
+
+  atomv& grid_atoms = m.grid_atoms.modify();
+  for (size_t i = 0; i < rec_atoms.size(); ++i) {
+    grid_atoms.push_back(atom());
+    grid_atoms.back().sm = rec_types[i];
+    grid_atoms.back().charge = rec_atoms[i].charge;
+    grid_atoms.back().coords = *(vec*) &rec_atoms[i];
+  }
+  const fl scales[] = { 0.999f, 0.99999f, 1.00001f, 1.001f };
+  VINA_FOR_IN(i, near) {
+    VINA_FOR(s, 4) {
+      grid_atoms.push_back(atom());
+      grid_atoms.back().sm = static_cast<smt>(type_dist(engine));
+      grid_atoms.back().charge = 0;
+      grid_atoms.back().coords = near[i] + (r * scales[s]) * random_direction(engine);
+    }
+  }
+}
+
+void test_receptor_index_eval() {
+  p_args.log << "Receptor Index Eval Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+
+  custom_terms t;
+  t.add("gauss(o=0,_w=0.5,_c=8)", -0.035579);
+  t.add("gauss(o=3,_w=2,_c=8)", -0.005156);
+  t.add("repulsion(o=0,_c=8)", 0.840245);
+  t.add("hydrophobic(g=0.5,_b=1.5,_c=8)", -0.035069);
+  t.add("non_dir_h_bond(g=-0.7,_b=0,_c=8)", -0.587439);
+  t.add("num_tors_div", 5 * 0.05846 / 0.1 - 1);
+  weighted_terms wt(&t, t.weights());
+  precalculate_exact prec(wt);
+  const fl cutoff = std::sqrt(prec.cutoff_sqr());
+  const fl v = 10;
+
+  VINA_FOR(pose, N_POSES) {
+    model m;
+    make_pose(engine, m, 15 + cutoff + 4);
+    //receptor atoms right around the cutoff of some ligand atoms
+    vecv near;
+    VINA_FOR(i, std::min(m.num_movable_atoms(), sz(5)))
+      near.push_back(m.coords[i]);
+    make_receptor(engine, m, near, cutoff);
+
+    receptor_index index(m.grid_atoms);
+    naive_non_cache scan(&prec);
+    naive_non_cache indexed(&prec, &index);
+    fl e_scan = scan.eval(m, v);
+    fl e_indexed = indexed.eval(m, v);
+
+    p_args.log << "pose " << pose << " all atoms: " << e_scan << " indexed: "
+        << e_indexed << "\n";
+    BOOST_REQUIRE_SMALL(e_scan - e_indexed,
+        (fl )1e-4 * std::max((fl )1, std::abs(e_scan)));
+  }
+}
+
+void test_receptor_index_near_box() {
+  p_args.log << "Receptor Index Near Box Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+  const fl r = 8;
+
+  VINA_FOR(pose, N_POSES) {
+    model m;
+    make_pose(engine, m, 15 + r + 4);
+    vec begin = m.coords[0], end = begin;
+    VINA_FOR_IN(i, m.coords)
+      VINA_FOR(d, 3) {
+        begin[d] = std::min(begin[d], m.coords[i][d]);
+        end[d] = std::max(end[d], m.coords[i][d]);
+      }
+    //points on the faces of the box, so the extra atoms are placed just
+    //inside and just outside r of the box along the outward normal
+    vecv faces;
+    std::uniform_real_distribution<float> u(0, 1);
+    VINA_FOR(f, 6) {
+      sz d = f / 2;
+      vec p;
+      VINA_FOR(k, 3)
+        p[k] = begin[k] + u(engine) * (end[k] - begin[k]);
+      p[d] = f % 2 ? end[d] : begin[d];
+      faces.push_back(p);
+    }
+    model rec;
+    make_receptor(engine, rec, vecv(), r);
+    atomv& grid_atoms = rec.grid_atoms.modify();
+    if (pose % 2) {
+      //far outliers that would need billions of cells at the requested size
+      VINA_FOR(o, 2) {
+        grid_atoms.push_back(atom());
+        grid_atoms.back().sm = smina_atom_type::AliphaticCarbonXSHydrophobe;
+        grid_atoms.back().coords = fl(o ? 1 : -1) * vec(1e4, -1e4, 1e4);
+      }
+    }
+    const fl scales[] = { 0.999f, 0.99999f, 1.00001f, 1.001f };
+    VINA_FOR_IN(f, faces) {
+      VINA_FOR(s, 4) {
+        vec normal(0, 0, 0);
+        normal[f / 2] = f % 2 ? 1 : -1;
+        grid_atoms.push_back(atom());
+        grid_atoms.back().sm = smina_atom_type::AliphaticCarbonXSHydrophobe;
+        grid_atoms.back().coords = faces[f] + (r * scales[s]) * normal;
+      }
+    }
+
+    //the scan evale_robust did before it used the index
+    const atomv& atoms = rec.grid_atoms.get();
+    const sz n = num_atom_types();
+    szv expected;
+    VINA_FOR_IN(j, atoms) {
+      const smt t = atoms[j].get();
+      if (brick_distance_sqr(begin, end, atoms[j].coords) < sqr(r) && t < n
+          && !is_hydrogen(t)) expected.push_back(j);
+    }
+
+    receptor_index index(rec.grid_atoms);
+    szv found;
+    index.near_box(begin, end, r, found);
+
+    p_args.log << "pose " << pose << " scan: " << expected.size()
+        << " indexed: " << found.size() << "\n";
+    BOOST_REQUIRE_EQUAL(expected.size(), found.size());
+    VINA_FOR_IN(i, expected)
+      BOOST_REQUIRE_EQUAL(expected[i], found[i]);
+  }
+}
+
+void test_receptor_index_generation() {
+  p_args.log << "Receptor Index Generation Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+
+  model m;
+  make_receptor(engine, m, vecv(), 8);
+  receptor_index index(m.grid_atoms);
+  BOOST_REQUIRE(index.indexes(m.grid_atoms));
+
+  //copies share the atoms and their generation
+  model copy = m;
+  BOOST_REQUIRE_EQUAL(copy.grid_atoms.generation(), m.grid_atoms.generation());
+  BOOST_REQUIRE(index.indexes(copy.grid_atoms));
+
+  //a rewrite that leaves the atoms as they were (as renumbering their bonds
+  //does) is a new generation, but still indexed
+  copy.grid_atoms.modify();
+  BOOST_REQUIRE(copy.grid_atoms.generation() != m.grid_atoms.generation());
+  BOOST_REQUIRE(index.indexes(copy.grid_atoms));
+  BOOST_REQUIRE(index.indexes(m.grid_atoms));
+
+  //but moving an indexed atom, retyping one or adding one is not
+  sz heavy = 0;
+  while (is_hydrogen(m.grid_atoms[heavy].get()))
+    heavy++;
+  model moved = m;
+  moved.grid_atoms.modify(heavy).coords[0] += 0.001;
+  BOOST_REQUIRE(!index.indexes(moved.grid_atoms));
+
+  model retyped = m;
+  retyped.grid_atoms.modify(heavy).sm = smina_atom_type::Hydrogen;
+  BOOST_REQUIRE(!index.indexes(retyped.grid_atoms));
+
+  model added = m;
+  added.grid_atoms.push_back(atom());
+  BOOST_REQUIRE(!index.indexes(added.grid_atoms));
+
+  //modifying atoms that aren't shared keeps the same vector, so this must
+  //not be mistaken for the original
+  model alone;
+  alone.grid_atoms = m.grid_atoms.get();
+  receptor_index alone_index(alone.grid_atoms);
+  alone.grid_atoms.modify(heavy).coords[1] += 1;
+  BOOST_REQUIRE(!alone_index.indexes(alone.grid_atoms));
+}
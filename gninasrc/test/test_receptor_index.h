@@ -0,0 +1,5 @@
+#pragma once
+
+void test_receptor_index_eval();
+void test_receptor_index_near_box();
+void test_receptor_index_generation();
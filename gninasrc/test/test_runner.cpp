@@ -6,6 +6,10 @@
 #include "test_tree.h"
 #include "test_cache.h"
 #include "test_cnn.h"
+#include "test_receptor_index.h"
+#include "test_ordered_index.h"
+#include "test_pair_kernel.h"
+#include "test_parse_sdf.h"
 #include "test_utils.h"
 #define N_ITERS 5
 #define BOOST_TEST_DYN_LINK
@@ -56,6 +60,50 @@ BOOST_AUTO_TEST_CASE(eval_deriv) {
 
 BOOST_AUTO_TEST_SUITE_END()
 
+BOOST_AUTO_TEST_SUITE(test_receptor_index)
+
+BOOST_AUTO_TEST_CASE(eval) {
+  boost_loop_test(&test_receptor_index_eval);
+}
+
+BOOST_AUTO_TEST_CASE(near_box) {
+  boost_loop_test(&test_receptor_index_near_box);
+}
+
+BOOST_AUTO_TEST_CASE(generation) {
+  boost_loop_test(&test_receptor_index_generation);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(test_pair_kernel)
+
+BOOST_AUTO_TEST_CASE(cutoff) {
+  boost_loop_test(&test_pair_kernel_cutoff);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(test_ordered_index)
+
+BOOST_AUTO_TEST_CASE(insert) {
+  boost_loop_test(&test_ordered_index_insert);
+}
+
+BOOST_AUTO_TEST_CASE(page) {
+  boost_loop_test(&test_ordered_index_page);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(test_parse_sdf)
+
+BOOST_AUTO_TEST_CASE(matches_openbabel) {
+  test_parse_sdf_openbabel();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
 BOOST_AUTO_TEST_SUITE(test_cnn)
 
 BOOST_AUTO_TEST_CASE(set_atom_gradients) {
@@ -74,6 +122,10 @@ BOOST_AUTO_TEST_CASE(strided_cube_datagetter) {
   boost_loop_test(&test_strided_cube_datagetter);
 }
 
+BOOST_AUTO_TEST_CASE(threaded_grids) {
+  boost_loop_test(&test_threaded_grids);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 void initializeCUDA(int device) {
@@ -121,7 +173,9 @@ bool init_unit_test() {
       "seed for random number generator")("n_iters",
       po::value<unsigned>(&p_args.n_iters),
       "number of iterations to repeat relevant tests")("log",
-      po::value<std::string>(&logname), "specify logfile, default is test.log");
+      po::value<std::string>(&logname), "specify logfile, default is test.log")(
+      "sdf", po::value<std::string>(&p_args.sdf),
+      "sdf file to also compare the native reader with OpenBabel on");
   po::options_description desc, desc_simple;
   desc.add(inputs);
   desc_simple.add(inputs);
@@ -162,6 +216,7 @@ int main(int argc, char* argv[]) {
   unsigned _dumvar1;
   unsigned _dumvar2;
   std::string _dumvar3;
+  std::string _dumvar4;
   bool help = false;
   po::positional_options_description positional;
   po::options_description inputs("Input");
@@ -170,7 +225,9 @@ int main(int argc, char* argv[]) {
       po::value<unsigned>(&_dumvar2),
       "number of iterations to repeat relevant tests")("log",
       po::value<std::string>(&_dumvar3),
-      "specify logfile, default is test.log");
+      "specify logfile, default is test.log")("sdf",
+      po::value<std::string>(&_dumvar4),
+      "sdf file to also compare the native reader with OpenBabel on");
   po::options_description info("Information");
   info.add_options()("help", po::bool_switch(&help), "print usage information");
   po::options_description desc, desc_simple;
@@ -12,6 +12,7 @@
 #include "CommandLine2/CommandLine.h"
 #include <openbabel/mol.h>
 #include "GninaConverter.h"
+#include "ligand_library.h"
 
 using namespace std;
 using namespace OpenBabel;
@@ -21,6 +22,7 @@ cl::opt<string> infile("in", cl::desc("input file"), cl::Required,
 cl::opt<string> outfile("out", cl::desc("output file"), cl::Required,
     cl::Positional);
 cl::opt<bool> textOutput("text", cl::desc("produce text output"));
+//an out name ending in .gninalib produces an indexed library
 
 int main(int argc, char *argv[]) {
   cl::ParseCommandLineOptions(argc, argv);
@@ -30,6 +32,18 @@ int main(int argc, char *argv[]) {
   obmol_opener opener;
   opener.openForInput(conv, infile);
 
+  if (ligand_library::is_library(path(outfile))) {
+    ligand_library_writer lib((path(outfile)));
+    OBMol mol;
+    while (conv.Read(&mol)) {
+      std::stringstream rec;
+      GninaConverter::convertBinary(mol, rec);
+      lib.add(rec.str());
+    }
+    lib.close();
+    return 0;
+  }
+
   ostream *out = NULL;
   ofstream outf;
   string outname(outfile);